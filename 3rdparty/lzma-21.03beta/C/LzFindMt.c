@@ -550,7 +550,8 @@ static void HashThreadFunc(CMatchFinderMt *mt)
 #define CYC_TO_POS_OFFSET 0
 // #define CYC_TO_POS_OFFSET 1 // for debug
 
-#define MFMT_GM_INLINE
+// LzFindOpt.c is not vendored, use the generic match getter
+// #define MFMT_GM_INLINE
 
 #ifdef MFMT_GM_INLINE
 
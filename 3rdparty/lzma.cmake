@@ -6,7 +6,6 @@ message(STATUS "LZMA VERSION: 21.03beta")
 target_compile_definitions(aaruformat PUBLIC _REENTRANT)
 target_compile_definitions(aaruformat PUBLIC _FILE_OFFSET_BITS)
 target_compile_definitions(aaruformat PUBLIC _LARGEFILE_SOURCE)
-target_compile_definitions(aaruformat PUBLIC _7ZIP_ST)
 
 # All assembly for x86 and x64 disabled because it uses a custom, non GAS, non MASM, assembler
 
@@ -67,21 +66,19 @@ target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/CpuArch.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/DllSecur.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/HuffEnc.c)
 target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/LzFind.c)
-## ifdef MT_FILES
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/LzFindMt.c)
-#
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Threads.c)
-## endif
+# Multithreading support, Threads is also used by libaaruformat itself
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/LzFindMt.c)
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Threads.c)
 #
 target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/LzmaEnc.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma86Dec.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma86Enc.c)
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma2Dec.c)
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma2Dec.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma2DecMt.c)
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma2Enc.c)
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Lzma2Enc.c)
 target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/LzmaLib.c)
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/MtCoder.c)
-#target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/MtDec.c)
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/MtCoder.c)
+target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/MtDec.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Ppmd7.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Ppmd7aDec.c)
 #target_sources(aaruformat PRIVATE ${LZMA_C_DIRECTORY}/Ppmd7Dec.c)
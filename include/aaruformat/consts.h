@@ -37,6 +37,46 @@
 #define LZMA_PROPERTIES_LENGTH 5
 /** Maximum number of entries for the DDT cache. */
 #define MAX_DDT_ENTRY_CACHE 16000000
+/** Decoded user data DDTs bigger than this are paged from a temporary file instead of kept in memory */
+#ifndef MAX_RESIDENT_DDT_SIZE
+#define MAX_RESIDENT_DDT_SIZE 268435456
+#endif
+/** Entries in each page of a paged DDT */
+#define DDT_PAGE_ENTRIES 8192
+/** Pages of a paged DDT kept decoded in memory */
+#define DDT_PAGE_CACHE_SLOTS 512
+/** Every how many extents of an extent DDT one is sampled into its top level index */
+#define DDT_EXTENT_INDEX_STRIDE 64
+/** Minimum DDT entries scanned by each thread when computing deduplication statistics or the reverse DDT */
+#define DEDUP_STATS_MT_MIN_CHUNK 1048576
+/** Biggest shift for which deduplication statistics count unique sectors */
+#define DEDUP_STATS_MAX_SHIFT 24
+/** Threads used to build the reverse DDT when it is first needed */
+#define REVERSE_DDT_THREADS 8
+/** Times a reader must repeat the same stride before blocks are prefetched for it */
+#define PREFETCH_MIN_HITS 2
+/** Maximum DDT entries the prefetcher looks at for each request */
+#define PREFETCH_MAX_SCAN 65536
+/** Blocks being compressed or waiting to be written to a new image, per compression thread */
+#define WRITE_QUEUE_DEPTH 2
+/** Fingerprints kept to find identical sectors while writing an image, 16 bytes each */
+#define WRITE_DEDUP_MAX_ENTRIES 16777216
+/** Fingerprints sharing each bucket of the deduplication table, the oldest one is replaced when it is full */
+#define WRITE_DEDUP_WAYS 4
+/** Data blocks written between checkpoints, so an interrupted image can be resumed */
+#define WRITE_CHECKPOINT_BLOCKS 64
+/** Blocks decoded ahead while comparing the sectors of a new child image with its parent */
+#define WRITE_PARENT_PREFETCH_DEPTH 4
+/** Parent images followed from a child before giving up, protects against loops */
+#define PARENT_MAX_DEPTH 16
+/** Opens the latest snapshot of an image */
+#define SNAPSHOT_LATEST 0xFFFFFFFF
+/** Blocks decoded ahead of a reader streaming a tape file, unless the reader set its own prefetch depth */
+#define TAPE_READ_AHEAD_BLOCKS 4
+/** Read at once while scanning a damaged image for blocks */
+#define RECOVER_BUFFER_SIZE 8388608
+/** Size of the buffers used when decoding LZMA from a file */
+#define LZMA_STREAM_BUFFER_SIZE 1048576
 /** How many samples are contained in a RedBook sector. */
 #define SAMPLES_PER_SECTOR 588
 /** Maximum number of samples for a FLAC block. Bigger than 4608 gives no benefit. */
@@ -54,6 +54,101 @@ typedef struct mediaTagEntry
     UT_hash_handle hh;
 } mediaTagEntry;
 
+/** How many sectors in the user data DDT point to a block */
+typedef struct BlockReferences
+{
+    uint64_t blockOffset;
+    uint64_t references;
+    uint64_t uniqueSectors;
+} BlockReferences;
+
+/** Deduplication statistics, filled by aaruf_get_dedup_stats() and released by aaruf_free_dedup_stats() */
+typedef struct DedupStats
+{
+    /** Sectors in the user data DDT */
+    uint64_t sectors;
+    /** Sectors never written, DDT entry is 0 */
+    uint64_t notDumped;
+    /** Sectors pointing to stored data */
+    uint64_t referenced;
+    /** Distinct stored sectors pointed to */
+    uint64_t unique;
+    /** Distinct blocks pointed to */
+    uint64_t blocks;
+    /** References to each block, sorted by block offset */
+    BlockReferences* blockReferences;
+    /** Number of entries in top */
+    uint32_t topCount;
+    /** Most referenced blocks, in descending order of references */
+    BlockReferences* top;
+} DedupStats;
+
+/** Consecutive sectors */
+typedef struct LbaRange
+{
+    uint64_t start;
+    uint64_t length;
+} LbaRange;
+
+/** Sectors referencing each data block, ranges of block i are ranges[firstRange[i]] to ranges[firstRange[i + 1] - 1] */
+typedef struct ReverseDdt
+{
+    uint64_t  blocks;
+    uint64_t* blockOffsets;
+    uint64_t* firstRange;
+    LbaRange* ranges;
+} ReverseDdt;
+
+/** What is left of an image that was never finished, up to its last checkpoint */
+typedef struct RecoveredImage
+{
+    CheckpointHeader checkpoint;
+    // Where the last checkpoint ends
+    uint64_t         end;
+    uint64_t*        ddt;
+    // Data blocks before the last checkpoint, in the order they were written
+    uint64_t*        blockOffsets;
+    uint64_t         blockCount;
+    uint64_t         blockCapacity;
+} RecoveredImage;
+
+/** Read-only mapping of part of a file */
+typedef struct MappedFile
+{
+    void*  address;
+    size_t length;
+    void*  handle;
+} MappedFile;
+
+typedef struct DdtPage
+{
+    uint64_t       page;
+    uint64_t*      entries;
+    UT_hash_handle hh;
+} DdtPage;
+
+/** DDT decoded to a temporary file, only the most recently used pages are kept in memory */
+typedef struct DdtPageCache
+{
+    FILE*           spill;
+    uint64_t        entries;
+    uint32_t        count;
+    struct DdtPage* pages;
+    struct DdtPage* last;
+} DdtPageCache;
+
+/** DDT stored as runs of entries that are all the same or consecutive, found by binary search */
+typedef struct DdtExtents
+{
+    uint64_t  count;
+    uint64_t* starts;
+    uint64_t* bases;
+    uint8_t*  consecutive;
+    uint64_t* index;
+    uint64_t  indexCount;
+    uint64_t  last;
+} DdtExtents;
+
 typedef struct aaruformatContext
 {
     uint64_t                            magic;
@@ -91,6 +186,45 @@ typedef struct aaruformatContext
     struct CacheHeader                  blockCache;
     struct Checksums                    checksums;
     struct mediaTagEntry*               mediaTags;
+    void*                               lzmaDecoder;
+    uint8_t*                            compressedBuffer;
+    size_t                              compressedBufferSize;
+    struct DdtPageCache*                pagedDdt;
+    struct DdtExtents*                  extentDdt;
+    struct ReverseDdt*                  reverseDdt;
+    void*                               prefetcher;
+    void*                               writer;
+    int64_t*                            dataTrackStarts;
+    uint8_t                             dataTrackBySequence[100];
+    uint8_t                             lastDataTrack;
+    int32_t*                            mediaTagTypes;
+    uint32_t                            mediaTagCount;
+    struct MappedFile                   userDataDdtMap;
+    struct MappedFile                   sectorPrefixDdtMap;
+    struct MappedFile                   sectorSuffixDdtMap;
+    char*                               imagePath;
+    ParentBlockHeader                   parentBlockHeader;
+    char*                               parentPath;
+    struct aaruformatContext*           parent;
+    uint8_t                             parentDepth;
+    bool                                parentFailed;
+    uint32_t                            snapshot;
+    uint32_t                            snapshots;
+    uint64_t                            resumeSector;
+    uint64_t                            recoveredBlocks;
+    uint64_t                            damagedBlocks;
+    uint64_t                            skippedBytes;
+    TapeFileEntry*                      tapeFiles;
+    uint32_t                            tapeFileCount;
+    TapePartitionEntry*                 tapePartitions;
+    uint8_t                             tapePartitionCount;
+    bool                                tapeReadAhead;
+    // Read the first time they are queried
+    uint64_t                            dpmOffset;
+    DataPositionMeasurementEntry*       dpmEntries;
+    uint32_t                            dpmCount;
+    bool                                dpmRead;
+    int32_t                             dpmError;
 } aaruformatContext;
 
 typedef struct DumpHardwareEntriesWithData
@@ -61,10 +61,47 @@ AARU_EXPORT int AARU_CALL aaruf_identify(const char* filename);
 AARU_EXPORT int AARU_CALL aaruf_identify_stream(FILE* imageStream);
 
 AARU_EXPORT void* AARU_CALL aaruf_open(const char* filepath);
+AARU_EXPORT void* AARU_CALL aaruf_open_snapshot(const char* filepath, uint32_t snapshot);
+AARU_EXPORT void* AARU_CALL aaruf_open_recover(const char* filepath);
 
 AARU_EXPORT int AARU_CALL aaruf_close(void* context);
 
+AARU_EXPORT void* AARU_CALL aaruf_create(const char* filepath,
+                                         uint32_t    mediaType,
+                                         uint32_t    sectorSize,
+                                         uint64_t    sectors,
+                                         uint8_t     shift,
+                                         uint16_t    compression,
+                                         uint32_t    threads);
+AARU_EXPORT void* AARU_CALL aaruf_create_snapshot(const char* filepath, uint16_t compression, uint32_t threads);
+AARU_EXPORT void* AARU_CALL aaruf_resume(const char* filepath, uint32_t threads);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_write_sector(void*          context,
+                                                 uint64_t       sectorAddress,
+                                                 const uint8_t* data,
+                                                 uint32_t       length);
+AARU_EXPORT int32_t AARU_CALL aaruf_write_sector_long(void*          context,
+                                                      uint64_t       sectorAddress,
+                                                      const uint8_t* data,
+                                                      uint32_t       length);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_tracks(void* context, const TrackEntry* tracks, uint16_t count);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_parent(void* context, const char* parentPath);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_deduplication(void* context, bool enabled);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_compression_level(void* context, uint32_t level);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_checkpoint_interval(void* context, uint32_t blocks);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_tape_files(void* context, const TapeFileEntry* files, uint32_t count);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_tape_partitions(void*                     context,
+                                                        const TapePartitionEntry* partitions,
+                                                        uint8_t                   count);
+AARU_EXPORT int32_t AARU_CALL aaruf_set_dpm(void* context, const DataPositionMeasurementEntry* entries, uint32_t count);
+AARU_EXPORT int32_t AARU_CALL aaruf_copy_metadata(void* context, void* source);
+
 AARU_EXPORT int32_t AARU_CALL aaruf_read_media_tag(void* context, uint8_t* data, int32_t tag, uint32_t* length);
+AARU_EXPORT int32_t AARU_CALL aaruf_get_media_tag(void*           context,
+                                                  int32_t         tag,
+                                                  const uint8_t** data,
+                                                  uint32_t*       length);
+AARU_EXPORT int32_t AARU_CALL aaruf_get_media_tag_types(void* context, const int32_t** tags, uint32_t* count);
 
 AARU_EXPORT crc64_ctx* AARU_CALL aaruf_crc64_init();
 AARU_EXPORT int AARU_CALL        aaruf_crc64_update(crc64_ctx* ctx, const uint8_t* data, uint32_t len);
@@ -78,9 +115,50 @@ AARU_EXPORT int32_t AARU_CALL aaruf_read_sector_long(void*     context,
                                                      uint64_t  sectorAddress,
                                                      uint8_t*  data,
                                                      uint32_t* length);
+AARU_EXPORT int32_t AARU_CALL aaruf_read_sector_tags(void*     context,
+                                                     uint64_t  sectorAddress,
+                                                     uint32_t  count,
+                                                     int32_t   tag,
+                                                     uint8_t*  data,
+                                                     uint32_t* length);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_get_tape_files(void* context, const TapeFileEntry** files, uint32_t* count);
+AARU_EXPORT int32_t AARU_CALL aaruf_get_tape_partitions(void*                      context,
+                                                        const TapePartitionEntry** partitions,
+                                                        uint8_t*                   count);
+AARU_EXPORT int32_t AARU_CALL aaruf_read_tape_file(void*     context,
+                                                   uint8_t   partition,
+                                                   uint32_t  file,
+                                                   uint64_t  offset,
+                                                   uint8_t*  data,
+                                                   uint32_t* length);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_get_dpm(void*                                context,
+                                            uint64_t                             startSector,
+                                            uint64_t                             endSector,
+                                            const DataPositionMeasurementEntry** entries,
+                                            uint32_t*                            count);
+AARU_EXPORT int32_t AARU_CALL aaruf_read_dpm(void*                         context,
+                                             uint64_t                      startSector,
+                                             uint64_t                      endSector,
+                                             DataPositionMeasurementEntry* entries,
+                                             uint32_t*                     count);
 
 AARU_EXPORT int32_t AARU_CALL aaruf_verify_image(void* context);
 
+AARU_EXPORT int32_t AARU_CALL aaruf_set_prefetch_depth(void* context, uint32_t depth);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_extract_user_data(void* context, FILE* output);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_get_dedup_stats(void* context, DedupStats* stats, uint32_t topCount, uint32_t threads);
+AARU_EXPORT void AARU_CALL    aaruf_free_dedup_stats(DedupStats* stats);
+AARU_EXPORT int32_t AARU_CALL aaruf_build_reverse_ddt(void* context, uint32_t threads);
+AARU_EXPORT int32_t AARU_CALL aaruf_get_ddt_entry(void* context, uint64_t sectorAddress, uint64_t* ddtEntry);
+AARU_EXPORT int32_t AARU_CALL aaruf_get_block_sectors(void*            context,
+                                                      uint64_t         blockOffset,
+                                                      const LbaRange** ranges,
+                                                      uint64_t*        rangeCount);
+
 AARU_EXPORT int32_t AARU_CALL aaruf_cst_transform(const uint8_t* interleaved, uint8_t* sequential, size_t length);
 
 AARU_EXPORT int32_t AARU_CALL aaruf_cst_untransform(const uint8_t* sequential, uint8_t* interleaved, size_t length);
@@ -140,13 +218,18 @@ AARU_LOCAL int32_t AARU_CALL aaruf_get_xml_mediatype(int32_t type);
 
 AARU_EXPORT spamsum_ctx* AARU_CALL aaruf_spamsum_init(void);
 AARU_EXPORT int AARU_CALL          aaruf_spamsum_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len);
+AARU_EXPORT int AARU_CALL aaruf_spamsum_update_mt(spamsum_ctx* ctx, const uint8_t* data, uint32_t len, uint32_t threads);
 AARU_EXPORT int AARU_CALL          aaruf_spamsum_final(spamsum_ctx* ctx, uint8_t* result);
 AARU_EXPORT void AARU_CALL         aaruf_spamsum_free(spamsum_ctx* ctx);
 
-AARU_LOCAL void fuzzy_engine_step(spamsum_ctx* ctx, uint8_t c);
-AARU_LOCAL void roll_hash(spamsum_ctx* ctx, uint8_t c);
+AARU_LOCAL void fuzzy_engine_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len);
 AARU_LOCAL void fuzzy_try_reduce_blockhash(spamsum_ctx* ctx);
-AARU_LOCAL void fuzzy_try_fork_blockhash(spamsum_ctx* ctx);
+AARU_LOCAL int  fuzzy_mt_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len, uint32_t threads);
+AARU_LOCAL void fuzzy_mt_scan(spamsum_chunk* chunk);
+AARU_LOCAL void fuzzy_mt_roll_at(roll_state* roll, const uint8_t* data, uint32_t pos, uint32_t n, uint32_t skew);
+AARU_LOCAL uint32_t
+    fuzzy_mt_find_trigger(const spamsum_ctx* ctx, const uint8_t* data, uint32_t pos, uint32_t len, uint32_t skew,
+                          uint32_t index);
 
 AARU_EXPORT size_t AARU_CALL aaruf_flac_decode_redbook_buffer(uint8_t*       dst_buffer,
                                                               size_t         dst_size,
@@ -191,6 +274,90 @@ AARU_EXPORT int32_t AARU_CALL aaruf_lzma_encode_buffer(uint8_t*       dst_buffer
                                                        int32_t        fb,
                                                        int32_t        numThreads);
 
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma2_encode_buffer(uint8_t*       dst_buffer,
+                                                        size_t*        dst_size,
+                                                        const uint8_t* src_buffer,
+                                                        size_t         src_size,
+                                                        uint8_t*       outProp,
+                                                        int32_t        level,
+                                                        uint32_t       dictSize,
+                                                        int32_t        lc,
+                                                        int32_t        lp,
+                                                        int32_t        pb,
+                                                        int32_t        fb,
+                                                        int32_t        numThreads);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma2_decode_buffer(
+    uint8_t* dst_buffer, size_t* dst_size, const uint8_t* src_buffer, size_t* src_size, uint8_t prop);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_lz4_encode_buffer(uint8_t*       dst_buffer,
+                                                      size_t*        dst_size,
+                                                      const uint8_t* src_buffer,
+                                                      size_t         src_size);
+
+AARU_EXPORT int32_t AARU_CALL aaruf_lz4_decode_buffer(uint8_t*       dst_buffer,
+                                                      size_t*        dst_size,
+                                                      const uint8_t* src_buffer,
+                                                      size_t*        src_size);
+
+AARU_EXPORT void* AARU_CALL   aaruf_lzma_decoder_init(void);
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma_decoder_decode(void*          decoder,
+                                                        uint8_t*       dst_buffer,
+                                                        size_t*        dst_size,
+                                                        const uint8_t* src_buffer,
+                                                        size_t*        src_size,
+                                                        const uint8_t* props,
+                                                        size_t         propsSize);
+AARU_EXPORT void AARU_CALL    aaruf_lzma_decoder_free(void* decoder);
+
+AARU_LOCAL int32_t AARU_CALL aaruf_lzma_decode_stream(FILE*          src,
+                                                      uint64_t       srcLen,
+                                                      const uint8_t* props,
+                                                      size_t         propsSize,
+                                                      FILE*          dst,
+                                                      uint64_t       dstLen);
+
+AARU_LOCAL uint8_t* AARU_CALL aaruf_get_compressed_buffer(void* context, size_t size);
+AARU_LOCAL int32_t AARU_CALL  aaruf_build_track_lookup(void* context);
+AARU_LOCAL TrackEntry* AARU_CALL aaruf_find_data_track(void* context, uint64_t sectorAddress);
+AARU_LOCAL TrackEntry* AARU_CALL aaruf_get_data_track(void* context, uint8_t sequence);
+
+AARU_LOCAL void* AARU_CALL aaruf_map_file(FILE* file, uint64_t offset, size_t length, MappedFile* mapping);
+AARU_LOCAL void AARU_CALL  aaruf_unmap_file(MappedFile* mapping);
+
+AARU_LOCAL int32_t AARU_CALL aaruf_set_ddt_entry(void* context, uint64_t sectorAddress, uint64_t ddtEntry);
+AARU_LOCAL void* AARU_CALL   aaruf_ddt_paged_init(FILE* spill, uint64_t entries);
+AARU_LOCAL void AARU_CALL    aaruf_ddt_paged_free(void* pagedDdt);
+AARU_LOCAL void AARU_CALL    aaruf_ddt_try_extents(void* context);
+AARU_LOCAL void AARU_CALL    aaruf_ddt_extents_free(void* extentDdt);
+AARU_LOCAL void AARU_CALL    aaruf_reverse_ddt_free(void* reverseDdt);
+
+AARU_LOCAL int32_t AARU_CALL aaruf_decode_block(const BlockHeader* blockHeader,
+                                                uint8_t*           cmpData,
+                                                void*              lzmaDecoder,
+                                                uint8_t*           block);
+AARU_LOCAL void AARU_CALL    aaruf_prefetch_lock(void* prefetcher);
+AARU_LOCAL void AARU_CALL    aaruf_prefetch_unlock(void* prefetcher);
+AARU_LOCAL void AARU_CALL    aaruf_prefetch_notify(void* prefetcher, uint64_t sectorAddress, uint64_t blockOffset);
+AARU_LOCAL void AARU_CALL    aaruf_prefetch_free(void* context);
+AARU_LOCAL int32_t AARU_CALL aaruf_write_finish(void* context);
+AARU_LOCAL char* AARU_CALL   aaruf_parent_resolve(const char* childPath, const char* parentPath);
+AARU_LOCAL int32_t AARU_CALL aaruf_parent_open(void* context);
+AARU_LOCAL void* AARU_CALL   aaruf_open_parent(const char* filepath, uint8_t parentDepth);
+AARU_LOCAL int32_t AARU_CALL aaruf_parent_read_sector(void*     context,
+                                                      uint64_t  sectorAddress,
+                                                      uint8_t*  data,
+                                                      uint32_t* length);
+AARU_LOCAL void AARU_CALL    aaruf_parent_free(void* context);
+AARU_LOCAL int32_t AARU_CALL aaruf_snapshot_find(void* context, uint32_t snapshot);
+AARU_LOCAL int32_t AARU_CALL aaruf_snapshot_apply(void* context, const IndexEntry* entries, uint16_t count);
+AARU_LOCAL int32_t AARU_CALL aaruf_recover_scan(FILE* stream, RecoveredImage* image);
+AARU_LOCAL void AARU_CALL    aaruf_recover_free(RecoveredImage* image);
+AARU_LOCAL int32_t AARU_CALL aaruf_recover_index(void* context, IndexEntry** entries, uint16_t* count);
+AARU_LOCAL int32_t AARU_CALL aaruf_tape_read_files(void* context, uint64_t offset);
+AARU_LOCAL int32_t AARU_CALL aaruf_tape_read_partitions(void* context, uint64_t offset);
+AARU_LOCAL void AARU_CALL    aaruf_dpm_sort(DataPositionMeasurementEntry* entries, uint32_t count);
+
 #if defined(__x86_64__) || defined(__amd64) || defined(_M_AMD64) || defined(_M_X64) || defined(__I386__) ||            \
     defined(__i386__) || defined(__THW_INTEL) || defined(_M_IX86)
 
@@ -31,7 +31,8 @@ typedef enum
     None                           = 0, /** LZMA */
     Lzma                           = 1, /** FLAC */
     Flac                           = 2, /** LZMA in Claunia Subchannel Transform processed data */
-    LzmaClauniaSubchannelTransform = 3
+    LzmaClauniaSubchannelTransform = 3, /** LZ4 block format, fast decoding */
+    Lz4                            = 4
 } CompressionType;
 
 /** List of known data types */
@@ -218,16 +219,20 @@ typedef enum
     CicmBlock = 0x4D434943,
     /** Block containing contents checksums */
     ChecksumBlock = 0x4D534B43,
-    /** TODO: Block containing data position measurements */
+    /** Block containing data position measurements */
     DataPositionMeasurementBlock = 0x2A4D5044,
-    /** TODO: Block containing a snapshot index */
+    /** Block containing the sectors written again in a snapshot */
     SnapshotBlock = 0x50414E53,
-    /** TODO: Block containing how to locate the parent image */
+    /** Block containing how to locate the parent image */
     ParentBlock = 0x50524E54,
     /** Block containing an array of hardware used to create the image */
     DumpHardwareBlock = 0x2A504D44,
-    /** TODO: Block containing list of files for a tape image */
-    TapeFileBlock = 0x454C4654
+    /** Block containing list of files for a tape image */
+    TapeFileBlock = 0x454C4654,
+    /** Block containing list of partitions for a tape image */
+    TapePartitionBlock = 0x54425054,
+    /** Block containing the sectors written so far to an image that is not finished yet */
+    CheckpointBlock = 0x544B4843
 } BlockType;
 
 typedef enum
@@ -37,6 +37,12 @@
 #define AARUF_ERROR_SECTOR_TAG_NOT_PRESENT -16
 #define AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK -17
 #define AARUF_ERROR_INVALID_BLOCK_CRC -18
+#define AARUF_ERROR_CANNOT_WRITE -19
+#define AARUF_ERROR_INCORRECT_DATA_SIZE -20
+#define AARUF_ERROR_READ_ONLY -21
+#define AARUF_ERROR_CANNOT_OPEN_PARENT -22
+#define AARUF_ERROR_SNAPSHOT_NOT_FOUND -23
+#define AARUF_ERROR_TAPE_FILE_NOT_FOUND -24
 
 #define AARUF_STATUS_OK 0
 #define AARUF_STATUS_SECTOR_NOT_DUMPED 1
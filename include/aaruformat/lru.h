@@ -37,6 +37,8 @@ void* find_in_cache(struct CacheHeader* cache, char* key);
  */
 void add_to_cache(struct CacheHeader* cache, char* key, void* value);
 
+void free_cache(struct CacheHeader* cache);
+
 /**
  * Finds an item in the specified cache using a 64-bit integer key
  * @param cache Pointer to the cache header
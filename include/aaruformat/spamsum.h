@@ -30,6 +30,8 @@
 #define HASH_PRIME 0x01000193
 #define MIN_BLOCKSIZE 3
 #define FUZZY_MAX_RESULT ((2 * SPAMSUM_LENGTH) + 20)
+#define SPAMSUM_MT_MIN_CHUNK 262144
+#define SPAMSUM_MT_TRIGGERS 64
 
 typedef struct
 {
@@ -58,4 +60,24 @@ typedef struct
     roll_state    roll;
 } spamsum_ctx;
 
+/* One chunk of aaruf_spamsum_update_mt(). Block hashes are tracked as maps of their lowest 6 bits, snapshot at the
+ * reset points the merge can need. Trigger positions are offsets in the whole buffer. */
+typedef struct
+{
+    const uint8_t* data;
+    uint32_t       start;
+    uint32_t       end;
+    uint32_t       bh_start;
+    roll_state     roll;
+    int32_t        top;
+    uint32_t       count[NUM_BLOCKHASHES];
+    uint16_t       first[NUM_BLOCKHASHES][SPAMSUM_MT_TRIGGERS];
+    uint32_t       last_pos[NUM_BLOCKHASHES];
+    uint8_t        last[NUM_BLOCKHASHES][64];
+    uint8_t        end_map[64];
+    uint32_t       snaps;
+    uint32_t*      snap_pos;
+    uint8_t*       snap;
+} spamsum_chunk;
+
 #endif // LIBAARUFORMAT_SPAMSUM_H_
@@ -293,6 +293,155 @@ typedef struct ChecksumEntry
     uint32_t length;
 } ChecksumEntry;
 
+/**Parent block, locates the image holding the sectors that were not written to this one */
+typedef struct ParentBlockHeader
+{
+    /**Identifier, <see cref="BlockType.ParentBlock" /> */
+    uint32_t identifier;
+    /**Length in bytes of the UTF-8 path of the parent that follows, relative to this image unless absolute */
+    uint32_t length;
+    /**Sectors in the parent image */
+    uint64_t sectors;
+    /**Creation time of the parent image, to detect it has been replaced */
+    int64_t creationTime;
+    /**CRC64-ECMA of the path */
+    uint64_t crc64;
+} ParentBlockHeader;
+
+/**Snapshot block, sectors written again since the previous snapshot, or since the image was created */
+typedef struct SnapshotHeader
+{
+    /**Identifier, <see cref="BlockType.SnapshotBlock" /> */
+    uint32_t identifier;
+    /**Number of the snapshot, the image as first written is snapshot 0 */
+    uint32_t snapshot;
+    /**When the snapshot was taken */
+    int64_t creationTime;
+    /**Offset of the index of the previous snapshot */
+    uint64_t previousIndexOffset;
+    /**How many entries follow this header */
+    uint64_t entries;
+    /**CRC64-ECMA of the entries */
+    uint64_t crc64;
+} SnapshotHeader;
+
+/**Tape file block, lists the files of a tape image */
+typedef struct TapeFileHeader
+{
+    /**Identifier, <see cref="BlockType.TapeFileBlock" /> */
+    uint32_t identifier;
+    /**How many entries follow this header */
+    uint32_t entries;
+    /**Length in bytes of the entries */
+    uint64_t length;
+    /**CRC64-ECMA of the entries */
+    uint64_t crc64;
+} TapeFileHeader;
+
+/**Tape file */
+typedef struct TapeFileEntry
+{
+    /**File number, starting again in each partition */
+    uint32_t file;
+    /**Partition the file is in */
+    uint8_t partition;
+    /**First block of the file */
+    uint64_t firstBlock;
+    /**Last block of the file */
+    uint64_t lastBlock;
+} TapeFileEntry;
+
+/**Tape partition block, lists the partitions of a tape image */
+typedef struct TapePartitionHeader
+{
+    /**Identifier, <see cref="BlockType.TapePartitionBlock" /> */
+    uint32_t identifier;
+    /**How many entries follow this header */
+    uint8_t entries;
+    /**Length in bytes of the entries */
+    uint64_t length;
+    /**CRC64-ECMA of the entries */
+    uint64_t crc64;
+} TapePartitionHeader;
+
+/**Tape partition */
+typedef struct TapePartitionEntry
+{
+    /**Partition number */
+    uint8_t number;
+    /**First block of the partition */
+    uint64_t firstBlock;
+    /**Last block of the partition */
+    uint64_t lastBlock;
+} TapePartitionEntry;
+
+/**Data position measurement block, physical positions measured for sectors of the media */
+typedef struct DataPositionMeasurementHeader
+{
+    /**Identifier, <see cref="BlockType.DataPositionMeasurementBlock" /> */
+    uint32_t identifier;
+    /**How many entries follow this header */
+    uint32_t entries;
+    /**Length in bytes of the entries */
+    uint64_t length;
+    /**CRC64-ECMA of the entries */
+    uint64_t crc64;
+} DataPositionMeasurementHeader;
+
+/**Data position measurement */
+typedef struct DataPositionMeasurementEntry
+{
+    /**Sector the measurement was taken at */
+    uint64_t sectorAddress;
+    /**Physical position of the sector, in the units reported by the drive */
+    int64_t position;
+} DataPositionMeasurementEntry;
+
+/**Checkpoint block, written while an image is created so it can be resumed or recovered if it is never finished */
+typedef struct CheckpointHeader
+{
+    /**Identifier, <see cref="BlockType.CheckpointBlock" /> */
+    uint32_t identifier;
+    /**Media type */
+    uint32_t mediaType;
+    /**Size of each user data sector */
+    uint32_t sectorSize;
+    /**Shift of the DDT entries */
+    uint8_t shift;
+    /**Compression of the data blocks */
+    uint16_t compression;
+    /**Number of user data sectors */
+    uint64_t sectors;
+    /**When the image was created */
+    int64_t creationTime;
+    /**Sectors written in order from the first one, 0 if they were not written in order */
+    uint64_t nextSector;
+    /**How many entries follow this header */
+    uint64_t entries;
+    /**CRC64-ECMA of the entries */
+    uint64_t crc64;
+} CheckpointHeader;
+
+/**Checkpoint entry, consecutive sectors stored one after the other since the previous checkpoint */
+typedef struct CheckpointEntry
+{
+    /**First sector */
+    uint64_t sectorAddress;
+    /**How many sectors */
+    uint32_t count;
+    /**DDT entry of the first sector */
+    uint64_t ddtEntry;
+} CheckpointEntry;
+
+/**Snapshot entry, replaces the user data DDT entry of a sector */
+typedef struct SnapshotEntry
+{
+    /**Sector */
+    uint64_t sectorAddress;
+    /**New DDT entry */
+    uint64_t ddtEntry;
+} SnapshotEntry;
+
 typedef struct Crc64Context
 {
     uint64_t finalSeed;
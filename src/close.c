@@ -20,15 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#ifdef __linux__
-#include <sys/mman.h>
-#endif
-
 #include <aaruformat.h>
 
 int aaruf_close(void* context)
 {
     int            i;
+    int32_t        errorNo;
     mediaTagEntry* mediaTag;
     mediaTagEntry* tmpMediaTag;
 
@@ -47,6 +44,14 @@ int aaruf_close(void* context)
         return -1;
     }
 
+    // Must be stopped before anything it uses is released
+    aaruf_prefetch_free(ctx);
+
+    // Images being created are finished before the file is closed
+    errorNo = aaruf_write_finish(ctx);
+
+    aaruf_parent_free(ctx);
+
     // This may do nothing if imageStream is NULL, but as the behaviour is undefined, better sure than sorry
     if(ctx->imageStream != NULL)
     {
@@ -77,25 +82,48 @@ int aaruf_close(void* context)
         }
     }
 
-#ifdef __linux__ // TODO: Implement
-    if(!ctx->inMemoryDdt)
-    {
-        munmap(ctx->userDataDdt, ctx->mappedMemoryDdtSize);
-        ctx->userDataDdt = NULL;
-    }
-#endif
+    free(ctx->mediaTagTypes);
+    ctx->mediaTagTypes = NULL;
+    ctx->mediaTagCount = 0;
+
+    if(ctx->inMemoryDdt) free(ctx->userDataDdt);
+    else
+        aaruf_unmap_file(&ctx->userDataDdtMap);
+
+    ctx->userDataDdt = NULL;
 
-    free(ctx->sectorPrefixDdt);
+    aaruf_ddt_paged_free(ctx->pagedDdt);
+    ctx->pagedDdt = NULL;
+    aaruf_ddt_extents_free(ctx->extentDdt);
+    ctx->extentDdt = NULL;
+    aaruf_reverse_ddt_free(ctx->reverseDdt);
+    ctx->reverseDdt = NULL;
+
+    if(ctx->sectorPrefixDdtMap.address != NULL) aaruf_unmap_file(&ctx->sectorPrefixDdtMap);
+    else
+        free(ctx->sectorPrefixDdt);
     ctx->sectorPrefixDdt = NULL;
-    free(ctx->sectorSuffixDdt);
+    if(ctx->sectorSuffixDdtMap.address != NULL) aaruf_unmap_file(&ctx->sectorSuffixDdtMap);
+    else
+        free(ctx->sectorSuffixDdt);
     ctx->sectorSuffixDdt = NULL;
 
     free(ctx->metadataBlock);
     ctx->metadataBlock = NULL;
     free(ctx->trackEntries);
     ctx->trackEntries = NULL;
+    free(ctx->dataTracks);
+    ctx->dataTracks = NULL;
+    free(ctx->dataTrackStarts);
+    ctx->dataTrackStarts = NULL;
     free(ctx->cicmBlock);
     ctx->cicmBlock = NULL;
+    free(ctx->tapeFiles);
+    ctx->tapeFiles = NULL;
+    free(ctx->tapePartitions);
+    ctx->tapePartitions = NULL;
+    free(ctx->dpmEntries);
+    ctx->dpmEntries = NULL;
 
     if(ctx->dumpHardwareEntriesWithData != NULL)
     {
@@ -126,15 +154,33 @@ int aaruf_close(void* context)
     free(ctx->readableSectorTags);
     ctx->readableSectorTags = NULL;
 
+    free(ctx->imageInfo.ApplicationVersion);
+    ctx->imageInfo.ApplicationVersion = NULL;
+    free(ctx->imageInfo.Version);
+    ctx->imageInfo.Version = NULL;
+
     free(ctx->eccCdContext);
     ctx->eccCdContext = NULL;
 
     free(ctx->checksums.spamsum);
     ctx->checksums.spamsum = NULL;
 
-    // TODO: Free caches
+    aaruf_lzma_decoder_free(ctx->lzmaDecoder);
+    ctx->lzmaDecoder = NULL;
+    free(ctx->compressedBuffer);
+    ctx->compressedBuffer     = NULL;
+    ctx->compressedBufferSize = 0;
+
+    free_cache(&ctx->blockHeaderCache);
+    free_cache(&ctx->blockCache);
 
     free(context);
 
+    if(errorNo != AARUF_STATUS_OK)
+    {
+        errno = errorNo;
+        return -1;
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,446 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#ifdef _WIN32
+#define ddt_fseek _fseeki64
+#else
+#define ddt_fseek fseeko
+#endif
+
+void* aaruf_ddt_paged_init(FILE* spill, uint64_t entries)
+{
+    DdtPageCache* paged;
+
+    paged = (DdtPageCache*)malloc(sizeof(DdtPageCache));
+
+    if(paged == NULL) return NULL;
+
+    memset(paged, 0, sizeof(DdtPageCache));
+    paged->spill   = spill;
+    paged->entries = entries;
+
+    return paged;
+}
+
+void aaruf_ddt_paged_free(void* pagedDdt)
+{
+    DdtPageCache* paged = pagedDdt;
+    DdtPage*      page;
+    DdtPage*      tmpPage;
+
+    if(paged == NULL) return;
+
+    HASH_ITER(hh, paged->pages, page, tmpPage)
+    {
+        HASH_DEL(paged->pages, page);
+        free(page->entries);
+        free(page);
+    }
+
+    if(paged->spill != NULL) fclose(paged->spill);
+
+    free(paged);
+}
+
+// Reads a page from the temporary file, reusing the least recently used page when the cache is full
+static DdtPage* ddt_paged_load(DdtPageCache* paged, uint64_t pageNumber)
+{
+    DdtPage* page;
+    uint64_t count;
+
+    if(paged->count >= DDT_PAGE_CACHE_SLOTS)
+    {
+        // Hash iteration is in insertion order, so the first one is the oldest
+        page = paged->pages;
+        HASH_DEL(paged->pages, page);
+        paged->count--;
+    }
+    else
+    {
+        page = (DdtPage*)malloc(sizeof(DdtPage));
+
+        if(page == NULL) return NULL;
+
+        page->entries = (uint64_t*)malloc(sizeof(uint64_t) * DDT_PAGE_ENTRIES);
+
+        if(page->entries == NULL)
+        {
+            free(page);
+            return NULL;
+        }
+    }
+
+    count = paged->entries - pageNumber * DDT_PAGE_ENTRIES;
+    if(count > DDT_PAGE_ENTRIES) count = DDT_PAGE_ENTRIES;
+
+    if(ddt_fseek(paged->spill, pageNumber * DDT_PAGE_ENTRIES * sizeof(uint64_t), SEEK_SET) != 0 ||
+       fread(page->entries, sizeof(uint64_t), count, paged->spill) != count)
+    {
+        free(page->entries);
+        free(page);
+        return NULL;
+    }
+
+    page->page = pageNumber;
+    HASH_ADD(hh, paged->pages, page, sizeof(uint64_t), page);
+    paged->count++;
+
+    return page;
+}
+
+// Size in memory of a DDT stored as extents
+#define DDT_EXTENT_SIZE(n)                                                                                             \
+    ((n) * 2 * sizeof(uint64_t) + sizeof(uint64_t) + ((n) + 7) / 8 +                                                   \
+     ((n) / DDT_EXTENT_INDEX_STRIDE + 1) * sizeof(uint64_t))
+
+typedef struct
+{
+    DdtExtents* extents;
+    uint64_t    capacity;
+    uint64_t    runLength;
+    int         stride;
+    size_t      maxSize;
+} ddt_extents_builder;
+
+// Returns false when the extents would not fit in maxSize
+static bool ddt_extents_add(ddt_extents_builder* builder, uint64_t sectorAddress, uint64_t entry)
+{
+    DdtExtents* extents = builder->extents;
+    uint64_t    n       = extents->count;
+    uint64_t    base;
+
+    if(n > 0)
+    {
+        base = extents->bases[n - 1];
+
+        if(builder->runLength == 1 && (entry == base || entry == base + 1))
+        {
+            builder->stride = entry == base ? 0 : 1;
+            builder->runLength++;
+            return true;
+        }
+
+        if(builder->runLength > 1 && entry == base + builder->stride * builder->runLength)
+        {
+            builder->runLength++;
+            return true;
+        }
+
+        if(builder->stride == 1) extents->consecutive[(n - 1) / 8] |= (uint8_t)(1 << ((n - 1) % 8));
+    }
+
+    if(DDT_EXTENT_SIZE(n + 1) > builder->maxSize) return false;
+
+    if(n == builder->capacity)
+    {
+        uint64_t capacity = builder->capacity == 0 ? 1024 : builder->capacity * 2;
+        uint64_t* starts  = realloc(extents->starts, sizeof(uint64_t) * (capacity + 1));
+        uint64_t* bases;
+        uint8_t*  consecutive;
+
+        if(starts == NULL) return false;
+        extents->starts = starts;
+
+        bases = realloc(extents->bases, sizeof(uint64_t) * capacity);
+        if(bases == NULL) return false;
+        extents->bases = bases;
+
+        consecutive = realloc(extents->consecutive, capacity / 8);
+        if(consecutive == NULL) return false;
+        memset(consecutive + builder->capacity / 8, 0, (capacity - builder->capacity) / 8);
+        extents->consecutive = consecutive;
+
+        builder->capacity = capacity;
+    }
+
+    extents->starts[n] = sectorAddress;
+    extents->bases[n]  = entry;
+    extents->count++;
+    builder->runLength = 1;
+    builder->stride    = 0;
+
+    return true;
+}
+
+static bool ddt_extents_finish(ddt_extents_builder* builder, uint64_t entries)
+{
+    DdtExtents* extents = builder->extents;
+    uint64_t    n       = extents->count;
+    uint64_t    i;
+
+    if(n > 0 && builder->stride == 1) extents->consecutive[(n - 1) / 8] |= (uint8_t)(1 << ((n - 1) % 8));
+
+    // Sentinel, so the length of the last extent is known
+    extents->starts[n] = entries;
+
+    // Small enough to stay in cache, narrows the search in starts to DDT_EXTENT_INDEX_STRIDE extents
+    extents->indexCount = (n + DDT_EXTENT_INDEX_STRIDE - 1) / DDT_EXTENT_INDEX_STRIDE;
+    extents->index      = (uint64_t*)malloc(sizeof(uint64_t) * extents->indexCount);
+
+    if(extents->index == NULL) return false;
+
+    for(i = 0; i < extents->indexCount; i++) extents->index[i] = extents->starts[i * DDT_EXTENT_INDEX_STRIDE];
+
+    return true;
+}
+
+void aaruf_ddt_extents_free(void* extentDdt)
+{
+    DdtExtents* extents = extentDdt;
+
+    if(extents == NULL) return;
+
+    free(extents->starts);
+    free(extents->bases);
+    free(extents->consecutive);
+    free(extents->index);
+    free(extents);
+}
+
+// Replaces the user data DDT with extents when they take less than half the memory. For a paged DDT the extents must
+// also fit in MAX_RESIDENT_DDT_SIZE.
+void aaruf_ddt_try_extents(void* context)
+{
+    aaruformatContext*  ctx = context;
+    ddt_extents_builder builder;
+    uint64_t            entries = ctx->imageInfo.Sectors;
+    uint64_t            i;
+    uint64_t            j;
+    uint64_t            count;
+    uint64_t*           buffer = NULL;
+    bool                fits   = true;
+
+    if(entries == 0 || (ctx->pagedDdt == NULL && (!ctx->inMemoryDdt || ctx->userDataDdt == NULL))) return;
+
+    memset(&builder, 0, sizeof(ddt_extents_builder));
+    builder.maxSize = (size_t)(entries * sizeof(uint64_t) / 2);
+
+    if(ctx->pagedDdt != NULL && builder.maxSize > MAX_RESIDENT_DDT_SIZE) builder.maxSize = MAX_RESIDENT_DDT_SIZE;
+
+    builder.extents = (DdtExtents*)calloc(1, sizeof(DdtExtents));
+
+    if(builder.extents == NULL) return;
+
+    if(ctx->pagedDdt == NULL)
+        for(i = 0; i < entries && fits; i++) fits = ddt_extents_add(&builder, i, ctx->userDataDdt[i]);
+    else
+    {
+        buffer = (uint64_t*)malloc(sizeof(uint64_t) * DDT_PAGE_ENTRIES);
+        fits   = buffer != NULL && ddt_fseek(ctx->pagedDdt->spill, 0, SEEK_SET) == 0;
+
+        for(i = 0; i < entries && fits; i += count)
+        {
+            count = entries - i < DDT_PAGE_ENTRIES ? entries - i : DDT_PAGE_ENTRIES;
+            fits  = fread(buffer, sizeof(uint64_t), count, ctx->pagedDdt->spill) == count;
+
+            for(j = 0; j < count && fits; j++) fits = ddt_extents_add(&builder, i + j, buffer[j]);
+        }
+
+        free(buffer);
+    }
+
+    if(!fits || !ddt_extents_finish(&builder, entries))
+    {
+        aaruf_ddt_extents_free(builder.extents);
+        return;
+    }
+
+    fprintf(stderr,
+            "libaaruformat: Using %" PRIu64 " extents for a deduplication table of %" PRIu64 " entries\n",
+            builder.extents->count,
+            entries);
+
+    if(ctx->pagedDdt != NULL)
+    {
+        aaruf_ddt_paged_free(ctx->pagedDdt);
+        ctx->pagedDdt = NULL;
+    }
+    else
+    {
+        free(ctx->userDataDdt);
+        ctx->userDataDdt = NULL;
+    }
+
+    ctx->extentDdt = builder.extents;
+}
+
+// Index of the last element in [low, high) of a sorted array not greater than value, array[low] must not be
+// greater than value
+static uint64_t ddt_extents_search(const uint64_t* array, uint64_t low, uint64_t high, uint64_t value)
+{
+    uint64_t mid;
+
+    while(high - low > 1)
+    {
+        mid = low + (high - low) / 2;
+
+        if(array[mid] <= value) low = mid;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static uint64_t ddt_extents_get(DdtExtents* extents, uint64_t sectorAddress)
+{
+    uint64_t k = extents->last;
+    uint64_t low;
+    uint64_t high;
+
+    // Sequential reads stay in the same extent, or go to the next one
+    if(sectorAddress < extents->starts[k] || sectorAddress >= extents->starts[k + 1])
+    {
+        if(k + 2 <= extents->count && sectorAddress >= extents->starts[k + 1] &&
+           sectorAddress < extents->starts[k + 2])
+            k++;
+        else
+        {
+            low  = ddt_extents_search(extents->index, 0, extents->indexCount, sectorAddress) * DDT_EXTENT_INDEX_STRIDE;
+            high = low + DDT_EXTENT_INDEX_STRIDE;
+
+            if(high > extents->count) high = extents->count;
+
+            k = ddt_extents_search(extents->starts, low, high, sectorAddress);
+        }
+
+        extents->last = k;
+    }
+
+    if(extents->consecutive[k / 8] & (1 << (k % 8))) return extents->bases[k] + (sectorAddress - extents->starts[k]);
+
+    return extents->bases[k];
+}
+
+/**
+ * Gets the user data DDT entry of a sector, whether the table is in memory, mapped, paged or kept as extents
+ * @param context Image context
+ * @param sectorAddress Sector
+ * @param ddtEntry Block offset shifted left by the image shift, plus the sector in the block
+ */
+int32_t aaruf_get_ddt_entry(void* context, uint64_t sectorAddress, uint64_t* ddtEntry)
+{
+    aaruformatContext* ctx = context;
+    DdtPageCache*      paged;
+    DdtPage*           page;
+    uint64_t           pageNumber;
+
+    if(sectorAddress >= ctx->imageInfo.Sectors) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    if(ctx->extentDdt != NULL)
+    {
+        *ddtEntry = ddt_extents_get(ctx->extentDdt, sectorAddress);
+        return AARUF_STATUS_OK;
+    }
+
+    paged = ctx->pagedDdt;
+
+    if(paged == NULL)
+    {
+        *ddtEntry = ctx->userDataDdt[sectorAddress];
+        return AARUF_STATUS_OK;
+    }
+
+    pageNumber = sectorAddress / DDT_PAGE_ENTRIES;
+    page       = paged->last;
+
+    if(page == NULL || page->page != pageNumber)
+    {
+        HASH_FIND(hh, paged->pages, &pageNumber, sizeof(uint64_t), page);
+
+        if(page != NULL)
+        {
+            // Move to the end, so it is the last to be evicted
+            HASH_DEL(paged->pages, page);
+            HASH_ADD(hh, paged->pages, page, sizeof(uint64_t), page);
+        }
+        else
+            page = ddt_paged_load(paged, pageNumber);
+
+        if(page == NULL)
+        {
+            fprintf(stderr, "libaaruformat: Could not read deduplication table page %" PRIu64 "\n", pageNumber);
+            paged->last = NULL;
+            return AARUF_ERROR_CANNOT_READ_BLOCK;
+        }
+
+        paged->last = page;
+    }
+
+    *ddtEntry = page->entries[sectorAddress % DDT_PAGE_ENTRIES];
+
+    return AARUF_STATUS_OK;
+}
+
+// Replaces an entry of the DDT as read from the image, before it is turned into extents
+int32_t aaruf_set_ddt_entry(void* context, uint64_t sectorAddress, uint64_t ddtEntry)
+{
+    aaruformatContext* ctx = context;
+    DdtPageCache*      paged;
+    DdtPage*           page;
+    uint64_t           pageNumber;
+    uint64_t*          copy;
+
+    if(ctx->extentDdt != NULL) return AARUF_ERROR_READ_ONLY;
+
+    paged = ctx->pagedDdt;
+
+    if(paged != NULL)
+    {
+        pageNumber = sectorAddress / DDT_PAGE_ENTRIES;
+
+        HASH_FIND(hh, paged->pages, &pageNumber, sizeof(uint64_t), page);
+
+        if(page != NULL) page->entries[sectorAddress % DDT_PAGE_ENTRIES] = ddtEntry;
+
+        if(ddt_fseek(paged->spill, sectorAddress * sizeof(uint64_t), SEEK_SET) != 0 ||
+           fwrite(&ddtEntry, sizeof(uint64_t), 1, paged->spill) != 1)
+            return AARUF_ERROR_CANNOT_WRITE;
+
+        return AARUF_STATUS_OK;
+    }
+
+    if(ctx->userDataDdt == NULL) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    // Mapped from the image, which is not written to
+    if(!ctx->inMemoryDdt)
+    {
+        copy = (uint64_t*)malloc(ctx->mappedMemoryDdtSize);
+
+        if(copy == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        memcpy(copy, ctx->userDataDdt, ctx->mappedMemoryDdtSize);
+        aaruf_unmap_file(&ctx->userDataDdtMap);
+
+        ctx->userDataDdt         = copy;
+        ctx->inMemoryDdt         = true;
+        ctx->mappedMemoryDdtSize = 0;
+    }
+
+    ctx->userDataDdt[sectorAddress] = ddtEntry;
+
+    return AARUF_STATUS_OK;
+}
@@ -0,0 +1,641 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#include "../3rdparty/lzma-21.03beta/C/Threads.h"
+
+typedef struct dedup_block
+{
+    uint64_t       offset;
+    uint64_t       references;
+    uint8_t*       sectors;
+    UT_hash_handle hh;
+} dedup_block;
+
+typedef struct
+{
+    aaruformatContext* ctx;
+    uint64_t           start;
+    uint64_t           end;
+    uint64_t           notDumped;
+    size_t             bitmapSize;
+    dedup_block*       blocks;
+    int32_t            error;
+} dedup_chunk;
+
+static void dedup_free_blocks(dedup_block* blocks)
+{
+    dedup_block* block;
+    dedup_block* tmp;
+
+    HASH_ITER(hh, blocks, block, tmp)
+    {
+        HASH_DEL(blocks, block);
+        free(block->sectors);
+        free(block);
+    }
+}
+
+static void dedup_scan(dedup_chunk* chunk)
+{
+    aaruformatContext* ctx        = chunk->ctx;
+    uint64_t           offsetMask = (1ULL << ctx->shift) - 1;
+    uint64_t           ddtEntry;
+    uint64_t           blockOffset;
+    uint64_t           offset;
+    uint64_t           i;
+    dedup_block*       block = NULL;
+
+    for(i = chunk->start; i < chunk->end; i++)
+    {
+        // Flat and mapped tables are read directly, so several threads can scan them
+        if(ctx->userDataDdt != NULL) ddtEntry = ctx->userDataDdt[i];
+        else
+        {
+            chunk->error = aaruf_get_ddt_entry(ctx, i, &ddtEntry);
+
+            if(chunk->error != AARUF_STATUS_OK) return;
+        }
+
+        if(ddtEntry == 0)
+        {
+            chunk->notDumped++;
+            continue;
+        }
+
+        offset      = ddtEntry & offsetMask;
+        blockOffset = ddtEntry >> ctx->shift;
+
+        if(block == NULL || block->offset != blockOffset)
+        {
+            HASH_FIND(hh, chunk->blocks, &blockOffset, sizeof(uint64_t), block);
+
+            if(block == NULL)
+            {
+                block = (dedup_block*)calloc(1, sizeof(dedup_block));
+
+                if(block == NULL)
+                {
+                    chunk->error = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+                    return;
+                }
+
+                block->offset = blockOffset;
+
+                if(chunk->bitmapSize > 0)
+                {
+                    block->sectors = (uint8_t*)calloc(1, chunk->bitmapSize);
+
+                    if(block->sectors == NULL)
+                    {
+                        free(block);
+                        chunk->error = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+                        return;
+                    }
+                }
+
+                HASH_ADD(hh, chunk->blocks, offset, sizeof(uint64_t), block);
+            }
+        }
+
+        block->references++;
+
+        if(block->sectors != NULL) block->sectors[offset / 8] |= (uint8_t)(1 << (offset % 8));
+    }
+}
+
+static THREAD_FUNC_DECL dedup_worker(void* param)
+{
+    dedup_scan((dedup_chunk*)param);
+
+    return 0;
+}
+
+static int dedup_compare_offset(const void* a, const void* b)
+{
+    const BlockReferences* x = a;
+    const BlockReferences* y = b;
+
+    return x->blockOffset < y->blockOffset ? -1 : x->blockOffset > y->blockOffset;
+}
+
+static int dedup_compare_references(const void* a, const void* b)
+{
+    const BlockReferences* x = a;
+    const BlockReferences* y = b;
+
+    if(x->references != y->references) return x->references > y->references ? -1 : 1;
+
+    return dedup_compare_offset(a, b);
+}
+
+/**
+ * Scans the user data DDT and counts how many sectors point to each block. Flat and memory mapped tables are split
+ * between up to the given number of threads. Unique sectors are not counted when a block can hold more than
+ * 2^DEDUP_STATS_MAX_SHIFT sectors.
+ * @param context Image context
+ * @param stats Where to store the statistics, must be released with aaruf_free_dedup_stats()
+ * @param topCount How many of the most referenced blocks to return in stats->top
+ * @param threads Maximum number of threads to use
+ */
+int32_t aaruf_get_dedup_stats(void* context, DedupStats* stats, uint32_t topCount, uint32_t threads)
+{
+    aaruformatContext* ctx;
+    dedup_chunk*       chunks;
+    CThread*           workers;
+    dedup_block*       block;
+    dedup_block*       tmp;
+    dedup_block*       merged;
+    BlockReferences*   tmpTop;
+    uint64_t           entries;
+    uint64_t           i;
+    uint32_t           t;
+    size_t             bitmapSize = 0;
+    size_t             b;
+    int32_t            error = AARUF_STATUS_OK;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    memset(stats, 0, sizeof(DedupStats));
+
+    entries        = ctx->imageInfo.Sectors;
+    stats->sectors = entries;
+
+    if(ctx->shift <= DEDUP_STATS_MAX_SHIFT) bitmapSize = ((1ULL << ctx->shift) + 7) / 8;
+
+    if(ctx->userDataDdt == NULL || threads < 1) threads = 1;
+    if(threads > entries / DEDUP_STATS_MT_MIN_CHUNK) threads = (uint32_t)(entries / DEDUP_STATS_MT_MIN_CHUNK);
+    if(threads < 1) threads = 1;
+
+    chunks  = (dedup_chunk*)calloc(threads, sizeof(dedup_chunk));
+    workers = (CThread*)calloc(threads, sizeof(CThread));
+
+    if(chunks == NULL || workers == NULL)
+    {
+        free(chunks);
+        free(workers);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for(t = 0; t < threads; t++)
+    {
+        chunks[t].ctx        = ctx;
+        chunks[t].start      = entries / threads * t;
+        chunks[t].end        = t == threads - 1 ? entries : entries / threads * (t + 1);
+        chunks[t].bitmapSize = bitmapSize;
+    }
+
+    // The prefetcher shares the DDT lookup state
+    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+    for(t = 1; t < threads; t++)
+    {
+        Thread_Construct(&workers[t]);
+
+        if(Thread_Create(&workers[t], dedup_worker, &chunks[t]) != 0) dedup_scan(&chunks[t]);
+    }
+
+    dedup_scan(&chunks[0]);
+
+    for(t = 1; t < threads; t++)
+        if(Thread_WasCreated(&workers[t])) Thread_Wait_Close(&workers[t]);
+
+    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+    // Merge all chunks into the first one
+    merged = chunks[0].blocks;
+
+    for(t = 0; t < threads; t++)
+    {
+        if(chunks[t].error != AARUF_STATUS_OK) error = chunks[t].error;
+
+        stats->notDumped += chunks[t].notDumped;
+
+        if(t == 0) continue;
+
+        HASH_ITER(hh, chunks[t].blocks, block, tmp)
+        {
+            dedup_block* found;
+
+            HASH_FIND(hh, merged, &block->offset, sizeof(uint64_t), found);
+
+            if(found == NULL)
+            {
+                HASH_DEL(chunks[t].blocks, block);
+                HASH_ADD(hh, merged, offset, sizeof(uint64_t), block);
+                continue;
+            }
+
+            found->references += block->references;
+
+            if(found->sectors != NULL)
+                for(b = 0; b < bitmapSize; b++) found->sectors[b] |= block->sectors[b];
+        }
+
+        dedup_free_blocks(chunks[t].blocks);
+    }
+
+    free(chunks);
+    free(workers);
+
+    if(error != AARUF_STATUS_OK)
+    {
+        dedup_free_blocks(merged);
+        return error;
+    }
+
+    stats->referenced      = entries - stats->notDumped;
+    stats->blocks          = HASH_COUNT(merged);
+    stats->blockReferences = (BlockReferences*)malloc(sizeof(BlockReferences) * (stats->blocks + 1));
+
+    if(stats->blockReferences == NULL)
+    {
+        dedup_free_blocks(merged);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    i = 0;
+    HASH_ITER(hh, merged, block, tmp)
+    {
+        stats->blockReferences[i].blockOffset   = block->offset;
+        stats->blockReferences[i].references    = block->references;
+        stats->blockReferences[i].uniqueSectors = 0;
+
+        if(block->sectors != NULL)
+            for(b = 0; b < bitmapSize; b++)
+                for(t = 0; t < 8; t++)
+                    if(block->sectors[b] & (1 << t)) stats->blockReferences[i].uniqueSectors++;
+
+        stats->unique += stats->blockReferences[i].uniqueSectors;
+        i++;
+    }
+
+    dedup_free_blocks(merged);
+
+    qsort(stats->blockReferences, stats->blocks, sizeof(BlockReferences), dedup_compare_offset);
+
+    if(topCount > stats->blocks) topCount = (uint32_t)stats->blocks;
+
+    stats->top = (BlockReferences*)malloc(sizeof(BlockReferences) * (stats->blocks + 1));
+
+    if(stats->top == NULL)
+    {
+        aaruf_free_dedup_stats(stats);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    memcpy(stats->top, stats->blockReferences, sizeof(BlockReferences) * stats->blocks);
+    qsort(stats->top, stats->blocks, sizeof(BlockReferences), dedup_compare_references);
+    stats->topCount = topCount;
+
+    // Only keep the requested ones
+    tmpTop = (BlockReferences*)realloc(stats->top, sizeof(BlockReferences) * (topCount + 1));
+    if(tmpTop != NULL) stats->top = tmpTop;
+
+    return AARUF_STATUS_OK;
+}
+
+void aaruf_free_dedup_stats(DedupStats* stats)
+{
+    if(stats == NULL) return;
+
+    free(stats->blockReferences);
+    free(stats->top);
+    stats->blockReferences = NULL;
+    stats->top             = NULL;
+    stats->topCount        = 0;
+}
+
+typedef struct
+{
+    uint64_t blockOffset;
+    uint64_t start;
+    uint64_t length;
+} reverse_ddt_run;
+
+typedef struct
+{
+    aaruformatContext* ctx;
+    uint64_t           start;
+    uint64_t           end;
+    reverse_ddt_run*   runs;
+    uint64_t           count;
+    uint64_t           allocated;
+    uint64_t           next;
+    int32_t            error;
+} reverse_ddt_chunk;
+
+static int reverse_ddt_compare_runs(const void* a, const void* b)
+{
+    const reverse_ddt_run* x = a;
+    const reverse_ddt_run* y = b;
+
+    if(x->blockOffset != y->blockOffset) return x->blockOffset < y->blockOffset ? -1 : 1;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Collects the runs of consecutive sectors stored in the same block and sorts them by block
+static void reverse_ddt_scan(reverse_ddt_chunk* chunk)
+{
+    aaruformatContext* ctx = chunk->ctx;
+    reverse_ddt_run*   tmpRuns;
+    reverse_ddt_run*   run = NULL;
+    uint64_t           ddtEntry;
+    uint64_t           blockOffset;
+    uint64_t           i;
+
+    for(i = chunk->start; i < chunk->end; i++)
+    {
+        if(ctx->userDataDdt != NULL) ddtEntry = ctx->userDataDdt[i];
+        else
+        {
+            chunk->error = aaruf_get_ddt_entry(ctx, i, &ddtEntry);
+
+            if(chunk->error != AARUF_STATUS_OK) return;
+        }
+
+        if(ddtEntry == 0)
+        {
+            run = NULL;
+            continue;
+        }
+
+        blockOffset = ddtEntry >> ctx->shift;
+
+        if(run != NULL && run->blockOffset == blockOffset)
+        {
+            run->length++;
+            continue;
+        }
+
+        if(chunk->count == chunk->allocated)
+        {
+            chunk->allocated = chunk->allocated == 0 ? 1024 : chunk->allocated * 2;
+            tmpRuns          = (reverse_ddt_run*)realloc(chunk->runs, sizeof(reverse_ddt_run) * chunk->allocated);
+
+            if(tmpRuns == NULL)
+            {
+                chunk->error = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+                return;
+            }
+
+            chunk->runs = tmpRuns;
+        }
+
+        run              = &chunk->runs[chunk->count++];
+        run->blockOffset = blockOffset;
+        run->start       = i;
+        run->length      = 1;
+    }
+
+    qsort(chunk->runs, chunk->count, sizeof(reverse_ddt_run), reverse_ddt_compare_runs);
+}
+
+static THREAD_FUNC_DECL reverse_ddt_worker(void* param)
+{
+    reverse_ddt_scan((reverse_ddt_chunk*)param);
+
+    return 0;
+}
+
+/**
+ * Builds the index of which sectors are stored in each data block, scanning the user data DDT once. Flat and memory
+ * mapped tables are split between up to the given number of threads, that sort their runs before they are merged.
+ * Does nothing if the index already exists.
+ * @param context Image context
+ * @param threads Maximum number of threads to use
+ */
+int32_t aaruf_build_reverse_ddt(void* context, uint32_t threads)
+{
+    aaruformatContext* ctx;
+    reverse_ddt_chunk* chunks;
+    CThread*           workers;
+    ReverseDdt*        reverse;
+    reverse_ddt_run*   run;
+    LbaRange*          range;
+    LbaRange*          tmpRanges;
+    uint64_t*          tmpOffsets;
+    uint64_t           entries;
+    uint64_t           runs = 0;
+    uint32_t           t;
+    uint32_t           lowest;
+    int32_t            error = AARUF_STATUS_OK;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->reverseDdt != NULL) return AARUF_STATUS_OK;
+
+    entries = ctx->imageInfo.Sectors;
+
+    if(ctx->userDataDdt == NULL || threads < 1) threads = 1;
+    if(threads > entries / DEDUP_STATS_MT_MIN_CHUNK) threads = (uint32_t)(entries / DEDUP_STATS_MT_MIN_CHUNK);
+    if(threads < 1) threads = 1;
+
+    chunks  = (reverse_ddt_chunk*)calloc(threads, sizeof(reverse_ddt_chunk));
+    workers = (CThread*)calloc(threads, sizeof(CThread));
+
+    if(chunks == NULL || workers == NULL)
+    {
+        free(chunks);
+        free(workers);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for(t = 0; t < threads; t++)
+    {
+        chunks[t].ctx   = ctx;
+        chunks[t].start = entries / threads * t;
+        chunks[t].end   = t == threads - 1 ? entries : entries / threads * (t + 1);
+    }
+
+    // The prefetcher shares the DDT lookup state
+    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+    for(t = 1; t < threads; t++)
+    {
+        Thread_Construct(&workers[t]);
+
+        if(Thread_Create(&workers[t], reverse_ddt_worker, &chunks[t]) != 0) reverse_ddt_scan(&chunks[t]);
+    }
+
+    reverse_ddt_scan(&chunks[0]);
+
+    for(t = 1; t < threads; t++)
+        if(Thread_WasCreated(&workers[t])) Thread_Wait_Close(&workers[t]);
+
+    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+    free(workers);
+
+    for(t = 0; t < threads; t++)
+    {
+        if(chunks[t].error != AARUF_STATUS_OK) error = chunks[t].error;
+
+        runs += chunks[t].count;
+    }
+
+    reverse = (ReverseDdt*)calloc(1, sizeof(ReverseDdt));
+
+    if(reverse != NULL)
+    {
+        reverse->blockOffsets = (uint64_t*)malloc(sizeof(uint64_t) * (runs + 1));
+        reverse->firstRange   = (uint64_t*)malloc(sizeof(uint64_t) * (runs + 1));
+        reverse->ranges       = (LbaRange*)malloc(sizeof(LbaRange) * (runs + 1));
+
+        if(reverse->blockOffsets == NULL || reverse->firstRange == NULL || reverse->ranges == NULL)
+            error = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    else
+        error = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(error != AARUF_STATUS_OK)
+    {
+        for(t = 0; t < threads; t++) free(chunks[t].runs);
+        free(chunks);
+        aaruf_reverse_ddt_free(reverse);
+        return error;
+    }
+
+    // Merge the sorted runs of all chunks, joining the ones that continue across chunk boundaries
+    range = NULL;
+
+    for(;;)
+    {
+        lowest = threads;
+
+        for(t = 0; t < threads; t++)
+        {
+            if(chunks[t].next >= chunks[t].count) continue;
+
+            if(lowest == threads ||
+               reverse_ddt_compare_runs(&chunks[t].runs[chunks[t].next],
+                                        &chunks[lowest].runs[chunks[lowest].next]) < 0)
+                lowest = t;
+        }
+
+        if(lowest == threads) break;
+
+        run = &chunks[lowest].runs[chunks[lowest].next++];
+
+        if(reverse->blocks == 0 || reverse->blockOffsets[reverse->blocks - 1] != run->blockOffset)
+        {
+            reverse->blockOffsets[reverse->blocks] = run->blockOffset;
+            reverse->firstRange[reverse->blocks]   = range == NULL ? 0 : range - reverse->ranges + 1;
+            reverse->blocks++;
+        }
+        else if(range->start + range->length == run->start)
+        {
+            range->length += run->length;
+            continue;
+        }
+
+        range         = range == NULL ? reverse->ranges : range + 1;
+        range->start  = run->start;
+        range->length = run->length;
+    }
+
+    reverse->firstRange[reverse->blocks] = range == NULL ? 0 : range - reverse->ranges + 1;
+
+    for(t = 0; t < threads; t++) free(chunks[t].runs);
+    free(chunks);
+
+    // Runs were joined and blocks repeated, give back what was not used
+    tmpOffsets = (uint64_t*)realloc(reverse->blockOffsets, sizeof(uint64_t) * (reverse->blocks + 1));
+    if(tmpOffsets != NULL) reverse->blockOffsets = tmpOffsets;
+    tmpOffsets = (uint64_t*)realloc(reverse->firstRange, sizeof(uint64_t) * (reverse->blocks + 1));
+    if(tmpOffsets != NULL) reverse->firstRange = tmpOffsets;
+    tmpRanges = (LbaRange*)realloc(reverse->ranges, sizeof(LbaRange) * (reverse->firstRange[reverse->blocks] + 1));
+    if(tmpRanges != NULL) reverse->ranges = tmpRanges;
+
+    ctx->reverseDdt = reverse;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Gets which sectors are stored in a data block, building the reverse DDT the first time it is needed.
+ * @param context Image context
+ * @param blockOffset Offset in the image of the data block
+ * @param ranges Ranges of sectors sorted by sector, owned by the context, NULL if no sector is stored in the block
+ * @param rangeCount Number of ranges
+ */
+int32_t aaruf_get_block_sectors(void* context, uint64_t blockOffset, const LbaRange** ranges, uint64_t* rangeCount)
+{
+    aaruformatContext* ctx;
+    ReverseDdt*        reverse;
+    uint64_t           low;
+    uint64_t           high;
+    uint64_t           mid;
+    int32_t            error;
+
+    *ranges     = NULL;
+    *rangeCount = 0;
+
+    error = aaruf_build_reverse_ddt(context, REVERSE_DDT_THREADS);
+
+    if(error != AARUF_STATUS_OK) return error;
+
+    ctx     = context;
+    reverse = ctx->reverseDdt;
+    low     = 0;
+    high    = reverse->blocks;
+
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if(reverse->blockOffsets[mid] < blockOffset) low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if(low == reverse->blocks || reverse->blockOffsets[low] != blockOffset) return AARUF_STATUS_OK;
+
+    *ranges     = &reverse->ranges[reverse->firstRange[low]];
+    *rangeCount = reverse->firstRange[low + 1] - reverse->firstRange[low];
+
+    return AARUF_STATUS_OK;
+}
+
+void aaruf_reverse_ddt_free(void* reverseDdt)
+{
+    ReverseDdt* reverse = reverseDdt;
+
+    if(reverse == NULL) return;
+
+    free(reverse->blockOffsets);
+    free(reverse->firstRange);
+    free(reverse->ranges);
+    free(reverse);
+}
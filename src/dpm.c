@@ -0,0 +1,222 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Data position measurements. The block is only read the first time measurements are queried, into an array sorted by
+// sector, so the measurements of a range of sectors are found by binary search and returned without copying them.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+static int compare_dpm(const void* a, const void* b)
+{
+    const DataPositionMeasurementEntry* x = a;
+    const DataPositionMeasurementEntry* y = b;
+
+    if(x->sectorAddress != y->sectorAddress) return x->sectorAddress < y->sectorAddress ? -1 : 1;
+
+    return x->position < y->position ? -1 : x->position > y->position;
+}
+
+void aaruf_dpm_sort(DataPositionMeasurementEntry* entries, uint32_t count)
+{
+    qsort(entries, count, sizeof(DataPositionMeasurementEntry), compare_dpm);
+}
+
+static int32_t dpm_read(aaruformatContext* ctx)
+{
+    DataPositionMeasurementHeader header;
+    DataPositionMeasurementEntry* entries;
+    uint64_t                      crc64;
+    uint32_t                      i;
+
+    if(fseek(ctx->imageStream, ctx->dpmOffset, SEEK_SET) != 0 ||
+       fread(&header, sizeof(DataPositionMeasurementHeader), 1, ctx->imageStream) != 1 ||
+       header.identifier != DataPositionMeasurementBlock ||
+       header.length != sizeof(DataPositionMeasurementEntry) * (uint64_t)header.entries ||
+       header.length > UINT32_MAX)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    // Nothing measured
+    if(header.entries == 0) return AARUF_STATUS_OK;
+
+    entries = malloc(header.length);
+
+    if(entries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fread(entries, sizeof(DataPositionMeasurementEntry), header.entries, ctx->imageStream) != header.entries)
+    {
+        free(entries);
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    crc64 = bswap_64(aaruf_crc64_data((const uint8_t*)entries, (uint32_t)header.length));
+
+    if(crc64 != header.crc64)
+    {
+        free(entries);
+        return AARUF_ERROR_INVALID_BLOCK_CRC;
+    }
+
+    // Written sorted, only sorted again if it was not
+    for(i = 1; i < header.entries; i++)
+    {
+        if(compare_dpm(&entries[i - 1], &entries[i]) <= 0) continue;
+
+        aaruf_dpm_sort(entries, header.entries);
+        break;
+    }
+
+    ctx->dpmEntries = entries;
+    ctx->dpmCount   = header.entries;
+
+    fprintf(stderr,
+            "libaaruformat: Found %u data position measurements at position %" PRIu64 ".\n",
+            header.entries,
+            ctx->dpmOffset);
+
+    return AARUF_STATUS_OK;
+}
+
+// Reads the block the first time, remembering if it could not be read
+static int32_t dpm_load(aaruformatContext* ctx)
+{
+    if(ctx->dpmRead) return ctx->dpmError;
+
+    ctx->dpmRead  = true;
+    ctx->dpmError = AARUF_STATUS_OK;
+
+    if(ctx->dpmOffset == 0) return AARUF_STATUS_OK;
+
+    // The prefetcher shares the image stream
+    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+    ctx->dpmError = dpm_read(ctx);
+
+    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+    if(ctx->dpmError != AARUF_STATUS_OK)
+        fprintf(stderr, "libaaruformat: Could not read data position measurement block, error %d.\n", ctx->dpmError);
+
+    return ctx->dpmError;
+}
+
+// First measurement at or after the sector
+static uint32_t dpm_lower_bound(const aaruformatContext* ctx, uint64_t sectorAddress)
+{
+    uint32_t low  = 0;
+    uint32_t high = ctx->dpmCount;
+    uint32_t mid;
+
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if(ctx->dpmEntries[mid].sectorAddress < sectorAddress) low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ * Gets the data position measurements taken from a sector to another, both included, sorted by sector, without
+ * copying them
+ * @param context Image context
+ * @param startSector First sector
+ * @param endSector Last sector
+ * @param entries Measurements, owned by the context
+ * @param count Number of measurements, 0 if the image has none in the range
+ */
+int32_t aaruf_get_dpm(void*                                context,
+                      uint64_t                             startSector,
+                      uint64_t                             endSector,
+                      const DataPositionMeasurementEntry** entries,
+                      uint32_t*                            count)
+{
+    aaruformatContext* ctx;
+    uint32_t           first;
+    uint32_t           last;
+    int32_t            errorNo;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    *entries = NULL;
+    *count   = 0;
+
+    errorNo = dpm_load(ctx);
+
+    if(errorNo != AARUF_STATUS_OK || startSector > endSector) return errorNo;
+
+    first = dpm_lower_bound(ctx, startSector);
+    last  = endSector == UINT64_MAX ? ctx->dpmCount : dpm_lower_bound(ctx, endSector + 1);
+
+    if(first == last) return AARUF_STATUS_OK;
+
+    *entries = &ctx->dpmEntries[first];
+    *count   = last - first;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Copies the data position measurements taken from a sector to another, both included, sorted by sector
+ * @param context Image context
+ * @param startSector First sector
+ * @param endSector Last sector, UINT64_MAX for every measurement from the first sector
+ * @param entries Buffer for the measurements, or NULL to get how many there are
+ * @param count Size of the buffer in measurements, set to the number of measurements in the range
+ * @return AARUF_STATUS_OK, or AARUF_ERROR_BUFFER_TOO_SMALL with count set to the size needed
+ */
+int32_t aaruf_read_dpm(void*                         context,
+                       uint64_t                      startSector,
+                       uint64_t                      endSector,
+                       DataPositionMeasurementEntry* entries,
+                       uint32_t*                     count)
+{
+    const DataPositionMeasurementEntry* found;
+    uint32_t                            foundCount;
+    int32_t                             errorNo;
+
+    errorNo = aaruf_get_dpm(context, startSector, endSector, &found, &foundCount);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    if(foundCount > 0 && (entries == NULL || *count < foundCount))
+    {
+        *count = foundCount;
+        return AARUF_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    *count = foundCount;
+
+    if(foundCount > 0) memcpy(entries, found, sizeof(DataPositionMeasurementEntry) * foundCount);
+
+    return AARUF_STATUS_OK;
+}
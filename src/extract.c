@@ -0,0 +1,258 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <aaruformat.h>
+
+static int32_t extract_write(FILE* output, uint64_t position, const uint8_t* data, size_t length)
+{
+#if defined(_WIN32)
+    if(_fseeki64(output, (int64_t)position, SEEK_SET) != 0 || fwrite(data, 1, length, output) != length)
+        return AARUF_ERROR_CANNOT_WRITE;
+#else
+    ssize_t written;
+    int     fd = fileno(output);
+
+    while(length > 0)
+    {
+        written = pwrite(fd, data, length, (off_t)position);
+
+        if(written <= 0) return AARUF_ERROR_CANNOT_WRITE;
+
+        data += written;
+        position += written;
+        length -= written;
+    }
+#endif
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t extract_set_size(FILE* output, uint64_t size)
+{
+#if defined(_WIN32)
+    fflush(output);
+    if(_chsize_s(_fileno(output), (int64_t)size) != 0) return AARUF_ERROR_CANNOT_WRITE;
+#else
+    if(ftruncate(fileno(output), (off_t)size) != 0) return AARUF_ERROR_CANNOT_WRITE;
+#endif
+
+    return AARUF_STATUS_OK;
+}
+
+// Reads and decodes the data block at blockOffset, growing the buffers as needed
+static int32_t extract_read_block(aaruformatContext* ctx,
+                                  uint64_t           blockOffset,
+                                  BlockHeader*       blockHeader,
+                                  uint8_t**          block,
+                                  size_t*            blockSize)
+{
+    uint8_t* cmpData;
+    uint8_t* buffer;
+
+    fseek(ctx->imageStream, blockOffset, SEEK_SET);
+
+    if(fread(blockHeader, 1, sizeof(BlockHeader), ctx->imageStream) != sizeof(BlockHeader))
+        return AARUF_ERROR_CANNOT_READ_HEADER;
+
+    if(blockHeader->identifier != DataBlock) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    if(blockHeader->length > *blockSize)
+    {
+        buffer = realloc(*block, blockHeader->length);
+
+        if(buffer == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        *block     = buffer;
+        *blockSize = blockHeader->length;
+    }
+
+    // Uncompressed blocks are read in place
+    if(blockHeader->compression == None)
+    {
+        if(fread(*block, 1, blockHeader->length, ctx->imageStream) != blockHeader->length)
+            return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+        return AARUF_STATUS_OK;
+    }
+
+    cmpData = aaruf_get_compressed_buffer(ctx, blockHeader->cmpLength);
+
+    if(cmpData == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fread(cmpData, 1, blockHeader->cmpLength, ctx->imageStream) != blockHeader->cmpLength)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    return aaruf_decode_block(blockHeader, cmpData, ctx->lzmaDecoder, *block);
+}
+
+// Sectors never written to a child image are read from its parent, the ones the parent does not have stay as zeroes
+static int32_t extract_from_parent(aaruformatContext* ctx, FILE* output)
+{
+    uint8_t* sector;
+    uint64_t i;
+    uint64_t ddtEntry;
+    uint32_t length;
+    int32_t  errorNo = AARUF_STATUS_OK;
+
+    sector = malloc(ctx->imageInfo.SectorSize);
+
+    if(sector == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    for(i = 0; i < ctx->imageInfo.Sectors && errorNo == AARUF_STATUS_OK; i++)
+    {
+        errorNo = aaruf_get_ddt_entry(ctx, i, &ddtEntry);
+
+        if(errorNo != AARUF_STATUS_OK || ddtEntry != 0) continue;
+
+        length  = ctx->imageInfo.SectorSize;
+        errorNo = aaruf_parent_read_sector(ctx, i, sector, &length);
+
+        if(errorNo == AARUF_STATUS_SECTOR_NOT_DUMPED)
+        {
+            errorNo = AARUF_STATUS_OK;
+            continue;
+        }
+
+        if(errorNo == AARUF_STATUS_OK)
+            errorNo = extract_write(output, i * ctx->imageInfo.SectorSize, sector, ctx->imageInfo.SectorSize);
+    }
+
+    free(sector);
+
+    return errorNo;
+}
+
+/**
+ * Writes the user data of all sectors to output, at sector * SectorSize. Blocks are read and decoded once each, in the
+ * order they are in the image, and their sectors scattered to every sector that references them. Sectors never
+ * written to a child image are read from its parent. Sectors that were not dumped are left as zeroes.
+ * @param context Image context
+ * @param output File to write to, must be opened for writing in binary mode
+ */
+int32_t aaruf_extract_user_data(void* context, FILE* output)
+{
+    aaruformatContext* ctx;
+    ReverseDdt*        reverse;
+    const LbaRange*    range;
+    BlockHeader        blockHeader;
+    uint8_t*           block     = NULL;
+    size_t             blockSize = 0;
+    uint64_t           offsetMask;
+    uint64_t           i;
+    uint64_t           r;
+    uint64_t           sector;
+    uint64_t           end;
+    uint64_t           ddtEntry;
+    uint64_t           runStart;
+    uint64_t           runOffset;
+    uint64_t           runLength;
+    int32_t            errorNo;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(output == NULL) return AARUF_ERROR_CANNOT_WRITE;
+
+    errorNo = aaruf_build_reverse_ddt(ctx, REVERSE_DDT_THREADS);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    reverse    = ctx->reverseDdt;
+    offsetMask = (1ULL << ctx->shift) - 1;
+
+    // The prefetcher shares the image stream and the DDT lookup state
+    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+    // Sized first so sectors not dumped at the end are there too
+    errorNo = extract_set_size(output, ctx->imageInfo.Sectors * ctx->imageInfo.SectorSize);
+
+    // Block offsets are sorted, so the image is read forward
+    for(i = 0; i < reverse->blocks && errorNo == AARUF_STATUS_OK; i++)
+    {
+        errorNo = extract_read_block(ctx, reverse->blockOffsets[i], &blockHeader, &block, &blockSize);
+
+        if(errorNo != AARUF_STATUS_OK) break;
+
+        for(r = reverse->firstRange[i]; r < reverse->firstRange[i + 1] && errorNo == AARUF_STATUS_OK; r++)
+        {
+            range     = &reverse->ranges[r];
+            end       = range->start + range->length;
+            runLength = 0;
+            runStart  = 0;
+            runOffset = 0;
+
+            // Sectors that are consecutive in the block too are written at once
+            for(sector = range->start; sector <= end && errorNo == AARUF_STATUS_OK; sector++)
+            {
+                if(sector < end)
+                {
+                    errorNo = aaruf_get_ddt_entry(ctx, sector, &ddtEntry);
+
+                    if(errorNo != AARUF_STATUS_OK) break;
+
+                    if(runLength > 0 && (ddtEntry & offsetMask) == runOffset + runLength &&
+                       blockHeader.sectorSize == ctx->imageInfo.SectorSize)
+                    {
+                        runLength++;
+                        continue;
+                    }
+                }
+
+                if(runLength > 0)
+                {
+                    if((runOffset + runLength) * blockHeader.sectorSize > blockHeader.length)
+                    {
+                        errorNo = AARUF_ERROR_CANNOT_READ_BLOCK;
+                        break;
+                    }
+
+                    errorNo = extract_write(output,
+                                            runStart * ctx->imageInfo.SectorSize,
+                                            block + runOffset * blockHeader.sectorSize,
+                                            runLength * blockHeader.sectorSize);
+                }
+
+                runStart  = sector;
+                runOffset = ddtEntry & offsetMask;
+                runLength = 1;
+            }
+        }
+    }
+
+    if(errorNo == AARUF_STATUS_OK && ctx->parentPath != NULL) errorNo = extract_from_parent(ctx, output);
+
+    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+    free(block);
+
+    return errorNo;
+}
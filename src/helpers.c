@@ -16,8 +16,10 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <aaru.h>
+#include <stdlib.h>
+#include <string.h>
 
+// aaru.h must come through aaruformat.h, structs.h includes it packed and the context layout depends on it
 #include <aaruformat.h>
 
 // Converts between image data type and aaru media tag type
@@ -197,3 +199,108 @@ int32_t aaruf_get_xml_mediatype(int32_t type)
         default: return BlockMedia;
     }
 }
+
+// Returns a buffer for compressed data of at least the requested size, reused across blocks until the image is closed
+uint8_t* aaruf_get_compressed_buffer(void* context, size_t size)
+{
+    aaruformatContext* ctx = context;
+    uint8_t*           buffer;
+
+    if(size <= ctx->compressedBufferSize) return ctx->compressedBuffer;
+
+    buffer = realloc(ctx->compressedBuffer, size);
+
+    if(buffer == NULL) return NULL;
+
+    ctx->compressedBuffer     = buffer;
+    ctx->compressedBufferSize = size;
+
+    return buffer;
+}
+
+static int compare_track_start(const void* a, const void* b)
+{
+    const TrackEntry* x = a;
+    const TrackEntry* y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Sorts the data tracks by their first sector and indexes them by sequence, so the track of a sector is found by
+// binary search and the track of a sequence directly
+int32_t aaruf_build_track_lookup(void* context)
+{
+    aaruformatContext* ctx = context;
+    uint8_t            i;
+
+    memset(ctx->dataTrackBySequence, 0, sizeof(ctx->dataTrackBySequence));
+    ctx->lastDataTrack = 0;
+
+    free(ctx->dataTrackStarts);
+    ctx->dataTrackStarts = NULL;
+
+    if(ctx->numberOfDataTracks == 0 || ctx->dataTracks == NULL) return AARUF_STATUS_OK;
+
+    qsort(ctx->dataTracks, ctx->numberOfDataTracks, sizeof(TrackEntry), compare_track_start);
+
+    ctx->dataTrackStarts = (int64_t*)malloc(sizeof(int64_t) * ctx->numberOfDataTracks);
+
+    if(ctx->dataTrackStarts == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    for(i = 0; i < ctx->numberOfDataTracks; i++)
+    {
+        ctx->dataTrackStarts[i] = ctx->dataTracks[i].start;
+
+        // Stored plus one, zero means there is no such track
+        ctx->dataTrackBySequence[ctx->dataTracks[i].sequence] = i + 1;
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Returns the data track that contains the sector, or NULL
+TrackEntry* aaruf_find_data_track(void* context, uint64_t sectorAddress)
+{
+    aaruformatContext* ctx    = context;
+    int64_t            sector = (int64_t)sectorAddress;
+    const int64_t*     base;
+    TrackEntry*        track;
+    uint8_t            count;
+    uint8_t            half;
+
+    if(ctx->dataTrackStarts == NULL) return NULL;
+
+    // Consecutive sectors are almost always in the same track
+    track = &ctx->dataTracks[ctx->lastDataTrack];
+
+    if(sector >= track->start && sector <= track->end) return track;
+
+    // Last track starting at or before the sector, the comparison compiles to a conditional move
+    base  = ctx->dataTrackStarts;
+    count = ctx->numberOfDataTracks;
+
+    while(count > 1)
+    {
+        half = count / 2;
+        base = base[half] <= sector ? base + half : base;
+        count -= half;
+    }
+
+    track = &ctx->dataTracks[base - ctx->dataTrackStarts];
+
+    if(sector < track->start || sector > track->end) return NULL;
+
+    ctx->lastDataTrack = (uint8_t)(base - ctx->dataTrackStarts);
+
+    return track;
+}
+
+// Returns the data track with the given sequence number, or NULL
+TrackEntry* aaruf_get_data_track(void* context, uint8_t sequence)
+{
+    aaruformatContext* ctx = context;
+
+    if(sequence > 99 || ctx->dataTrackBySequence[sequence] == 0) return NULL;
+
+    return &ctx->dataTracks[ctx->dataTrackBySequence[sequence] - 1];
+}
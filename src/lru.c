@@ -22,51 +22,58 @@ void* find_in_cache(struct CacheHeader* cache, char* key)
     return NULL;
 }
 
+// Values are owned by the cache once added, and freed when evicted
 void add_to_cache(struct CacheHeader* cache, char* key, void* value)
 {
-    struct CacheEntry *entry, *tmp_entry;
-    // TODO: Is this needed or we're just losing cycles? uthash does not free the entry
-    entry        = malloc(sizeof(struct CacheEntry));
-    entry->key   = strdup(key);
-    entry->value = value;
-    HASH_ADD_KEYPTR(hh, cache->cache, entry->key, strlen(entry->key), entry);
+    struct CacheEntry *entry, *added, *tmp_entry;
+    added        = malloc(sizeof(struct CacheEntry));
+    added->key   = strdup(key);
+    added->value = value;
+    HASH_ADD_KEYPTR(hh, cache->cache, added->key, strlen(added->key), added);
 
     // prune the cache to MAX_CACHE_SIZE
-    if(HASH_COUNT(cache->cache) >= cache->max_items)
+    if(HASH_COUNT(cache->cache) > cache->max_items)
     {
         HASH_ITER(hh, cache->cache, entry, tmp_entry)
         {
+            // The caller still uses the value it just added
+            if(entry == added) continue;
+
             // prune the first entry (loop is based on insertion order so this deletes the oldest item)
             HASH_DELETE(hh, cache->cache, entry);
             free(entry->key);
+            free(entry->value);
             free(entry);
             break;
         }
     }
 }
 
+void free_cache(struct CacheHeader* cache)
+{
+    struct CacheEntry *entry, *tmp_entry;
+
+    HASH_ITER(hh, cache->cache, entry, tmp_entry)
+    {
+        HASH_DELETE(hh, cache->cache, entry);
+        free(entry->key);
+        free(entry->value);
+        free(entry);
+    }
+
+    cache->cache = NULL;
+}
+
 FORCE_INLINE char* int64_to_string(uint64_t number)
 {
     char* charKey;
+    int   i;
 
     charKey = malloc(17);
 
-    charKey[0]  = (char)(number >> 60);
-    charKey[1]  = (char)((number & 0xF00000000000000ULL) >> 56);
-    charKey[2]  = (char)((number & 0xF0000000000000ULL) >> 52);
-    charKey[3]  = (char)((number & 0xF000000000000ULL) >> 48);
-    charKey[4]  = (char)((number & 0xF00000000000ULL) >> 44);
-    charKey[5]  = (char)((number & 0xF0000000000ULL) >> 40);
-    charKey[6]  = (char)((number & 0xF000000000ULL) >> 36);
-    charKey[7]  = (char)((number & 0xF00000000ULL) >> 32);
-    charKey[8]  = (char)((number & 0xF0000000ULL) >> 28);
-    charKey[9]  = (char)((number & 0xF000000ULL) >> 24);
-    charKey[10] = (char)((number & 0xF00000ULL) >> 20);
-    charKey[11] = (char)((number & 0xF0000ULL) >> 16);
-    charKey[12] = (char)((number & 0xF000ULL) >> 12);
-    charKey[13] = (char)((number & 0xF00ULL) >> 8);
-    charKey[14] = (char)((number & 0xF0ULL) >> 4);
-    charKey[15] = (char)(number & 0xFULL);
+    // Printable nibbles, a zero nibble would terminate the key
+    for(i = 0; i < 16; i++) charKey[i] = (char)('A' + ((number >> (60 - i * 4)) & 0xF));
+
     charKey[16] = 0;
 
     return charKey;
@@ -74,10 +81,19 @@ FORCE_INLINE char* int64_to_string(uint64_t number)
 
 void* find_in_cache_uint64(struct CacheHeader* cache, uint64_t key)
 {
-    return find_in_cache(cache, int64_to_string(key));
+    char* charKey = int64_to_string(key);
+    void* value   = find_in_cache(cache, charKey);
+
+    free(charKey);
+
+    return value;
 }
 
 void add_to_cache_uint64(struct CacheHeader* cache, uint64_t key, void* value)
 {
-    return add_to_cache(cache, int64_to_string(key), value);
-}
\ No newline at end of file
+    char* charKey = int64_to_string(key);
+
+    add_to_cache(cache, charKey, value);
+
+    free(charKey);
+}
@@ -18,11 +18,46 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include <aaruformat.h>
 
+#include "../3rdparty/lzma-21.03beta/C/Alloc.h"
+#include "../3rdparty/lzma-21.03beta/C/Lzma2Dec.h"
+#include "../3rdparty/lzma-21.03beta/C/Lzma2Enc.h"
+#include "../3rdparty/lzma-21.03beta/C/LzmaDec.h"
 #include "../3rdparty/lzma-21.03beta/C/LzmaLib.h"
 
+/* A decoder kept across blocks. LZMA decoding into a buffer only allocates the probability tables, so the allocator
+ * keeps a single arena, sized for the biggest lc + lp seen, and never frees it until the decoder is freed. */
+typedef struct
+{
+    ISzAlloc alloc;
+    void*    arena;
+    size_t   arenaSize;
+    CLzmaDec decoder;
+} lzma_decoder_ctx;
+
+static void* lzma_arena_alloc(ISzAllocPtr p, size_t size)
+{
+    lzma_decoder_ctx* ctx = (lzma_decoder_ctx*)p;
+
+    if(size <= ctx->arenaSize) return ctx->arena;
+
+    free(ctx->arena);
+    ctx->arena     = malloc(size);
+    ctx->arenaSize = ctx->arena == NULL ? 0 : size;
+
+    return ctx->arena;
+}
+
+static void lzma_arena_free(ISzAllocPtr p, void* address)
+{
+    // Kept for the next block, released by aaruf_lzma_decoder_free()
+    (void)p;
+    (void)address;
+}
+
 AARU_EXPORT int32_t AARU_CALL aaruf_lzma_decode_buffer(uint8_t*       dst_buffer,
                                                        size_t*        dst_size,
                                                        const uint8_t* src_buffer,
@@ -50,3 +85,214 @@ AARU_EXPORT int32_t AARU_CALL aaruf_lzma_encode_buffer(uint8_t*       dst_buffer
     return LzmaCompress(
         dst_buffer, dst_size, src_buffer, srcLen, outProps, outPropsSize, level, dictSize, lc, lp, pb, fb, numThreads);
 }
+
+// LZMA2 splits the data in blocks, compressed in parallel by up to numThreads threads. LZMA2 properties are a single byte.
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma2_encode_buffer(uint8_t*       dst_buffer,
+                                                        size_t*        dst_size,
+                                                        const uint8_t* src_buffer,
+                                                        size_t         srcLen,
+                                                        uint8_t*       outProp,
+                                                        int32_t        level,
+                                                        uint32_t       dictSize,
+                                                        int32_t        lc,
+                                                        int32_t        lp,
+                                                        int32_t        pb,
+                                                        int32_t        fb,
+                                                        int32_t        numThreads)
+{
+    CLzma2EncHandle encoder;
+    CLzma2EncProps  props;
+    SRes            res;
+
+    encoder = Lzma2Enc_Create(&g_Alloc, &g_BigAlloc);
+
+    if(encoder == NULL) return SZ_ERROR_MEM;
+
+    Lzma2EncProps_Init(&props);
+    props.lzmaProps.level      = level;
+    props.lzmaProps.dictSize   = dictSize;
+    props.lzmaProps.lc         = lc;
+    props.lzmaProps.lp         = lp;
+    props.lzmaProps.pb         = pb;
+    props.lzmaProps.fb         = fb;
+    props.lzmaProps.reduceSize = srcLen;
+    props.numTotalThreads      = numThreads;
+
+    res = Lzma2Enc_SetProps(encoder, &props);
+
+    if(res == SZ_OK)
+    {
+        Lzma2Enc_SetDataSize(encoder, srcLen);
+        *outProp = Lzma2Enc_WriteProperties(encoder);
+
+        res = Lzma2Enc_Encode2(encoder, NULL, dst_buffer, dst_size, NULL, src_buffer, srcLen, NULL);
+    }
+
+    Lzma2Enc_Destroy(encoder);
+
+    return res;
+}
+
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma2_decode_buffer(uint8_t*       dst_buffer,
+                                                        size_t*        dst_size,
+                                                        const uint8_t* src_buffer,
+                                                        size_t*        srcLen,
+                                                        uint8_t        prop)
+{
+    ELzmaStatus status;
+
+    return Lzma2Decode(dst_buffer, dst_size, src_buffer, srcLen, prop, LZMA_FINISH_ANY, &status, &g_Alloc);
+}
+
+AARU_EXPORT void* AARU_CALL aaruf_lzma_decoder_init(void)
+{
+    lzma_decoder_ctx* ctx = (lzma_decoder_ctx*)malloc(sizeof(lzma_decoder_ctx));
+
+    if(ctx == NULL) return NULL;
+
+    ctx->alloc.Alloc = lzma_arena_alloc;
+    ctx->alloc.Free  = lzma_arena_free;
+    ctx->arena       = NULL;
+    ctx->arenaSize   = 0;
+    LzmaDec_Construct(&ctx->decoder);
+
+    return ctx;
+}
+
+// Same as aaruf_lzma_decode_buffer() but reusing the decoder state. A decoder must not be shared between threads.
+AARU_EXPORT int32_t AARU_CALL aaruf_lzma_decoder_decode(void*          decoder,
+                                                        uint8_t*       dst_buffer,
+                                                        size_t*        dst_size,
+                                                        const uint8_t* src_buffer,
+                                                        size_t*        srcLen,
+                                                        const uint8_t* props,
+                                                        size_t         propsSize)
+{
+    lzma_decoder_ctx* ctx = decoder;
+    ELzmaStatus       status;
+    SRes              res;
+    SizeT             outSize = *dst_size;
+    SizeT             inSize  = *srcLen;
+
+    if(ctx == NULL) return aaruf_lzma_decode_buffer(dst_buffer, dst_size, src_buffer, srcLen, props, propsSize);
+
+    *dst_size = 0;
+    *srcLen   = 0;
+
+    // Range coder initialization needs 5 bytes
+    if(inSize < 5) return SZ_ERROR_INPUT_EOF;
+
+    res = LzmaDec_AllocateProbs(&ctx->decoder, props, (unsigned)propsSize, &ctx->alloc);
+
+    if(res != SZ_OK) return res;
+
+    ctx->decoder.dic        = dst_buffer;
+    ctx->decoder.dicBufSize = outSize;
+    LzmaDec_Init(&ctx->decoder);
+
+    *srcLen = inSize;
+    res     = LzmaDec_DecodeToDic(&ctx->decoder, outSize, src_buffer, srcLen, LZMA_FINISH_ANY, &status);
+
+    *dst_size = ctx->decoder.dicPos;
+
+    if(res == SZ_OK && status == LZMA_STATUS_NEEDS_MORE_INPUT) res = SZ_ERROR_INPUT_EOF;
+
+    // The output buffer belongs to the caller
+    ctx->decoder.dic        = NULL;
+    ctx->decoder.dicBufSize = 0;
+
+    return res;
+}
+
+AARU_EXPORT void AARU_CALL aaruf_lzma_decoder_free(void* decoder)
+{
+    lzma_decoder_ctx* ctx = decoder;
+
+    if(ctx == NULL) return;
+
+    free(ctx->arena);
+    free(ctx);
+}
+
+// Decodes srcLen bytes of LZMA data read from src, writing the dstLen decoded bytes to dst, without holding either
+// whole buffer in memory. Memory used is the dictionary plus two fixed size buffers.
+AARU_LOCAL int32_t AARU_CALL aaruf_lzma_decode_stream(FILE*          src,
+                                                      uint64_t       srcLen,
+                                                      const uint8_t* props,
+                                                      size_t         propsSize,
+                                                      FILE*          dst,
+                                                      uint64_t       dstLen)
+{
+    CLzmaDec    decoder;
+    ELzmaStatus status;
+    SRes        res;
+    uint8_t*    inBuf;
+    uint8_t*    outBuf;
+    size_t      inPos  = 0;
+    size_t      inSize = 0;
+    SizeT       inProcessed;
+    SizeT       outProcessed;
+
+    LzmaDec_Construct(&decoder);
+    res = LzmaDec_Allocate(&decoder, props, (unsigned)propsSize, &g_Alloc);
+
+    if(res != SZ_OK) return res;
+
+    inBuf  = malloc(LZMA_STREAM_BUFFER_SIZE);
+    outBuf = malloc(LZMA_STREAM_BUFFER_SIZE);
+
+    if(inBuf == NULL || outBuf == NULL)
+    {
+        free(inBuf);
+        free(outBuf);
+        LzmaDec_Free(&decoder, &g_Alloc);
+        return SZ_ERROR_MEM;
+    }
+
+    LzmaDec_Init(&decoder);
+
+    while(dstLen > 0)
+    {
+        if(inPos == inSize && srcLen > 0)
+        {
+            inSize = srcLen < LZMA_STREAM_BUFFER_SIZE ? (size_t)srcLen : LZMA_STREAM_BUFFER_SIZE;
+            inPos  = 0;
+
+            if(fread(inBuf, 1, inSize, src) != inSize)
+            {
+                res = SZ_ERROR_READ;
+                break;
+            }
+
+            srcLen -= inSize;
+        }
+
+        inProcessed  = inSize - inPos;
+        outProcessed = dstLen < LZMA_STREAM_BUFFER_SIZE ? (size_t)dstLen : LZMA_STREAM_BUFFER_SIZE;
+
+        res = LzmaDec_DecodeToBuf(&decoder, outBuf, &outProcessed, inBuf + inPos, &inProcessed, LZMA_FINISH_ANY, &status);
+
+        if(res != SZ_OK) break;
+
+        inPos += inProcessed;
+        dstLen -= outProcessed;
+
+        if(outProcessed > 0 && fwrite(outBuf, 1, outProcessed, dst) != outProcessed)
+        {
+            res = SZ_ERROR_WRITE;
+            break;
+        }
+
+        if(dstLen > 0 && inProcessed == 0 && outProcessed == 0)
+        {
+            res = SZ_ERROR_INPUT_EOF;
+            break;
+        }
+    }
+
+    free(inBuf);
+    free(outBuf);
+    LzmaDec_Free(&decoder, &g_Alloc);
+
+    return res;
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <aaruformat.h>
+
+static uint64_t map_file_size(FILE* file)
+{
+#if defined(_WIN32)
+    struct __stat64 fileStat;
+
+    if(_fstat64(_fileno(file), &fileStat) != 0) return 0;
+#else
+    struct stat fileStat;
+
+    if(fstat(fileno(file), &fileStat) != 0) return 0;
+#endif
+
+    return (uint64_t)fileStat.st_size;
+}
+
+// Maps length bytes of the file starting at offset, read-only. Offsets do not need any alignment, the mapping starts at
+// the previous page boundary and the returned pointer is adjusted accordingly.
+void* aaruf_map_file(FILE* file, uint64_t offset, size_t length, MappedFile* mapping)
+{
+    uint64_t alignedOffset;
+    size_t   delta;
+
+    memset(mapping, 0, sizeof(MappedFile));
+
+    if(file == NULL || length == 0) return NULL;
+
+    // Reading a mapping past the end of the file faults instead of failing
+    if(offset + length < offset || offset + length > map_file_size(file)) return NULL;
+
+#if defined(_WIN32)
+    SYSTEM_INFO systemInfo;
+    HANDLE      fileMapping;
+    void*       view;
+
+    GetSystemInfo(&systemInfo);
+    alignedOffset = offset - offset % systemInfo.dwAllocationGranularity;
+    delta         = (size_t)(offset - alignedOffset);
+
+    fileMapping = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(file)), NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if(fileMapping == NULL) return NULL;
+
+    view = MapViewOfFile(
+        fileMapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), length + delta);
+
+    if(view == NULL)
+    {
+        CloseHandle(fileMapping);
+        return NULL;
+    }
+
+    mapping->address = view;
+    mapping->handle  = fileMapping;
+#else
+    long  pageSize = sysconf(_SC_PAGESIZE);
+    void* view;
+
+    if(pageSize <= 0) pageSize = 4096;
+
+    alignedOffset = offset - offset % (uint64_t)pageSize;
+    delta         = (size_t)(offset - alignedOffset);
+
+    view = mmap(NULL, length + delta, PROT_READ, MAP_SHARED, fileno(file), (off_t)alignedOffset);
+
+    if(view == MAP_FAILED) return NULL;
+
+    mapping->address = view;
+#endif
+
+    mapping->length = length + delta;
+
+    return (uint8_t*)mapping->address + delta;
+}
+
+void aaruf_unmap_file(MappedFile* mapping)
+{
+    if(mapping->address == NULL) return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(mapping->address);
+    CloseHandle(mapping->handle);
+#else
+    munmap(mapping->address, mapping->length);
+#endif
+
+    memset(mapping, 0, sizeof(MappedFile));
+}
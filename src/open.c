@@ -22,20 +22,127 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef __linux__
-#include <sys/mman.h>
-#endif
-
 #include <aaruformat.h>
 
-void* aaruf_open(const char* filepath)
+static int compare_media_tag_type(const void* a, const void* b)
+{
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Reads the index the header points to
+static int32_t read_index(aaruformatContext* ctx, IndexHeader* idxHeader, IndexEntry** idxEntries)
+{
+    size_t readBytes;
+
+    if(fseek(ctx->imageStream, ctx->header.indexOffset, SEEK_SET) != 0 ||
+       ftell(ctx->imageStream) != ctx->header.indexOffset)
+        return AARUF_ERROR_CANNOT_READ_INDEX;
+
+    readBytes = fread(idxHeader, 1, sizeof(IndexHeader), ctx->imageStream);
+
+    if(readBytes != sizeof(IndexHeader) || idxHeader->identifier != IndexBlock) return AARUF_ERROR_CANNOT_READ_INDEX;
+
+    fprintf(stderr,
+            "libaaruformat: Index at %" PRIu64 " contains %d entries\n",
+            ctx->header.indexOffset,
+            idxHeader->entries);
+
+    *idxEntries = (IndexEntry*)malloc(sizeof(IndexEntry) * idxHeader->entries);
+
+    if(*idxEntries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    memset(*idxEntries, 0, sizeof(IndexEntry) * idxHeader->entries);
+    readBytes = fread(*idxEntries, sizeof(IndexEntry), idxHeader->entries, ctx->imageStream);
+
+    if(readBytes != idxHeader->entries)
+    {
+        free(*idxEntries);
+        return AARUF_ERROR_CANNOT_READ_INDEX;
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Decodes a DDT compressed with LZ4 the same way as data blocks, NULL if it cannot be read or its CRC64 does not match
+static void* open_lz4_ddt(aaruformatContext* ctx, const DdtHeader* ddtHeader)
+{
+    BlockHeader blockHeader;
+    uint8_t*    cmpData;
+    uint8_t*    ddt;
+    uint64_t    crc64;
+    int32_t     errorNo;
+
+    if(ddtHeader->cmpLength > UINT32_MAX || ddtHeader->length > UINT32_MAX)
+    {
+        fprintf(stderr, "libaaruformat: Deduplication table is too big, continuing...\n");
+        return NULL;
+    }
+
+    memset(&blockHeader, 0, sizeof(BlockHeader));
+    blockHeader.compression = Lz4;
+    blockHeader.cmpLength   = (uint32_t)ddtHeader->cmpLength;
+    blockHeader.length      = (uint32_t)ddtHeader->length;
+
+    cmpData = (uint8_t*)malloc(blockHeader.cmpLength);
+    ddt     = (uint8_t*)malloc(blockHeader.length);
+
+    if(cmpData == NULL || ddt == NULL)
+    {
+        fprintf(stderr, "Cannot allocate memory for DDT, continuing...\n");
+        free(cmpData);
+        free(ddt);
+        return NULL;
+    }
+
+    if(fread(cmpData, 1, blockHeader.cmpLength, ctx->imageStream) != blockHeader.cmpLength)
+        errorNo = AARUF_ERROR_CANNOT_READ_BLOCK;
+    else
+        errorNo = aaruf_decode_block(&blockHeader, cmpData, ctx->lzmaDecoder, ddt);
+
+    free(cmpData);
+
+    if(errorNo == AARUF_STATUS_OK)
+    {
+        crc64 = aaruf_crc64_data(ddt, blockHeader.length);
+
+        if(ctx->header.imageMajorVersion <= AARUF_VERSION) crc64 = bswap_64(crc64);
+
+        if(crc64 != ddtHeader->crc64) errorNo = AARUF_ERROR_INVALID_BLOCK_CRC;
+    }
+
+    if(errorNo != AARUF_STATUS_OK)
+    {
+        fprintf(stderr, "libaaruformat: Could not decode deduplication table, error %d, continuing...\n", errorNo);
+        free(ddt);
+        return NULL;
+    }
+
+    return ddt;
+}
+
+// Frees a CD prefix or suffix DDT, mapped or read into memory
+static void open_drop_cd_ddt(uint32_t** ddt, MappedFile* mapping)
+{
+    if(mapping->address != NULL) aaruf_unmap_file(mapping);
+    else
+        free(*ddt);
+
+    *ddt = NULL;
+}
+
+// Opens an image from its index, or from the blocks found scanning it when recovering. The depth in the chain of
+// parents is known before the image opens its own parent, so a chain that loops stops at PARENT_MAX_DEPTH.
+static void* open_image(const char* filepath, uint32_t snapshot, bool recover, uint8_t parentDepth)
 {
     aaruformatContext* ctx;
     int                errorNo;
     size_t             readBytes;
     long               pos;
     IndexHeader        idxHeader;
-    IndexEntry*        idxEntries;
+    IndexEntry*        idxEntries = NULL;
     uint8_t*           data;
     uint8_t*           cmpData;
     uint8_t*           cstData;
@@ -51,7 +158,6 @@ void* aaruf_open(const char* filepath)
     mediaTagEntry*     oldMediaTag;
 
     ctx = (aaruformatContext*)malloc(sizeof(aaruformatContext));
-    memset(ctx, 0, sizeof(aaruformatContext));
 
     if(ctx == NULL)
     {
@@ -59,6 +165,10 @@ void* aaruf_open(const char* filepath)
         return NULL;
     }
 
+    memset(ctx, 0, sizeof(aaruformatContext));
+
+    ctx->parentDepth = parentDepth;
+
     ctx->imageStream = fopen(filepath, "rb");
 
     if(ctx->imageStream == NULL)
@@ -70,31 +180,30 @@ void* aaruf_open(const char* filepath)
         return NULL;
     }
 
+    // Parents are found relative to it
+    ctx->imagePath = malloc(strlen(filepath) + 1);
+
+    if(ctx->imagePath != NULL) strcpy(ctx->imagePath, filepath);
+
     fseek(ctx->imageStream, 0, SEEK_SET);
     readBytes = fread(&ctx->header, 1, sizeof(AaruHeader), ctx->imageStream);
 
     if(readBytes != sizeof(AaruHeader))
     {
-        free(ctx);
-        errno = AARUF_ERROR_FILE_TOO_SMALL;
-
-        return NULL;
+        errorNo = AARUF_ERROR_FILE_TOO_SMALL;
+        goto fail;
     }
 
     if(ctx->header.identifier != DIC_MAGIC && ctx->header.identifier != AARU_MAGIC)
     {
-        free(ctx);
-        errno = AARUF_ERROR_NOT_AARUFORMAT;
-
-        return NULL;
+        errorNo = AARUF_ERROR_NOT_AARUFORMAT;
+        goto fail;
     }
 
     if(ctx->header.imageMajorVersion > AARUF_VERSION)
     {
-        free(ctx);
-        errno = AARUF_ERROR_INCOMPATIBLE_VERSION;
-
-        return NULL;
+        errorNo = AARUF_ERROR_INCOMPATIBLE_VERSION;
+        goto fail;
     }
 
     fprintf(stderr,
@@ -102,14 +211,23 @@ void* aaruf_open(const char* filepath)
             ctx->header.imageMajorVersion,
             ctx->header.imageMinorVersion);
 
+    // Older snapshots are found from the index of the latest one
+    if(snapshot != SNAPSHOT_LATEST)
+    {
+        errorNo = aaruf_snapshot_find(ctx, snapshot);
+
+        if(errorNo != AARUF_STATUS_OK) goto fail;
+    }
+
+    // Reused by every LZMA block, if it cannot be allocated decoding falls back to one-shot decoding
+    ctx->lzmaDecoder = aaruf_lzma_decoder_init();
+
     ctx->readableSectorTags = (bool*)malloc(sizeof(bool) * MaxSectorTag);
 
     if(ctx->readableSectorTags == NULL)
     {
-        free(ctx);
-        errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
-
-        return NULL;
+        errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        goto fail;
     }
 
     memset(ctx->readableSectorTags, 0, sizeof(bool) * MaxSectorTag);
@@ -132,61 +250,15 @@ void* aaruf_open(const char* filepath)
     }
     ctx->imageInfo.MediaType = ctx->header.mediaType;
 
-    // Read the index header
-    pos = fseek(ctx->imageStream, ctx->header.indexOffset, SEEK_SET);
-    if(pos < 0)
-    {
-        free(ctx);
-        errno = AARUF_ERROR_CANNOT_READ_INDEX;
-
-        return NULL;
-    }
-
-    pos = ftell(ctx->imageStream);
-    if(pos != ctx->header.indexOffset)
-    {
-        free(ctx);
-        errno = AARUF_ERROR_CANNOT_READ_INDEX;
-
-        return NULL;
-    }
-
-    readBytes = fread(&idxHeader, 1, sizeof(IndexHeader), ctx->imageStream);
-
-    if(readBytes != sizeof(IndexHeader) || idxHeader.identifier != IndexBlock)
-    {
-        free(ctx);
-        errno = AARUF_ERROR_CANNOT_READ_INDEX;
-
-        return NULL;
-    }
-
-    fprintf(stderr,
-            "libaaruformat: Index at %" PRIu64 " contains %d entries\n",
-            ctx->header.indexOffset,
-            idxHeader.entries);
-
-    idxEntries = (IndexEntry*)malloc(sizeof(IndexEntry) * idxHeader.entries);
-
-    if(idxEntries == NULL)
-    {
-        errorNo = errno;
-        free(ctx);
-        errno = errorNo;
-
-        return NULL;
-    }
-
-    memset(idxEntries, 0, sizeof(IndexEntry) * idxHeader.entries);
-    readBytes = fread(idxEntries, sizeof(IndexEntry), idxHeader.entries, ctx->imageStream);
+    if(recover) errorNo = aaruf_recover_index(ctx, &idxEntries, &idxHeader.entries);
+    else
+        errorNo = read_index(ctx, &idxHeader, &idxEntries);
 
-    if(readBytes != idxHeader.entries)
+    if(errorNo != AARUF_STATUS_OK)
     {
-        free(idxEntries);
-        free(ctx);
-        errno = AARUF_ERROR_CANNOT_READ_INDEX;
-
-        return NULL;
+        // Freed already
+        idxEntries = NULL;
+        goto fail;
     }
 
     for(i = 0; i < idxHeader.entries; i++)
@@ -198,8 +270,11 @@ void* aaruf_open(const char* filepath)
                 idxEntries[i].offset);
     }
 
-    bool foundUserDataDdt    = false;
-    ctx->imageInfo.ImageSize = 0;
+    bool     foundUserDataDdt = false;
+    uint64_t tapeFileOffset   = 0;
+    uint64_t prefixDdtEntries = 0;
+    uint64_t suffixDdtEntries = 0;
+    ctx->imageInfo.ImageSize  = 0;
     for(i = 0; i < idxHeader.entries; i++)
     {
         pos = fseek(ctx->imageStream, idxEntries[i].offset, SEEK_SET);
@@ -316,18 +391,21 @@ void* aaruf_open(const char* filepath)
                     }
 
                     readBytes = blockHeader.length;
-                    errorNo   = aaruf_lzma_decode_buffer(
-                        data, &readBytes, cmpData, &lzmaSize, lzmaProperties, LZMA_PROPERTIES_LENGTH);
+                    errorNo   = aaruf_lzma_decoder_decode(ctx->lzmaDecoder,
+                                                        data,
+                                                        &readBytes,
+                                                        cmpData,
+                                                        &lzmaSize,
+                                                        lzmaProperties,
+                                                        LZMA_PROPERTIES_LENGTH);
 
                     if(errorNo != 0)
                     {
                         fprintf(stderr, "Got error %d from LZMA, continuing...\n", errorNo);
                         free(cmpData);
                         free(data);
-                        errno = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                        // TODO: Clean-up all memory!!!
-                        return NULL;
+                        errorNo = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                        goto fail;
                     }
 
                     if(readBytes != blockHeader.length)
@@ -336,10 +414,8 @@ void* aaruf_open(const char* filepath)
                                 "Error decompressing block, should be {0} bytes but got {1} bytes., continuing...\n");
                         free(cmpData);
                         free(data);
-                        errno = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                        // TODO: Clean-up all memory!!!
-                        return NULL;
+                        errorNo = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                        goto fail;
                     }
 
                     if(blockHeader.compression == LzmaClauniaSubchannelTransform)
@@ -361,6 +437,42 @@ void* aaruf_open(const char* filepath)
 
                     free(cmpData);
                 }
+                else if(blockHeader.compression == Lz4)
+                {
+                    cmpData = (uint8_t*)malloc(blockHeader.cmpLength);
+                    if(cmpData == NULL)
+                    {
+                        fprintf(stderr, "Cannot allocate memory for block, continuing...\n");
+                        break;
+                    }
+
+                    data = (uint8_t*)malloc(blockHeader.length);
+                    if(data == NULL)
+                    {
+                        fprintf(stderr, "Cannot allocate memory for block, continuing...\n");
+                        free(cmpData);
+                        break;
+                    }
+
+                    readBytes = fread(cmpData, 1, blockHeader.cmpLength, ctx->imageStream);
+                    if(readBytes != blockHeader.cmpLength)
+                    {
+                        fprintf(stderr, "Could not read compressed block, continuing...\n");
+                        free(cmpData);
+                        free(data);
+                        break;
+                    }
+
+                    errorNo = aaruf_decode_block(&blockHeader, cmpData, ctx->lzmaDecoder, data);
+                    free(cmpData);
+
+                    if(errorNo != AARUF_STATUS_OK)
+                    {
+                        fprintf(stderr, "Got error %d from LZ4, continuing...\n", errorNo);
+                        free(data);
+                        break;
+                    }
+                }
                 else if(blockHeader.compression == None)
                 {
                     data = (uint8_t*)malloc(blockHeader.length);
@@ -431,8 +543,8 @@ void* aaruf_open(const char* filepath)
                         ctx->readableSectorTags[CdSectorEdc]       = true;
                         break;
                     case CdSectorSubchannel:
-                        ctx->sectorSubchannel                       = data;
-                        ctx->readableSectorTags[CdSectorSubchannel] = true;
+                        ctx->sectorSubchannel                           = data;
+                        ctx->readableSectorTags[CdSectorSubchannelAaru] = true;
                         break;
                     case AppleProfileTag:
                     case AppleSonyTag:
@@ -440,7 +552,10 @@ void* aaruf_open(const char* filepath)
                         ctx->sectorSubchannel                   = data;
                         ctx->readableSectorTags[AppleSectorTag] = true;
                         break;
-                    case CompactDiscMode2Subheader: ctx->mode2Subheaders = data; break;
+                    case CompactDiscMode2Subheader:
+                        ctx->mode2Subheaders                       = data;
+                        ctx->readableSectorTags[CdSectorSubHeader] = true;
+                        break;
                     default:
                         mediaTag = (mediaTagEntry*)malloc(sizeof(mediaTagEntry));
 
@@ -496,6 +611,54 @@ void* aaruf_open(const char* filepath)
                         case Lzma:
                             lzmaSize = ddtHeader.cmpLength - LZMA_PROPERTIES_LENGTH;
 
+                            // Too big to keep in memory, decode it to a temporary file and page it from there
+                            if(ddtHeader.length > MAX_RESIDENT_DDT_SIZE)
+                            {
+                                foundUserDataDdt = false;
+
+                                readBytes = fread(lzmaProperties, 1, LZMA_PROPERTIES_LENGTH, ctx->imageStream);
+                                if(readBytes != LZMA_PROPERTIES_LENGTH)
+                                {
+                                    fprintf(stderr, "Could not read LZMA properties, continuing...\n");
+                                    break;
+                                }
+
+                                FILE* spill = tmpfile();
+                                if(spill == NULL)
+                                {
+                                    fprintf(stderr, "Cannot create temporary file for DDT, continuing...\n");
+                                    break;
+                                }
+
+                                errorNo = aaruf_lzma_decode_stream(ctx->imageStream,
+                                                                   lzmaSize,
+                                                                   lzmaProperties,
+                                                                   LZMA_PROPERTIES_LENGTH,
+                                                                   spill,
+                                                                   ddtHeader.length);
+
+                                if(errorNo != 0)
+                                {
+                                    fprintf(stderr, "Got error %d from LZMA, stopping...\n", errorNo);
+                                    fclose(spill);
+                                    errorNo = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                                    goto fail;
+                                }
+
+                                ctx->pagedDdt = aaruf_ddt_paged_init(spill, ddtHeader.entries);
+                                if(ctx->pagedDdt == NULL)
+                                {
+                                    fprintf(stderr, "Cannot allocate memory for DDT, continuing...\n");
+                                    fclose(spill);
+                                    break;
+                                }
+
+                                ctx->inMemoryDdt = true;
+                                foundUserDataDdt = true;
+
+                                break;
+                            }
+
                             cmpData = (uint8_t*)malloc(lzmaSize);
                             if(cmpData == NULL)
                             {
@@ -532,12 +695,13 @@ void* aaruf_open(const char* filepath)
                             }
 
                             readBytes = ddtHeader.length;
-                            errorNo   = aaruf_lzma_decode_buffer((uint8_t*)ctx->userDataDdt,
-                                                               &readBytes,
-                                                               cmpData,
-                                                               &lzmaSize,
-                                                               lzmaProperties,
-                                                               LZMA_PROPERTIES_LENGTH);
+                            errorNo   = aaruf_lzma_decoder_decode(ctx->lzmaDecoder,
+                                                                (uint8_t*)ctx->userDataDdt,
+                                                                &readBytes,
+                                                                cmpData,
+                                                                &lzmaSize,
+                                                                lzmaProperties,
+                                                                LZMA_PROPERTIES_LENGTH);
 
                             if(errorNo != 0)
                             {
@@ -545,10 +709,8 @@ void* aaruf_open(const char* filepath)
                                 free(cmpData);
                                 free(ctx->userDataDdt);
                                 ctx->userDataDdt = NULL;
-                                errno            = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                                // TODO: Clean-up all memory!!!
-                                return NULL;
+                                errorNo          = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                                goto fail;
                             }
 
                             if(readBytes != ddtHeader.length)
@@ -559,28 +721,44 @@ void* aaruf_open(const char* filepath)
                                 free(cmpData);
                                 free(ctx->userDataDdt);
                                 ctx->userDataDdt = NULL;
-                                errno            = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                                // TODO: Clean-up all memory!!!
-                                return NULL;
+                                errorNo          = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                                goto fail;
                             }
 
+                            free(cmpData);
+
                             ctx->inMemoryDdt = true;
                             foundUserDataDdt = true;
 
+                            break;
+                        case Lz4:
+                            ctx->userDataDdt = open_lz4_ddt(ctx, &ddtHeader);
+
+                            if(ctx->userDataDdt == NULL)
+                            {
+                                foundUserDataDdt = false;
+                                break;
+                            }
+
+                            ctx->inMemoryDdt = true;
+
                             break;
                             // TODO: Check CRC
                         case None:
-#ifdef __linux__
+                            if(ddtHeader.entries > SIZE_MAX / sizeof(uint64_t))
+                            {
+                                foundUserDataDdt = false;
+                                fprintf(stderr, "libaaruformat: Deduplication table is too big.\n");
+                                break;
+                            }
+
                             ctx->mappedMemoryDdtSize = sizeof(uint64_t) * ddtHeader.entries;
-                            ctx->userDataDdt         = mmap(NULL,
-                                                    ctx->mappedMemoryDdtSize,
-                                                    PROT_READ,
-                                                    MAP_SHARED,
-                                                    fileno(ctx->imageStream),
-                                                    idxEntries[i].offset + sizeof(ddtHeader));
-
-                            if(ctx->userDataDdt == MAP_FAILED)
+                            ctx->userDataDdt         = aaruf_map_file(ctx->imageStream,
+                                                              idxEntries[i].offset + sizeof(ddtHeader),
+                                                              ctx->mappedMemoryDdtSize,
+                                                              &ctx->userDataDdtMap);
+
+                            if(ctx->userDataDdt == NULL)
                             {
                                 foundUserDataDdt = false;
                                 fprintf(stderr, "libaaruformat: Could not read map deduplication table.\n");
@@ -589,11 +767,6 @@ void* aaruf_open(const char* filepath)
 
                             ctx->inMemoryDdt = false;
                             break;
-#else // TODO: Implement
-                            fprintf(stderr, "libaaruformat: Uncompressed DDT not yet implemented...\n");
-                            foundUserDataDdt = false;
-                            break;
-#endif
                         default:
                             fprintf(stderr,
                                     "libaaruformat: Found unknown compression type %d, continuing...\n",
@@ -605,6 +778,18 @@ void* aaruf_open(const char* filepath)
                 else if(idxEntries[i].dataType == CdSectorPrefixCorrected ||
                         idxEntries[i].dataType == CdSectorSuffixCorrected)
                 {
+                    if(ddtHeader.entries > SIZE_MAX / sizeof(uint32_t) ||
+                       ddtHeader.length != ddtHeader.entries * sizeof(uint32_t))
+                    {
+                        fprintf(stderr, "libaaruformat: Deduplication table has a wrong size, continuing...\n");
+                        break;
+                    }
+
+                    // Checked against the sectors once the user data DDT has been read
+                    if(idxEntries[i].dataType == CdSectorPrefixCorrected) prefixDdtEntries = ddtHeader.entries;
+                    else
+                        suffixDdtEntries = ddtHeader.entries;
+
                     switch(ddtHeader.compression)
                     {
                             // TODO: Check CRC
@@ -647,23 +832,21 @@ void* aaruf_open(const char* filepath)
                             }
 
                             readBytes = ddtHeader.length;
-                            errorNo   = aaruf_lzma_decode_buffer((uint8_t*)cdDdt,
-                                                               &readBytes,
-                                                               cmpData,
-                                                               &lzmaSize,
-                                                               lzmaProperties,
-                                                               LZMA_PROPERTIES_LENGTH);
+                            errorNo   = aaruf_lzma_decoder_decode(ctx->lzmaDecoder,
+                                                                (uint8_t*)cdDdt,
+                                                                &readBytes,
+                                                                cmpData,
+                                                                &lzmaSize,
+                                                                lzmaProperties,
+                                                                LZMA_PROPERTIES_LENGTH);
 
                             if(errorNo != 0)
                             {
                                 fprintf(stderr, "Got error %d from LZMA, stopping...\n", errorNo);
                                 free(cmpData);
                                 free(cdDdt);
-                                ctx->userDataDdt = NULL;
-                                errno            = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                                // TODO: Clean-up all memory!!!
-                                return NULL;
+                                errorNo = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                                goto fail;
                             }
 
                             if(readBytes != ddtHeader.length)
@@ -673,13 +856,12 @@ void* aaruf_open(const char* filepath)
                                     "Error decompressing block, should be {0} bytes but got {1} bytes., stopping...\n");
                                 free(cmpData);
                                 free(cdDdt);
-                                ctx->userDataDdt = NULL;
-                                errno            = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-
-                                // TODO: Clean-up all memory!!!
-                                return NULL;
+                                errorNo = AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+                                goto fail;
                             }
 
+                            free(cmpData);
+
                             if(idxEntries[i].dataType == CdSectorPrefixCorrected) ctx->sectorPrefixDdt = cdDdt;
                             else if(idxEntries[i].dataType == CdSectorSuffixCorrected)
                                 ctx->sectorSuffixDdt = cdDdt;
@@ -688,30 +870,37 @@ void* aaruf_open(const char* filepath)
 
                             break;
 
-                            // TODO: Check CRC
-                        case None:
-                            cdDdt = (uint32_t*)malloc(ddtHeader.entries * sizeof(uint32_t));
+                        case Lz4:
+                            cdDdt = open_lz4_ddt(ctx, &ddtHeader);
 
-                            if(mediaTag == NULL)
-                            {
-                                fprintf(stderr, "libaaruformat: Cannot allocate memory for deduplication table.\n");
-                                break;
-                            }
+                            if(cdDdt == NULL) break;
+
+                            if(idxEntries[i].dataType == CdSectorPrefixCorrected) ctx->sectorPrefixDdt = cdDdt;
+                            else if(idxEntries[i].dataType == CdSectorSuffixCorrected)
+                                ctx->sectorSuffixDdt = cdDdt;
+                            else
+                                free(cdDdt);
 
-                            readBytes = fread(cdDdt, 1, ddtHeader.entries * sizeof(uint32_t), ctx->imageStream);
+                            break;
 
-                            if(readBytes != ddtHeader.entries * sizeof(uint32_t))
+                            // TODO: Check CRC
+                        case None:
+                            cdDdt = aaruf_map_file(ctx->imageStream,
+                                                   idxEntries[i].offset + sizeof(ddtHeader),
+                                                   ddtHeader.entries * sizeof(uint32_t),
+                                                   idxEntries[i].dataType == CdSectorPrefixCorrected
+                                                       ? &ctx->sectorPrefixDdtMap
+                                                       : &ctx->sectorSuffixDdtMap);
+
+                            if(cdDdt == NULL)
                             {
-                                free(cdDdt);
-                                fprintf(stderr, "libaaruformat: Could not read deduplication table, continuing...\n");
+                                fprintf(stderr, "libaaruformat: Could not map deduplication table, continuing...\n");
                                 break;
                             }
 
                             if(idxEntries[i].dataType == CdSectorPrefixCorrected) ctx->sectorPrefixDdt = cdDdt;
-                            else if(idxEntries[i].dataType == CdSectorSuffixCorrected)
-                                ctx->sectorSuffixDdt = cdDdt;
                             else
-                                free(cdDdt);
+                                ctx->sectorSuffixDdt = cdDdt;
 
                             break;
                         default:
@@ -720,6 +909,22 @@ void* aaruf_open(const char* filepath)
                                     blockHeader.compression);
                             break;
                     }
+
+                    // Images where every prefix or suffix could be rebuilt have no block of corrected ones
+                    if(ctx->sectorPrefixDdt != NULL)
+                    {
+                        ctx->readableSectorTags[CdSectorSync]   = true;
+                        ctx->readableSectorTags[CdSectorHeader] = true;
+                    }
+
+                    if(ctx->sectorSuffixDdt != NULL)
+                    {
+                        ctx->readableSectorTags[CdSectorSubHeader] = true;
+                        ctx->readableSectorTags[CdSectorEcc]       = true;
+                        ctx->readableSectorTags[CdSectorEccP]      = true;
+                        ctx->readableSectorTags[CdSectorEccQ]      = true;
+                        ctx->readableSectorTags[CdSectorEdc]       = true;
+                    }
                 }
                 break;
                 // Logical geometry block. It doesn't have a CRC coz, well, it's not so important
@@ -1045,6 +1250,9 @@ void* aaruf_open(const char* filepath)
                         memcpy(&ctx->dataTracks[k++], &ctx->trackEntries[j], sizeof(TrackEntry));
                 }
 
+                if(aaruf_build_track_lookup(ctx) != AARUF_STATUS_OK)
+                    fprintf(stderr, "libaaruformat: Could not allocate memory for track lookup, continuing...\n");
+
                 break;
                 // CICM XML metadata block
             case CicmBlock:
@@ -1473,6 +1681,54 @@ void* aaruf_open(const char* filepath)
                 free(data);
 
                 break;
+            case ParentBlock:
+                readBytes = fread(&ctx->parentBlockHeader, 1, sizeof(ParentBlockHeader), ctx->imageStream);
+
+                if(readBytes != sizeof(ParentBlockHeader) || ctx->parentBlockHeader.identifier != ParentBlock)
+                {
+                    memset(&ctx->parentBlockHeader, 0, sizeof(ParentBlockHeader));
+                    fprintf(stderr, "libaaruformat: Could not read parent block header, continuing...\n");
+                    break;
+                }
+
+                ctx->parentPath = malloc(ctx->parentBlockHeader.length + 1);
+
+                if(ctx->parentPath == NULL)
+                {
+                    fprintf(stderr, "libaaruformat: Could not allocate memory for parent block, continuing...\n");
+                    break;
+                }
+
+                readBytes = fread(ctx->parentPath, 1, ctx->parentBlockHeader.length, ctx->imageStream);
+
+                crc64 = aaruf_crc64_data((const uint8_t*)ctx->parentPath, readBytes);
+
+                // Due to how C# wrote it, it is effectively reversed
+                if(ctx->header.imageMajorVersion <= AARUF_VERSION) crc64 = bswap_64(crc64);
+
+                if(readBytes != ctx->parentBlockHeader.length || crc64 != ctx->parentBlockHeader.crc64)
+                {
+                    free(ctx->parentPath);
+                    ctx->parentPath = NULL;
+                    fprintf(stderr, "libaaruformat: Could not read parent block, continuing...\n");
+                    break;
+                }
+
+                ctx->parentPath[ctx->parentBlockHeader.length] = 0;
+
+                fprintf(stderr, "libaaruformat: Found parent image %s.\n", ctx->parentPath);
+
+                break;
+            // Applied once the user data DDT has been read
+            case SnapshotBlock: break;
+            // Read the first time it is queried
+            case DataPositionMeasurementBlock: ctx->dpmOffset = idxEntries[i].offset; break;
+            // Checked against the sectors once the user data DDT has been read
+            case TapeFileBlock: tapeFileOffset = idxEntries[i].offset; break;
+            case TapePartitionBlock:
+                if(aaruf_tape_read_partitions(ctx, idxEntries[i].offset) != AARUF_STATUS_OK)
+                    fprintf(stderr, "libaaruformat: Could not read tape partition block, continuing...\n");
+                break;
             default:
                 fprintf(stderr,
                         "libaaruformat: Unhandled block type %4.4s with data type %d is indexed to be at %" PRIu64 "\n",
@@ -1483,15 +1739,38 @@ void* aaruf_open(const char* filepath)
         }
     }
 
-    free(idxEntries);
-
     if(!foundUserDataDdt)
     {
         fprintf(stderr, "libaaruformat: Could not find user data deduplication table, aborting...\n");
-        aaruf_close(ctx);
-        return NULL;
+        errorNo = AARUF_ERROR_CANNOT_READ_BLOCK;
+        goto fail;
+    }
+
+    // Read for every sector, so a table for another number of sectors is not used
+    if(ctx->sectorPrefixDdt != NULL && prefixDdtEntries != ctx->imageInfo.Sectors)
+    {
+        fprintf(stderr, "libaaruformat: Sector prefix deduplication table does not match the image, ignoring it.\n");
+        open_drop_cd_ddt(&ctx->sectorPrefixDdt, &ctx->sectorPrefixDdtMap);
+    }
+
+    if(ctx->sectorSuffixDdt != NULL && suffixDdtEntries != ctx->imageInfo.Sectors)
+    {
+        fprintf(stderr, "libaaruformat: Sector suffix deduplication table does not match the image, ignoring it.\n");
+        open_drop_cd_ddt(&ctx->sectorSuffixDdt, &ctx->sectorSuffixDdtMap);
     }
 
+    errorNo = aaruf_snapshot_apply(ctx, idxEntries, idxHeader.entries);
+
+    free(idxEntries);
+    idxEntries = NULL;
+
+    if(errorNo != AARUF_STATUS_OK) goto fail;
+
+    if(tapeFileOffset != 0 && aaruf_tape_read_files(ctx, tapeFileOffset) != AARUF_STATUS_OK)
+        fprintf(stderr, "libaaruformat: Could not read tape file block, continuing...\n");
+
+    aaruf_ddt_try_extents(ctx);
+
     ctx->imageInfo.CreationTime         = ctx->header.creationTime;
     ctx->imageInfo.LastModificationTime = ctx->header.lastWrittenTime;
     ctx->imageInfo.XmlMediaType         = aaruf_get_xml_mediatype(ctx->header.mediaType);
@@ -1503,14 +1782,33 @@ void* aaruf_open(const char* filepath)
         ctx->imageInfo.SectorsPerTrack = 63;
     }
 
+    // A child with every sector in its parent has no data block to take the sector size from
+    if(ctx->imageInfo.SectorSize == 0 && ctx->parentPath != NULL) aaruf_parent_open(ctx);
+
     // Initialize caches
-    ctx->blockHeaderCache.cache     = NULL;
-    ctx->blockHeaderCache.max_items = MAX_CACHE_SIZE / (ctx->imageInfo.SectorSize * (1 << ctx->shift));
+    ctx->blockHeaderCache.cache = NULL;
+    ctx->blockHeaderCache.max_items =
+        ctx->imageInfo.SectorSize == 0 ? 0 : MAX_CACHE_SIZE / (ctx->imageInfo.SectorSize * (1 << ctx->shift));
     ctx->blockCache.cache           = NULL;
     ctx->blockCache.max_items       = ctx->blockHeaderCache.max_items;
 
     // TODO: Cache tracks and sessions?
 
+    // Present media tags, so they can be enumerated without probing every type
+    ctx->mediaTagCount = HASH_COUNT(ctx->mediaTags);
+
+    if(ctx->mediaTagCount > 0) ctx->mediaTagTypes = (int32_t*)malloc(sizeof(int32_t) * ctx->mediaTagCount);
+
+    if(ctx->mediaTagTypes != NULL)
+    {
+        k = 0;
+        HASH_ITER(hh, ctx->mediaTags, mediaTag, oldMediaTag) ctx->mediaTagTypes[k++] = mediaTag->type;
+
+        qsort(ctx->mediaTagTypes, ctx->mediaTagCount, sizeof(int32_t), compare_media_tag_type);
+    }
+    else
+        ctx->mediaTagCount = 0;
+
     // Initialize ECC for Compact Disc
     ctx->eccCdContext = (CdEccContext*)aaruf_ecc_cd_init();
 
@@ -1519,4 +1817,47 @@ void* aaruf_open(const char* filepath)
     ctx->libraryMinorVersion = LIBAARUFORMAT_MINOR_VERSION;
 
     return ctx;
-}
\ No newline at end of file
+
+fail:
+    free(idxEntries);
+
+    // Closed as an opened image so the stream and everything read so far are freed
+    ctx->magic = AARU_MAGIC;
+    aaruf_close(ctx);
+
+    errno = errorNo;
+    return NULL;
+}
+
+/**
+ * Opens an image as it is after its latest snapshot
+ * @param filepath Path of the image
+ * @return Image context, or NULL with errno set
+ */
+void* aaruf_open(const char* filepath) { return aaruf_open_snapshot(filepath, SNAPSHOT_LATEST); }
+
+/**
+ * Opens an image as it was when a snapshot was taken
+ * @param filepath Path of the image
+ * @param snapshot Snapshot to open, 0 is the image as first written, SNAPSHOT_LATEST the latest one
+ * @return Image context, or NULL with errno set
+ */
+void* aaruf_open_snapshot(const char* filepath, uint32_t snapshot)
+{
+    return open_image(filepath, snapshot, false, 0);
+}
+
+/**
+ * Opens an image whose index is damaged or missing. The whole image is scanned for blocks instead, the ones whose
+ * CRC64 does not match are left out, and the index is rebuilt in memory from the rest. Opened as after its latest
+ * snapshot, how many blocks were found and how many were damaged is left in the context.
+ * @param filepath Path of the image
+ * @return Image context, or NULL with errno set
+ */
+void* aaruf_open_recover(const char* filepath) { return open_image(filepath, SNAPSHOT_LATEST, true, 0); }
+
+// Opens the parent of an image that is parentDepth images down the chain
+void* aaruf_open_parent(const char* filepath, uint8_t parentDepth)
+{
+    return open_image(filepath, SNAPSHOT_LATEST, false, parentDepth);
+}
@@ -0,0 +1,155 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Differential images. A child image only stores the sectors that differ from its parent, reading a sector never
+// written to the child falls through to the parent, and from there up the chain. Each parent is opened the first time
+// it is needed and kept open until the child is closed.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+/**
+ * Parent paths are relative to the directory of the child unless absolute
+ * @param childPath Path of the child image
+ * @param parentPath Path of the parent image as stored in the child
+ * @return Path to open the parent with, to be freed by the caller, or NULL if there is not enough memory
+ */
+char* aaruf_parent_resolve(const char* childPath, const char* parentPath)
+{
+    const char* separator = NULL;
+    const char* c;
+    size_t      directoryLength = 0;
+    size_t      parentLength    = strlen(parentPath);
+    char*       path;
+
+    if(parentPath[0] != '/' && parentPath[0] != '\\' && !(parentPath[0] != 0 && parentPath[1] == ':') &&
+       childPath != NULL)
+    {
+        for(c = childPath; *c != 0; c++)
+            if(*c == '/' || *c == '\\') separator = c;
+
+        if(separator != NULL) directoryLength = separator - childPath + 1;
+    }
+
+    path = malloc(directoryLength + parentLength + 1);
+
+    if(path == NULL) return NULL;
+
+    memcpy(path, childPath, directoryLength);
+    memcpy(path + directoryLength, parentPath, parentLength + 1);
+
+    return path;
+}
+
+// Opens the parent the first time it is needed, NULL if it cannot be used
+static aaruformatContext* parent_get(aaruformatContext* ctx)
+{
+    aaruformatContext* parent;
+    char*              path;
+
+    if(ctx->parent != NULL || ctx->parentFailed) return ctx->parent;
+
+    // Not tried again
+    ctx->parentFailed = true;
+
+    if(ctx->parentDepth >= PARENT_MAX_DEPTH)
+    {
+        fprintf(stderr,
+                "libaaruformat: Chain of parent images is deeper than %d images, not following it.\n",
+                PARENT_MAX_DEPTH);
+        return NULL;
+    }
+
+    path = aaruf_parent_resolve(ctx->imagePath, ctx->parentPath);
+
+    if(path == NULL) return NULL;
+
+    // Its own parent is opened with the depth already known
+    parent = aaruf_open_parent(path, ctx->parentDepth + 1);
+
+    if(parent == NULL)
+    {
+        fprintf(stderr, "libaaruformat: Could not open parent image %s.\n", path);
+        free(path);
+        return NULL;
+    }
+
+    if(parent->header.creationTime != ctx->parentBlockHeader.creationTime ||
+       parent->imageInfo.Sectors != ctx->parentBlockHeader.sectors ||
+       (ctx->imageInfo.SectorSize != 0 && parent->imageInfo.SectorSize != ctx->imageInfo.SectorSize))
+    {
+        fprintf(stderr, "libaaruformat: Parent image %s is not the one this image was created from.\n", path);
+        aaruf_close(parent);
+        free(path);
+        return NULL;
+    }
+
+    free(path);
+
+    // A child with every sector in its parent has no data block to take it from
+    if(ctx->imageInfo.SectorSize == 0) ctx->imageInfo.SectorSize = parent->imageInfo.SectorSize;
+
+    ctx->parent       = parent;
+    ctx->parentFailed = false;
+
+    return parent;
+}
+
+int32_t aaruf_parent_open(void* context)
+{
+    return parent_get(context) == NULL ? AARUF_ERROR_CANNOT_OPEN_PARENT : AARUF_STATUS_OK;
+}
+
+// Reads a sector never written to the child from its parent
+int32_t aaruf_parent_read_sector(void* context, uint64_t sectorAddress, uint8_t* data, uint32_t* length)
+{
+    aaruformatContext* ctx    = context;
+    aaruformatContext* parent = parent_get(ctx);
+
+    if(parent == NULL) return AARUF_ERROR_CANNOT_OPEN_PARENT;
+
+    // Past the end of the parent it was never dumped
+    if(sectorAddress >= parent->imageInfo.Sectors)
+    {
+        if(data != NULL && *length >= ctx->imageInfo.SectorSize) memset(data, 0, ctx->imageInfo.SectorSize);
+
+        *length = ctx->imageInfo.SectorSize;
+        return AARUF_STATUS_SECTOR_NOT_DUMPED;
+    }
+
+    return aaruf_read_sector(parent, sectorAddress, data, length);
+}
+
+void aaruf_parent_free(void* context)
+{
+    aaruformatContext* ctx = context;
+
+    if(ctx->parent != NULL) aaruf_close(ctx->parent);
+
+    free(ctx->parentPath);
+    free(ctx->imagePath);
+
+    ctx->parent     = NULL;
+    ctx->parentPath = NULL;
+    ctx->imagePath  = NULL;
+}
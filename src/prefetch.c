@@ -0,0 +1,354 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Background decoding of the blocks a sequential or strided reader is going to need next. The reader and the
+// prefetcher share the block caches, the DDT and the image stream under a lock, blocks are decoded outside of it.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#include "../3rdparty/lzma-21.03beta/C/Threads.h"
+
+typedef struct
+{
+    aaruformatContext* ctx;
+    CThread            thread;
+    CCriticalSection   lock;
+    CAutoResetEvent    wake;
+    uint32_t           depth;
+    bool               stop;
+    // Last request, protected by the lock
+    bool               pending;
+    uint64_t           requestSector;
+    int64_t            requestStride;
+    // Access pattern, only touched by the reader
+    uint64_t           lastSector;
+    int64_t            lastStride;
+    uint32_t           hits;
+    uint64_t           lastBlock;
+    // Only touched by the prefetcher thread
+    void*              lzmaDecoder;
+    uint8_t*           cmpBuffer;
+    size_t             cmpBufferSize;
+} block_prefetcher;
+
+void aaruf_prefetch_lock(void* prefetcher) { CriticalSection_Enter(&((block_prefetcher*)prefetcher)->lock); }
+
+void aaruf_prefetch_unlock(void* prefetcher) { CriticalSection_Leave(&((block_prefetcher*)prefetcher)->lock); }
+
+// Called with the lock held. Copies the compressed data of the block to the prefetcher buffer if it is not cached yet,
+// returns false if nothing needs to be decoded.
+static bool prefetch_fetch(block_prefetcher* prefetcher, uint64_t blockOffset, BlockHeader* blockHeader)
+{
+    aaruformatContext* ctx = prefetcher->ctx;
+    BlockHeader*       cachedHeader;
+    uint8_t*           buffer;
+
+    if(find_in_cache_uint64(&ctx->blockCache, blockOffset) != NULL) return false;
+
+    cachedHeader = find_in_cache_uint64(&ctx->blockHeaderCache, blockOffset);
+
+    if(cachedHeader == NULL)
+    {
+        cachedHeader = malloc(sizeof(BlockHeader));
+
+        if(cachedHeader == NULL) return false;
+
+        fseek(ctx->imageStream, blockOffset, SEEK_SET);
+
+        if(fread(cachedHeader, 1, sizeof(BlockHeader), ctx->imageStream) != sizeof(BlockHeader))
+        {
+            free(cachedHeader);
+            return false;
+        }
+
+        add_to_cache_uint64(&ctx->blockHeaderCache, blockOffset, cachedHeader);
+    }
+    else
+        fseek(ctx->imageStream, blockOffset + sizeof(BlockHeader), SEEK_SET);
+
+    memcpy(blockHeader, cachedHeader, sizeof(BlockHeader));
+
+    if(blockHeader->cmpLength > prefetcher->cmpBufferSize)
+    {
+        buffer = realloc(prefetcher->cmpBuffer, blockHeader->cmpLength);
+
+        if(buffer == NULL) return false;
+
+        prefetcher->cmpBuffer     = buffer;
+        prefetcher->cmpBufferSize = blockHeader->cmpLength;
+    }
+
+    return fread(prefetcher->cmpBuffer, 1, blockHeader->cmpLength, ctx->imageStream) == blockHeader->cmpLength;
+}
+
+// Follows the access pattern through the DDT until depth blocks ahead of the reader are in the cache
+static void prefetch_run(block_prefetcher* prefetcher, uint64_t sector, int64_t stride)
+{
+    aaruformatContext* ctx       = prefetcher->ctx;
+    uint64_t           blocks    = 0;
+    uint64_t           scanned   = 0;
+    uint64_t           lastBlock = 0;
+    uint64_t           current;
+    uint64_t           ddtEntry;
+    uint64_t           blockOffset;
+    BlockHeader        blockHeader;
+    uint8_t*           block;
+    bool               fetched;
+    int32_t            errorNo;
+
+    while(blocks < prefetcher->depth && scanned < PREFETCH_MAX_SCAN && sector < ctx->imageInfo.Sectors)
+    {
+        current = sector;
+        scanned++;
+
+        // Going backwards past the first sector ends the loop
+        if(stride < 0 && (uint64_t)-stride > sector) sector = ctx->imageInfo.Sectors;
+        else
+            sector += stride;
+
+        // Flat and mapped tables are not modified by lookups
+        if(ctx->userDataDdt != NULL) ddtEntry = ctx->userDataDdt[current];
+        else
+        {
+            aaruf_prefetch_lock(prefetcher);
+            errorNo = aaruf_get_ddt_entry(ctx, current, &ddtEntry);
+            aaruf_prefetch_unlock(prefetcher);
+
+            if(errorNo != AARUF_STATUS_OK) return;
+        }
+
+        if(ddtEntry == 0) continue;
+
+        blockOffset = ddtEntry >> ctx->shift;
+
+        if(blockOffset == lastBlock) continue;
+
+        lastBlock = blockOffset;
+        blocks++;
+
+        aaruf_prefetch_lock(prefetcher);
+
+        // A newer request supersedes this one
+        if(prefetcher->pending || prefetcher->stop)
+        {
+            aaruf_prefetch_unlock(prefetcher);
+            return;
+        }
+
+        fetched = prefetch_fetch(prefetcher, blockOffset, &blockHeader);
+
+        aaruf_prefetch_unlock(prefetcher);
+
+        if(!fetched) continue;
+
+        block = (uint8_t*)malloc(blockHeader.length);
+
+        if(block == NULL) return;
+
+        if(aaruf_decode_block(&blockHeader, prefetcher->cmpBuffer, prefetcher->lzmaDecoder, block) != AARUF_STATUS_OK)
+        {
+            free(block);
+            continue;
+        }
+
+        aaruf_prefetch_lock(prefetcher);
+
+        // The reader may have needed it first
+        if(find_in_cache_uint64(&ctx->blockCache, blockOffset) == NULL)
+            add_to_cache_uint64(&ctx->blockCache, blockOffset, block);
+        else
+            free(block);
+
+        aaruf_prefetch_unlock(prefetcher);
+    }
+}
+
+static THREAD_FUNC_DECL prefetch_worker(void* param)
+{
+    block_prefetcher* prefetcher = param;
+    uint64_t          sector;
+    int64_t           stride;
+
+    for(;;)
+    {
+        Event_Wait(&prefetcher->wake);
+
+        aaruf_prefetch_lock(prefetcher);
+
+        if(prefetcher->stop)
+        {
+            aaruf_prefetch_unlock(prefetcher);
+            break;
+        }
+
+        if(!prefetcher->pending)
+        {
+            aaruf_prefetch_unlock(prefetcher);
+            continue;
+        }
+
+        sector              = prefetcher->requestSector;
+        stride              = prefetcher->requestStride;
+        prefetcher->pending = false;
+
+        aaruf_prefetch_unlock(prefetcher);
+
+        prefetch_run(prefetcher, sector, stride);
+    }
+
+    return 0;
+}
+
+// Called by the reader after each sector it reads. Once the same stride is seen PREFETCH_MIN_HITS times in a row, asks
+// the prefetcher to follow it every time the reader enters a new block.
+void aaruf_prefetch_notify(void* prefetcher, uint64_t sectorAddress, uint64_t blockOffset)
+{
+    block_prefetcher* p      = prefetcher;
+    int64_t           stride = (int64_t)(sectorAddress - p->lastSector);
+
+    if(stride != 0 && stride == p->lastStride)
+    {
+        if(p->hits < PREFETCH_MIN_HITS) p->hits++;
+    }
+    else
+        p->hits = 0;
+
+    p->lastStride = stride;
+    p->lastSector = sectorAddress;
+
+    if(p->hits < PREFETCH_MIN_HITS || blockOffset == p->lastBlock) return;
+
+    p->lastBlock = blockOffset;
+
+    if(stride < 0 && (uint64_t)-stride > sectorAddress) return;
+
+    aaruf_prefetch_lock(p);
+    p->requestSector = sectorAddress + stride;
+    p->requestStride = stride;
+    p->pending       = true;
+    aaruf_prefetch_unlock(p);
+
+    Event_Set(&p->wake);
+}
+
+static void prefetch_stop(aaruformatContext* ctx)
+{
+    block_prefetcher* prefetcher = ctx->prefetcher;
+
+    if(prefetcher == NULL) return;
+
+    aaruf_prefetch_lock(prefetcher);
+    prefetcher->stop = true;
+    aaruf_prefetch_unlock(prefetcher);
+
+    Event_Set(&prefetcher->wake);
+    Thread_Wait_Close(&prefetcher->thread);
+
+    Event_Close(&prefetcher->wake);
+    CriticalSection_Delete(&prefetcher->lock);
+    aaruf_lzma_decoder_free(prefetcher->lzmaDecoder);
+    free(prefetcher->cmpBuffer);
+    free(prefetcher);
+
+    ctx->prefetcher = NULL;
+}
+
+/**
+ * Enables decoding ahead of sequential or strided readers in a background thread
+ * @param context Image context
+ * @param depth How many blocks to decode ahead of the reader, 0 disables prefetching. Limited to half the block cache.
+ */
+int32_t aaruf_set_prefetch_depth(void* context, uint32_t depth)
+{
+    aaruformatContext* ctx;
+    block_prefetcher*  prefetcher;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    // Prefetched blocks must not evict the ones being read
+    if(depth > ctx->blockCache.max_items / 2) depth = (uint32_t)(ctx->blockCache.max_items / 2);
+
+    if(depth == 0)
+    {
+        prefetch_stop(ctx);
+        return AARUF_STATUS_OK;
+    }
+
+    if(ctx->prefetcher != NULL)
+    {
+        prefetcher = ctx->prefetcher;
+
+        aaruf_prefetch_lock(prefetcher);
+        prefetcher->depth = depth;
+        aaruf_prefetch_unlock(prefetcher);
+
+        return AARUF_STATUS_OK;
+    }
+
+    prefetcher = (block_prefetcher*)calloc(1, sizeof(block_prefetcher));
+
+    if(prefetcher == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    prefetcher->ctx         = ctx;
+    prefetcher->depth       = depth;
+    prefetcher->lzmaDecoder = aaruf_lzma_decoder_init();
+
+    Thread_Construct(&prefetcher->thread);
+    Event_Construct(&prefetcher->wake);
+
+    if(CriticalSection_Init(&prefetcher->lock) != 0)
+    {
+        aaruf_lzma_decoder_free(prefetcher->lzmaDecoder);
+        free(prefetcher);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    if(AutoResetEvent_CreateNotSignaled(&prefetcher->wake) != 0)
+    {
+        CriticalSection_Delete(&prefetcher->lock);
+        aaruf_lzma_decoder_free(prefetcher->lzmaDecoder);
+        free(prefetcher);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    if(Thread_Create(&prefetcher->thread, prefetch_worker, prefetcher) != 0)
+    {
+        Event_Close(&prefetcher->wake);
+        CriticalSection_Delete(&prefetcher->lock);
+        aaruf_lzma_decoder_free(prefetcher->lzmaDecoder);
+        free(prefetcher);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    ctx->prefetcher = prefetcher;
+
+    return AARUF_STATUS_OK;
+}
+
+void aaruf_prefetch_free(void* context) { prefetch_stop(context); }
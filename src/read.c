@@ -16,6 +16,7 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -53,20 +54,17 @@ int32_t aaruf_read_media_tag(void* context, uint8_t* data, int32_t tag, uint32_t
     return AARUF_STATUS_OK;
 }
 
-int32_t aaruf_read_sector(void* context, uint64_t sectorAddress, uint8_t* data, uint32_t* length)
+/**
+ * Gets a media tag without copying it. The data belongs to the context and stays valid until it is closed.
+ * @param context Image context
+ * @param tag Media tag type
+ * @param data Where to store the pointer to the tag data
+ * @param length Where to store the length of the tag data
+ */
+int32_t aaruf_get_media_tag(void* context, int32_t tag, const uint8_t** data, uint32_t* length)
 {
     aaruformatContext* ctx;
-    uint64_t           ddtEntry;
-    uint32_t           offsetMask;
-    uint64_t           offset;
-    uint64_t           blockOffset;
-    BlockHeader*       blockHeader;
-    uint8_t*           block;
-    size_t             readBytes;
-    uint8_t            lzmaProperties[LZMA_PROPERTIES_LENGTH];
-    size_t             lzmaSize;
-    uint8_t*           cmpData;
-    int                errorNo;
+    mediaTagEntry*     item;
 
     if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
 
@@ -75,23 +73,145 @@ int32_t aaruf_read_sector(void* context, uint64_t sectorAddress, uint8_t* data,
     // Not a libaaruformat context
     if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
 
-    if(sectorAddress > ctx->imageInfo.Sectors - 1) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+    HASH_FIND_INT(ctx->mediaTags, &tag, item);
+
+    if(item == NULL)
+    {
+        *data   = NULL;
+        *length = 0;
+        return AARUF_ERROR_MEDIA_TAG_NOT_PRESENT;
+    }
+
+    *data   = item->data;
+    *length = item->length;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Lists the media tags present in the image. The list belongs to the context and stays valid until it is closed.
+ * @param context Image context
+ * @param tags Where to store the pointer to the media tag types, in ascending order
+ * @param count Where to store how many media tags are present
+ */
+int32_t aaruf_get_media_tag_types(void* context, const int32_t** tags, uint32_t* count)
+{
+    aaruformatContext* ctx;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    *tags  = ctx->mediaTagTypes;
+    *count = ctx->mediaTagCount;
+
+    return AARUF_STATUS_OK;
+}
+
+// Decodes the compressed data of a block, the caller provides a buffer of blockHeader->length bytes. Does not touch
+// the context so the prefetcher can decode outside the image lock with its own LZMA decoder.
+int32_t aaruf_decode_block(const BlockHeader* blockHeader, uint8_t* cmpData, void* lzmaDecoder, uint8_t* block)
+{
+    size_t readBytes;
+    size_t cmpSize;
+    int    errorNo;
+
+    switch(blockHeader->compression)
+    {
+        case None:
+            if(blockHeader->cmpLength < blockHeader->length) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            memcpy(block, cmpData, blockHeader->length);
+
+            break;
+        case Lzma:
+            cmpSize   = blockHeader->cmpLength - LZMA_PROPERTIES_LENGTH;
+            readBytes = blockHeader->length;
+            errorNo   = aaruf_lzma_decoder_decode(lzmaDecoder,
+                                                block,
+                                                &readBytes,
+                                                cmpData + LZMA_PROPERTIES_LENGTH,
+                                                &cmpSize,
+                                                cmpData,
+                                                LZMA_PROPERTIES_LENGTH);
+
+            if(errorNo != 0)
+            {
+                fprintf(stderr, "Got error %d from LZMA...\n", errorNo);
+                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+            }
+
+            if(readBytes != blockHeader->length)
+            {
+                fprintf(stderr, "Error decompressing block, should be {0} bytes but got {1} bytes...\n");
+                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+            }
 
-    ddtEntry    = ctx->userDataDdt[sectorAddress];
-    offsetMask  = (uint32_t)((1 << ctx->shift) - 1);
-    offset      = ddtEntry & offsetMask;
-    blockOffset = ddtEntry >> ctx->shift;
+            break;
+        case Flac:
+            readBytes = aaruf_flac_decode_redbook_buffer(block, blockHeader->length, cmpData, blockHeader->cmpLength);
+
+            if(readBytes != blockHeader->length)
+            {
+                fprintf(stderr, "Error decompressing block, should be {0} bytes but got {1} bytes...\n");
+                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+            }
+
+            break;
+        case Lz4:
+            cmpSize   = blockHeader->cmpLength;
+            readBytes = blockHeader->length;
+            errorNo   = aaruf_lz4_decode_buffer(block, &readBytes, cmpData, &cmpSize);
+
+            if(errorNo != AARUF_STATUS_OK || readBytes != blockHeader->length)
+            {
+                fprintf(stderr, "Error decompressing block, should be {0} bytes but got {1} bytes...\n");
+                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
+            }
+
+            break;
+        default: return AARUF_ERROR_UNSUPPORTED_COMPRESSION;
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t read_sector(aaruformatContext* ctx,
+                           uint64_t           sectorAddress,
+                           uint8_t*           data,
+                           uint32_t*          length,
+                           uint64_t*          blockOffset)
+{
+    uint64_t     ddtEntry;
+    uint32_t     offsetMask;
+    uint64_t     offset;
+    BlockHeader* blockHeader;
+    uint8_t*     block;
+    size_t       readBytes;
+    uint8_t*     cmpData;
+    int          errorNo;
+
+    errorNo = aaruf_get_ddt_entry(ctx, sectorAddress, &ddtEntry);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    offsetMask   = (uint32_t)((1 << ctx->shift) - 1);
+    offset       = ddtEntry & offsetMask;
+    *blockOffset = ddtEntry >> ctx->shift;
 
     // Partially written image... as we can't know the real sector size just assume it's common :/
     if(ddtEntry == 0)
     {
-        memset(data, 0, ctx->imageInfo.SectorSize);
+        if(data != NULL && *length >= ctx->imageInfo.SectorSize) memset(data, 0, ctx->imageInfo.SectorSize);
         *length = ctx->imageInfo.SectorSize;
         return AARUF_STATUS_SECTOR_NOT_DUMPED;
     }
 
     // Check if block header is cached
-    blockHeader = find_in_cache_uint64(&ctx->blockHeaderCache, blockOffset);
+    blockHeader = find_in_cache_uint64(&ctx->blockHeaderCache, *blockOffset);
 
     // Read block header
     if(blockHeader == NULL)
@@ -99,15 +219,19 @@ int32_t aaruf_read_sector(void* context, uint64_t sectorAddress, uint8_t* data,
         blockHeader = malloc(sizeof(BlockHeader));
         if(blockHeader == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
 
-        fseek(ctx->imageStream, blockOffset, SEEK_SET);
+        fseek(ctx->imageStream, *blockOffset, SEEK_SET);
         readBytes = fread(blockHeader, 1, sizeof(BlockHeader), ctx->imageStream);
 
-        if(readBytes != sizeof(BlockHeader)) return AARUF_ERROR_CANNOT_READ_HEADER;
+        if(readBytes != sizeof(BlockHeader))
+        {
+            free(blockHeader);
+            return AARUF_ERROR_CANNOT_READ_HEADER;
+        }
 
-        add_to_cache_uint64(&ctx->blockHeaderCache, blockOffset, blockHeader);
+        add_to_cache_uint64(&ctx->blockHeaderCache, *blockOffset, blockHeader);
     }
     else
-        fseek(ctx->imageStream, blockOffset + sizeof(BlockHeader), SEEK_SET); // Advance as if reading the header
+        fseek(ctx->imageStream, *blockOffset + sizeof(BlockHeader), SEEK_SET); // Advance as if reading the header
 
     if(data == NULL || *length < blockHeader->sectorSize)
     {
@@ -116,145 +240,110 @@ int32_t aaruf_read_sector(void* context, uint64_t sectorAddress, uint8_t* data,
     }
 
     // Check if block is cached
-    block = find_in_cache_uint64(&ctx->blockCache, blockOffset);
+    block = find_in_cache_uint64(&ctx->blockCache, *blockOffset);
 
     if(block != NULL)
     {
-        memcpy(data, block + offset, blockHeader->sectorSize);
+        memcpy(data, block + (offset * blockHeader->sectorSize), blockHeader->sectorSize);
         *length = blockHeader->sectorSize;
         return AARUF_STATUS_OK;
     }
 
-    // Decompress block
-    switch(blockHeader->compression)
-    {
-        case None:
-            block = (uint8_t*)malloc(blockHeader->length);
-            if(block == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    if(blockHeader->compression != None && blockHeader->compression != Lzma && blockHeader->compression != Flac &&
+       blockHeader->compression != Lz4)
+        return AARUF_ERROR_UNSUPPORTED_COMPRESSION;
 
-            readBytes = fread(block, 1, blockHeader->length, ctx->imageStream);
-
-            if(readBytes != blockHeader->length)
-            {
-                free(block);
-                return AARUF_ERROR_CANNOT_READ_BLOCK;
-            }
-
-            break;
-        case Lzma:
-            lzmaSize = blockHeader->cmpLength - LZMA_PROPERTIES_LENGTH;
-            cmpData  = malloc(lzmaSize);
-
-            if(cmpData == NULL)
-            {
-                fprintf(stderr, "Cannot allocate memory for block...\n");
-                return AARUF_ERROR_NOT_ENOUGH_MEMORY;
-            }
-
-            block = malloc(blockHeader->length);
-            if(block == NULL)
-            {
-                fprintf(stderr, "Cannot allocate memory for block...\n");
-                free(cmpData);
-                return AARUF_ERROR_NOT_ENOUGH_MEMORY;
-            }
+    block = (uint8_t*)malloc(blockHeader->length);
+    if(block == NULL)
+    {
+        fprintf(stderr, "Cannot allocate memory for block...\n");
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
 
-            readBytes = fread(lzmaProperties, 1, LZMA_PROPERTIES_LENGTH, ctx->imageStream);
+    // Uncompressed blocks are read in place
+    if(blockHeader->compression == None)
+    {
+        readBytes = fread(block, 1, blockHeader->length, ctx->imageStream);
 
-            if(readBytes != LZMA_PROPERTIES_LENGTH)
-            {
-                fprintf(stderr, "Could not read LZMA properties...\n");
-                free(block);
-                free(cmpData);
-                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-            }
+        if(readBytes != blockHeader->length)
+        {
+            free(block);
+            return AARUF_ERROR_CANNOT_READ_BLOCK;
+        }
+    }
+    else
+    {
+        cmpData = aaruf_get_compressed_buffer(ctx, blockHeader->cmpLength);
 
-            readBytes = fread(cmpData, 1, lzmaSize, ctx->imageStream);
-            if(readBytes != lzmaSize)
-            {
-                fprintf(stderr, "Could not read compressed block...\n");
-                free(cmpData);
-                free(block);
-                break;
-            }
+        if(cmpData == NULL)
+        {
+            fprintf(stderr, "Cannot allocate memory for block...\n");
+            free(block);
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        }
 
-            readBytes = blockHeader->length;
-            errorNo =
-                aaruf_lzma_decode_buffer(block, &readBytes, cmpData, &lzmaSize, lzmaProperties, LZMA_PROPERTIES_LENGTH);
+        readBytes = fread(cmpData, 1, blockHeader->cmpLength, ctx->imageStream);
+        if(readBytes != blockHeader->cmpLength)
+        {
+            fprintf(stderr, "Could not read compressed block...\n");
+            free(block);
+            return AARUF_ERROR_CANNOT_READ_BLOCK;
+        }
 
-            if(errorNo != 0)
-            {
-                fprintf(stderr, "Got error %d from LZMA...\n", errorNo);
-                free(cmpData);
-                free(block);
-                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-            }
+        errorNo = aaruf_decode_block(blockHeader, cmpData, ctx->lzmaDecoder, block);
 
-            if(readBytes != blockHeader->length)
-            {
-                fprintf(stderr, "Error decompressing block, should be {0} bytes but got {1} bytes...\n");
-                free(cmpData);
-                free(block);
-                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-            }
+        if(errorNo != AARUF_STATUS_OK)
+        {
+            free(block);
+            return errorNo;
+        }
+    }
 
-            free(cmpData);
+    // Add block to cache
+    add_to_cache_uint64(&ctx->blockCache, *blockOffset, block);
 
-            break;
-        case Flac:
-            cmpData = malloc(blockHeader->cmpLength);
+    memcpy(data, block + (offset * blockHeader->sectorSize), blockHeader->sectorSize);
+    *length = blockHeader->sectorSize;
+    return AARUF_STATUS_OK;
+}
 
-            if(cmpData == NULL)
-            {
-                fprintf(stderr, "Cannot allocate memory for block...\n");
-                return AARUF_ERROR_NOT_ENOUGH_MEMORY;
-            }
+int32_t aaruf_read_sector(void* context, uint64_t sectorAddress, uint8_t* data, uint32_t* length)
+{
+    aaruformatContext* ctx;
+    uint64_t           blockOffset = 0;
+    int32_t            errorNo;
 
-            block = malloc(blockHeader->length);
-            if(block == NULL)
-            {
-                fprintf(stderr, "Cannot allocate memory for block...\n");
-                free(cmpData);
-                return AARUF_ERROR_NOT_ENOUGH_MEMORY;
-            }
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
 
-            readBytes = fread(cmpData, 1, blockHeader->cmpLength, ctx->imageStream);
-            if(readBytes != blockHeader->cmpLength)
-            {
-                fprintf(stderr, "Could not read compressed block...\n");
-                free(cmpData);
-                free(block);
-                break;
-            }
+    ctx = context;
 
-            readBytes = aaruf_flac_decode_redbook_buffer(block, blockHeader->length, cmpData, blockHeader->cmpLength);
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
 
-            if(readBytes != blockHeader->length)
-            {
-                fprintf(stderr, "Error decompressing block, should be {0} bytes but got {1} bytes...\n");
-                free(cmpData);
-                free(block);
-                return AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK;
-            }
+    if(sectorAddress > ctx->imageInfo.Sectors - 1) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
 
-            free(cmpData);
+    if(ctx->prefetcher == NULL) errorNo = read_sector(ctx, sectorAddress, data, length, &blockOffset);
+    else
+    {
+        // The prefetcher shares the caches, the DDT and the image stream
+        aaruf_prefetch_lock(ctx->prefetcher);
+        errorNo = read_sector(ctx, sectorAddress, data, length, &blockOffset);
+        aaruf_prefetch_unlock(ctx->prefetcher);
 
-            break;
-        default: return AARUF_ERROR_UNSUPPORTED_COMPRESSION;
+        if(errorNo == AARUF_STATUS_OK) aaruf_prefetch_notify(ctx->prefetcher, sectorAddress, blockOffset);
     }
 
-    // Add block to cache
-    add_to_cache_uint64(&ctx->blockCache, blockOffset, block);
+    // Never written to a child image, the parent has it
+    if(errorNo == AARUF_STATUS_SECTOR_NOT_DUMPED && ctx->parentPath != NULL)
+        return aaruf_parent_read_sector(ctx, sectorAddress, data, length);
 
-    memcpy(data, block + (offset * blockHeader->sectorSize), blockHeader->sectorSize);
-    *length = blockHeader->sectorSize;
-    return AARUF_STATUS_OK;
+    return errorNo;
 }
 
 int32_t aaruf_read_track_sector(void* context, uint8_t* data, uint64_t sectorAddress, uint32_t* length, uint8_t track)
 {
     aaruformatContext* ctx;
-    int                i;
+    TrackEntry*        trk;
 
     if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
 
@@ -265,15 +354,63 @@ int32_t aaruf_read_track_sector(void* context, uint8_t* data, uint64_t sectorAdd
 
     if(ctx->imageInfo.XmlMediaType != OpticalDisc) return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
 
-    for(i = 0; i < ctx->numberOfDataTracks; i++)
+    trk = aaruf_get_data_track(ctx, track);
+
+    if(trk == NULL) return AARUF_ERROR_TRACK_NOT_FOUND;
+
+    return aaruf_read_sector(context, trk->start + sectorAddress, data, length);
+}
+
+// Length of the tag of the given type each sector has, 0 if the media cannot have it
+static uint32_t sector_tag_length(aaruformatContext* ctx, int32_t tag)
+{
+    switch(tag)
     {
-        if(ctx->dataTracks[i].sequence == track)
-        {
-            return aaruf_read_sector(context, ctx->dataTracks[i].start + sectorAddress, data, length);
-        }
+        case AppleSectorTag:
+            switch(ctx->imageInfo.MediaType)
+            {
+                case AppleFileWare:
+                case AppleProfile:
+                case AppleWidget: return 20;
+                case AppleSonySS:
+                case AppleSonyDS: return 12;
+                case PriamDataTower: return 24;
+                default: return 0;
+            }
+        case CdSectorSync: return 12;
+        case CdSectorHeader: return 4;
+        case CdSectorSubHeader: return 8;
+        case CdSectorEdc: return 4;
+        case CdSectorEccP: return 172;
+        case CdSectorEccQ: return 104;
+        case CdSectorEcc: return 276;
+        case CdSectorSubchannelAaru: return 96;
+        default: return 0;
     }
+}
+
+// Where the subheader, EDC or ECC is in a 2352 bytes long sector of the given track type, 0 if that sector does not
+// have it
+static uint32_t cd_sector_tag_offset(uint8_t trackType, const uint8_t* sector, int32_t tag)
+{
+    bool mode2;
+    bool form2;
+
+    if(trackType != CdMode1 && trackType != CdMode2Formless && trackType != CdMode2Form1 && trackType != CdMode2Form2)
+        return 0;
 
-    return AARUF_ERROR_TRACK_NOT_FOUND;
+    mode2 = trackType != CdMode1;
+    form2 = trackType == CdMode2Form2 || (trackType == CdMode2Formless && (sector[18] & 0x20) == 0x20);
+
+    switch(tag)
+    {
+        case CdSectorSubHeader: return mode2 ? 16 : 0;
+        case CdSectorEdc: return !mode2 ? 2064 : form2 ? 2348 : 2072;
+        case CdSectorEccP:
+        case CdSectorEcc: return form2 ? 0 : 2076;
+        case CdSectorEccQ: return form2 ? 0 : 2248;
+        default: return 0;
+    }
 }
 
 int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* data, uint32_t* length)
@@ -283,9 +420,7 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
     uint32_t           tagLength;
     uint8_t*           bareData;
     int32_t            res;
-    TrackEntry         trk;
-    int                i;
-    bool               trkFound;
+    TrackEntry*        trk;
 
     if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
 
@@ -303,7 +438,7 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                 return AARUF_ERROR_BUFFER_TOO_SMALL;
             }
             if((ctx->sectorSuffix == NULL || ctx->sectorPrefix == NULL) &&
-               (ctx->sectorSuffixCorrected == NULL || ctx->sectorPrefixCorrected == NULL))
+               (ctx->sectorSuffixDdt == NULL || ctx->sectorPrefixDdt == NULL))
                 return aaruf_read_sector(context, sectorAddress, data, length);
 
             bareLength = 0;
@@ -321,24 +456,18 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                 return res;
             }
 
-            trkFound = false;
+            trk = aaruf_find_data_track(ctx, sectorAddress);
 
-            for(i = 0; i < ctx->numberOfDataTracks; i++)
+            if(trk == NULL)
             {
-                if(sectorAddress >= ctx->dataTracks[i].start && sectorAddress <= ctx->dataTracks[i].end)
-                {
-                    trkFound = true;
-                    trk      = ctx->dataTracks[i];
-                    break;
-                }
+                free(bareData);
+                return AARUF_ERROR_TRACK_NOT_FOUND;
             }
 
-            if(!trkFound) return AARUF_ERROR_TRACK_NOT_FOUND;
-
-            switch(trk.type)
+            switch(trk->type)
             {
                 case Audio:
-                case Data: memcpy(data, bareData, bareLength); return res;
+                case Data: memcpy(data, bareData, bareLength); break;
                 case CdMode1:
                     memcpy(data + 16, bareData, 2048);
 
@@ -347,7 +476,7 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                     {
                         if((ctx->sectorPrefixDdt[sectorAddress] & CD_XFIX_MASK) == Correct)
                         {
-                            aaruf_ecc_cd_reconstruct_prefix(data, trk.type, sectorAddress);
+                            aaruf_ecc_cd_reconstruct_prefix(data, trk->type, sectorAddress);
                             res = AARUF_STATUS_OK;
                         }
                         else if((ctx->sectorPrefixDdt[sectorAddress] & CD_XFIX_MASK) == NotDumped)
@@ -363,16 +492,16 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                         }
                     }
                     else
-                        return AARUF_ERROR_REACHED_UNREACHABLE_CODE;
+                        res = AARUF_ERROR_REACHED_UNREACHABLE_CODE;
 
-                    if(res != AARUF_STATUS_OK) return res;
+                    if(res != AARUF_STATUS_OK) break;
 
                     if(ctx->sectorSuffix != NULL) memcpy(data + 2064, ctx->sectorSuffix + sectorAddress * 288, 288);
                     else if(ctx->sectorSuffixDdt != NULL)
                     {
                         if((ctx->sectorSuffixDdt[sectorAddress] & CD_XFIX_MASK) == Correct)
                         {
-                            aaruf_ecc_cd_reconstruct(ctx->eccCdContext, data, trk.type);
+                            aaruf_ecc_cd_reconstruct(ctx->eccCdContext, data, trk->type);
                             res = AARUF_STATUS_OK;
                         }
                         else if((ctx->sectorSuffixDdt[sectorAddress] & CD_XFIX_MASK) == NotDumped)
@@ -388,9 +517,9 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                         }
                     }
                     else
-                        return AARUF_ERROR_REACHED_UNREACHABLE_CODE;
+                        res = AARUF_ERROR_REACHED_UNREACHABLE_CODE;
 
-                    return res;
+                    break;
                 case CdMode2Formless:
                 case CdMode2Form1:
                 case CdMode2Form2:
@@ -399,7 +528,7 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                     {
                         if((ctx->sectorPrefixDdt[sectorAddress] & CD_XFIX_MASK) == Correct)
                         {
-                            aaruf_ecc_cd_reconstruct_prefix(data, trk.type, sectorAddress);
+                            aaruf_ecc_cd_reconstruct_prefix(data, trk->type, sectorAddress);
                             res = AARUF_STATUS_OK;
                         }
                         else if((ctx->sectorPrefixDdt[sectorAddress] & CD_XFIX_MASK) == NotDumped)
@@ -415,9 +544,9 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                         }
                     }
                     else
-                        return AARUF_ERROR_REACHED_UNREACHABLE_CODE;
+                        res = AARUF_ERROR_REACHED_UNREACHABLE_CODE;
 
-                    if(res != AARUF_STATUS_OK) return res;
+                    if(res != AARUF_STATUS_OK) break;
 
                     if(ctx->mode2Subheaders != NULL && ctx->sectorSuffixDdt != NULL)
                     {
@@ -451,9 +580,13 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                     else
                         memcpy(data + 16, bareData, 2336);
 
-                    return res;
-                default: return AARUF_ERROR_INVALID_TRACK_FORMAT;
+                    break;
+                default: res = AARUF_ERROR_INVALID_TRACK_FORMAT; break;
             }
+
+            free(bareData);
+
+            return res;
         case BlockMedia:
             switch(ctx->imageInfo.MediaType)
             {
@@ -465,17 +598,7 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
                 case PriamDataTower:
                     if(ctx->sectorSubchannel == NULL) return aaruf_read_sector(context, sectorAddress, data, length);
 
-                    switch(ctx->imageInfo.MediaType)
-                    {
-                        case AppleFileWare:
-                        case AppleProfile:
-                        case AppleWidget: tagLength = 20; break;
-                        case AppleSonySS:
-                        case AppleSonyDS: tagLength = 12; break;
-                        case PriamDataTower: tagLength = 24; break;
-                        default: return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
-                    }
-
+                    tagLength  = sector_tag_length(ctx, AppleSectorTag);
                     bareLength = 512;
 
                     if(*length < tagLength + bareLength || data == NULL)
@@ -490,10 +613,16 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
 
                     res = aaruf_read_sector(context, sectorAddress, bareData, &bareLength);
 
-                    if(bareLength != 512) return res;
+                    if(bareLength != 512)
+                    {
+                        free(bareData);
+                        return res;
+                    }
 
+                    // Tag goes first, followed by the sector data
                     memcpy(data, ctx->sectorSubchannel + sectorAddress * tagLength, tagLength);
-                    memcpy(data, bareData, 512);
+                    memcpy(data + tagLength, bareData, 512);
+                    *length = tagLength + bareLength;
 
                     free(bareData);
 
@@ -502,4 +631,158 @@ int32_t aaruf_read_sector_long(void* context, uint64_t sectorAddress, uint8_t* d
             }
         default: return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Reads the tags of a range of sectors, one after the other. Sectors that cannot have the tag, like audio sectors or the
+ * ECC of mode 2 form 2 sectors, are filled with zeroes.
+ * @param context Image context
+ * @param sectorAddress First sector
+ * @param count How many sectors
+ * @param tag Sector tag type
+ * @param data Buffer for the tags
+ * @param length Length of the buffer, updated with the length of the tags
+ */
+int32_t aaruf_read_sector_tags(void*     context,
+                               uint64_t  sectorAddress,
+                               uint32_t  count,
+                               int32_t   tag,
+                               uint8_t*  data,
+                               uint32_t* length)
+{
+    aaruformatContext* ctx;
+    uint32_t           tagLength;
+    uint64_t           totalLength;
+    uint64_t           sector;
+    uint32_t           offset;
+    uint32_t           longLength;
+    uint32_t           fix;
+    uint8_t            longSector[2352];
+    uint8_t*           out;
+    int32_t            res;
+    int32_t            status = AARUF_STATUS_OK;
+    TrackEntry*        trk;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(tag < 0 || tag >= MaxSectorTag || !ctx->readableSectorTags[tag]) return AARUF_ERROR_SECTOR_TAG_NOT_PRESENT;
+
+    tagLength = sector_tag_length(ctx, tag);
+
+    if(tagLength == 0) return AARUF_ERROR_SECTOR_TAG_NOT_PRESENT;
+
+    if(sectorAddress >= ctx->imageInfo.Sectors || count > ctx->imageInfo.Sectors - sectorAddress)
+        return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    totalLength = (uint64_t)count * tagLength;
+
+    // Cannot be described by length, read less sectors at once
+    if(totalLength > UINT32_MAX) return AARUF_ERROR_BUFFER_TOO_SMALL;
+
+    if(*length < totalLength || data == NULL)
+    {
+        *length = (uint32_t)totalLength;
+        return AARUF_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    *length = (uint32_t)totalLength;
+
+    // Stored as is for every sector
+    if(tag == AppleSectorTag || tag == CdSectorSubchannelAaru)
+    {
+        if(ctx->sectorSubchannel == NULL) return AARUF_ERROR_SECTOR_TAG_NOT_PRESENT;
+
+        memcpy(data, ctx->sectorSubchannel + sectorAddress * tagLength, totalLength);
+
+        return AARUF_STATUS_OK;
+    }
+
+    if(ctx->imageInfo.XmlMediaType != OpticalDisc) return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
+
+    for(sector = sectorAddress, out = data; sector < sectorAddress + count; sector++, out += tagLength)
+    {
+        trk = aaruf_find_data_track(ctx, sector);
+
+        if(trk == NULL) return AARUF_ERROR_TRACK_NOT_FOUND;
+
+        if(trk->type == Audio || trk->type == Data || (trk->type == CdMode1 && tag == CdSectorSubHeader))
+        {
+            memset(out, 0, tagLength);
+            continue;
+        }
+
+        // Sync and header come from the prefix alone
+        if(tag == CdSectorSync || tag == CdSectorHeader)
+        {
+            offset = tag == CdSectorSync ? 0 : 12;
+
+            if(ctx->sectorPrefix != NULL)
+            {
+                memcpy(out, ctx->sectorPrefix + sector * 16 + offset, tagLength);
+                continue;
+            }
+
+            if(ctx->sectorPrefixDdt == NULL) return AARUF_ERROR_SECTOR_TAG_NOT_PRESENT;
+
+            fix = ctx->sectorPrefixDdt[sector] & CD_XFIX_MASK;
+
+            if(fix == Correct)
+            {
+                aaruf_ecc_cd_reconstruct_prefix(longSector, trk->type, (int64_t)sector);
+                memcpy(out, longSector + offset, tagLength);
+            }
+            else if(fix == NotDumped)
+            {
+                memset(out, 0, tagLength);
+                status = AARUF_STATUS_SECTOR_NOT_DUMPED;
+            }
+            else
+                memcpy(out,
+                       ctx->sectorPrefixCorrected + ((ctx->sectorPrefixDdt[sector] & CD_DFIX_MASK) - 1) * 16 + offset,
+                       tagLength);
+
+            continue;
+        }
+
+        // Mode 2 subheaders are stored as is
+        if(tag == CdSectorSubHeader && ctx->mode2Subheaders != NULL)
+        {
+            memcpy(out, ctx->mode2Subheaders + sector * 8, tagLength);
+            continue;
+        }
+
+        // Mode 1 suffixes stored as is
+        if(trk->type == CdMode1 && ctx->sectorSuffix != NULL)
+        {
+            offset = cd_sector_tag_offset(trk->type, NULL, tag);
+            memcpy(out, ctx->sectorSuffix + sector * 288 + (offset - 2064), tagLength);
+            continue;
+        }
+
+        // Anything else needs the whole sector to be rebuilt
+        longLength = sizeof(longSector);
+        res        = aaruf_read_sector_long(ctx, sector, longSector, &longLength);
+
+        if(res < AARUF_STATUS_OK) return res;
+
+        if(res == AARUF_STATUS_SECTOR_NOT_DUMPED)
+        {
+            memset(out, 0, tagLength);
+            status = AARUF_STATUS_SECTOR_NOT_DUMPED;
+            continue;
+        }
+
+        offset = cd_sector_tag_offset(trk->type, longSector, tag);
+
+        if(offset == 0) memset(out, 0, tagLength);
+        else
+            memcpy(out, longSector + offset, tagLength);
+    }
+
+    return status;
+}
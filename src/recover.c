@@ -0,0 +1,683 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Images that were never finished. Until the header is written at the end there is no index, but blocks are written
+// one after the other from the header on, so they can be walked in order. Every checkpoint lists the sectors stored in
+// the blocks written since the previous one, anything after the last checkpoint is lost.
+//
+// Images whose index is damaged. Every block starts with a known identifier and most carry the CRC64 of what follows
+// their header, so the whole image is scanned for them. Valid blocks are skipped over in one go, and past a damaged
+// one the next identifier is searched for, 16 bytes at a time where there are vector instructions for it.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#if defined(__x86_64__) || defined(__amd64) || defined(_M_AMD64) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN32
+#define recover_fseek _fseeki64
+#define recover_ftell _ftelli64
+#else
+#define recover_fseek fseeko
+#define recover_ftell ftello
+#endif
+
+// First and last characters of the identifiers of the blocks below, a position matching both is checked further
+static const uint8_t recover_first[] = {'D', 'I', 'G', 'M', 'T', 'C', 'S'};
+static const uint8_t recover_last[]  = {'K', '*', 'X', 'M', 'A', 'S', 'P', 'T', 'E'};
+
+static int32_t recover_add_block(RecoveredImage* image, uint64_t offset)
+{
+    uint64_t* blockOffsets;
+
+    if(image->blockCount == image->blockCapacity)
+    {
+        blockOffsets = realloc(image->blockOffsets, sizeof(uint64_t) * (image->blockCapacity + 4096));
+
+        if(blockOffsets == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        image->blockOffsets = blockOffsets;
+        image->blockCapacity += 4096;
+    }
+
+    image->blockOffsets[image->blockCount++] = offset;
+
+    return AARUF_STATUS_OK;
+}
+
+// Reads a checkpoint and points its sectors to their blocks, false if it is not complete
+static bool recover_checkpoint(FILE* stream, RecoveredImage* image, const CheckpointHeader* checkpoint)
+{
+    CheckpointEntry* entries;
+    uint64_t         crc64;
+    uint64_t         i;
+    uint32_t         j;
+    bool             valid = true;
+
+    if(checkpoint->sectors == 0 || checkpoint->sectorSize == 0 || checkpoint->shift == 0 || checkpoint->shift > 24 ||
+       checkpoint->entries > checkpoint->sectors)
+        return false;
+
+    // All the checkpoints of an image describe the same image
+    if(image->ddt != NULL && (checkpoint->sectors != image->checkpoint.sectors ||
+                              checkpoint->sectorSize != image->checkpoint.sectorSize ||
+                              checkpoint->shift != image->checkpoint.shift))
+        return false;
+
+    entries = malloc(sizeof(CheckpointEntry) * (checkpoint->entries + 1));
+
+    if(entries == NULL) return false;
+
+    if(fread(entries, sizeof(CheckpointEntry), checkpoint->entries, stream) != checkpoint->entries)
+    {
+        free(entries);
+        return false;
+    }
+
+    crc64 = bswap_64(aaruf_crc64_data((const uint8_t*)entries, sizeof(CheckpointEntry) * checkpoint->entries));
+
+    for(i = 0; i < checkpoint->entries && valid; i++)
+        valid = entries[i].sectorAddress < checkpoint->sectors &&
+                entries[i].count <= checkpoint->sectors - entries[i].sectorAddress;
+
+    if(crc64 != checkpoint->crc64 || !valid)
+    {
+        free(entries);
+        return false;
+    }
+
+    if(image->ddt == NULL)
+    {
+        image->ddt = calloc(checkpoint->sectors, sizeof(uint64_t));
+
+        if(image->ddt == NULL)
+        {
+            free(entries);
+            return false;
+        }
+    }
+
+    for(i = 0; i < checkpoint->entries; i++)
+        for(j = 0; j < entries[i].count; j++) image->ddt[entries[i].sectorAddress + j] = entries[i].ddtEntry + j;
+
+    free(entries);
+
+    image->checkpoint = *checkpoint;
+
+    return true;
+}
+
+/**
+ * Walks the blocks of an image that was never finished up to where they stop making sense
+ * @param stream Image
+ * @param image Filled with the sectors stored before the last checkpoint, to be freed with aaruf_recover_free()
+ * @return AARUF_STATUS_OK, or AARUF_ERROR_CANNOT_READ_INDEX if there is no checkpoint at all
+ */
+int32_t aaruf_recover_scan(FILE* stream, RecoveredImage* image)
+{
+    uint64_t         offset = sizeof(AaruHeader);
+    uint64_t         blocks = 0;
+    uint32_t         identifier;
+    BlockHeader      blockHeader;
+    DdtHeader        ddtHeader;
+    CheckpointHeader checkpoint;
+
+    memset(image, 0, sizeof(RecoveredImage));
+
+    for(;;)
+    {
+        if(recover_fseek(stream, offset, SEEK_SET) != 0 || fread(&identifier, sizeof(uint32_t), 1, stream) != 1 ||
+           recover_fseek(stream, offset, SEEK_SET) != 0)
+            break;
+
+        if(identifier == DataBlock)
+        {
+            if(fread(&blockHeader, sizeof(BlockHeader), 1, stream) != 1 ||
+               recover_add_block(image, offset) != AARUF_STATUS_OK)
+                break;
+
+            offset += sizeof(BlockHeader) + blockHeader.cmpLength;
+            continue;
+        }
+
+        // Written when the image is being finished
+        if(identifier == DeDuplicationTable)
+        {
+            if(fread(&ddtHeader, sizeof(DdtHeader), 1, stream) != 1) break;
+
+            offset += sizeof(DdtHeader) + ddtHeader.cmpLength;
+            continue;
+        }
+
+        if(identifier != CheckpointBlock || fread(&checkpoint, sizeof(CheckpointHeader), 1, stream) != 1 ||
+           !recover_checkpoint(stream, image, &checkpoint))
+            break;
+
+        offset += sizeof(CheckpointHeader) + sizeof(CheckpointEntry) * checkpoint.entries;
+        image->end = offset;
+        blocks     = image->blockCount;
+    }
+
+    // Nothing points to the blocks after the last checkpoint
+    image->blockCount = blocks;
+
+    fprintf(stderr,
+            "libaaruformat: Recovered %" PRIu64 " data blocks up to %" PRIu64 ".\n",
+            image->blockCount,
+            image->end);
+
+    return image->ddt == NULL ? AARUF_ERROR_CANNOT_READ_INDEX : AARUF_STATUS_OK;
+}
+
+void aaruf_recover_free(RecoveredImage* image)
+{
+    free(image->ddt);
+    free(image->blockOffsets);
+
+    image->ddt          = NULL;
+    image->blockOffsets = NULL;
+}
+
+static bool recover_known(uint32_t identifier)
+{
+    switch(identifier)
+    {
+        case DataBlock:
+        case DeDuplicationTable:
+        case IndexBlock:
+        case GeometryBlock:
+        case MetadataBlock:
+        case TracksBlock:
+        case TapeFileBlock:
+        case TapePartitionBlock:
+        case DataPositionMeasurementBlock:
+        case CicmBlock:
+        case ChecksumBlock:
+        case SnapshotBlock:
+        case ParentBlock:
+        case DumpHardwareBlock:
+        case CheckpointBlock: return true;
+        default: return false;
+    }
+}
+
+// Position of the first block identifier in the data, or its length if there is none
+static size_t recover_find(const uint8_t* data, size_t length)
+{
+    size_t   i = 0;
+    size_t   j;
+    uint32_t identifier;
+#if defined(__x86_64__) || defined(__amd64) || defined(_M_AMD64) || defined(_M_X64)
+    __m128i first;
+    __m128i last;
+    __m128i firstMatch;
+    __m128i lastMatch;
+    int     mask;
+
+    for(; i + 19 <= length; i += 16)
+    {
+        first      = _mm_loadu_si128((const __m128i*)(data + i));
+        last       = _mm_loadu_si128((const __m128i*)(data + i + 3));
+        firstMatch = _mm_setzero_si128();
+        lastMatch  = _mm_setzero_si128();
+
+        for(j = 0; j < sizeof(recover_first); j++)
+            firstMatch = _mm_or_si128(firstMatch, _mm_cmpeq_epi8(first, _mm_set1_epi8((char)recover_first[j])));
+
+        for(j = 0; j < sizeof(recover_last); j++)
+            lastMatch = _mm_or_si128(lastMatch, _mm_cmpeq_epi8(last, _mm_set1_epi8((char)recover_last[j])));
+
+        mask = _mm_movemask_epi8(_mm_and_si128(firstMatch, lastMatch));
+
+        for(j = 0; mask != 0; j++, mask >>= 1)
+        {
+            if((mask & 1) == 0) continue;
+
+            memcpy(&identifier, data + i + j, sizeof(uint32_t));
+
+            if(recover_known(identifier)) return i + j;
+        }
+    }
+#elif defined(__aarch64__)
+    uint8x16_t first;
+    uint8x16_t last;
+    uint8x16_t firstMatch;
+    uint8x16_t lastMatch;
+
+    for(; i + 19 <= length; i += 16)
+    {
+        first      = vld1q_u8(data + i);
+        last       = vld1q_u8(data + i + 3);
+        firstMatch = vdupq_n_u8(0);
+        lastMatch  = vdupq_n_u8(0);
+
+        for(j = 0; j < sizeof(recover_first); j++)
+            firstMatch = vorrq_u8(firstMatch, vceqq_u8(first, vdupq_n_u8(recover_first[j])));
+
+        for(j = 0; j < sizeof(recover_last); j++)
+            lastMatch = vorrq_u8(lastMatch, vceqq_u8(last, vdupq_n_u8(recover_last[j])));
+
+        if(vmaxvq_u8(vandq_u8(firstMatch, lastMatch)) == 0) continue;
+
+        for(j = 0; j < 16; j++)
+        {
+            memcpy(&identifier, data + i + j, sizeof(uint32_t));
+
+            if(recover_known(identifier)) return i + j;
+        }
+    }
+#endif
+
+    for(; i + sizeof(uint32_t) <= length; i++)
+    {
+        memcpy(&identifier, data + i, sizeof(uint32_t));
+
+        if(recover_known(identifier)) return i;
+    }
+
+    return length;
+}
+
+// Offset of the next block identifier from the given one, or the end of the image if there is none
+static uint64_t recover_search(FILE* stream, uint64_t offset, uint64_t fileSize, uint8_t* buffer)
+{
+    size_t length;
+    size_t position;
+
+    while(offset + sizeof(uint32_t) <= fileSize)
+    {
+        length = fileSize - offset < RECOVER_BUFFER_SIZE ? (size_t)(fileSize - offset) : RECOVER_BUFFER_SIZE;
+
+        if(recover_fseek(stream, offset, SEEK_SET) != 0) break;
+
+        length = fread(buffer, 1, length, stream);
+
+        if(length < sizeof(uint32_t)) break;
+
+        position = recover_find(buffer, length);
+
+        if(position < length) return offset + position;
+
+        // An identifier may start in the last bytes read
+        offset += length - (sizeof(uint32_t) - 1);
+    }
+
+    return fileSize;
+}
+
+// Reads the next bytes from the stream and returns their CRC64
+static int32_t recover_crc(FILE* stream, uint64_t length, uint8_t* buffer, uint64_t* crc64)
+{
+    crc64_ctx* crc = aaruf_crc64_init();
+    size_t     chunk;
+
+    if(crc == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    while(length > 0)
+    {
+        chunk = length < RECOVER_BUFFER_SIZE ? (size_t)length : RECOVER_BUFFER_SIZE;
+
+        if(fread(buffer, 1, chunk, stream) != chunk)
+        {
+            aaruf_crc64_free(crc);
+            return AARUF_ERROR_CANNOT_READ_BLOCK;
+        }
+
+        aaruf_crc64_update(crc, buffer, (uint32_t)chunk);
+        length -= chunk;
+    }
+
+    aaruf_crc64_final(crc, crc64);
+    aaruf_crc64_free(crc);
+
+    // Due to how C# wrote it, it is effectively reversed
+    *crc64 = bswap_64(*crc64);
+
+    return AARUF_STATUS_OK;
+}
+
+// Whether another block starts at the offset, or the image ends there
+static bool recover_followed(FILE* stream, uint64_t offset, uint64_t fileSize)
+{
+    uint32_t identifier;
+
+    if(offset == fileSize) return true;
+
+    return recover_fseek(stream, offset, SEEK_SET) == 0 && fread(&identifier, sizeof(uint32_t), 1, stream) == 1 &&
+           recover_known(identifier);
+}
+
+/**
+ * Checks the block at an offset
+ * @return AARUF_STATUS_OK with its index entry and length filled, AARUF_ERROR_INVALID_BLOCK_CRC if its contents are
+ * damaged, or AARUF_ERROR_CANNOT_READ_BLOCK if there is no block there
+ */
+static int32_t recover_block(FILE*       stream,
+                             uint64_t    offset,
+                             uint64_t    fileSize,
+                             uint8_t*    buffer,
+                             IndexEntry* entry,
+                             uint64_t*   length)
+{
+    uint32_t                      identifier;
+    BlockHeader                   blockHeader;
+    DdtHeader                     ddtHeader;
+    IndexHeader                   indexHeader;
+    MetadataBlockHeader           metadataHeader;
+    TracksHeader                  tracksHeader;
+    TapeFileHeader                tapeFileHeader;
+    TapePartitionHeader           tapePartitionHeader;
+    DataPositionMeasurementHeader dpmHeader;
+    CicmMetadataBlock             cicmHeader;
+    DumpHardwareHeader            dumpHardwareHeader;
+    ChecksumHeader                checksumHeader;
+    ParentBlockHeader             parentHeader;
+    SnapshotHeader                snapshotHeader;
+    CheckpointHeader              checkpointHeader;
+    uint64_t                      headerLength;
+    uint64_t                      payload  = 0;
+    uint64_t                      expected = 0;
+    uint64_t                      crc64;
+    bool                          hasCrc   = true;
+    int32_t                       errorNo;
+
+    if(recover_fseek(stream, offset, SEEK_SET) != 0 || fread(&identifier, sizeof(uint32_t), 1, stream) != 1 ||
+       !recover_known(identifier) || recover_fseek(stream, offset, SEEK_SET) != 0)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    entry->blockType = identifier;
+    entry->dataType  = 0;
+    entry->offset    = offset;
+
+    switch(identifier)
+    {
+        case DataBlock:
+            if(fread(&blockHeader, sizeof(BlockHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            entry->dataType = blockHeader.type;
+            headerLength    = sizeof(BlockHeader);
+            payload         = blockHeader.cmpLength;
+            expected        = blockHeader.cmpCrc64;
+            break;
+        case DeDuplicationTable:
+            if(fread(&ddtHeader, sizeof(DdtHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            entry->dataType = ddtHeader.type;
+            headerLength    = sizeof(DdtHeader);
+            payload         = ddtHeader.cmpLength;
+            expected        = ddtHeader.cmpCrc64;
+            break;
+        case IndexBlock:
+            if(fread(&indexHeader, sizeof(IndexHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(IndexHeader);
+            payload      = sizeof(IndexEntry) * indexHeader.entries;
+            expected     = indexHeader.crc64;
+            break;
+        case TracksBlock:
+            if(fread(&tracksHeader, sizeof(TracksHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(TracksHeader);
+            payload      = sizeof(TrackEntry) * tracksHeader.entries;
+            expected     = tracksHeader.crc64;
+            break;
+        case TapeFileBlock:
+            if(fread(&tapeFileHeader, sizeof(TapeFileHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(TapeFileHeader);
+            payload      = tapeFileHeader.length;
+            expected     = tapeFileHeader.crc64;
+            break;
+        case TapePartitionBlock:
+            if(fread(&tapePartitionHeader, sizeof(TapePartitionHeader), 1, stream) != 1)
+                return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(TapePartitionHeader);
+            payload      = tapePartitionHeader.length;
+            expected     = tapePartitionHeader.crc64;
+            break;
+        case DataPositionMeasurementBlock:
+            if(fread(&dpmHeader, sizeof(DataPositionMeasurementHeader), 1, stream) != 1)
+                return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(DataPositionMeasurementHeader);
+            payload      = dpmHeader.length;
+            expected     = dpmHeader.crc64;
+            break;
+        case DumpHardwareBlock:
+            if(fread(&dumpHardwareHeader, sizeof(DumpHardwareHeader), 1, stream) != 1)
+                return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(DumpHardwareHeader);
+            payload      = dumpHardwareHeader.length;
+            expected     = dumpHardwareHeader.crc64;
+            break;
+        case ParentBlock:
+            if(fread(&parentHeader, sizeof(ParentBlockHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(ParentBlockHeader);
+            payload      = parentHeader.length;
+            expected     = parentHeader.crc64;
+            break;
+        case SnapshotBlock:
+            if(fread(&snapshotHeader, sizeof(SnapshotHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            if(snapshotHeader.entries > fileSize) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(SnapshotHeader);
+            payload      = sizeof(SnapshotEntry) * snapshotHeader.entries;
+            expected     = snapshotHeader.crc64;
+            break;
+        case CheckpointBlock:
+            if(fread(&checkpointHeader, sizeof(CheckpointHeader), 1, stream) != 1)
+                return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            if(checkpointHeader.entries > fileSize) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(CheckpointHeader);
+            payload      = sizeof(CheckpointEntry) * checkpointHeader.entries;
+            expected     = checkpointHeader.crc64;
+            break;
+        // These have nothing to check their contents against
+        case GeometryBlock:
+            headerLength = sizeof(GeometryBlockHeader);
+            hasCrc       = false;
+            break;
+        case MetadataBlock:
+            if(fread(&metadataHeader, sizeof(MetadataBlockHeader), 1, stream) != 1)
+                return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            // Includes the header
+            headerLength = metadataHeader.blockSize < sizeof(MetadataBlockHeader) ? sizeof(MetadataBlockHeader)
+                                                                                  : metadataHeader.blockSize;
+            hasCrc       = false;
+            break;
+        case CicmBlock:
+            if(fread(&cicmHeader, sizeof(CicmMetadataBlock), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(CicmMetadataBlock);
+            payload      = cicmHeader.length;
+            hasCrc       = false;
+            break;
+        case ChecksumBlock:
+            if(fread(&checksumHeader, sizeof(ChecksumHeader), 1, stream) != 1) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+            headerLength = sizeof(ChecksumHeader);
+            payload      = checksumHeader.length;
+            hasCrc       = false;
+            break;
+        default: return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    if(headerLength > fileSize - offset || payload > fileSize - offset - headerLength)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    *length = headerLength + payload;
+
+    // At least the next block has to start right after it
+    if(!hasCrc)
+        return recover_followed(stream, offset + *length, fileSize) ? AARUF_STATUS_OK : AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    if(recover_fseek(stream, offset + headerLength, SEEK_SET) != 0) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    errorNo = recover_crc(stream, payload, buffer, &crc64);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    return crc64 == expected ? AARUF_STATUS_OK : AARUF_ERROR_INVALID_BLOCK_CRC;
+}
+
+// Only the first user data block is needed, for the sector size, the DDT points to the others
+static bool recover_indexed(const IndexEntry* entry, bool* userData)
+{
+    switch(entry->blockType)
+    {
+        case IndexBlock:
+        case CheckpointBlock: return false;
+        case DataBlock:
+            if(entry->dataType != UserData) return true;
+
+            if(*userData) return false;
+
+            *userData = true;
+            return true;
+        default: return true;
+    }
+}
+
+/**
+ * Scans the whole image for blocks and rebuilds its index from the ones that are not damaged, in the order they were
+ * found. How many were found and how many were damaged is left in the context.
+ * @param context Image context, with the header read
+ * @param entries Rebuilt index entries, to be freed by the caller
+ * @param count Number of index entries
+ */
+int32_t aaruf_recover_index(void* context, IndexEntry** entries, uint16_t* count)
+{
+    aaruformatContext* ctx        = context;
+    uint64_t           offset     = sizeof(AaruHeader);
+    uint64_t           fileSize;
+    uint64_t           length;
+    uint64_t           next;
+    uint8_t*           buffer;
+    IndexEntry*        found      = NULL;
+    IndexEntry*        grown;
+    IndexEntry         entry;
+    uint32_t           foundCount = 0;
+    uint32_t           capacity   = 0;
+    bool               userData   = false;
+    int32_t            errorNo    = AARUF_STATUS_OK;
+
+    if(recover_fseek(ctx->imageStream, 0, SEEK_END) != 0) return AARUF_ERROR_CANNOT_READ_INDEX;
+
+    fileSize = (uint64_t)recover_ftell(ctx->imageStream);
+    buffer   = malloc(RECOVER_BUFFER_SIZE);
+
+    if(buffer == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    ctx->recoveredBlocks = 0;
+    ctx->damagedBlocks   = 0;
+    ctx->skippedBytes    = 0;
+
+    while(offset + sizeof(uint32_t) <= fileSize)
+    {
+        errorNo = recover_block(ctx->imageStream, offset, fileSize, buffer, &entry, &length);
+
+        if(errorNo == AARUF_ERROR_NOT_ENOUGH_MEMORY) break;
+
+        if(errorNo != AARUF_STATUS_OK)
+        {
+            if(errorNo == AARUF_ERROR_INVALID_BLOCK_CRC)
+            {
+                fprintf(stderr,
+                        "libaaruformat: Block type %4.4s at %" PRIu64 " is damaged, skipping it...\n",
+                        (char*)&entry.blockType,
+                        offset);
+                ctx->damagedBlocks++;
+            }
+
+            // Its length cannot be trusted, so the next block is searched for
+            next = recover_search(ctx->imageStream, offset + 1, fileSize, buffer);
+            ctx->skippedBytes += next - offset;
+            offset = next;
+            continue;
+        }
+
+        ctx->recoveredBlocks++;
+        offset += length;
+
+        if(!recover_indexed(&entry, &userData)) continue;
+
+        if(foundCount == UINT16_MAX)
+        {
+            fprintf(stderr, "libaaruformat: Too many blocks to index, ignoring block at %" PRIu64 "\n", entry.offset);
+            continue;
+        }
+
+        if(foundCount == capacity)
+        {
+            grown = realloc(found, sizeof(IndexEntry) * (capacity + 256));
+
+            if(grown == NULL)
+            {
+                errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+                break;
+            }
+
+            found = grown;
+            capacity += 256;
+        }
+
+        found[foundCount++] = entry;
+    }
+
+    free(buffer);
+
+    if(errorNo == AARUF_ERROR_NOT_ENOUGH_MEMORY)
+    {
+        free(found);
+        return errorNo;
+    }
+
+    fprintf(stderr,
+            "libaaruformat: Found %" PRIu64 " blocks, %" PRIu64 " damaged, %" PRIu64 " bytes skipped\n",
+            ctx->recoveredBlocks,
+            ctx->damagedBlocks,
+            ctx->skippedBytes);
+
+    if(foundCount == 0)
+    {
+        free(found);
+        return AARUF_ERROR_CANNOT_READ_INDEX;
+    }
+
+    *entries = found;
+    *count   = (uint16_t)foundCount;
+
+    return AARUF_STATUS_OK;
+}
@@ -0,0 +1,235 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Snapshots. A snapshot appends the blocks of the sectors written again, a snapshot block with their new DDT entries
+// and a new index to the image, which keeps every entry of the previous index. The header is rewritten last, so until
+// then the image opens as the previous snapshot. The snapshot block points to the previous index, older snapshots are
+// opened from there.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+static int32_t snapshot_read_header(FILE* stream, uint64_t offset, SnapshotHeader* header)
+{
+    if(fseek(stream, offset, SEEK_SET) != 0 || fread(header, sizeof(SnapshotHeader), 1, stream) != 1 ||
+       header->identifier != SnapshotBlock)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    return AARUF_STATUS_OK;
+}
+
+static IndexEntry* snapshot_read_index(FILE* stream, uint64_t offset, uint16_t* count)
+{
+    IndexHeader indexHeader;
+    IndexEntry* entries;
+
+    if(fseek(stream, offset, SEEK_SET) != 0 || fread(&indexHeader, sizeof(IndexHeader), 1, stream) != 1 ||
+       indexHeader.identifier != IndexBlock)
+        return NULL;
+
+    entries = malloc(sizeof(IndexEntry) * indexHeader.entries);
+
+    if(entries == NULL) return NULL;
+
+    if(fread(entries, sizeof(IndexEntry), indexHeader.entries, stream) != indexHeader.entries)
+    {
+        free(entries);
+        return NULL;
+    }
+
+    *count = indexHeader.entries;
+
+    return entries;
+}
+
+/**
+ * Points the header to the index of an older snapshot, so the image is opened as it was then
+ * @param context Image context, with the header read
+ * @param snapshot Snapshot to open, 0 is the image as first written
+ */
+int32_t aaruf_snapshot_find(void* context, uint32_t snapshot)
+{
+    aaruformatContext* ctx         = context;
+    IndexEntry*        entries;
+    SnapshotHeader     header;
+    uint64_t           indexOffset = ctx->header.indexOffset;
+    uint16_t           count       = 0;
+    uint16_t           i;
+
+    entries = snapshot_read_index(ctx->imageStream, ctx->header.indexOffset, &count);
+
+    if(entries == NULL) return AARUF_ERROR_CANNOT_READ_INDEX;
+
+    ctx->snapshots = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        if(entries[i].blockType != SnapshotBlock) continue;
+
+        if(snapshot_read_header(ctx->imageStream, entries[i].offset, &header) != AARUF_STATUS_OK) continue;
+
+        if(header.snapshot > ctx->snapshots) ctx->snapshots = header.snapshot;
+
+        // Taken on top of the one requested
+        if(header.snapshot == snapshot + 1) indexOffset = header.previousIndexOffset;
+    }
+
+    free(entries);
+
+    if(snapshot > ctx->snapshots) return AARUF_ERROR_SNAPSHOT_NOT_FOUND;
+
+    if(snapshot < ctx->snapshots && indexOffset == ctx->header.indexOffset) return AARUF_ERROR_SNAPSHOT_NOT_FOUND;
+
+    ctx->header.indexOffset = indexOffset;
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t snapshot_apply_one(aaruformatContext* ctx, uint64_t offset, const SnapshotHeader* header)
+{
+    SnapshotEntry* entries;
+    uint64_t       crc64;
+    uint64_t       i;
+    int32_t        errorNo = AARUF_STATUS_OK;
+
+    // Nothing was written again
+    if(header->entries == 0) return AARUF_STATUS_OK;
+
+    if(header->entries > ctx->imageInfo.Sectors) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    entries = malloc(sizeof(SnapshotEntry) * header->entries);
+
+    if(entries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, offset + sizeof(SnapshotHeader), SEEK_SET) != 0 ||
+       fread(entries, sizeof(SnapshotEntry), header->entries, ctx->imageStream) != header->entries)
+    {
+        free(entries);
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    crc64 = bswap_64(aaruf_crc64_data((const uint8_t*)entries, sizeof(SnapshotEntry) * header->entries));
+
+    if(crc64 != header->crc64)
+    {
+        free(entries);
+        return AARUF_ERROR_INVALID_BLOCK_CRC;
+    }
+
+    for(i = 0; i < header->entries && errorNo == AARUF_STATUS_OK; i++)
+    {
+        if(entries[i].sectorAddress >= ctx->imageInfo.Sectors)
+        {
+            errorNo = AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        errorNo = aaruf_set_ddt_entry(ctx, entries[i].sectorAddress, entries[i].ddtEntry);
+    }
+
+    free(entries);
+
+    return errorNo;
+}
+
+typedef struct
+{
+    uint64_t       offset;
+    uint16_t       position;
+    SnapshotHeader header;
+} snapshot_found;
+
+static int compare_snapshot(const void* a, const void* b)
+{
+    const snapshot_found* x = a;
+    const snapshot_found* y = b;
+
+    if(x->header.snapshot != y->header.snapshot) return x->header.snapshot < y->header.snapshot ? -1 : 1;
+
+    return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/**
+ * Replaces the DDT entries of the sectors written again by every snapshot in the index, oldest first
+ * @param context Image context, with the user data DDT read and not yet turned into extents
+ * @param entries Index entries
+ * @param count Number of index entries
+ */
+int32_t aaruf_snapshot_apply(void* context, const IndexEntry* entries, uint16_t count)
+{
+    aaruformatContext* ctx       = context;
+    snapshot_found*    snapshots = NULL;
+    uint32_t           found     = 0;
+    uint32_t           applied   = 0;
+    uint32_t           i;
+    int32_t            errorNo   = AARUF_STATUS_OK;
+
+    for(i = 0; i < count; i++)
+    {
+        if(entries[i].blockType != SnapshotBlock) continue;
+
+        if(snapshots == NULL)
+        {
+            snapshots = malloc(sizeof(snapshot_found) * count);
+
+            if(snapshots == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        if(snapshot_read_header(ctx->imageStream, entries[i].offset, &snapshots[found].header) != AARUF_STATUS_OK)
+            continue;
+
+        snapshots[found].offset   = entries[i].offset;
+        snapshots[found].position = i;
+        found++;
+    }
+
+    // Each index lists every snapshot before it, in the order they were taken, but they are applied by number
+    if(found > 0) qsort(snapshots, found, sizeof(snapshot_found), compare_snapshot);
+
+    for(i = 0; i < found; i++)
+    {
+        // Listed twice, the first one in the index is used
+        if(snapshots[i].header.snapshot == applied) continue;
+
+        if(snapshots[i].header.snapshot != applied + 1) break;
+
+        errorNo = snapshot_apply_one(ctx, snapshots[i].offset, &snapshots[i].header);
+
+        if(errorNo != AARUF_STATUS_OK)
+        {
+            fprintf(stderr, "libaaruformat: Could not apply snapshot %u, error %d.\n", applied + 1, errorNo);
+            break;
+        }
+
+        applied++;
+    }
+
+    free(snapshots);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    ctx->snapshot = applied;
+
+    if(ctx->snapshots < applied) ctx->snapshots = applied;
+
+    return AARUF_STATUS_OK;
+}
@@ -27,6 +27,7 @@
 
 #include <aaruformat.h>
 
+#include "../3rdparty/lzma-21.03beta/C/Threads.h"
 #include "spamsum.h"
 
 static uint8_t b64[] = {0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50,
@@ -50,10 +51,27 @@ AARU_EXPORT spamsum_ctx* AARU_CALL aaruf_spamsum_init(void)
 
 AARU_EXPORT int AARU_CALL aaruf_spamsum_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len)
 {
-    int i;
     if(!ctx || !data) return -1;
 
-    for(i = 0; i < len; i++) fuzzy_engine_step(ctx, data[i]);
+    fuzzy_engine_update(ctx, data, len);
+
+    ctx->total_size += len;
+
+    return 0;
+}
+
+/* Same as aaruf_spamsum_update() but splits the buffer among up to the given number of threads. The resulting digest
+ * is the same. Falls back to the serial engine when the buffer is too small to be worth it. */
+AARU_EXPORT int AARU_CALL aaruf_spamsum_update_mt(spamsum_ctx* ctx, const uint8_t* data, uint32_t len, uint32_t threads)
+{
+    if(!ctx || !data) return -1;
+
+    if(threads > len / SPAMSUM_MT_MIN_CHUNK) threads = len / SPAMSUM_MT_MIN_CHUNK;
+
+    /* Chunks rebuild their rolling hash from the preceding bytes, which is only exact if the byte count does not wrap
+     * around inside the buffer */
+    if(threads < 2 || (uint64_t)ctx->roll.n + len > 0x100000000ULL || fuzzy_mt_update(ctx, data, len, threads) != 0)
+        fuzzy_engine_update(ctx, data, len);
 
     ctx->total_size += len;
 
@@ -68,38 +86,56 @@ AARU_EXPORT void AARU_CALL aaruf_spamsum_free(spamsum_ctx* ctx)
 #define ROLL_SUM(ctx) ((ctx)->roll.h1 + (ctx)->roll.h2 + (ctx)->roll.h3)
 #define SUM_HASH(c, h) (((h)*HASH_PRIME) ^ (c));
 #define SSDEEP_BS(index) (MIN_BLOCKSIZE << (index))
+#define MT_SKEW_POS (2 * ROLLING_WINDOW)
 
-AARU_LOCAL inline void fuzzy_engine_step(spamsum_ctx* ctx, uint8_t c)
+FORCE_INLINE void fuzzy_roll_step(roll_state* roll, uint8_t c)
 {
-    uint32_t i;
-    /* At each character we update the rolling hash and the normal hashes.
-     * When the rolling hash hits a reset value then we emit a normal hash
-     * as a element of the signature and reset the normal hash. */
-    roll_hash(ctx, c);
-    uint64_t h = ROLL_SUM(ctx);
+    roll->h2 -= roll->h1;
+    roll->h2 += ROLLING_WINDOW * c;
 
-    for(i = ctx->bh_start; i < ctx->bh_end; ++i)
-    {
-        ctx->bh[i].h      = SUM_HASH(c, ctx->bh[i].h);
-        ctx->bh[i].half_h = SUM_HASH(c, ctx->bh[i].half_h);
-    }
+    roll->h1 += c;
+    roll->h1 -= roll->window[roll->n % ROLLING_WINDOW];
+
+    roll->window[roll->n % ROLLING_WINDOW] = c;
+    roll->n++;
+
+    roll->h3 <<= 5;
+    roll->h3 ^= c;
+}
+
+/* Processes a reset point. m is (rolling hash + 1) / 3, so block size i hits when m is a multiple of 1 << i. Block
+ * hashes are taken from (and left in) the interleaved state array used by fuzzy_engine_update(), h for block size i at
+ * state[i * 2] and half_h at state[i * 2 + 1]. */
+FORCE_INLINE void fuzzy_engine_trigger(spamsum_ctx* ctx, uint16_t* state, uint64_t m)
+{
+    uint32_t i;
+    uint32_t obh;
+    uint32_t nbh;
 
     for(i = ctx->bh_start; i < ctx->bh_end; ++i)
     {
-        /* With growing blocksize almost no runs fail the next test. */
-        if(h % SSDEEP_BS(i) != SSDEEP_BS(i) - 1)
-            /* Once this condition is false for one bs, it is
-             * automatically false for all further bs. I.e. if
-             * h === -1 (mod 2*bs) then h === -1 (mod bs). */
-            break;
+        /* Once this condition is false for one bs, it is automatically false for all further bs. The last block size
+         * does not fit in an int, so h % SSDEEP_BS(i) never matches it. */
+        if(i >= NUM_BLOCKHASHES - 1 || (m & ((1ULL << i) - 1)) != 0) break;
 
         /* We have hit a reset point. We now emit hashes which are
          * based on all characters in the piece of the message between
          * the last reset point and this one */
-        if(0 == ctx->bh[i].d_len) fuzzy_try_fork_blockhash(ctx);
+        if(0 == ctx->bh[i].d_len && ctx->bh_end < NUM_BLOCKHASHES)
+        {
+            /* Fork a new block hash from the last one */
+            obh                      = ctx->bh_end - 1;
+            nbh                      = ctx->bh_end;
+            state[nbh * 2]           = state[obh * 2];
+            state[nbh * 2 + 1]       = state[obh * 2 + 1];
+            ctx->bh[nbh].digest[0]   = 0;
+            ctx->bh[nbh].half_digest = 0;
+            ctx->bh[nbh].d_len       = 0;
+            ++ctx->bh_end;
+        }
 
-        ctx->bh[i].digest[ctx->bh[i].d_len] = b64[ctx->bh[i].h % 64];
-        ctx->bh[i].half_digest              = b64[ctx->bh[i].half_h % 64];
+        ctx->bh[i].digest[ctx->bh[i].d_len] = b64[state[i * 2] % 64];
+        ctx->bh[i].half_digest              = b64[state[i * 2 + 1] % 64];
 
         if(ctx->bh[i].d_len < SPAMSUM_LENGTH - 1)
         {
@@ -110,11 +146,11 @@ AARU_LOCAL inline void fuzzy_engine_step(spamsum_ctx* ctx, uint8_t c)
              * last few pieces of the message into a single piece
              * */
             ctx->bh[i].digest[++ctx->bh[i].d_len] = 0;
-            ctx->bh[i].h                          = HASH_INIT;
+            state[i * 2]                          = (uint16_t)HASH_INIT;
 
             if(ctx->bh[i].d_len >= SPAMSUM_LENGTH / 2) continue;
 
-            ctx->bh[i].half_h      = HASH_INIT;
+            state[i * 2 + 1]       = (uint16_t)HASH_INIT;
             ctx->bh[i].half_digest = 0;
         }
         else
@@ -122,22 +158,86 @@ AARU_LOCAL inline void fuzzy_engine_step(spamsum_ctx* ctx, uint8_t c)
     }
 }
 
-AARU_LOCAL inline void roll_hash(spamsum_ctx* ctx, uint8_t c)
+/* Runs the engine over a whole buffer. The rolling window and all block hashes live in locals for the duration of the
+ * call, so the per-byte work is the rolling hash plus one multiply-xor per active block hash, done over a contiguous
+ * array the compiler can vectorize. Only the lowest 6 bits of a block hash ever reach the digest, and those only depend
+ * on the lowest bits of the previous value, so block hashes are kept as 16-bit values, which SSE2 and NEON multiply
+ * natively. Reset points are at most a third of the bytes, so a cheap necessary condition on the rolling sum filters
+ * them before the exact per block size check. */
+AARU_LOCAL void fuzzy_engine_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len)
 {
-    ctx->roll.h2 -= ctx->roll.h1;
-    ctx->roll.h2 += ROLLING_WINDOW * c;
+    uint16_t       state[NUM_BLOCKHASHES * 2];
+    uint8_t        window[ROLLING_WINDOW];
+    uint32_t       h1, h2, h3, n, w;
+    uint32_t       sum;
+    uint32_t       i, s, e;
+    uint32_t       mask;
+    uint8_t        c;
+    const uint8_t* end = data + len;
+
+    for(i = 0; i < NUM_BLOCKHASHES; i++)
+    {
+        state[i * 2]     = (uint16_t)ctx->bh[i].h;
+        state[i * 2 + 1] = (uint16_t)ctx->bh[i].half_h;
+    }
+
+    memcpy(window, ctx->roll.window, ROLLING_WINDOW);
+    h1 = ctx->roll.h1;
+    h2 = ctx->roll.h2;
+    h3 = ctx->roll.h3;
+    n  = ctx->roll.n;
+    w  = n % ROLLING_WINDOW;
+
+    s    = ctx->bh_start * 2;
+    e    = ctx->bh_end * 2;
+    mask = (1U << ctx->bh_start) - 1;
+
+    while(data < end)
+    {
+        c = *data++;
+
+        h2 -= h1;
+        h2 += ROLLING_WINDOW * c;
+        h1 += c;
+        h1 -= window[w];
+        window[w] = c;
+
+        /* The window index follows n % ROLLING_WINDOW, including when n wraps around */
+        if(++n == 0) w = 0;
+        else if(++w == ROLLING_WINDOW)
+            w = 0;
+
+        /* The original spamsum AND'ed this value with 0xFFFFFFFF which
+         * in theory should have no effect. This AND has been removed
+         * for performance (jk) */
+        h3 <<= 5;
+        h3 ^= c;
+
+        for(i = s; i < e; i++) state[i] = (uint16_t)SUM_HASH(c, (uint32_t)state[i]);
+
+        sum = h1 + h2 + h3;
 
-    ctx->roll.h1 += c;
-    ctx->roll.h1 -= ctx->roll.window[ctx->roll.n % ROLLING_WINDOW];
+        /* Every block size is 3 << n, so a reset point needs sum + 1 to be a multiple of both */
+        if(((sum + 1) & mask) != 0 || sum % 3 != 2) continue;
 
-    ctx->roll.window[ctx->roll.n % ROLLING_WINDOW] = c;
-    ctx->roll.n++;
+        fuzzy_engine_trigger(ctx, state, ((uint64_t)sum + 1) / 3);
 
-    /* The original spamsum AND'ed this value with 0xFFFFFFFF which
-     * in theory should have no effect. This AND has been removed
-     * for performance (jk) */
-    ctx->roll.h3 <<= 5;
-    ctx->roll.h3 ^= c;
+        s    = ctx->bh_start * 2;
+        e    = ctx->bh_end * 2;
+        mask = (1U << ctx->bh_start) - 1;
+    }
+
+    for(i = 0; i < NUM_BLOCKHASHES; i++)
+    {
+        ctx->bh[i].h      = state[i * 2];
+        ctx->bh[i].half_h = state[i * 2 + 1];
+    }
+
+    memcpy(ctx->roll.window, window, ROLLING_WINDOW);
+    ctx->roll.h1 = h1;
+    ctx->roll.h2 = h2;
+    ctx->roll.h3 = h3;
+    ctx->roll.n  = n;
 }
 
 AARU_LOCAL inline void fuzzy_try_reduce_blockhash(spamsum_ctx* ctx)
@@ -160,22 +260,6 @@ AARU_LOCAL inline void fuzzy_try_reduce_blockhash(spamsum_ctx* ctx)
     ++ctx->bh_start;
 }
 
-AARU_LOCAL inline void fuzzy_try_fork_blockhash(spamsum_ctx* ctx)
-{
-    if(ctx->bh_end >= NUM_BLOCKHASHES) return;
-
-    // assert(ctx->bh_end != 0);
-
-    uint32_t obh             = ctx->bh_end - 1;
-    uint32_t nbh             = ctx->bh_end;
-    ctx->bh[nbh].h           = ctx->bh[obh].h;
-    ctx->bh[nbh].half_h      = ctx->bh[obh].half_h;
-    ctx->bh[nbh].digest[0]   = 0;
-    ctx->bh[nbh].half_digest = 0;
-    ctx->bh[nbh].d_len       = 0;
-    ++ctx->bh_end;
-}
-
 AARU_EXPORT int AARU_CALL aaruf_spamsum_final(spamsum_ctx* ctx, uint8_t* result)
 {
     uint32_t bi     = ctx->bh_start;
@@ -313,3 +397,364 @@ AARU_EXPORT int AARU_CALL aaruf_spamsum_final(spamsum_ctx* ctx, uint8_t* result)
 
     return 0;
 }
+
+/* The parallel engine. Every chunk is scanned on its own and the results are merged serially into exactly what the
+ * serial engine would have produced.
+ *
+ * A block hash only reaches the digest through its lowest 6 bits, and for those each byte is a permutation of 64 values
+ * that is the same for every block size. A chunk cannot know the block hashes it starts with, so it tracks the
+ * composition of those permutations since its start (the map), and snapshots it at the reset points the merge can need:
+ * the first SPAMSUM_MT_TRIGGERS ones of each block size (a digest never grows past that), the last one of each block
+ * size and the end of the chunk. Apart from the first and last block sizes in use, block sizes do not affect each other:
+ * a block hash that is not forked yet is the same as the last one, which has not hit any reset point, so the merge
+ * replays every block size on its own and then works out where forks and reductions happened.
+ *
+ * The rolling hash depends on the last ROLLING_WINDOW bytes, except for h2 that keeps a constant skew from the windows
+ * seen when the byte count wrapped around. Measuring that skew once lets any chunk rebuild its starting state. */
+
+/* Rebuilds the rolling hash state before the byte at pos, that must be at least ROLLING_WINDOW, with n as byte count */
+AARU_LOCAL void fuzzy_mt_roll_at(roll_state* roll, const uint8_t* data, uint32_t pos, uint32_t n, uint32_t skew)
+{
+    uint32_t i;
+    uint8_t  c;
+
+    roll->h1 = 0;
+    roll->h2 = skew;
+    roll->h3 = 0;
+    roll->n  = n;
+
+    for(i = 0; i < ROLLING_WINDOW; i++)
+    {
+        c = data[pos - ROLLING_WINDOW + i];
+
+        roll->window[(n - ROLLING_WINDOW + i) % ROLLING_WINDOW] = c;
+
+        roll->h1 += c;
+        roll->h2 += (i + 1) * c;
+        roll->h3 = (roll->h3 << 5) ^ c;
+    }
+}
+
+static THREAD_FUNC_DECL fuzzy_mt_worker(void* param)
+{
+    fuzzy_mt_scan((spamsum_chunk*)param);
+
+    return 0;
+}
+
+AARU_LOCAL void fuzzy_mt_scan(spamsum_chunk* chunk)
+{
+    uint16_t       map[64];
+    uint8_t        window[ROLLING_WINDOW];
+    uint32_t       h1, h2, h3, n, w;
+    uint32_t       sum;
+    uint32_t       mask;
+    uint32_t       pos;
+    uint32_t       top;
+    uint32_t       i;
+    uint8_t        c;
+    const uint8_t* data = chunk->data;
+
+    for(i = 0; i < 64; i++) map[i] = (uint16_t)i;
+
+    memset(chunk->count, 0, sizeof(chunk->count));
+    memset(chunk->last_pos, 0xFF, sizeof(chunk->last_pos));
+    chunk->top   = -1;
+    chunk->snaps = 0;
+
+    memcpy(window, chunk->roll.window, ROLLING_WINDOW);
+    h1   = chunk->roll.h1;
+    h2   = chunk->roll.h2;
+    h3   = chunk->roll.h3;
+    n    = chunk->roll.n;
+    w    = n % ROLLING_WINDOW;
+    mask = (1U << chunk->bh_start) - 1;
+
+    for(pos = chunk->start; pos < chunk->end; pos++)
+    {
+        c = data[pos];
+
+        h2 -= h1;
+        h2 += ROLLING_WINDOW * c;
+        h1 += c;
+        h1 -= window[w];
+        window[w] = c;
+
+        if(++n == 0) w = 0;
+        else if(++w == ROLLING_WINDOW)
+            w = 0;
+
+        h3 <<= 5;
+        h3 ^= c;
+
+        for(i = 0; i < 64; i++) map[i] = (uint16_t)SUM_HASH(c, (uint32_t)map[i]);
+
+        sum = h1 + h2 + h3;
+
+        if(((sum + 1) & mask) != 0 || sum % 3 != 2) continue;
+
+        /* Biggest block size hitting a reset point here, all smaller ones hit it too */
+        top = chunk->bh_start;
+        while(top < NUM_BLOCKHASHES - 2 && ((sum + 1) & ((1U << (top + 1)) - 1)) == 0) top++;
+
+        if((int32_t)top > chunk->top) chunk->top = (int32_t)top;
+
+        /* Block sizes up to top have seen at least as many reset points as top */
+        if(chunk->count[top] < SPAMSUM_MT_TRIGGERS)
+        {
+            for(i = 0; i < 64; i++) chunk->snap[chunk->snaps * 64 + i] = map[i] % 64;
+            chunk->snap_pos[chunk->snaps] = pos;
+
+            for(i = chunk->bh_start; i <= top; i++)
+                if(chunk->count[i] < SPAMSUM_MT_TRIGGERS) chunk->first[i][chunk->count[i]] = (uint16_t)chunk->snaps;
+
+            chunk->snaps++;
+        }
+
+        for(i = chunk->bh_start; i <= top; i++) chunk->count[i]++;
+
+        for(i = 0; i < 64; i++) chunk->last[top][i] = map[i] % 64;
+        chunk->last_pos[top] = pos;
+    }
+
+    for(i = 0; i < 64; i++) chunk->end_map[i] = map[i] % 64;
+
+    memcpy(chunk->roll.window, window, ROLLING_WINDOW);
+    chunk->roll.h1 = h1;
+    chunk->roll.h2 = h2;
+    chunk->roll.h3 = h3;
+    chunk->roll.n  = n;
+}
+
+/* Finds the first reset point of the given block size at or after pos, or UINT32_MAX if there is none */
+AARU_LOCAL uint32_t fuzzy_mt_find_trigger(const spamsum_ctx* ctx, const uint8_t* data, uint32_t pos, uint32_t len,
+                                          uint32_t skew, uint32_t index)
+{
+    roll_state roll;
+    uint32_t   sum;
+    uint32_t   mask = (1U << index) - 1;
+    uint32_t   i;
+
+    if(pos < MT_SKEW_POS)
+    {
+        roll = ctx->roll;
+        for(i = 0; i < pos; i++) fuzzy_roll_step(&roll, data[i]);
+    }
+    else
+        fuzzy_mt_roll_at(&roll, data, pos, ctx->roll.n + pos, skew);
+
+    for(; pos < len; pos++)
+    {
+        fuzzy_roll_step(&roll, data[pos]);
+
+        sum = roll.h1 + roll.h2 + roll.h3;
+
+        if(((sum + 1) & mask) == 0 && sum % 3 == 2) return pos;
+    }
+
+    return UINT32_MAX;
+}
+
+FORCE_INLINE uint8_t fuzzy_mt_preimage(const uint8_t* map, uint8_t value)
+{
+    uint8_t i;
+
+    for(i = 0; i < 63; i++)
+        if(map[i] == value) break;
+
+    return i;
+}
+
+AARU_LOCAL int fuzzy_mt_update(spamsum_ctx* ctx, const uint8_t* data, uint32_t len, uint32_t threads)
+{
+    spamsum_chunk* chunks;
+    spamsum_chunk* chunk;
+    CThread*       workers;
+    blockhash_ctx* bh;
+    roll_state     roll;
+    const uint8_t* map;
+    uint32_t       skew;
+    uint32_t       i, k, t;
+    uint32_t       pos;
+    int32_t        top = -1;
+    int32_t        last_of[NUM_BLOCKHASHES];
+    uint8_t        y[NUM_BLOCKHASHES];
+    uint8_t        half_y[NUM_BLOCKHASHES];
+    uint32_t       full_at[NUM_BLOCKHASHES];
+    uint32_t       half_at[NUM_BLOCKHASHES];
+    uint32_t       half_full[NUM_BLOCKHASHES];
+    uint32_t       bh_start = ctx->bh_start;
+
+    chunks  = (spamsum_chunk*)calloc(threads, sizeof(spamsum_chunk));
+    workers = (CThread*)calloc(threads, sizeof(CThread));
+
+    for(i = 0; chunks != NULL && workers != NULL && i < threads; i++)
+    {
+        chunks[i].snap     = (uint8_t*)malloc(SPAMSUM_MT_TRIGGERS * (NUM_BLOCKHASHES - 1) * 64);
+        chunks[i].snap_pos = (uint32_t*)malloc(SPAMSUM_MT_TRIGGERS * (NUM_BLOCKHASHES - 1) * sizeof(uint32_t));
+
+        if(chunks[i].snap == NULL || chunks[i].snap_pos == NULL) break;
+    }
+
+    if(chunks == NULL || workers == NULL || i < threads)
+    {
+        for(i = 0; chunks != NULL && i < threads; i++)
+        {
+            free(chunks[i].snap);
+            free(chunks[i].snap_pos);
+        }
+
+        free(chunks);
+        free(workers);
+        return -1;
+    }
+
+    /* Past the first few bytes the rolling hash is the one rebuilt from the window plus the skew */
+    roll = ctx->roll;
+    for(i = 0; i < MT_SKEW_POS; i++) fuzzy_roll_step(&roll, data[i]);
+    skew = roll.h2;
+    fuzzy_mt_roll_at(&roll, data, MT_SKEW_POS, ctx->roll.n + MT_SKEW_POS, 0);
+    skew -= roll.h2;
+
+    for(i = 0; i < threads; i++)
+    {
+        chunks[i].data     = data;
+        chunks[i].start    = (uint32_t)((uint64_t)len * i / threads);
+        chunks[i].end      = (uint32_t)((uint64_t)len * (i + 1) / threads);
+        chunks[i].bh_start = bh_start;
+
+        if(i == 0) chunks[i].roll = ctx->roll;
+        else
+            fuzzy_mt_roll_at(&chunks[i].roll, data, chunks[i].start, ctx->roll.n + chunks[i].start, skew);
+    }
+
+    for(i = 1; i < threads; i++)
+    {
+        Thread_Construct(&workers[i]);
+
+        if(Thread_Create(&workers[i], fuzzy_mt_worker, &chunks[i]) != 0) fuzzy_mt_scan(&chunks[i]);
+    }
+
+    fuzzy_mt_scan(&chunks[0]);
+
+    for(i = 1; i < threads; i++)
+        if(Thread_WasCreated(&workers[i])) Thread_Wait_Close(&workers[i]);
+
+    /* Block hashes not forked yet are copies of the last one, that has not hit any reset point */
+    for(k = ctx->bh_end; k < NUM_BLOCKHASHES; k++)
+    {
+        ctx->bh[k].h           = ctx->bh[ctx->bh_end - 1].h;
+        ctx->bh[k].half_h      = ctx->bh[ctx->bh_end - 1].half_h;
+        ctx->bh[k].digest[0]   = 0;
+        ctx->bh[k].half_digest = 0;
+        ctx->bh[k].d_len       = 0;
+    }
+
+    for(k = bh_start; k < NUM_BLOCKHASHES; k++)
+    {
+        y[k]         = ctx->bh[k].h % 64;
+        half_y[k]    = ctx->bh[k].half_h % 64;
+        full_at[k]   = UINT32_MAX;
+        half_at[k]   = UINT32_MAX;
+        half_full[k] = ctx->bh[k].d_len >= SPAMSUM_LENGTH / 2;
+    }
+
+    /* Replays every block size over the snapshots. y is the value that, run through the map of the chunk, gives the
+     * block hash at any point of it */
+    for(i = 0; i < threads; i++)
+    {
+        chunk = &chunks[i];
+
+        if(chunk->top > top) top = chunk->top;
+
+        /* The last reset point of a block size is the last one of it or any bigger one */
+        last_of[NUM_BLOCKHASHES - 1] = -1;
+        for(k = NUM_BLOCKHASHES - 1; k-- > bh_start;)
+        {
+            last_of[k] = last_of[k + 1];
+
+            if(chunk->last_pos[k] != UINT32_MAX &&
+               (last_of[k] < 0 || chunk->last_pos[k] > chunk->last_pos[last_of[k]]))
+                last_of[k] = (int32_t)k;
+        }
+
+        for(k = bh_start; k < NUM_BLOCKHASHES; k++)
+        {
+            bh = &ctx->bh[k];
+
+            for(t = 0; t < chunk->count[k] && t < SPAMSUM_MT_TRIGGERS && bh->d_len < SPAMSUM_LENGTH - 1; t++)
+            {
+                map = chunk->snap + chunk->first[k][t] * 64;
+
+                bh->digest[bh->d_len]   = b64[map[y[k]]];
+                bh->half_digest         = b64[map[half_y[k]]];
+                bh->digest[++bh->d_len] = 0;
+                y[k]                    = fuzzy_mt_preimage(map, HASH_INIT % 64);
+
+                if(bh->d_len == SPAMSUM_LENGTH / 2) half_at[k] = chunk->snap_pos[chunk->first[k][t]];
+
+                if(bh->d_len >= SPAMSUM_LENGTH / 2) continue;
+
+                half_y[k]       = fuzzy_mt_preimage(map, HASH_INIT % 64);
+                bh->half_digest = 0;
+            }
+
+            /* Once the digest is full its last character is rewritten at every reset point, so only the last one of
+             * the chunk matters, but the first one is the first chance to reduce */
+            if(t < chunk->count[k])
+            {
+                if(full_at[k] == UINT32_MAX) full_at[k] = chunk->snap_pos[chunk->first[k][t]];
+
+                map                            = chunk->last[last_of[k]];
+                bh->digest[SPAMSUM_LENGTH - 1] = b64[map[y[k]]];
+                bh->half_digest                = b64[map[half_y[k]]];
+            }
+
+            y[k]      = chunk->end_map[y[k]];
+            half_y[k] = chunk->end_map[half_y[k]];
+        }
+    }
+
+    for(k = bh_start; k < NUM_BLOCKHASHES; k++)
+    {
+        ctx->bh[k].h      = y[k];
+        ctx->bh[k].half_h = half_y[k];
+    }
+
+    /* A block size forks the next one on its first reset point */
+    if(top >= 0 && ctx->bh_end < (uint32_t)top + 2)
+        ctx->bh_end = (uint32_t)top + 2 < NUM_BLOCKHASHES ? (uint32_t)top + 2 : NUM_BLOCKHASHES;
+
+    /* Reductions happen on a reset point of the first block size once its digest is full and the next one is half full,
+     * no earlier than the previous reduction */
+    pos = 0;
+    for(k = bh_start; k < NUM_BLOCKHASHES - 1; k++)
+    {
+        if((uint64_t)SSDEEP_BS(k) * SPAMSUM_LENGTH >= ctx->total_size || full_at[k] == UINT32_MAX) break;
+
+        if(!half_full[k + 1] && half_at[k + 1] == UINT32_MAX) break;
+
+        t = full_at[k] > pos ? full_at[k] : pos;
+
+        if(!half_full[k + 1] && half_at[k + 1] >= t) t = half_at[k + 1] + 1;
+
+        pos = t == full_at[k] ? t : fuzzy_mt_find_trigger(ctx, data, t, len, skew, k);
+
+        if(pos == UINT32_MAX) break;
+
+        ctx->bh_start = k + 1;
+    }
+
+    ctx->roll = chunks[threads - 1].roll;
+
+    for(i = 0; i < threads; i++)
+    {
+        free(chunks[i].snap);
+        free(chunks[i].snap_pos);
+    }
+
+    free(chunks);
+    free(workers);
+
+    return 0;
+}
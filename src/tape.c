@@ -0,0 +1,317 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tape images. Each tape block is stored as a sector, the tape file and partition blocks list where each file and
+// partition starts and ends. Files are kept sorted by partition and number so they are found by binary search.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+static int compare_tape_file(const void* a, const void* b)
+{
+    const TapeFileEntry* x = a;
+    const TapeFileEntry* y = b;
+
+    if(x->partition != y->partition) return x->partition < y->partition ? -1 : 1;
+
+    return x->file < y->file ? -1 : x->file > y->file;
+}
+
+/**
+ * Reads the tape file block, keeping the files sorted by partition and number
+ * @param context Image context
+ * @param offset Offset of the block in the image
+ */
+int32_t aaruf_tape_read_files(void* context, uint64_t offset)
+{
+    aaruformatContext* ctx = context;
+    TapeFileHeader     header;
+    TapeFileEntry*     files;
+    uint64_t           crc64;
+    uint32_t           i;
+
+    if(fseek(ctx->imageStream, offset, SEEK_SET) != 0 ||
+       fread(&header, sizeof(TapeFileHeader), 1, ctx->imageStream) != 1 || header.identifier != TapeFileBlock ||
+       header.length != sizeof(TapeFileEntry) * header.entries)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    files = malloc(header.length);
+
+    if(files == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fread(files, sizeof(TapeFileEntry), header.entries, ctx->imageStream) != header.entries)
+    {
+        free(files);
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    crc64 = bswap_64(aaruf_crc64_data((const uint8_t*)files, header.length));
+
+    if(crc64 != header.crc64)
+    {
+        free(files);
+        return AARUF_ERROR_INVALID_BLOCK_CRC;
+    }
+
+    // A file must be made of blocks that are in the image
+    for(i = 0; i < header.entries; i++)
+    {
+        if(files[i].firstBlock <= files[i].lastBlock && files[i].lastBlock < ctx->imageInfo.Sectors) continue;
+
+        free(files);
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    qsort(files, header.entries, sizeof(TapeFileEntry), compare_tape_file);
+
+    free(ctx->tapeFiles);
+    ctx->tapeFiles     = files;
+    ctx->tapeFileCount = header.entries;
+
+    fprintf(stderr, "libaaruformat: Found %u tape files at position %" PRIu64 ".\n", header.entries, offset);
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Reads the tape partition block
+ * @param context Image context
+ * @param offset Offset of the block in the image
+ */
+int32_t aaruf_tape_read_partitions(void* context, uint64_t offset)
+{
+    aaruformatContext*  ctx = context;
+    TapePartitionHeader header;
+    TapePartitionEntry* partitions;
+    uint64_t            crc64;
+
+    if(fseek(ctx->imageStream, offset, SEEK_SET) != 0 ||
+       fread(&header, sizeof(TapePartitionHeader), 1, ctx->imageStream) != 1 ||
+       header.identifier != TapePartitionBlock || header.length != sizeof(TapePartitionEntry) * header.entries)
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+    partitions = malloc(header.length);
+
+    if(partitions == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fread(partitions, sizeof(TapePartitionEntry), header.entries, ctx->imageStream) != header.entries)
+    {
+        free(partitions);
+        return AARUF_ERROR_CANNOT_READ_BLOCK;
+    }
+
+    crc64 = bswap_64(aaruf_crc64_data((const uint8_t*)partitions, header.length));
+
+    if(crc64 != header.crc64)
+    {
+        free(partitions);
+        return AARUF_ERROR_INVALID_BLOCK_CRC;
+    }
+
+    free(ctx->tapePartitions);
+    ctx->tapePartitions     = partitions;
+    ctx->tapePartitionCount = header.entries;
+
+    fprintf(stderr, "libaaruformat: Found %u tape partitions at position %" PRIu64 ".\n", header.entries, offset);
+
+    return AARUF_STATUS_OK;
+}
+
+static const TapeFileEntry* tape_find_file(const aaruformatContext* ctx, uint8_t partition, uint32_t file)
+{
+    TapeFileEntry key;
+    uint32_t      low  = 0;
+    uint32_t      high = ctx->tapeFileCount;
+    uint32_t      mid;
+    int           cmp;
+
+    key.partition = partition;
+    key.file      = file;
+
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+        cmp = compare_tape_file(&ctx->tapeFiles[mid], &key);
+
+        if(cmp == 0) return &ctx->tapeFiles[mid];
+
+        if(cmp < 0) low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return NULL;
+}
+
+/**
+ * Gets the files of a tape image, sorted by partition and file number
+ * @param context Image context
+ * @param files Files, owned by the context
+ * @param count Number of files, 0 if the image is not a tape
+ */
+int32_t aaruf_get_tape_files(void* context, const TapeFileEntry** files, uint32_t* count)
+{
+    aaruformatContext* ctx;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    *files = ctx->tapeFiles;
+    *count = ctx->tapeFileCount;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Gets the partitions of a tape image
+ * @param context Image context
+ * @param partitions Partitions, owned by the context
+ * @param count Number of partitions, 0 if the image is not a tape
+ */
+int32_t aaruf_get_tape_partitions(void* context, const TapePartitionEntry** partitions, uint8_t* count)
+{
+    aaruformatContext* ctx;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    *partitions = ctx->tapePartitions;
+    *count      = ctx->tapePartitionCount;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Reads the contents of a tape file as a stream of bytes, every block of the image being the same size. Reading a
+ * file from start to end makes the blocks after the ones being read be decoded in the background, unless the caller
+ * already set a prefetch depth with aaruf_set_prefetch_depth().
+ * @param context Image context
+ * @param partition Partition the file is in
+ * @param file File number in the partition
+ * @param offset Byte in the file to start reading at
+ * @param data Buffer for the data
+ * @param length Size of the buffer, set to the bytes read, 0 past the end of the file
+ * @return AARUF_STATUS_OK, or the error reading a block with length set to the bytes read before it
+ */
+int32_t aaruf_read_tape_file(void*     context,
+                             uint8_t   partition,
+                             uint32_t  file,
+                             uint64_t  offset,
+                             uint8_t*  data,
+                             uint32_t* length)
+{
+    aaruformatContext*   ctx;
+    const TapeFileEntry* entry;
+    uint8_t*             block = NULL;
+    uint64_t             fileLength;
+    uint64_t             sector;
+    uint32_t             blockSize;
+    uint32_t             within;
+    uint32_t             chunk;
+    uint32_t             sectorLength;
+    uint32_t             done = 0;
+    uint32_t             wanted;
+    int32_t              errorNo = AARUF_STATUS_OK;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    entry = tape_find_file(ctx, partition, file);
+
+    if(entry == NULL) return AARUF_ERROR_TAPE_FILE_NOT_FOUND;
+
+    blockSize = ctx->imageInfo.SectorSize;
+
+    if(blockSize == 0 || entry->firstBlock > entry->lastBlock || entry->lastBlock >= ctx->imageInfo.Sectors)
+        return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    fileLength = (entry->lastBlock - entry->firstBlock + 1) * blockSize;
+
+    if(offset >= fileLength)
+    {
+        *length = 0;
+        return AARUF_STATUS_OK;
+    }
+
+    wanted = fileLength - offset < *length ? (uint32_t)(fileLength - offset) : *length;
+
+    // Only tried once, the caller may disable it afterwards
+    if(!ctx->tapeReadAhead)
+    {
+        ctx->tapeReadAhead = true;
+
+        if(ctx->prefetcher == NULL) aaruf_set_prefetch_depth(ctx, TAPE_READ_AHEAD_BLOCKS);
+    }
+
+    while(done < wanted)
+    {
+        sector       = entry->firstBlock + (offset + done) / blockSize;
+        within       = (uint32_t)((offset + done) % blockSize);
+        chunk        = blockSize - within < wanted - done ? blockSize - within : wanted - done;
+        sectorLength = blockSize;
+
+        // Whole blocks go straight to the caller
+        if(chunk == blockSize)
+        {
+            errorNo = aaruf_read_sector(ctx, sector, data + done, &sectorLength);
+
+            if(errorNo != AARUF_STATUS_OK) break;
+
+            done += chunk;
+            continue;
+        }
+
+        if(block == NULL) block = malloc(blockSize);
+
+        if(block == NULL)
+        {
+            errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        errorNo = aaruf_read_sector(ctx, sector, block, &sectorLength);
+
+        if(errorNo != AARUF_STATUS_OK) break;
+
+        memcpy(data + done, block + within, chunk);
+        done += chunk;
+    }
+
+    free(block);
+
+    *length = done;
+
+    return errorNo;
+}
@@ -22,27 +22,24 @@
 
 #define VERIFY_SIZE 1048576
 
-int32_t aaruf_verify_image(void* context)
+static int32_t verify_image(aaruformatContext* ctx)
 {
-    aaruformatContext* ctx;
-    uint64_t           crc64;
-    int                i;
-    IndexHeader        index_header;
-    IndexEntry*        index_entries;
-    size_t             read_bytes;
-    void*              buffer;
-    crc64_ctx*         crc64_context;
-    BlockHeader        block_header;
-    uint64_t           verified_bytes;
-    DdtHeader          ddt_header;
-    TracksHeader       tracks_header;
-
-    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
-
-    ctx = context;
-
-    // Not a libaaruformat context
-    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+    uint64_t        crc64;
+    int             i;
+    IndexHeader     index_header;
+    IndexEntry*     index_entries;
+    size_t          read_bytes;
+    void*           buffer;
+    crc64_ctx*      crc64_context;
+    BlockHeader     block_header;
+    uint64_t        verified_bytes;
+    DdtHeader       ddt_header;
+    TracksHeader    tracks_header;
+    const LbaRange* ranges;
+    uint64_t        range_count;
+    uint64_t        r;
+    uint64_t        damaged_blocks = 0;
+    int32_t         errorNo;
 
     // This will traverse all blocks and check their CRC64 without uncompressing them
     fprintf(stderr, "Checking index integrity at %lu.\n", ctx->header.indexOffset);
@@ -151,8 +148,23 @@ int32_t aaruf_verify_image(void* context)
                 if(crc64 != block_header.cmpCrc64)
                 {
                     fprintf(stderr, "Expected block CRC 0x%16lX but got 0x%16lX.\n", block_header.cmpCrc64, crc64);
-                    free(index_entries);
-                    return AARUF_ERROR_INVALID_BLOCK_CRC;
+                    damaged_blocks++;
+
+                    // Keep checking the other blocks, the sectors stored in this one are damaged. Building the reverse
+                    // DDT takes the prefetcher lock itself, the next block is sought again after it.
+                    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+                    errorNo = aaruf_get_block_sectors(ctx, index_entries[i].offset, &ranges, &range_count);
+
+                    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+                    if(errorNo != AARUF_STATUS_OK) continue;
+
+                    for(r = 0; r < range_count; r++)
+                        fprintf(stderr,
+                                "Sectors %" PRIu64 " to %" PRIu64 " are damaged.\n",
+                                ranges[r].start,
+                                ranges[r].start + ranges[r].length - 1);
                 }
 
                 break;
@@ -237,5 +249,30 @@ int32_t aaruf_verify_image(void* context)
         }
     }
 
-    return AARUF_STATUS_OK;
-}
\ No newline at end of file
+    free(buffer);
+    free(index_entries);
+
+    return damaged_blocks > 0 ? AARUF_ERROR_INVALID_BLOCK_CRC : AARUF_STATUS_OK;
+}
+
+int32_t aaruf_verify_image(void* context)
+{
+    aaruformatContext* ctx;
+    int32_t            errorNo;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    // The prefetcher shares the image stream
+    if(ctx->prefetcher != NULL) aaruf_prefetch_lock(ctx->prefetcher);
+
+    errorNo = verify_image(ctx);
+
+    if(ctx->prefetcher != NULL) aaruf_prefetch_unlock(ctx->prefetcher);
+
+    return errorNo;
+}
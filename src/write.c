@@ -0,0 +1,2690 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Image creation. Sectors are gathered in blocks, filled blocks are compressed by a pool of threads while the caller
+// keeps writing, and written to the image strictly in the order they were filled so the layout does not depend on the
+// number of threads.
+//
+// Until the image is finished the DDT points sectors to the sequence number of their block, as the offset of a block is
+// only known once it is written. Sectors already stored elsewhere in the image are found by a fingerprint in a bounded
+// set associative table, confirmed byte by byte, and pointed to the stored copy instead of being stored again.
+//
+// Raw CD sectors travel with the block holding their user data. The threads check which prefixes and suffixes can be
+// rebuilt when reading, only the others are stored.
+//
+// A child image is compared with its parent as it is written, sectors the parent already has are left out of it. A
+// snapshot is compared the same way with the image it is appended to.
+//
+// Every few blocks a checkpoint with the DDT entries of the sectors in them is written after them, so an image whose
+// writing was interrupted can be resumed or salvaged up to the last checkpoint.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef AARU_HAS_SHA256
+#include <openssl/sha.h>
+#endif
+
+#include <aaruformat.h>
+
+#include "../3rdparty/lzma-21.03beta/C/Threads.h"
+
+/** Seconds between 1601/01/01 and 1970/01/01 */
+#define FILETIME_UNIX_EPOCH 11644473600LL
+
+// Raw CD sector written with aaruf_write_sector_long(), its prefix and suffix are checked along with the block
+typedef struct
+{
+    uint64_t address;
+    uint8_t  type;
+    bool     prefixCorrect;
+    bool     suffixCorrect;
+} raw_sector;
+
+typedef struct
+{
+    BlockHeader header;
+    uint8_t*    data;
+    uint8_t*    cmpData;
+    uint32_t    sectors;
+    // Every sector written while the block was being filled, in order, even the ones not stored in it
+    uint8_t*    stream;
+    uint32_t    streamLength;
+    uint32_t    level;
+    bool        deduplicate;
+    bool        streamed;
+    bool        sequential;
+    bool        done;
+    // Pending DDT entries of the sectors written while the block was being filled, for the checkpoints
+    SnapshotEntry* written;
+    uint32_t       writtenCount;
+    uint64_t       nextSector;
+    // Only allocated once tracks are set
+    raw_sector* raw;
+    uint8_t*    rawData;
+    uint32_t    rawCount;
+} write_job;
+
+// Block copied as is from another image by aaruf_copy_metadata()
+typedef struct
+{
+    uint32_t blockType;
+    uint16_t dataType;
+    uint8_t* data;
+    uint64_t length;
+} copied_block;
+
+// Prefixes or suffixes that cannot be rebuilt, stored one after the other
+typedef struct
+{
+    uint8_t* data;
+    uint32_t length;
+    uint32_t count;
+    uint32_t capacity;
+} corrected_fixes;
+
+typedef struct
+{
+    uint64_t fingerprint;
+    // Same as the pending DDT entry of the sector, 0 if empty
+    uint64_t location;
+} dedup_entry;
+
+typedef struct
+{
+    aaruformatContext*  ctx;
+    uint16_t            compression;
+    uint32_t            level;
+    uint32_t            sectorsPerBlock;
+    uint32_t            blockLength;
+    // Sequence of the block << shift | index in the block, plus one so 0 is still not written
+    uint64_t*           ddt;
+    write_job*          jobs;
+    uint32_t            slots;
+    write_job*          current;
+    CThread*            workers;
+    uint32_t            threads;
+    CSemaphore          freeSlots;
+    CSemaphore          queued;
+    // Protected by the lock
+    CCriticalSection    lock;
+    uint64_t            submitted;
+    uint64_t            taken;
+    uint64_t            committed;
+    bool                committing;
+    bool                stop;
+    int32_t             error;
+    // Only touched by whoever is committing, blockOffsets is read by the caller under the file lock
+    CCriticalSection    fileLock;
+    uint64_t*           blockOffsets;
+    uint64_t            blockOffsetCount;
+    uint64_t            blockOffsetCapacity;
+    uint64_t            nextOffset;
+    IndexEntry*         index;
+    uint32_t            indexCount;
+    uint32_t            indexCapacity;
+    CheckpointEntry*    checkpointEntries;
+    uint64_t            checkpointCount;
+    uint64_t            checkpointCapacity;
+    uint32_t            checkpointInterval;
+    uint32_t            checkpointBlocks;
+    uint32_t*           prefixDdt;
+    uint32_t*           suffixDdt;
+    corrected_fixes     prefixes;
+    corrected_fixes     suffixes;
+    spamsum_ctx*        spamsum;
+#ifdef AARU_HAS_SHA256
+    SHA256_CTX          sha256;
+#endif
+    // Only touched by the caller
+    uint64_t            nextSector;
+    bool                sequential;
+    bool                deduplicate;
+    dedup_entry*        dedupTable;
+    uint64_t            dedupMask;
+    // Last block read back from the image to confirm a match
+    uint8_t*            dedupBlock;
+    uint8_t*            dedupCmpData;
+    uint64_t            dedupBlockSequence;
+    void*               lzmaDecoder;
+    copied_block*       copiedBlocks;
+    uint32_t            copiedBlockCount;
+    bool                copiedChecksums;
+    // Image the new one is a child of, or the image as it was before the snapshot
+    aaruformatContext*  parent;
+    char*               parentPath;
+    uint8_t*            parentSector;
+    uint32_t            snapshot;
+    uint64_t            previousIndexOffset;
+    TrackEntry*         tracks;
+    uint16_t            trackCount;
+    uint16_t            lastTrack;
+    bool                longSectors;
+    TapeFileEntry*      tapeFiles;
+    uint32_t            tapeFileCount;
+    TapePartitionEntry* tapePartitions;
+    uint8_t             tapePartitionCount;
+    // Header and sorted entries, ready to be written
+    uint8_t*            dpmBlock;
+    uint64_t            dpmBlockLength;
+    // Read only once created, shared by all the threads
+    void*               eccContext;
+} image_writer;
+
+static int64_t filetime_now(void) { return ((int64_t)time(NULL) + FILETIME_UNIX_EPOCH) * 10000000; }
+
+static int32_t writer_add_index(image_writer* writer, uint32_t blockType, uint16_t dataType, uint64_t offset)
+{
+    IndexEntry* index;
+
+    if(writer->indexCount == writer->indexCapacity)
+    {
+        index = realloc(writer->index, sizeof(IndexEntry) * (writer->indexCapacity + 256));
+
+        if(index == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        writer->index = index;
+        writer->indexCapacity += 256;
+    }
+
+    writer->index[writer->indexCount].blockType = blockType;
+    writer->index[writer->indexCount].dataType  = dataType;
+    writer->index[writer->indexCount].offset    = offset;
+    writer->indexCount++;
+
+    return AARUF_STATUS_OK;
+}
+
+// Checks which prefixes and suffixes of the raw sectors in the block can be rebuilt when reading
+static void classify_raw(image_writer* writer, write_job* job)
+{
+    const uint8_t* sector;
+    raw_sector*    raw;
+    uint8_t        expected[24];
+    uint32_t       i;
+
+    for(i = 0; i < job->rawCount; i++)
+    {
+        raw    = &job->raw[i];
+        sector = job->rawData + (size_t)i * 2352;
+
+        // Mode 2 prefixes are rebuilt from the bytes that follow them
+        memcpy(expected, sector, sizeof(expected));
+        aaruf_ecc_cd_reconstruct_prefix(expected, raw->type, (int64_t)raw->address);
+
+        raw->prefixCorrect = memcmp(expected, sector, 16) == 0;
+        raw->suffixCorrect = raw->type == CdMode1 && aaruf_ecc_cd_is_suffix_correct(writer->eccContext, sector);
+    }
+}
+
+// Fills the block header and compresses the block, does not touch the writer so it can run in any thread
+static void encode_job(image_writer* writer, write_job* job)
+{
+    uint32_t length = job->sectors * writer->ctx->imageInfo.SectorSize;
+    size_t   cmpLength;
+    size_t   propsLength = LZMA_PROPERTIES_LENGTH;
+    uint64_t crc64;
+
+    classify_raw(writer, job);
+
+    // Everything in it was deduplicated
+    if(job->sectors == 0) return;
+
+    job->header.identifier  = DataBlock;
+    job->header.type        = UserData;
+    job->header.compression = None;
+    job->header.sectorSize  = writer->ctx->imageInfo.SectorSize;
+    job->header.length      = length;
+
+    crc64 = aaruf_crc64_data(job->data, length);
+
+    switch(writer->compression)
+    {
+        case Lzma:
+            cmpLength = length - LZMA_PROPERTIES_LENGTH;
+
+            if(aaruf_lzma_encode_buffer(job->cmpData + LZMA_PROPERTIES_LENGTH,
+                                        &cmpLength,
+                                        job->data,
+                                        length,
+                                        job->cmpData,
+                                        &propsLength,
+                                        (int)job->level,
+                                        length < 4096 ? 4096 : length,
+                                        3,
+                                        0,
+                                        2,
+                                        273,
+                                        1) == 0 &&
+               propsLength == LZMA_PROPERTIES_LENGTH)
+            {
+                job->header.compression = Lzma;
+                job->header.cmpLength   = (uint32_t)(cmpLength + LZMA_PROPERTIES_LENGTH);
+            }
+
+            break;
+        case Lz4:
+            cmpLength = length;
+
+            if(aaruf_lz4_encode_buffer(job->cmpData, &cmpLength, job->data, length) == AARUF_STATUS_OK &&
+               cmpLength < length)
+            {
+                job->header.compression = Lz4;
+                job->header.cmpLength   = (uint32_t)cmpLength;
+            }
+
+            break;
+    }
+
+    // Stored as is when it does not compress
+    if(job->header.compression == None)
+    {
+        job->header.cmpLength = length;
+        job->header.cmpCrc64  = crc64;
+    }
+    else
+        job->header.cmpCrc64 = aaruf_crc64_data(job->cmpData, job->header.cmpLength);
+
+    // Due to how C# wrote it, it is effectively reversed
+    job->header.crc64    = bswap_64(crc64);
+    job->header.cmpCrc64 = bswap_64(job->header.cmpCrc64);
+}
+
+// Appends a prefix or suffix, entry gets its index plus one
+static int32_t add_fix(corrected_fixes* fixes, const uint8_t* data, uint32_t* entry)
+{
+    uint8_t* grown;
+
+    // No room for more in the table entries
+    if(fixes->count == CD_DFIX_MASK) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    if(fixes->count == fixes->capacity)
+    {
+        grown = realloc(fixes->data, (size_t)fixes->length * (fixes->capacity + 4096));
+
+        if(grown == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        fixes->data = grown;
+        fixes->capacity += 4096;
+    }
+
+    memcpy(fixes->data + (size_t)fixes->length * fixes->count, data, fixes->length);
+    fixes->count++;
+    *entry = fixes->count;
+
+    return AARUF_STATUS_OK;
+}
+
+// Points the prefix and suffix tables to whatever is needed to rebuild the raw sectors of the block
+static int32_t commit_raw(image_writer* writer, write_job* job)
+{
+    const uint8_t* sector;
+    raw_sector*    raw;
+    uint32_t       entry;
+    uint32_t       i;
+    int32_t        errorNo;
+
+    for(i = 0; i < job->rawCount; i++)
+    {
+        raw    = &job->raw[i];
+        sector = job->rawData + (size_t)i * 2352;
+
+        if(raw->prefixCorrect) writer->prefixDdt[raw->address] = Correct;
+        else
+        {
+            errorNo = add_fix(&writer->prefixes, sector, &entry);
+
+            if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+            writer->prefixDdt[raw->address] = entry;
+        }
+
+        // Mode 2 suffixes are part of the user data
+        if(raw->type != CdMode1) continue;
+
+        if(raw->suffixCorrect) writer->suffixDdt[raw->address] = Correct;
+        else
+        {
+            errorNo = add_fix(&writer->suffixes, sector + 2064, &entry);
+
+            if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+            writer->suffixDdt[raw->address] = entry;
+        }
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Adds the sectors of a block just written to the next checkpoint, as runs of consecutive sectors in the image
+static int32_t checkpoint_add(image_writer* writer, write_job* job)
+{
+    aaruformatContext* ctx = writer->ctx;
+    CheckpointEntry*   entries;
+    CheckpointEntry*   last;
+    uint64_t           location;
+    uint64_t           ddtEntry;
+    uint32_t           i;
+
+    for(i = 0; i < job->writtenCount; i++)
+    {
+        location = job->written[i].ddtEntry - 1;
+        ddtEntry = writer->blockOffsets[location >> ctx->shift] << ctx->shift;
+        ddtEntry |= location & (writer->sectorsPerBlock - 1);
+        last = writer->checkpointCount == 0 ? NULL : &writer->checkpointEntries[writer->checkpointCount - 1];
+
+        if(last != NULL && last->sectorAddress + last->count == job->written[i].sectorAddress &&
+           last->ddtEntry + last->count == ddtEntry && last->count < UINT32_MAX)
+        {
+            last->count++;
+            continue;
+        }
+
+        if(writer->checkpointCount == writer->checkpointCapacity)
+        {
+            entries =
+                realloc(writer->checkpointEntries, sizeof(CheckpointEntry) * (writer->checkpointCapacity + 4096));
+
+            if(entries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+            writer->checkpointEntries = entries;
+            writer->checkpointCapacity += 4096;
+        }
+
+        last                = &writer->checkpointEntries[writer->checkpointCount++];
+        last->sectorAddress = job->written[i].sectorAddress;
+        last->count         = 1;
+        last->ddtEntry      = ddtEntry;
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Called with the file lock held. Flushed so it survives the process, not a power loss.
+static int32_t write_checkpoint(image_writer* writer, uint64_t nextSector)
+{
+    aaruformatContext* ctx = writer->ctx;
+    CheckpointHeader   checkpoint;
+
+    checkpoint.identifier   = CheckpointBlock;
+    checkpoint.mediaType    = ctx->imageInfo.MediaType;
+    checkpoint.sectorSize   = ctx->imageInfo.SectorSize;
+    checkpoint.shift        = ctx->shift;
+    checkpoint.compression  = writer->compression;
+    checkpoint.sectors      = ctx->imageInfo.Sectors;
+    checkpoint.creationTime = ctx->header.creationTime;
+    checkpoint.nextSector   = nextSector;
+    checkpoint.entries      = writer->checkpointCount;
+    checkpoint.crc64        = bswap_64(
+        aaruf_crc64_data((const uint8_t*)writer->checkpointEntries, sizeof(CheckpointEntry) * checkpoint.entries));
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(&checkpoint, sizeof(CheckpointHeader), 1, ctx->imageStream) != 1 ||
+       fwrite(writer->checkpointEntries, sizeof(CheckpointEntry), checkpoint.entries, ctx->imageStream) !=
+           checkpoint.entries ||
+       fflush(ctx->imageStream) != 0)
+        return AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(CheckpointHeader) + sizeof(CheckpointEntry) * checkpoint.entries;
+    writer->checkpointCount  = 0;
+    writer->checkpointBlocks = 0;
+
+    return AARUF_STATUS_OK;
+}
+
+// Writes an encoded block after the previous one and records where it went, blocks must be committed in order
+static int32_t commit_job(image_writer* writer, write_job* job)
+{
+    aaruformatContext* ctx     = writer->ctx;
+    const uint8_t*     payload = job->header.compression == None ? job->data : job->cmpData;
+    uint64_t*          blockOffsets;
+    int32_t            errorNo = AARUF_STATUS_OK;
+
+    CriticalSection_Enter(&writer->fileLock);
+
+    if(writer->blockOffsetCount == writer->blockOffsetCapacity)
+    {
+        blockOffsets = realloc(writer->blockOffsets, sizeof(uint64_t) * (writer->blockOffsetCapacity + 4096));
+
+        if(blockOffsets == NULL)
+        {
+            CriticalSection_Leave(&writer->fileLock);
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        writer->blockOffsets = blockOffsets;
+        writer->blockOffsetCapacity += 4096;
+    }
+
+    writer->blockOffsets[writer->blockOffsetCount++] = job->sectors == 0 ? 0 : writer->nextOffset;
+
+    if(job->sectors > 0)
+    {
+        if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+           fwrite(&job->header, sizeof(BlockHeader), 1, ctx->imageStream) != 1 ||
+           fwrite(payload, 1, job->header.cmpLength, ctx->imageStream) != job->header.cmpLength)
+            errorNo = AARUF_ERROR_CANNOT_WRITE;
+        else if(writer_add_index(writer, DataBlock, UserData, writer->nextOffset) != AARUF_STATUS_OK)
+            errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        writer->nextOffset += sizeof(BlockHeader) + job->header.cmpLength;
+    }
+
+    if(errorNo == AARUF_STATUS_OK && writer->checkpointInterval > 0)
+    {
+        errorNo = checkpoint_add(writer, job);
+
+        if(errorNo == AARUF_STATUS_OK && ++writer->checkpointBlocks >= writer->checkpointInterval)
+            errorNo = write_checkpoint(writer, job->nextSector);
+    }
+
+    CriticalSection_Leave(&writer->fileLock);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = commit_raw(writer, job);
+
+    if(errorNo != AARUF_STATUS_OK) return errorNo;
+
+    // Only blocks written in order make up the user data checksums
+    if(job->sequential)
+    {
+        payload = job->streamed ? job->stream : job->data;
+
+        aaruf_spamsum_update(writer->spamsum, payload, job->streamed ? job->streamLength : job->header.length);
+#ifdef AARU_HAS_SHA256
+        SHA256_Update(&writer->sha256, payload, job->streamed ? job->streamLength : job->header.length);
+#endif
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Called with the lock held. Writes all the consecutive encoded blocks, unless another thread is already doing it.
+static void commit_ready(image_writer* writer)
+{
+    write_job* job;
+    int32_t    errorNo;
+
+    if(writer->committing) return;
+
+    writer->committing = true;
+
+    while(writer->committed < writer->submitted)
+    {
+        job = &writer->jobs[writer->committed % writer->slots];
+
+        if(!job->done) break;
+
+        CriticalSection_Leave(&writer->lock);
+        errorNo = commit_job(writer, job);
+        CriticalSection_Enter(&writer->lock);
+
+        if(errorNo != AARUF_STATUS_OK && writer->error == AARUF_STATUS_OK) writer->error = errorNo;
+
+        job->done    = false;
+        job->sectors = 0;
+        writer->committed++;
+
+        if(writer->threads > 0) Semaphore_Release1(&writer->freeSlots);
+    }
+
+    writer->committing = false;
+}
+
+static THREAD_FUNC_DECL write_worker(void* param)
+{
+    image_writer* writer = param;
+    write_job*    job;
+
+    for(;;)
+    {
+        Semaphore_Wait(&writer->queued);
+
+        CriticalSection_Enter(&writer->lock);
+
+        if(writer->taken == writer->submitted)
+        {
+            if(writer->stop)
+            {
+                CriticalSection_Leave(&writer->lock);
+                break;
+            }
+
+            CriticalSection_Leave(&writer->lock);
+            continue;
+        }
+
+        job = &writer->jobs[writer->taken % writer->slots];
+        writer->taken++;
+
+        CriticalSection_Leave(&writer->lock);
+
+        encode_job(writer, job);
+
+        CriticalSection_Enter(&writer->lock);
+        job->done = true;
+        commit_ready(writer);
+        CriticalSection_Leave(&writer->lock);
+    }
+
+    return 0;
+}
+
+// Hands the filled block to the pool, or encodes and writes it right away without one
+static int32_t submit_job(image_writer* writer)
+{
+    write_job* job = writer->current;
+    int32_t    errorNo;
+
+    writer->current = NULL;
+    job->nextSector = writer->sequential ? writer->nextSector : 0;
+
+    if(writer->threads == 0)
+    {
+        encode_job(writer, job);
+        errorNo = commit_job(writer, job);
+
+        if(errorNo != AARUF_STATUS_OK && writer->error == AARUF_STATUS_OK) writer->error = errorNo;
+
+        job->sectors = 0;
+        writer->submitted++;
+        writer->committed++;
+
+        return writer->error;
+    }
+
+    CriticalSection_Enter(&writer->lock);
+    writer->submitted++;
+    errorNo = writer->error;
+    CriticalSection_Leave(&writer->lock);
+
+    Semaphore_Release1(&writer->queued);
+
+    return errorNo;
+}
+
+// Takes the slot of the next block, already free
+static void start_job(image_writer* writer)
+{
+    writer->current               = &writer->jobs[writer->submitted % writer->slots];
+    writer->current->sectors      = 0;
+    writer->current->streamLength = 0;
+    writer->current->rawCount     = 0;
+    writer->current->deduplicate  = writer->deduplicate;
+    writer->current->streamed     = writer->deduplicate || writer->parent != NULL;
+    writer->current->level        = writer->level;
+    writer->current->writtenCount = 0;
+}
+
+// Waits until the slot of the next block is not in use anymore
+static void next_job(image_writer* writer)
+{
+    if(writer->threads > 0) Semaphore_Wait(&writer->freeSlots);
+
+    start_job(writer);
+}
+
+// Sized for one entry per sector up to WRITE_DEDUP_MAX_ENTRIES, past that older entries are replaced by newer ones
+static int32_t dedup_init(image_writer* writer)
+{
+    uint64_t entries = WRITE_DEDUP_WAYS;
+
+    while(entries < writer->ctx->imageInfo.Sectors && entries < WRITE_DEDUP_MAX_ENTRIES) entries <<= 1;
+
+    writer->dedupTable         = (dedup_entry*)calloc(entries, sizeof(dedup_entry));
+    writer->dedupMask          = entries / WRITE_DEDUP_WAYS - 1;
+    writer->dedupBlock         = malloc(writer->blockLength);
+    writer->dedupCmpData       = malloc(writer->blockLength);
+    writer->dedupBlockSequence = UINT64_MAX;
+    writer->lzmaDecoder        = aaruf_lzma_decoder_init();
+
+    if(writer->dedupTable != NULL && writer->dedupBlock != NULL && writer->dedupCmpData != NULL &&
+       writer->lzmaDecoder != NULL)
+        return AARUF_STATUS_OK;
+
+    free(writer->dedupTable);
+    free(writer->dedupBlock);
+    free(writer->dedupCmpData);
+    if(writer->lzmaDecoder != NULL) aaruf_lzma_decoder_free(writer->lzmaDecoder);
+
+    writer->dedupTable   = NULL;
+    writer->dedupBlock   = NULL;
+    writer->dedupCmpData = NULL;
+    writer->lzmaDecoder  = NULL;
+
+    return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+}
+
+// Gets a stored sector from memory if its block is still in a slot, or from the image
+static const uint8_t* dedup_sector(image_writer* writer, uint64_t location)
+{
+    uint32_t    sectorSize = writer->ctx->imageInfo.SectorSize;
+    uint64_t    sequence   = (location - 1) >> writer->ctx->shift;
+    uint32_t    index      = (uint32_t)((location - 1) & (writer->sectorsPerBlock - 1));
+    uint64_t    blockOffset;
+    BlockHeader blockHeader;
+    bool        read;
+
+    // Slots are only reused by the caller, so they keep their data until the caller moves past them
+    if(writer->submitted - sequence < writer->slots)
+        return writer->jobs[sequence % writer->slots].data + (size_t)index * sectorSize;
+
+    if(sequence != writer->dedupBlockSequence)
+    {
+        // Must be written already, as its slot was reused
+        CriticalSection_Enter(&writer->fileLock);
+
+        blockOffset = writer->blockOffsets[sequence];
+        read        = fseek(writer->ctx->imageStream, blockOffset, SEEK_SET) == 0 &&
+               fread(&blockHeader, sizeof(BlockHeader), 1, writer->ctx->imageStream) == 1 &&
+               blockHeader.cmpLength <= writer->blockLength &&
+               fread(writer->dedupCmpData, 1, blockHeader.cmpLength, writer->ctx->imageStream) == blockHeader.cmpLength;
+
+        CriticalSection_Leave(&writer->fileLock);
+
+        writer->dedupBlockSequence = UINT64_MAX;
+
+        if(!read || aaruf_decode_block(&blockHeader, writer->dedupCmpData, writer->lzmaDecoder, writer->dedupBlock) !=
+                        AARUF_STATUS_OK)
+            return NULL;
+
+        writer->dedupBlockSequence = sequence;
+    }
+
+    return writer->dedupBlock + (size_t)index * sectorSize;
+}
+
+static uint64_t rotate_left(uint64_t value, int bits) { return value << bits | value >> (64 - bits); }
+
+// Four lanes of the xxHash64 round, matches are confirmed anyway so it only needs to be fast and well spread
+static uint64_t dedup_fingerprint(const uint8_t* data, uint32_t length)
+{
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t       lanes[4];
+    uint64_t       word;
+    uint64_t       hash;
+    uint32_t       i;
+    uint32_t       j;
+
+    lanes[0] = prime1 + prime2;
+    lanes[1] = prime2;
+    lanes[2] = 0;
+    lanes[3] = 0 - prime1;
+
+    for(i = 0; i + 32 <= length; i += 32)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            memcpy(&word, data + i + j * 8, sizeof(uint64_t));
+            lanes[j] = rotate_left(lanes[j] + word * prime2, 31) * prime1;
+        }
+    }
+
+    hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) +
+           rotate_left(lanes[3], 18) + length;
+
+    for(; i < length; i++) hash = rotate_left(hash ^ data[i] * prime1, 11) * prime2;
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime1;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+// Returns the location of an identical sector already stored, or 0 after remembering where this one is going to be
+static uint64_t dedup_lookup(image_writer* writer, const uint8_t* data, uint64_t location)
+{
+    uint32_t       sectorSize  = writer->ctx->imageInfo.SectorSize;
+    uint64_t       fingerprint = dedup_fingerprint(data, sectorSize);
+    dedup_entry*   bucket;
+    dedup_entry*   victim;
+    const uint8_t* stored;
+    uint32_t       i;
+
+    bucket = &writer->dedupTable[(fingerprint & writer->dedupMask) * WRITE_DEDUP_WAYS];
+    victim = &bucket[0];
+
+    for(i = 0; i < WRITE_DEDUP_WAYS; i++)
+    {
+        if(bucket[i].location == 0)
+        {
+            if(victim->location != 0) victim = &bucket[i];
+
+            continue;
+        }
+
+        if(bucket[i].fingerprint == fingerprint)
+        {
+            stored = dedup_sector(writer, bucket[i].location);
+
+            if(stored != NULL && memcmp(stored, data, sectorSize) == 0) return bucket[i].location;
+        }
+
+        if(victim->location != 0 && bucket[i].location < victim->location) victim = &bucket[i];
+    }
+
+    // An empty way, or the oldest one
+    victim->fingerprint = fingerprint;
+    victim->location    = location;
+
+    return 0;
+}
+
+static void raw_free(image_writer* writer)
+{
+    uint32_t i;
+
+    for(i = 0; i < writer->slots; i++)
+    {
+        free(writer->jobs[i].raw);
+        free(writer->jobs[i].rawData);
+        writer->jobs[i].raw     = NULL;
+        writer->jobs[i].rawData = NULL;
+    }
+
+    free(writer->prefixDdt);
+    free(writer->suffixDdt);
+    free(writer->eccContext);
+    free(writer->prefixes.data);
+    free(writer->suffixes.data);
+
+    writer->prefixDdt     = NULL;
+    writer->suffixDdt     = NULL;
+    writer->eccContext    = NULL;
+    writer->prefixes.data = NULL;
+    writer->suffixes.data = NULL;
+}
+
+// Tables for the prefixes and suffixes, and room in every block for the raw sectors it holds
+static int32_t raw_init(image_writer* writer)
+{
+    uint32_t i;
+
+    writer->prefixDdt       = (uint32_t*)calloc(writer->ctx->imageInfo.Sectors, sizeof(uint32_t));
+    writer->suffixDdt       = (uint32_t*)calloc(writer->ctx->imageInfo.Sectors, sizeof(uint32_t));
+    writer->eccContext      = aaruf_ecc_cd_init();
+    writer->prefixes.length = 16;
+    writer->suffixes.length = 288;
+
+    if(writer->prefixDdt == NULL || writer->suffixDdt == NULL || writer->eccContext == NULL)
+    {
+        raw_free(writer);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for(i = 0; i < writer->slots; i++)
+    {
+        writer->jobs[i].raw     = (raw_sector*)calloc(writer->sectorsPerBlock, sizeof(raw_sector));
+        writer->jobs[i].rawData = malloc((size_t)writer->sectorsPerBlock * 2352);
+
+        if(writer->jobs[i].raw == NULL || writer->jobs[i].rawData == NULL)
+        {
+            raw_free(writer);
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+static void writer_free(image_writer* writer)
+{
+    uint32_t i;
+
+    if(writer == NULL) return;
+
+    if(writer->jobs != NULL)
+    {
+        for(i = 0; i < writer->slots; i++)
+        {
+            free(writer->jobs[i].data);
+            free(writer->jobs[i].cmpData);
+            free(writer->jobs[i].stream);
+            free(writer->jobs[i].written);
+        }
+    }
+
+    if(writer->spamsum != NULL) aaruf_spamsum_free(writer->spamsum);
+
+    if(writer->lzmaDecoder != NULL) aaruf_lzma_decoder_free(writer->lzmaDecoder);
+
+    for(i = 0; i < writer->copiedBlockCount; i++) free(writer->copiedBlocks[i].data);
+
+    if(writer->jobs != NULL) raw_free(writer);
+
+    CriticalSection_Delete(&writer->lock);
+    CriticalSection_Delete(&writer->fileLock);
+
+    free(writer->jobs);
+    free(writer->workers);
+    free(writer->ddt);
+    free(writer->index);
+    free(writer->checkpointEntries);
+    free(writer->blockOffsets);
+    free(writer->dedupTable);
+    free(writer->dedupBlock);
+    free(writer->dedupCmpData);
+    free(writer->copiedBlocks);
+    if(writer->parent != NULL) aaruf_close(writer->parent);
+
+    free(writer->parentPath);
+    free(writer->parentSector);
+    free(writer->tracks);
+    free(writer->tapeFiles);
+    free(writer->tapePartitions);
+    free(writer->dpmBlock);
+    free(writer);
+}
+
+// Stops the pool after all the submitted blocks have been written
+static void writer_stop(image_writer* writer)
+{
+    uint32_t i;
+
+    if(writer->workers == NULL) return;
+
+    CriticalSection_Enter(&writer->lock);
+    writer->stop = true;
+    CriticalSection_Leave(&writer->lock);
+
+    Semaphore_ReleaseN(&writer->queued, writer->threads);
+
+    for(i = 0; i < writer->threads; i++) Thread_Wait_Close(&writer->workers[i]);
+
+    Semaphore_Close(&writer->queued);
+    Semaphore_Close(&writer->freeSlots);
+
+    free(writer->workers);
+    writer->workers = NULL;
+    writer->threads = 0;
+}
+
+// Points the DDT to the blocks, now that they all have been written
+static void resolve_ddt(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    uint64_t           location;
+    uint64_t           i;
+
+    for(i = 0; i < ctx->imageInfo.Sectors; i++)
+    {
+        if(writer->ddt[i] == 0) continue;
+
+        location       = writer->ddt[i] - 1;
+        writer->ddt[i] = writer->blockOffsets[location >> ctx->shift] << ctx->shift |
+                         (location & (writer->sectorsPerBlock - 1));
+    }
+}
+
+// Compresses metadata with LZMA at the highest level, returns NULL if it does not compress
+static uint8_t* encode_metadata(const uint8_t* payload, uint64_t length, uint64_t* cmpLength)
+{
+    uint8_t* cmpData;
+    size_t   encodedLength;
+    size_t   propsLength = LZMA_PROPERTIES_LENGTH;
+
+    if(length <= LZMA_PROPERTIES_LENGTH) return NULL;
+
+    cmpData = malloc(length);
+
+    if(cmpData == NULL) return NULL;
+
+    encodedLength = length - LZMA_PROPERTIES_LENGTH;
+
+    if(aaruf_lzma_encode_buffer(cmpData + LZMA_PROPERTIES_LENGTH,
+                                &encodedLength,
+                                payload,
+                                length,
+                                cmpData,
+                                &propsLength,
+                                9,
+                                length < 33554432 ? (length < 4096 ? 4096 : (uint32_t)length) : 33554432,
+                                3,
+                                0,
+                                2,
+                                273,
+                                1) != 0 ||
+       propsLength != LZMA_PROPERTIES_LENGTH)
+    {
+        free(cmpData);
+        return NULL;
+    }
+
+    *cmpLength = encodedLength + LZMA_PROPERTIES_LENGTH;
+
+    return cmpData;
+}
+
+static int32_t write_ddt(image_writer*  writer,
+                         uint16_t       dataType,
+                         const uint8_t* payload,
+                         uint64_t       entries,
+                         uint32_t       entrySize)
+{
+    aaruformatContext* ctx = writer->ctx;
+    DdtHeader          ddtHeader;
+    uint8_t*           cmpData;
+    uint64_t           length = entries * entrySize;
+    int32_t            errorNo;
+
+    memset(&ddtHeader, 0, sizeof(DdtHeader));
+    ddtHeader.identifier  = DeDuplicationTable;
+    ddtHeader.type        = dataType;
+    ddtHeader.compression = None;
+    ddtHeader.shift       = ctx->shift;
+    ddtHeader.entries     = entries;
+    ddtHeader.length      = length;
+    ddtHeader.cmpLength   = length;
+    ddtHeader.crc64       = bswap_64(aaruf_crc64_data(payload, length));
+    ddtHeader.cmpCrc64    = ddtHeader.crc64;
+
+    cmpData = encode_metadata(payload, length, &ddtHeader.cmpLength);
+
+    if(cmpData != NULL)
+    {
+        ddtHeader.compression = Lzma;
+        ddtHeader.cmpCrc64    = bswap_64(aaruf_crc64_data(cmpData, ddtHeader.cmpLength));
+        payload               = cmpData;
+    }
+
+    errorNo = writer_add_index(writer, DeDuplicationTable, dataType, writer->nextOffset);
+
+    if(errorNo == AARUF_STATUS_OK &&
+       (fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+        fwrite(&ddtHeader, sizeof(DdtHeader), 1, ctx->imageStream) != 1 ||
+        fwrite(payload, 1, ddtHeader.cmpLength, ctx->imageStream) != ddtHeader.cmpLength))
+        errorNo = AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(DdtHeader) + ddtHeader.cmpLength;
+
+    free(cmpData);
+
+    return errorNo;
+}
+
+static int32_t write_data_block(image_writer*  writer,
+                                uint16_t       dataType,
+                                const uint8_t* payload,
+                                uint32_t       sectorSize,
+                                uint32_t       sectors)
+{
+    aaruformatContext* ctx = writer->ctx;
+    BlockHeader        blockHeader;
+    uint8_t*           cmpData;
+    uint64_t           cmpLength;
+    int32_t            errorNo;
+
+    memset(&blockHeader, 0, sizeof(BlockHeader));
+    blockHeader.identifier  = DataBlock;
+    blockHeader.type        = dataType;
+    blockHeader.compression = None;
+    blockHeader.sectorSize  = sectorSize;
+    blockHeader.length      = sectorSize * sectors;
+    blockHeader.cmpLength   = blockHeader.length;
+    blockHeader.crc64       = bswap_64(aaruf_crc64_data(payload, blockHeader.length));
+    blockHeader.cmpCrc64    = blockHeader.crc64;
+
+    cmpData = encode_metadata(payload, blockHeader.length, &cmpLength);
+
+    if(cmpData != NULL)
+    {
+        blockHeader.compression = Lzma;
+        blockHeader.cmpLength   = (uint32_t)cmpLength;
+        blockHeader.cmpCrc64    = bswap_64(aaruf_crc64_data(cmpData, blockHeader.cmpLength));
+        payload                 = cmpData;
+    }
+
+    errorNo = writer_add_index(writer, DataBlock, dataType, writer->nextOffset);
+
+    if(errorNo == AARUF_STATUS_OK &&
+       (fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+        fwrite(&blockHeader, sizeof(BlockHeader), 1, ctx->imageStream) != 1 ||
+        fwrite(payload, 1, blockHeader.cmpLength, ctx->imageStream) != blockHeader.cmpLength))
+        errorNo = AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(BlockHeader) + blockHeader.cmpLength;
+
+    free(cmpData);
+
+    return errorNo;
+}
+
+// Prefixes and suffixes of the sectors never written with aaruf_write_sector_long() are marked as not dumped
+static int32_t write_cd_fixes(image_writer* writer)
+{
+    aaruformatContext* ctx     = writer->ctx;
+    int32_t            errorNo = AARUF_STATUS_OK;
+    uint64_t           i;
+
+    if(!writer->longSectors) return AARUF_STATUS_OK;
+
+    for(i = 0; i < ctx->imageInfo.Sectors; i++)
+    {
+        if(writer->prefixDdt[i] == 0) writer->prefixDdt[i] = NotDumped;
+
+        if(writer->suffixDdt[i] == 0) writer->suffixDdt[i] = NotDumped;
+    }
+
+    if(writer->prefixes.count > 0)
+        errorNo = write_data_block(writer, CdSectorPrefixCorrected, writer->prefixes.data, 16, writer->prefixes.count);
+
+    if(errorNo == AARUF_STATUS_OK && writer->suffixes.count > 0)
+        errorNo = write_data_block(writer, CdSectorSuffixCorrected, writer->suffixes.data, 288, writer->suffixes.count);
+
+    if(errorNo == AARUF_STATUS_OK)
+        errorNo = write_ddt(writer,
+                            CdSectorPrefixCorrected,
+                            (const uint8_t*)writer->prefixDdt,
+                            ctx->imageInfo.Sectors,
+                            sizeof(uint32_t));
+
+    if(errorNo == AARUF_STATUS_OK)
+        errorNo = write_ddt(writer,
+                            CdSectorSuffixCorrected,
+                            (const uint8_t*)writer->suffixDdt,
+                            ctx->imageInfo.Sectors,
+                            sizeof(uint32_t));
+
+    return errorNo;
+}
+
+// Only the sectors stored anew, the others keep the DDT entry of the previous snapshot
+static int32_t write_snapshot(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    SnapshotHeader     snapshotHeader;
+    SnapshotEntry*     entries = NULL;
+    uint64_t           count   = 0;
+    uint64_t           i;
+    int32_t            errorNo = AARUF_STATUS_OK;
+
+    for(i = 0; i < ctx->imageInfo.Sectors; i++)
+        if(writer->ddt[i] != 0) count++;
+
+    if(count > 0)
+    {
+        entries = malloc(sizeof(SnapshotEntry) * count);
+
+        if(entries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        count = 0;
+
+        for(i = 0; i < ctx->imageInfo.Sectors; i++)
+        {
+            if(writer->ddt[i] == 0) continue;
+
+            entries[count].sectorAddress = i;
+            entries[count].ddtEntry      = writer->ddt[i];
+            count++;
+        }
+    }
+
+    snapshotHeader.identifier          = SnapshotBlock;
+    snapshotHeader.snapshot            = writer->snapshot;
+    snapshotHeader.creationTime        = filetime_now();
+    snapshotHeader.previousIndexOffset = writer->previousIndexOffset;
+    snapshotHeader.entries             = count;
+    snapshotHeader.crc64 =
+        count == 0 ? 0 : bswap_64(aaruf_crc64_data((const uint8_t*)entries, sizeof(SnapshotEntry) * count));
+
+    errorNo = writer_add_index(writer, SnapshotBlock, UserData, writer->nextOffset);
+
+    if(errorNo == AARUF_STATUS_OK &&
+       (fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+        fwrite(&snapshotHeader, sizeof(SnapshotHeader), 1, ctx->imageStream) != 1 ||
+        (count > 0 && fwrite(entries, sizeof(SnapshotEntry), count, ctx->imageStream) != count)))
+        errorNo = AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(SnapshotHeader) + sizeof(SnapshotEntry) * count;
+
+    free(entries);
+
+    return errorNo;
+}
+
+static int32_t write_parent(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    ParentBlockHeader  parentHeader;
+
+    if(writer->parentPath == NULL) return AARUF_STATUS_OK;
+
+    parentHeader.identifier   = ParentBlock;
+    parentHeader.length       = (uint32_t)strlen(writer->parentPath);
+    parentHeader.sectors      = writer->parent->imageInfo.Sectors;
+    parentHeader.creationTime = writer->parent->header.creationTime;
+    parentHeader.crc64        = bswap_64(aaruf_crc64_data((const uint8_t*)writer->parentPath, parentHeader.length));
+
+    if(writer_add_index(writer, ParentBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(&parentHeader, sizeof(ParentBlockHeader), 1, ctx->imageStream) != 1 ||
+       fwrite(writer->parentPath, 1, parentHeader.length, ctx->imageStream) != parentHeader.length)
+        return AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(ParentBlockHeader) + parentHeader.length;
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t write_tracks(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    TracksHeader       tracksHeader;
+
+    if(writer->tracks == NULL) return AARUF_STATUS_OK;
+
+    tracksHeader.identifier = TracksBlock;
+    tracksHeader.entries    = writer->trackCount;
+    tracksHeader.crc64 =
+        bswap_64(aaruf_crc64_data((const uint8_t*)writer->tracks, sizeof(TrackEntry) * writer->trackCount));
+
+    if(writer_add_index(writer, TracksBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(&tracksHeader, sizeof(TracksHeader), 1, ctx->imageStream) != 1 ||
+       fwrite(writer->tracks, sizeof(TrackEntry), writer->trackCount, ctx->imageStream) != writer->trackCount)
+        return AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(TracksHeader) + sizeof(TrackEntry) * writer->trackCount;
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t write_tape(image_writer* writer)
+{
+    aaruformatContext*  ctx = writer->ctx;
+    TapePartitionHeader partitionHeader;
+    TapeFileHeader      fileHeader;
+
+    if(writer->tapePartitions != NULL)
+    {
+        partitionHeader.identifier = TapePartitionBlock;
+        partitionHeader.entries    = writer->tapePartitionCount;
+        partitionHeader.length     = sizeof(TapePartitionEntry) * writer->tapePartitionCount;
+        partitionHeader.crc64 =
+            bswap_64(aaruf_crc64_data((const uint8_t*)writer->tapePartitions, partitionHeader.length));
+
+        if(writer_add_index(writer, TapePartitionBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+           fwrite(&partitionHeader, sizeof(TapePartitionHeader), 1, ctx->imageStream) != 1 ||
+           fwrite(writer->tapePartitions, partitionHeader.length, 1, ctx->imageStream) != 1)
+            return AARUF_ERROR_CANNOT_WRITE;
+
+        writer->nextOffset += sizeof(TapePartitionHeader) + partitionHeader.length;
+    }
+
+    if(writer->tapeFiles == NULL) return AARUF_STATUS_OK;
+
+    fileHeader.identifier = TapeFileBlock;
+    fileHeader.entries    = writer->tapeFileCount;
+    fileHeader.length     = sizeof(TapeFileEntry) * writer->tapeFileCount;
+    fileHeader.crc64      = bswap_64(aaruf_crc64_data((const uint8_t*)writer->tapeFiles, fileHeader.length));
+
+    if(writer_add_index(writer, TapeFileBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(&fileHeader, sizeof(TapeFileHeader), 1, ctx->imageStream) != 1 ||
+       fwrite(writer->tapeFiles, fileHeader.length, 1, ctx->imageStream) != 1)
+        return AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += sizeof(TapeFileHeader) + fileHeader.length;
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t write_dpm(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+
+    if(writer->dpmBlock == NULL) return AARUF_STATUS_OK;
+
+    if(writer_add_index(writer, DataPositionMeasurementBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(writer->dpmBlock, 1, writer->dpmBlockLength, ctx->imageStream) != writer->dpmBlockLength)
+        return AARUF_ERROR_CANNOT_WRITE;
+
+    writer->nextOffset += writer->dpmBlockLength;
+
+    return AARUF_STATUS_OK;
+}
+
+// Only written when every sector was written once and in order, as the checksums are computed on the fly
+static int32_t write_checksums(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    ChecksumHeader     checksumHeader;
+    ChecksumEntry      checksumEntry;
+    uint8_t            spamsum[FUZZY_MAX_RESULT];
+    bool               failed = false;
+#ifdef AARU_HAS_SHA256
+    uint8_t sha256[SHA256_DIGEST_LENGTH];
+#endif
+
+    // The ones of the image the metadata was copied from are kept instead
+    if(writer->copiedChecksums) return AARUF_STATUS_OK;
+
+    if(!writer->sequential || writer->nextSector != ctx->imageInfo.Sectors) return AARUF_STATUS_OK;
+
+    memset(spamsum, 0, FUZZY_MAX_RESULT);
+    aaruf_spamsum_final(writer->spamsum, spamsum);
+
+    checksumHeader.identifier = ChecksumBlock;
+    checksumHeader.entries    = 1;
+    checksumHeader.length     = sizeof(ChecksumEntry) + (uint32_t)strlen((char*)spamsum);
+
+#ifdef AARU_HAS_SHA256
+    SHA256_Final(sha256, &writer->sha256);
+    checksumHeader.entries++;
+    checksumHeader.length += sizeof(ChecksumEntry) + SHA256_DIGEST_LENGTH;
+#endif
+
+    if(writer_add_index(writer, ChecksumBlock, 0, writer->nextOffset) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    failed |= fwrite(&checksumHeader, sizeof(ChecksumHeader), 1, ctx->imageStream) != 1;
+
+#ifdef AARU_HAS_SHA256
+    checksumEntry.type   = Sha256;
+    checksumEntry.length = SHA256_DIGEST_LENGTH;
+    failed |= fwrite(&checksumEntry, sizeof(ChecksumEntry), 1, ctx->imageStream) != 1;
+    failed |= fwrite(sha256, 1, SHA256_DIGEST_LENGTH, ctx->imageStream) != SHA256_DIGEST_LENGTH;
+#endif
+
+    checksumEntry.type   = SpamSum;
+    checksumEntry.length = (uint32_t)strlen((char*)spamsum);
+    failed |= fwrite(&checksumEntry, sizeof(ChecksumEntry), 1, ctx->imageStream) != 1;
+    failed |= fwrite(spamsum, 1, checksumEntry.length, ctx->imageStream) != checksumEntry.length;
+
+    writer->nextOffset += sizeof(ChecksumHeader) + checksumHeader.length;
+
+    return failed ? AARUF_ERROR_CANNOT_WRITE : AARUF_STATUS_OK;
+}
+
+static int32_t write_copied_blocks(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    uint32_t           i;
+
+    for(i = 0; i < writer->copiedBlockCount; i++)
+    {
+        if(writer_add_index(writer, writer->copiedBlocks[i].blockType, writer->copiedBlocks[i].dataType,
+                            writer->nextOffset) != AARUF_STATUS_OK)
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+        if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+           fwrite(writer->copiedBlocks[i].data, 1, writer->copiedBlocks[i].length, ctx->imageStream) !=
+               writer->copiedBlocks[i].length)
+            return AARUF_ERROR_CANNOT_WRITE;
+
+        writer->nextOffset += writer->copiedBlocks[i].length;
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+static int32_t write_index(image_writer* writer)
+{
+    aaruformatContext* ctx = writer->ctx;
+    IndexHeader        indexHeader;
+    IndexEntry*        entries;
+    uint32_t           count      = 0;
+    uint32_t           otherCount = 0;
+    uint32_t           userData   = 0;
+    uint32_t           i;
+    int32_t            errorNo = AARUF_STATUS_OK;
+
+    for(i = 0; i < writer->indexCount; i++)
+    {
+        if(writer->index[i].blockType == DataBlock && writer->index[i].dataType == UserData) userData++;
+        else
+            otherCount++;
+    }
+
+    // The index cannot hold more than 65535 entries. User data blocks are found from the DDT, they are only needed
+    // there for the image size, and the first for the sector size, so the ones that do not fit are left out.
+    if(otherCount + (userData > 0 ? 1 : 0) > UINT16_MAX)
+    {
+        fprintf(stderr,
+                "libaaruformat: Image has %u blocks that must be indexed, more than fit in the index.\n",
+                otherCount);
+        return AARUF_ERROR_CANNOT_WRITE;
+    }
+
+    userData = UINT16_MAX - otherCount;
+
+    entries = malloc(sizeof(IndexEntry) * (writer->indexCount > UINT16_MAX ? UINT16_MAX : writer->indexCount));
+
+    if(entries == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    for(i = 0; i < writer->indexCount; i++)
+    {
+        if(writer->index[i].blockType == DataBlock && writer->index[i].dataType == UserData)
+        {
+            if(userData == 0) continue;
+
+            userData--;
+        }
+
+        entries[count++] = writer->index[i];
+    }
+
+    indexHeader.identifier = IndexBlock;
+    indexHeader.entries    = (uint16_t)count;
+    indexHeader.crc64      = bswap_64(aaruf_crc64_data((const uint8_t*)entries, sizeof(IndexEntry) * count));
+
+    if(fseek(ctx->imageStream, writer->nextOffset, SEEK_SET) != 0 ||
+       fwrite(&indexHeader, sizeof(IndexHeader), 1, ctx->imageStream) != 1 ||
+       fwrite(entries, sizeof(IndexEntry), count, ctx->imageStream) != count)
+        errorNo = AARUF_ERROR_CANNOT_WRITE;
+
+    ctx->header.indexOffset = writer->nextOffset;
+    writer->nextOffset += sizeof(IndexHeader) + sizeof(IndexEntry) * count;
+
+    free(entries);
+
+    return errorNo;
+}
+
+static void header_init(AaruHeader* header, uint32_t mediaType)
+{
+    const char* application = "libaaruformat";
+    uint32_t    i;
+
+    memset(header, 0, sizeof(AaruHeader));
+
+    header->identifier              = AARU_MAGIC;
+    header->imageMajorVersion       = AARUF_VERSION;
+    header->imageMinorVersion       = 0;
+    header->applicationMajorVersion = LIBAARUFORMAT_MAJOR_VERSION;
+    header->applicationMinorVersion = LIBAARUFORMAT_MINOR_VERSION;
+    header->mediaType               = mediaType;
+    header->creationTime            = filetime_now();
+
+    // UTF-16LE
+    for(i = 0; application[i] != 0 && i < sizeof(header->application) / 2; i++)
+        header->application[i * 2] = (uint8_t)application[i];
+}
+
+// Creates a new image, or appends to an existing one when its header is given
+static aaruformatContext* writer_create(const char*       filepath,
+                                        const AaruHeader* header,
+                                        uint32_t          mediaType,
+                                        uint32_t          sectorSize,
+                                        uint64_t          sectors,
+                                        uint8_t           shift,
+                                        uint16_t          compression,
+                                        uint32_t          threads)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    uint64_t           blockLength;
+    uint32_t           i;
+    AaruHeader         emptyHeader;
+
+    if(compression != None && compression != Lzma && compression != Lz4)
+    {
+        errno = AARUF_ERROR_UNSUPPORTED_COMPRESSION;
+        return NULL;
+    }
+
+    blockLength = (uint64_t)sectorSize << shift;
+
+    if(sectorSize == 0 || sectors == 0 || shift == 0 || shift > 24 || blockLength > UINT32_MAX)
+    {
+        errno = AARUF_ERROR_INCORRECT_DATA_SIZE;
+        return NULL;
+    }
+
+    ctx = (aaruformatContext*)calloc(1, sizeof(aaruformatContext));
+
+    if(ctx == NULL)
+    {
+        errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+
+    ctx->shift                  = shift;
+    ctx->imageInfo.Sectors      = sectors;
+    ctx->imageInfo.SectorSize   = sectorSize;
+    ctx->imageInfo.MediaType    = mediaType;
+    ctx->imageInfo.XmlMediaType = aaruf_get_xml_mediatype(mediaType);
+
+    writer = (image_writer*)calloc(1, sizeof(image_writer));
+
+    if(writer == NULL)
+    {
+        free(ctx);
+        errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+
+    writer->ctx                = ctx;
+    writer->compression        = compression;
+    writer->level              = 9;
+    writer->sectorsPerBlock    = 1U << shift;
+    writer->blockLength        = (uint32_t)blockLength;
+    writer->threads            = threads;
+    writer->slots              = threads == 0 ? 1 : threads * WRITE_QUEUE_DEPTH + 1;
+    writer->sequential         = true;
+    writer->deduplicate        = true;
+    writer->nextOffset         = sizeof(AaruHeader);
+    writer->checkpointInterval = WRITE_CHECKPOINT_BLOCKS;
+    writer->ddt                = (uint64_t*)calloc(sectors, sizeof(uint64_t));
+    writer->jobs               = (write_job*)calloc(writer->slots, sizeof(write_job));
+    writer->spamsum            = aaruf_spamsum_init();
+
+    if(CriticalSection_Init(&writer->lock) != 0 || CriticalSection_Init(&writer->fileLock) != 0)
+    {
+        free(writer->ddt);
+        free(writer->jobs);
+        if(writer->spamsum != NULL) aaruf_spamsum_free(writer->spamsum);
+        free(writer);
+        free(ctx);
+        errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+
+    if(writer->ddt == NULL || writer->jobs == NULL || writer->spamsum == NULL || dedup_init(writer) != AARUF_STATUS_OK)
+    {
+        writer_free(writer);
+        free(ctx);
+        errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        return NULL;
+    }
+
+#ifdef AARU_HAS_SHA256
+    SHA256_Init(&writer->sha256);
+#endif
+
+    for(i = 0; i < writer->slots; i++)
+    {
+        writer->jobs[i].data    = malloc(blockLength);
+        writer->jobs[i].cmpData = malloc(blockLength);
+        writer->jobs[i].stream  = malloc(blockLength);
+        writer->jobs[i].written = malloc(sizeof(SnapshotEntry) << shift);
+
+        if(writer->jobs[i].data == NULL || writer->jobs[i].cmpData == NULL || writer->jobs[i].stream == NULL ||
+           writer->jobs[i].written == NULL)
+        {
+            writer_free(writer);
+            free(ctx);
+            errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+            return NULL;
+        }
+    }
+
+    ctx->imageStream = fopen(filepath, header == NULL ? "w+b" : "r+b");
+
+    if(ctx->imageStream == NULL)
+    {
+        writer_free(writer);
+        free(ctx);
+        errno = AARUF_ERROR_CANNOT_WRITE;
+        return NULL;
+    }
+
+    // Kept as it is until the image is finished, so it still opens as it was before
+    if(header != NULL)
+    {
+        ctx->header = *header;
+
+        if(fseek(ctx->imageStream, 0, SEEK_END) != 0)
+        {
+            fclose(ctx->imageStream);
+            writer_free(writer);
+            free(ctx);
+            errno = AARUF_ERROR_CANNOT_WRITE;
+            return NULL;
+        }
+
+        writer->nextOffset = (uint64_t)ftell(ctx->imageStream);
+    }
+    else
+    {
+        header_init(&ctx->header, mediaType);
+
+        // Filled when the image is closed, until then it is not recognized as an image
+        memset(&emptyHeader, 0, sizeof(AaruHeader));
+
+        if(fwrite(&emptyHeader, sizeof(AaruHeader), 1, ctx->imageStream) != 1)
+        {
+            fclose(ctx->imageStream);
+            writer_free(writer);
+            free(ctx);
+            errno = AARUF_ERROR_CANNOT_WRITE;
+            return NULL;
+        }
+    }
+
+    if(threads > 0)
+    {
+        writer->workers = (CThread*)calloc(threads, sizeof(CThread));
+
+        Semaphore_Construct(&writer->freeSlots);
+        Semaphore_Construct(&writer->queued);
+
+        if(writer->workers == NULL || Semaphore_Create(&writer->freeSlots, writer->slots, writer->slots) != 0 ||
+           Semaphore_Create(&writer->queued, 0, writer->slots + threads) != 0)
+        {
+            fclose(ctx->imageStream);
+            writer_free(writer);
+            free(ctx);
+            errno = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+            return NULL;
+        }
+
+        for(i = 0; i < threads; i++)
+        {
+            Thread_Construct(&writer->workers[i]);
+
+            if(Thread_Create(&writer->workers[i], write_worker, writer) != 0) break;
+        }
+
+        // Blocks are compressed in the caller if no thread could be created
+        if(i < threads)
+        {
+            fprintf(stderr, "libaaruformat: Could only create %u of %u compression threads.\n", i, threads);
+            writer->threads = i;
+
+            if(i == 0) writer_stop(writer);
+        }
+    }
+
+    next_job(writer);
+
+    // Parents are found relative to it
+    ctx->imagePath = malloc(strlen(filepath) + 1);
+
+    if(ctx->imagePath != NULL) strcpy(ctx->imagePath, filepath);
+
+    ctx->writer              = writer;
+    ctx->magic               = AARU_MAGIC;
+    ctx->libraryMajorVersion = LIBAARUFORMAT_MAJOR_VERSION;
+    ctx->libraryMinorVersion = LIBAARUFORMAT_MINOR_VERSION;
+
+    return ctx;
+}
+
+/**
+ * Creates a new image, to be filled with aaruf_write_sector() and finished by aaruf_close()
+ * @param filepath Path of the image to create, overwritten if it exists
+ * @param mediaType Media type
+ * @param sectorSize Size of each user data sector
+ * @param sectors Number of user data sectors
+ * @param shift Each data block holds up to 2^shift sectors
+ * @param compression Compression for the data blocks, None, Lzma or Lz4
+ * @param threads Threads compressing the data blocks while the caller keeps writing, 0 compresses them in the caller
+ * @return Image context, or NULL with errno set
+ */
+void* aaruf_create(const char* filepath,
+                   uint32_t    mediaType,
+                   uint32_t    sectorSize,
+                   uint64_t    sectors,
+                   uint8_t     shift,
+                   uint16_t    compression,
+                   uint32_t    threads)
+{
+    return writer_create(filepath, NULL, mediaType, sectorSize, sectors, shift, compression, threads);
+}
+
+/**
+ * Takes a new snapshot of an image, to be filled with aaruf_write_sector() and finished by aaruf_close(). Sectors
+ * written that are the same as in the latest snapshot are not stored again, so only the changed ones cost space and
+ * I/O. Tracks, raw sectors and parents cannot be changed in a snapshot.
+ * @param filepath Path of the image
+ * @param compression Compression for the new data blocks, None, Lzma or Lz4
+ * @param threads Threads compressing the data blocks while the caller keeps writing, 0 compresses them in the caller
+ * @return Image context, or NULL with errno set
+ */
+void* aaruf_create_snapshot(const char* filepath, uint16_t compression, uint32_t threads)
+{
+    aaruformatContext* source;
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    IndexHeader        indexHeader;
+    IndexEntry*        entries;
+    uint8_t*           sector;
+    uint32_t           count = 0;
+    uint16_t           i;
+    int                errorNo;
+
+    source = aaruf_open(filepath);
+
+    if(source == NULL) return NULL;
+
+    // Every entry of the previous index is kept, except the ones written anew
+    if(fseek(source->imageStream, source->header.indexOffset, SEEK_SET) != 0 ||
+       fread(&indexHeader, sizeof(IndexHeader), 1, source->imageStream) != 1 || indexHeader.identifier != IndexBlock)
+    {
+        aaruf_close(source);
+        errno = AARUF_ERROR_CANNOT_READ_INDEX;
+        return NULL;
+    }
+
+    entries = malloc(sizeof(IndexEntry) * (indexHeader.entries + 1));
+    sector  = malloc(source->imageInfo.SectorSize);
+
+    if(entries == NULL || sector == NULL ||
+       fread(entries, sizeof(IndexEntry), indexHeader.entries, source->imageStream) != indexHeader.entries)
+    {
+        errorNo = entries == NULL || sector == NULL ? AARUF_ERROR_NOT_ENOUGH_MEMORY : AARUF_ERROR_CANNOT_READ_INDEX;
+        free(entries);
+        free(sector);
+        aaruf_close(source);
+        errno = errorNo;
+        return NULL;
+    }
+
+    for(i = 0; i < indexHeader.entries; i++)
+        if(entries[i].blockType != IndexBlock && entries[i].blockType != ChecksumBlock) entries[count++] = entries[i];
+
+    ctx = writer_create(filepath,
+                        &source->header,
+                        source->imageInfo.MediaType,
+                        source->imageInfo.SectorSize,
+                        source->imageInfo.Sectors,
+                        source->shift,
+                        compression,
+                        threads);
+
+    if(ctx == NULL)
+    {
+        errorNo = errno;
+        free(entries);
+        free(sector);
+        aaruf_close(source);
+        errno = errorNo;
+        return NULL;
+    }
+
+    writer = ctx->writer;
+
+    free(writer->index);
+    writer->index         = entries;
+    writer->indexCount    = count;
+    writer->indexCapacity = indexHeader.entries + 1;
+
+    // Until it is finished the image opens as it was before, so it does not need them
+    writer->checkpointInterval = 0;
+
+    writer->snapshot            = source->snapshot + 1;
+    writer->previousIndexOffset = source->header.indexOffset;
+    writer->parent              = source;
+    writer->parentSector        = sector;
+    writer->current->streamed   = true;
+
+    aaruf_set_prefetch_depth(source, WRITE_PARENT_PREFETCH_DEPTH);
+
+    return ctx;
+}
+
+// Index of a recovered data block from its offset, they are in the order they were written
+static bool resume_find_block(const RecoveredImage* image, uint64_t offset, uint64_t* block)
+{
+    uint64_t low  = 0;
+    uint64_t high = image->blockCount;
+    uint64_t mid;
+
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if(image->blockOffsets[mid] < offset) low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *block = low;
+
+    return low < image->blockCount && image->blockOffsets[low] == offset;
+}
+
+/**
+ * Resumes writing an image that was never finished from its last checkpoint, closing it right away salvages what was
+ * written up to there. Data blocks written after the last checkpoint are lost. The user data checksums, tracks and
+ * prefixes and suffixes of raw sectors are not part of the checkpoints and cannot be written to a resumed image.
+ * @param filepath Path of the image
+ * @param threads Threads compressing the data blocks while the caller keeps writing, 0 compresses them in the caller
+ * @return Image context with resumeSector set to the first sector not written yet if they were written in order, 0
+ * otherwise, or NULL with errno set
+ */
+void* aaruf_resume(const char* filepath, uint32_t threads)
+{
+    FILE*              stream;
+    AaruHeader         header;
+    RecoveredImage     image;
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    IndexEntry*        entries;
+    uint64_t           i;
+    uint64_t           block;
+    uint64_t           mask;
+    int32_t            errorNo;
+
+    stream = fopen(filepath, "rb");
+
+    if(stream == NULL) return NULL;
+
+    if(fread(&header, sizeof(AaruHeader), 1, stream) != 1)
+    {
+        fclose(stream);
+        errno = AARUF_ERROR_FILE_TOO_SMALL;
+        return NULL;
+    }
+
+    // It was finished
+    if(header.identifier == AARU_MAGIC || header.identifier == DIC_MAGIC)
+    {
+        fclose(stream);
+        errno = AARUF_ERROR_CANNOT_WRITE;
+        return NULL;
+    }
+
+    errorNo = aaruf_recover_scan(stream, &image);
+    fclose(stream);
+
+    entries = errorNo == AARUF_STATUS_OK ? malloc(sizeof(IndexEntry) * (image.blockCount + 1)) : NULL;
+
+    if(errorNo == AARUF_STATUS_OK && entries == NULL) errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    if(errorNo != AARUF_STATUS_OK)
+    {
+        aaruf_recover_free(&image);
+        errno = errorNo;
+        return NULL;
+    }
+
+    for(i = 0; i < image.blockCount; i++)
+    {
+        entries[i].blockType = DataBlock;
+        entries[i].dataType  = UserData;
+        entries[i].offset    = image.blockOffsets[i];
+    }
+
+    // Pending DDT entries point to the sequence of the block, the recovered blocks come first
+    mask = (1ULL << image.checkpoint.shift) - 1;
+
+    for(i = 0; i < image.checkpoint.sectors; i++)
+    {
+        if(image.ddt[i] == 0) continue;
+
+        if(resume_find_block(&image, image.ddt[i] >> image.checkpoint.shift, &block))
+            image.ddt[i] = (block << image.checkpoint.shift | (image.ddt[i] & mask)) + 1;
+        else
+            image.ddt[i] = 0;
+    }
+
+    header_init(&header, image.checkpoint.mediaType);
+    header.creationTime = image.checkpoint.creationTime;
+
+    ctx = writer_create(filepath,
+                        &header,
+                        image.checkpoint.mediaType,
+                        image.checkpoint.sectorSize,
+                        image.checkpoint.sectors,
+                        image.checkpoint.shift,
+                        image.checkpoint.compression,
+                        threads);
+
+    if(ctx == NULL)
+    {
+        errorNo = errno;
+        free(entries);
+        aaruf_recover_free(&image);
+        errno = errorNo;
+        return NULL;
+    }
+
+    writer = ctx->writer;
+
+    free(writer->ddt);
+    free(writer->index);
+    free(writer->blockOffsets);
+
+    writer->ddt                 = image.ddt;
+    writer->index               = entries;
+    writer->indexCount          = (uint32_t)image.blockCount;
+    writer->indexCapacity       = (uint32_t)image.blockCount + 1;
+    writer->blockOffsets        = image.blockOffsets;
+    writer->blockOffsetCount    = image.blockCount;
+    writer->blockOffsetCapacity = image.blockCapacity;
+    writer->submitted           = image.blockCount;
+    writer->taken               = image.blockCount;
+    writer->committed           = image.blockCount;
+
+    // Whatever was written after the last checkpoint is overwritten
+    writer->nextOffset = image.end;
+
+    // The checksums of the sectors already written are lost
+    writer->sequential = false;
+
+    // No block was submitted yet, the slot already taken is just moved
+    start_job(writer);
+
+    ctx->resumeSector = image.checkpoint.nextSector;
+
+    return ctx;
+}
+
+// Whether the parent, or an image above it, already has the sector as it is
+static bool parent_matches(image_writer* writer, uint64_t sectorAddress, const uint8_t* data, uint32_t length)
+{
+    uint32_t parentLength = length;
+
+    if(sectorAddress >= writer->parent->imageInfo.Sectors) return false;
+
+    if(aaruf_read_sector(writer->parent, sectorAddress, writer->parentSector, &parentLength) != AARUF_STATUS_OK)
+        return false;
+
+    return parentLength == length && memcmp(writer->parentSector, data, length) == 0;
+}
+
+// Stores the sector in the block being filled, or points it to an identical one already stored, and hands the block
+// over once it is full
+static int32_t writer_store(image_writer* writer, uint64_t sectorAddress, const uint8_t* data, uint32_t length)
+{
+    aaruformatContext* ctx = writer->ctx;
+    write_job*         job = writer->current;
+    uint64_t           location;
+    uint64_t           stored = 0;
+    int32_t            errorNo;
+
+    if(sectorAddress != writer->nextSector) writer->sequential = false;
+    else
+        writer->nextSector++;
+
+    location = (writer->submitted << ctx->shift | job->sectors) + 1;
+
+    // Checksums need the sectors as they were written
+    if(job->streamed && writer->sequential)
+    {
+        memcpy(job->stream + job->streamLength, data, length);
+        job->streamLength += length;
+    }
+
+    // Left for the parent, or the previous snapshot, to provide
+    if(writer->parent != NULL && parent_matches(writer, sectorAddress, data, length)) writer->ddt[sectorAddress] = 0;
+    else
+    {
+        if(job->deduplicate) stored = dedup_lookup(writer, data, location);
+
+        if(stored != 0) writer->ddt[sectorAddress] = stored;
+        else
+        {
+            memcpy(job->data + (size_t)job->sectors * length, data, length);
+            writer->ddt[sectorAddress] = location;
+            job->sectors++;
+        }
+
+        job->written[job->writtenCount].sectorAddress = sectorAddress;
+        job->written[job->writtenCount].ddtEntry      = writer->ddt[sectorAddress];
+        job->writtenCount++;
+    }
+
+    if(job->sectors < writer->sectorsPerBlock && job->streamLength < writer->blockLength &&
+       job->rawCount < writer->sectorsPerBlock && job->writtenCount < writer->sectorsPerBlock)
+        return AARUF_STATUS_OK;
+
+    job->sequential = writer->sequential;
+    errorNo         = submit_job(writer);
+
+    next_job(writer);
+
+    return errorNo;
+}
+
+/**
+ * Writes a user data sector. Writing a sector again replaces it, but the previous copy still takes space in the image.
+ * Unless disabled with aaruf_set_deduplication(), a sector identical to one already stored is not stored again.
+ * @param context Image context, from aaruf_create()
+ * @param sectorAddress Sector
+ * @param data Sector data
+ * @param length Length of the sector data, must be the sector size of the image
+ */
+int32_t aaruf_write_sector(void* context, uint64_t sectorAddress, const uint8_t* data, uint32_t length)
+{
+    aaruformatContext* ctx;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(sectorAddress >= ctx->imageInfo.Sectors) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    if(data == NULL || length != ctx->imageInfo.SectorSize) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    return writer_store(ctx->writer, sectorAddress, data, length);
+}
+
+static TrackEntry* writer_find_track(image_writer* writer, uint64_t sectorAddress)
+{
+    int64_t     sector = (int64_t)sectorAddress;
+    TrackEntry* track  = &writer->tracks[writer->lastTrack];
+    uint16_t    i;
+
+    // Consecutive sectors are almost always in the same track
+    if(sector >= track->start && sector <= track->end) return track;
+
+    for(i = 0; i < writer->trackCount; i++)
+    {
+        if(sector < writer->tracks[i].start || sector > writer->tracks[i].end) continue;
+
+        writer->lastTrack = i;
+        return &writer->tracks[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Sets the tracks of an optical disc, needed to write raw sectors with aaruf_write_sector_long(). Must be called
+ * before writing any sector.
+ * @param context Image context, from aaruf_create()
+ * @param tracks Tracks, copied
+ * @param count Number of tracks
+ */
+int32_t aaruf_set_tracks(void* context, const TrackEntry* tracks, uint16_t count)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    TrackEntry*        copy;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(ctx->imageInfo.XmlMediaType != OpticalDisc) return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
+
+    if(tracks == NULL || count == 0) return AARUF_ERROR_TRACK_NOT_FOUND;
+
+    writer = ctx->writer;
+
+    // Snapshots only replace user data
+    if(writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    // The buffers for raw sectors cannot change once blocks are being compressed
+    if(writer->nextSector != 0 || !writer->sequential) return AARUF_ERROR_CANNOT_WRITE;
+
+    if(writer->prefixDdt == NULL && raw_init(writer) != AARUF_STATUS_OK) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    copy = malloc(sizeof(TrackEntry) * count);
+
+    if(copy == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    memcpy(copy, tracks, sizeof(TrackEntry) * count);
+
+    free(writer->tracks);
+    writer->tracks     = copy;
+    writer->trackCount = count;
+    writer->lastTrack  = 0;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Sets the files of a tape image, each file being a range of blocks stored as sectors. Can be called at any time
+ * before the image is finished.
+ * @param context Image context, from aaruf_create()
+ * @param files Files, copied
+ * @param count Number of files
+ */
+int32_t aaruf_set_tape_files(void* context, const TapeFileEntry* files, uint32_t count)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    TapeFileEntry*     copy;
+    uint32_t           i;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(ctx->imageInfo.XmlMediaType != BlockMedia) return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
+
+    if(files == NULL || count == 0) return AARUF_ERROR_TAPE_FILE_NOT_FOUND;
+
+    writer = ctx->writer;
+
+    // Snapshots only replace user data
+    if(writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    for(i = 0; i < count; i++)
+        if(files[i].firstBlock > files[i].lastBlock || files[i].lastBlock >= ctx->imageInfo.Sectors)
+            return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    copy = malloc(sizeof(TapeFileEntry) * count);
+
+    if(copy == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    memcpy(copy, files, sizeof(TapeFileEntry) * count);
+
+    free(writer->tapeFiles);
+    writer->tapeFiles     = copy;
+    writer->tapeFileCount = count;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Sets the partitions of a tape image. Can be called at any time before the image is finished.
+ * @param context Image context, from aaruf_create()
+ * @param partitions Partitions, copied
+ * @param count Number of partitions
+ */
+int32_t aaruf_set_tape_partitions(void* context, const TapePartitionEntry* partitions, uint8_t count)
+{
+    aaruformatContext*  ctx;
+    image_writer*       writer;
+    TapePartitionEntry* copy;
+    uint8_t             i;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(ctx->imageInfo.XmlMediaType != BlockMedia) return AARUF_ERROR_INCORRECT_MEDIA_TYPE;
+
+    if(partitions == NULL || count == 0) return AARUF_ERROR_TAPE_FILE_NOT_FOUND;
+
+    writer = ctx->writer;
+
+    // Snapshots only replace user data
+    if(writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    for(i = 0; i < count; i++)
+        if(partitions[i].firstBlock > partitions[i].lastBlock || partitions[i].lastBlock >= ctx->imageInfo.Sectors)
+            return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    copy = malloc(sizeof(TapePartitionEntry) * count);
+
+    if(copy == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    memcpy(copy, partitions, sizeof(TapePartitionEntry) * count);
+
+    free(writer->tapePartitions);
+    writer->tapePartitions     = copy;
+    writer->tapePartitionCount = count;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Sets the physical positions measured for sectors of the media, kept sorted by sector in the image. More than one
+ * measurement can be taken at the same sector. Can be called at any time before the image is finished.
+ * @param context Image context, from aaruf_create()
+ * @param entries Measurements, copied
+ * @param count Number of measurements
+ */
+int32_t aaruf_set_dpm(void* context, const DataPositionMeasurementEntry* entries, uint32_t count)
+{
+    aaruformatContext*             ctx;
+    image_writer*                  writer;
+    DataPositionMeasurementHeader* header;
+    uint8_t*                       block;
+    uint64_t                       length;
+    uint32_t                       i;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    // The CRC64 is computed at once
+    if(entries == NULL || count == 0 || count > UINT32_MAX / sizeof(DataPositionMeasurementEntry))
+        return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    writer = ctx->writer;
+
+    // Snapshots only replace user data
+    if(writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    for(i = 0; i < count; i++)
+        if(entries[i].sectorAddress >= ctx->imageInfo.Sectors) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    length = sizeof(DataPositionMeasurementEntry) * (uint64_t)count;
+    block  = malloc(sizeof(DataPositionMeasurementHeader) + length);
+
+    if(block == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    memcpy(block + sizeof(DataPositionMeasurementHeader), entries, length);
+    aaruf_dpm_sort((DataPositionMeasurementEntry*)(block + sizeof(DataPositionMeasurementHeader)), count);
+
+    header             = (DataPositionMeasurementHeader*)block;
+    header->identifier = DataPositionMeasurementBlock;
+    header->entries    = count;
+    header->length     = length;
+    header->crc64      = bswap_64(aaruf_crc64_data(block + sizeof(DataPositionMeasurementHeader), length));
+
+    free(writer->dpmBlock);
+    writer->dpmBlock       = block;
+    writer->dpmBlockLength = sizeof(DataPositionMeasurementHeader) + length;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Makes the new image a child of another one. Sectors the parent already has are not stored, reading them from the
+ * child falls through to the parent. Must be called before writing any sector.
+ * @param context Image context, from aaruf_create()
+ * @param parentPath Path of the parent image, relative to the directory of the new image unless absolute
+ */
+int32_t aaruf_set_parent(void* context, const char* parentPath)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    aaruformatContext* parent;
+    char*              path;
+    char*              copy;
+    uint8_t*           sector;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(parentPath == NULL || parentPath[0] == 0) return AARUF_ERROR_CANNOT_OPEN_PARENT;
+
+    writer = ctx->writer;
+
+    // Sectors already written were not compared, and snapshots keep the parent of the image
+    if(writer->nextSector != 0 || !writer->sequential || writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    path = aaruf_parent_resolve(ctx->imagePath, parentPath);
+
+    if(path == NULL) return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    parent = aaruf_open(path);
+    free(path);
+
+    if(parent == NULL) return AARUF_ERROR_CANNOT_OPEN_PARENT;
+
+    if(parent->imageInfo.SectorSize != ctx->imageInfo.SectorSize)
+    {
+        aaruf_close(parent);
+        return AARUF_ERROR_INCORRECT_DATA_SIZE;
+    }
+
+    copy   = malloc(strlen(parentPath) + 1);
+    sector = malloc(ctx->imageInfo.SectorSize);
+
+    if(copy == NULL || sector == NULL)
+    {
+        free(copy);
+        free(sector);
+        aaruf_close(parent);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    strcpy(copy, parentPath);
+    aaruf_set_prefetch_depth(parent, WRITE_PARENT_PREFETCH_DEPTH);
+
+    if(writer->parent != NULL) aaruf_close(writer->parent);
+
+    free(writer->parentPath);
+    free(writer->parentSector);
+
+    writer->parent       = parent;
+    writer->parentPath   = copy;
+    writer->parentSector = sector;
+
+    // An image recovered from them would not know its parent
+    writer->checkpointInterval = 0;
+
+    // Nothing was written to it yet
+    writer->current->streamed = true;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Writes a raw CD sector. Its prefix and suffix are only stored when they cannot be rebuilt from the rest of the
+ * sector, the checks run in the compression threads. Sectors of audio and data tracks are written as user data.
+ * @param context Image context, from aaruf_create(), with tracks set by aaruf_set_tracks()
+ * @param sectorAddress Sector
+ * @param data Raw sector
+ * @param length Length of the sector data, must be 2352
+ */
+int32_t aaruf_write_sector_long(void* context, uint64_t sectorAddress, const uint8_t* data, uint32_t length)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+    write_job*         job;
+    TrackEntry*        track;
+    raw_sector*        raw;
+    uint32_t           userLength;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(sectorAddress >= ctx->imageInfo.Sectors) return AARUF_ERROR_SECTOR_OUT_OF_BOUNDS;
+
+    if(data == NULL || length != 2352) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    writer = ctx->writer;
+
+    if(writer->tracks == NULL || writer->prefixDdt == NULL) return AARUF_ERROR_TRACK_NOT_FOUND;
+
+    track = writer_find_track(writer, sectorAddress);
+
+    if(track == NULL) return AARUF_ERROR_TRACK_NOT_FOUND;
+
+    switch(track->type)
+    {
+        case Audio:
+        case Data: return aaruf_write_sector(context, sectorAddress, data, length);
+        case CdMode1: userLength = 2048; break;
+        case CdMode2Formless: userLength = 2336; break;
+        // Subheaders are not stored separately
+        default: return AARUF_ERROR_INVALID_TRACK_FORMAT;
+    }
+
+    if(userLength != ctx->imageInfo.SectorSize) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    job = writer->current;
+    raw = &job->raw[job->rawCount];
+
+    raw->address = sectorAddress;
+    raw->type    = track->type;
+    memcpy(job->rawData + (size_t)job->rawCount * 2352, data, 2352);
+    job->rawCount++;
+
+    writer->longSectors = true;
+
+    return writer_store(writer, sectorAddress, data + 16, userLength);
+}
+
+// Writes the pending blocks, the DDT, checksums, index and header. Called by aaruf_close(), releases the writer.
+int32_t aaruf_write_finish(void* context)
+{
+    aaruformatContext* ctx    = context;
+    image_writer*      writer = ctx->writer;
+    int32_t            errorNo;
+
+    if(writer == NULL) return AARUF_STATUS_OK;
+
+    if(writer->current != NULL && (writer->current->sectors > 0 || writer->current->streamLength > 0))
+    {
+        writer->current->sequential = writer->sequential;
+        submit_job(writer);
+    }
+
+    writer_stop(writer);
+
+    errorNo = writer->error;
+
+    if(errorNo == AARUF_STATUS_OK)
+    {
+        resolve_ddt(writer);
+
+        if(writer->snapshot != 0) errorNo = write_snapshot(writer);
+        else
+            errorNo =
+                write_ddt(writer, UserData, (const uint8_t*)writer->ddt, ctx->imageInfo.Sectors, sizeof(uint64_t));
+    }
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_cd_fixes(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_tracks(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_tape(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_dpm(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_parent(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_copied_blocks(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_checksums(writer);
+
+    if(errorNo == AARUF_STATUS_OK) errorNo = write_index(writer);
+
+    if(errorNo == AARUF_STATUS_OK)
+    {
+        ctx->header.lastWrittenTime = filetime_now();
+
+        if(fseek(ctx->imageStream, 0, SEEK_SET) != 0 ||
+           fwrite(&ctx->header, sizeof(AaruHeader), 1, ctx->imageStream) != 1 || fflush(ctx->imageStream) != 0)
+            errorNo = AARUF_ERROR_CANNOT_WRITE;
+    }
+
+    writer_free(writer);
+    ctx->writer = NULL;
+
+    return errorNo;
+}
+
+/**
+ * Enables or disables storing only once sectors that are identical, enabled by default. Takes effect from the next
+ * data block.
+ * @param context Image context, from aaruf_create()
+ * @param enabled Whether to deduplicate sectors
+ */
+int32_t aaruf_set_deduplication(void* context, bool enabled)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    writer = ctx->writer;
+
+    if(enabled && writer->dedupTable == NULL && dedup_init(writer) != AARUF_STATUS_OK)
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+
+    writer->deduplicate = enabled;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Sets the LZMA compression level of the data blocks, 9 by default. Takes effect from the next data block.
+ * @param context Image context, from aaruf_create()
+ * @param level Compression level, from 0 to 9
+ */
+int32_t aaruf_set_compression_level(void* context, uint32_t level)
+{
+    aaruformatContext* ctx;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(level > 9) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    ((image_writer*)ctx->writer)->level = level;
+
+    return AARUF_STATUS_OK;
+}
+
+/**
+ * Sets how many data blocks are written between checkpoints, WRITE_CHECKPOINT_BLOCKS by default. An image that is
+ * never finished can be resumed from its last checkpoint with aaruf_resume(). Children and snapshots have none.
+ * @param context Image context, from aaruf_create()
+ * @param blocks Data blocks between checkpoints, 0 disables them
+ */
+int32_t aaruf_set_checkpoint_interval(void* context, uint32_t blocks)
+{
+    aaruformatContext* ctx;
+    image_writer*      writer;
+
+    if(context == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx = context;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    writer = ctx->writer;
+
+    if(writer->parentPath != NULL || writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    // Read by whoever is committing
+    CriticalSection_Enter(&writer->fileLock);
+    writer->checkpointInterval = blocks;
+    CriticalSection_Leave(&writer->fileLock);
+
+    return AARUF_STATUS_OK;
+}
+
+// Gets the size of the block pointed by an index entry from its header
+static bool copied_block_length(FILE* stream, const IndexEntry* entry, uint64_t* length)
+{
+    BlockHeader                   blockHeader;
+    DdtHeader                     ddtHeader;
+    MetadataBlockHeader           metadataHeader;
+    TracksHeader                  tracksHeader;
+    TapeFileHeader                tapeFileHeader;
+    TapePartitionHeader           tapePartitionHeader;
+    CicmMetadataBlock             cicmHeader;
+    DataPositionMeasurementHeader dpmHeader;
+    DumpHardwareHeader            dumpHardwareHeader;
+    ChecksumHeader                checksumHeader;
+
+    if(fseek(stream, entry->offset, SEEK_SET) != 0) return false;
+
+    switch(entry->blockType)
+    {
+        case DataBlock:
+            if(fread(&blockHeader, sizeof(BlockHeader), 1, stream) != 1) return false;
+            *length = sizeof(BlockHeader) + blockHeader.cmpLength;
+            return true;
+        case DeDuplicationTable:
+            if(fread(&ddtHeader, sizeof(DdtHeader), 1, stream) != 1) return false;
+            *length = sizeof(DdtHeader) + ddtHeader.cmpLength;
+            return true;
+        case GeometryBlock: *length = sizeof(GeometryBlockHeader); return true;
+        case MetadataBlock:
+            if(fread(&metadataHeader, sizeof(MetadataBlockHeader), 1, stream) != 1) return false;
+            // Includes the header
+            *length = metadataHeader.blockSize < sizeof(MetadataBlockHeader) ? sizeof(MetadataBlockHeader)
+                                                                             : metadataHeader.blockSize;
+            return true;
+        case TracksBlock:
+            if(fread(&tracksHeader, sizeof(TracksHeader), 1, stream) != 1) return false;
+            *length = sizeof(TracksHeader) + sizeof(TrackEntry) * tracksHeader.entries;
+            return true;
+        case TapeFileBlock:
+            if(fread(&tapeFileHeader, sizeof(TapeFileHeader), 1, stream) != 1) return false;
+            *length = sizeof(TapeFileHeader) + tapeFileHeader.length;
+            return true;
+        case TapePartitionBlock:
+            if(fread(&tapePartitionHeader, sizeof(TapePartitionHeader), 1, stream) != 1) return false;
+            *length = sizeof(TapePartitionHeader) + tapePartitionHeader.length;
+            return true;
+        case DataPositionMeasurementBlock:
+            if(fread(&dpmHeader, sizeof(DataPositionMeasurementHeader), 1, stream) != 1) return false;
+            *length = sizeof(DataPositionMeasurementHeader) + dpmHeader.length;
+            return true;
+        case CicmBlock:
+            if(fread(&cicmHeader, sizeof(CicmMetadataBlock), 1, stream) != 1) return false;
+            *length = sizeof(CicmMetadataBlock) + cicmHeader.length;
+            return true;
+        case DumpHardwareBlock:
+            if(fread(&dumpHardwareHeader, sizeof(DumpHardwareHeader), 1, stream) != 1) return false;
+            *length = sizeof(DumpHardwareHeader) + dumpHardwareHeader.length;
+            return true;
+        case ChecksumBlock:
+            if(fread(&checksumHeader, sizeof(ChecksumHeader), 1, stream) != 1) return false;
+            *length = sizeof(ChecksumHeader) + checksumHeader.length;
+            return true;
+        default: return false;
+    }
+}
+
+/**
+ * Copies from an opened image everything that is not user data: media tags, sector tags, tracks, tape files, geometry,
+ * metadata, data position measurements, dump hardware and checksums. Blocks are copied as they are and written when
+ * the new image is finished, the new image must have the same sectors.
+ * @param context Image context, from aaruf_create()
+ * @param source Image context, from aaruf_open()
+ */
+int32_t aaruf_copy_metadata(void* context, void* source)
+{
+    aaruformatContext* ctx;
+    aaruformatContext* sourceCtx;
+    image_writer*      writer;
+    IndexHeader        indexHeader;
+    IndexEntry*        entries;
+    copied_block*      copied;
+    uint64_t           length;
+    uint16_t           i;
+    int32_t            errorNo = AARUF_STATUS_OK;
+
+    if(context == NULL || source == NULL) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    ctx       = context;
+    sourceCtx = source;
+
+    // Not a libaaruformat context
+    if(ctx->magic != AARU_MAGIC || sourceCtx->magic != AARU_MAGIC) return AARUF_ERROR_NOT_AARUFORMAT;
+
+    if(ctx->writer == NULL) return AARUF_ERROR_READ_ONLY;
+
+    if(sourceCtx->imageInfo.Sectors != ctx->imageInfo.Sectors) return AARUF_ERROR_INCORRECT_DATA_SIZE;
+
+    writer = ctx->writer;
+
+    // Snapshots only replace user data
+    if(writer->snapshot != 0) return AARUF_ERROR_CANNOT_WRITE;
+
+    // The prefetcher shares the stream
+    if(sourceCtx->prefetcher != NULL) aaruf_prefetch_lock(sourceCtx->prefetcher);
+
+    if(fseek(sourceCtx->imageStream, sourceCtx->header.indexOffset, SEEK_SET) != 0 ||
+       fread(&indexHeader, sizeof(IndexHeader), 1, sourceCtx->imageStream) != 1 ||
+       indexHeader.identifier != IndexBlock)
+    {
+        if(sourceCtx->prefetcher != NULL) aaruf_prefetch_unlock(sourceCtx->prefetcher);
+        return AARUF_ERROR_CANNOT_READ_INDEX;
+    }
+
+    entries = malloc(sizeof(IndexEntry) * indexHeader.entries);
+
+    if(entries == NULL ||
+       fread(entries, sizeof(IndexEntry), indexHeader.entries, sourceCtx->imageStream) != indexHeader.entries)
+    {
+        if(sourceCtx->prefetcher != NULL) aaruf_prefetch_unlock(sourceCtx->prefetcher);
+        free(entries);
+        return entries == NULL ? AARUF_ERROR_NOT_ENOUGH_MEMORY : AARUF_ERROR_CANNOT_READ_INDEX;
+    }
+
+    for(i = 0; i < indexHeader.entries && errorNo == AARUF_STATUS_OK; i++)
+    {
+        // Written anew
+        if(entries[i].blockType == IndexBlock) continue;
+
+        if((entries[i].blockType == DataBlock || entries[i].blockType == DeDuplicationTable) &&
+           entries[i].dataType == UserData)
+            continue;
+
+        if(!copied_block_length(sourceCtx->imageStream, &entries[i], &length))
+        {
+            fprintf(stderr,
+                    "libaaruformat: Not copying block type %4.4s at %" PRIu64 ".\n",
+                    (char*)&entries[i].blockType,
+                    entries[i].offset);
+            continue;
+        }
+
+        copied = realloc(writer->copiedBlocks, sizeof(copied_block) * (writer->copiedBlockCount + 1));
+
+        if(copied == NULL)
+        {
+            errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        writer->copiedBlocks = copied;
+        copied               = &writer->copiedBlocks[writer->copiedBlockCount];
+        copied->blockType    = entries[i].blockType;
+        copied->dataType     = entries[i].dataType;
+        copied->length       = length;
+        copied->data         = malloc(length);
+
+        if(copied->data == NULL)
+        {
+            errorNo = AARUF_ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        if(fseek(sourceCtx->imageStream, entries[i].offset, SEEK_SET) != 0 ||
+           fread(copied->data, 1, length, sourceCtx->imageStream) != length)
+        {
+            free(copied->data);
+            errorNo = AARUF_ERROR_CANNOT_READ_BLOCK;
+            break;
+        }
+
+        writer->copiedBlockCount++;
+
+        if(copied->blockType == ChecksumBlock) writer->copiedChecksums = true;
+    }
+
+    if(sourceCtx->prefetcher != NULL) aaruf_prefetch_unlock(sourceCtx->prefetcher);
+
+    free(entries);
+
+    return errorNo;
+}
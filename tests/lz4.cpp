@@ -0,0 +1,138 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <aaruformat.h>
+
+#include "crc32.h"
+#include "gtest/gtest.h"
+
+static const uint8_t* buffer;
+
+// Literals "abc", match of 12 bytes at distance 3, literals "abcab"
+static const uint8_t lz4_block[]    = {0x38, 'a', 'b', 'c', 0x03, 0x00, 0x50, 'a', 'b', 'c', 'a', 'b'};
+static const char    lz4_expected[] = "abcabcabcabcabcabcab";
+
+class lz4Fixture : public ::testing::Test
+{
+  public:
+    lz4Fixture()
+    {
+        // initialization;
+        // can also be done in SetUp()
+    }
+
+  protected:
+    void SetUp()
+    {
+        char path[PATH_MAX];
+        char filename[PATH_MAX];
+
+        getcwd(path, PATH_MAX);
+        snprintf(filename, PATH_MAX, "%s/data/data.bin", path);
+
+        FILE* file = fopen(filename, "rb");
+        buffer     = (const uint8_t*)malloc(8388608);
+        fread((void*)buffer, 1, 8388608, file);
+        fclose(file);
+    }
+
+    void TearDown() { free((void*)buffer); }
+
+    ~lz4Fixture()
+    {
+        // resources cleanup, no exceptions allowed
+    }
+
+    // shared user data
+};
+
+TEST_F(lz4Fixture, lz4)
+{
+    uint8_t decoded[20];
+    size_t  dst_len = sizeof(decoded);
+    size_t  src_len = sizeof(lz4_block);
+
+    auto err = aaruf_lz4_decode_buffer(decoded, &dst_len, lz4_block, &src_len);
+
+    EXPECT_EQ(err, 0);
+    EXPECT_EQ(dst_len, 20);
+    EXPECT_EQ(src_len, sizeof(lz4_block));
+    EXPECT_EQ(memcmp(decoded, lz4_expected, 20), 0);
+
+    // Truncated
+    dst_len = sizeof(decoded);
+    src_len = 5;
+    err     = aaruf_lz4_decode_buffer(decoded, &dst_len, lz4_block, &src_len);
+
+    EXPECT_EQ(err, AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK);
+
+    // Output buffer too small for the match
+    dst_len = 10;
+    src_len = sizeof(lz4_block);
+    err     = aaruf_lz4_decode_buffer(decoded, &dst_len, lz4_block, &src_len);
+
+    EXPECT_EQ(err, AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK);
+
+    // Output buffer too small for the last literals
+    dst_len = sizeof(decoded) - 1;
+    src_len = sizeof(lz4_block);
+    err     = aaruf_lz4_decode_buffer(decoded, &dst_len, lz4_block, &src_len);
+
+    EXPECT_EQ(err, AARUF_ERROR_CANNOT_DECOMPRESS_BLOCK);
+}
+
+TEST_F(lz4Fixture, lz4Compress)
+{
+    size_t   original_len = 8388608;
+    size_t   cmp_len      = original_len + original_len / 255 + 16;
+    size_t   decmp_len    = original_len;
+    uint32_t original_crc, decmp_crc;
+    uint8_t* cmp_buffer;
+    uint8_t* decmp_buffer;
+    int      err;
+
+    // Allocate buffers
+    cmp_buffer   = (uint8_t*)malloc(cmp_len);
+    decmp_buffer = (uint8_t*)malloc(decmp_len);
+
+    // Calculate the CRC
+    original_crc = crc32_data(buffer, original_len);
+
+    // Compress
+    err = aaruf_lz4_encode_buffer(cmp_buffer, &cmp_len, buffer, original_len);
+    EXPECT_EQ(err, 0);
+
+    // Decompress
+    err = aaruf_lz4_decode_buffer(decmp_buffer, &decmp_len, cmp_buffer, &cmp_len);
+    EXPECT_EQ(err, 0);
+
+    EXPECT_EQ(decmp_len, original_len);
+
+    decmp_crc = crc32_data(decmp_buffer, decmp_len);
+
+    // Free buffers
+    free(cmp_buffer);
+    free(decmp_buffer);
+
+    EXPECT_EQ(decmp_crc, original_crc);
+}
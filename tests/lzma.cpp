@@ -134,3 +134,106 @@ TEST_F(lzmaFixture, lzmaCompress)
 
     EXPECT_EQ(decmp_crc, original_crc);
 }
+
+TEST_F(lzmaFixture, lzmaDecoderReuse)
+{
+    uint8_t params[] = {0x5D, 0x00, 0x00, 0x00, 0x02};
+    size_t  destLen;
+    size_t  srcLen;
+    size_t  cmpLen;
+    auto*   outBuf  = (uint8_t*)malloc(8388608);
+    auto*   cmpBuf  = (uint8_t*)malloc(1048576);
+    auto*   decmp   = (uint8_t*)malloc(65536);
+    void*   decoder = aaruf_lzma_decoder_init();
+    uint8_t props[5];
+    size_t  propsLen;
+    int     err;
+
+    EXPECT_NE(decoder, nullptr);
+
+    // Alternates between properties needing bigger and smaller probability tables
+    for(int i = 0; i < 3; i++)
+    {
+        destLen = 8388608;
+        srcLen  = 1200275;
+        err     = aaruf_lzma_decoder_decode(decoder, outBuf, &destLen, buffer, &srcLen, params, 5);
+
+        EXPECT_EQ(err, 0);
+        EXPECT_EQ(destLen, 8388608);
+        EXPECT_EQ(crc32_data(outBuf, 8388608), EXPECTED_CRC32);
+
+        cmpLen   = 1048576;
+        propsLen = 5;
+        err      = aaruf_lzma_encode_buffer(
+            cmpBuf, &cmpLen, outBuf, 65536, props, &propsLen, 9, 65536, 4, 4 - i, 2, 273, 1);
+        EXPECT_EQ(err, 0);
+
+        destLen = 65536;
+        err     = aaruf_lzma_decoder_decode(decoder, decmp, &destLen, cmpBuf, &cmpLen, props, propsLen);
+
+        EXPECT_EQ(err, 0);
+        EXPECT_EQ(destLen, 65536);
+        EXPECT_EQ(memcmp(decmp, outBuf, 65536), 0);
+    }
+
+    aaruf_lzma_decoder_free(decoder);
+    free(outBuf);
+    free(cmpBuf);
+    free(decmp);
+}
+
+TEST_F(lzmaFixture, lzma2CompressMt)
+{
+    size_t         original_len = 8388608;
+    char           path[PATH_MAX];
+    char           filename[PATH_MAX * 2];
+    FILE*          file;
+    uint32_t       original_crc, decmp_crc;
+    const uint8_t* original;
+    uint8_t*       cmp_buffer;
+    uint8_t*       decmp_buffer;
+    int            err;
+    uint8_t        prop;
+
+    // Allocate buffers
+    original     = (const uint8_t*)malloc(original_len);
+    cmp_buffer   = (uint8_t*)malloc(original_len);
+    decmp_buffer = (uint8_t*)malloc(original_len);
+
+    // Read the file
+    getcwd(path, PATH_MAX);
+    snprintf(filename, PATH_MAX, "%s/data/data.bin", path);
+
+    file = fopen(filename, "rb");
+    fread((void*)original, 1, original_len, file);
+    fclose(file);
+
+    // Calculate the CRC
+    original_crc = crc32_data(original, original_len);
+
+    for(int threads = 1; threads <= 4; threads *= 2)
+    {
+        size_t cmp_len   = original_len;
+        size_t decmp_len = original_len;
+
+        // Compress
+        err = aaruf_lzma2_encode_buffer(
+            cmp_buffer, &cmp_len, original, original_len, &prop, 9, 1048576, 3, 0, 2, 273, threads);
+        EXPECT_EQ(err, 0);
+
+        // Decompress
+        err = aaruf_lzma2_decode_buffer(decmp_buffer, &decmp_len, cmp_buffer, &cmp_len, prop);
+        EXPECT_EQ(err, 0);
+
+        EXPECT_EQ(decmp_len, original_len);
+
+        decmp_crc = crc32_data(decmp_buffer, decmp_len);
+
+        EXPECT_EQ(decmp_crc, original_crc);
+    }
+
+    // Free buffers
+    free((void*)original);
+    free(cmp_buffer);
+    free(decmp_buffer);
+}
@@ -174,3 +174,40 @@ TEST_F(spamsumFixture, spamsum_auto_2352bytes)
 
     free((void*)spamsum);
 }
+
+TEST_F(spamsumFixture, spamsum_auto_chunked)
+{
+    spamsum_ctx* ctx     = aaruf_spamsum_init();
+    const char*  spamsum = (const char*)malloc(FUZZY_MAX_RESULT);
+
+    EXPECT_NE(ctx, nullptr);
+    EXPECT_NE(spamsum, nullptr);
+
+    // Odd sized chunks so updates end at arbitrary positions of the rolling window
+    for(uint32_t pos = 0; pos < 1048576; pos += 2352)
+        aaruf_spamsum_update(ctx, buffer + pos, 1048576 - pos < 2352 ? 1048576 - pos : 2352);
+
+    aaruf_spamsum_final(ctx, (uint8_t*)spamsum);
+    aaruf_spamsum_free(ctx);
+
+    EXPECT_STREQ(spamsum, EXPECTED_SPAMSUM);
+
+    free((void*)spamsum);
+}
+
+TEST_F(spamsumFixture, spamsum_auto_mt)
+{
+    spamsum_ctx* ctx     = aaruf_spamsum_init();
+    const char*  spamsum = (const char*)malloc(FUZZY_MAX_RESULT);
+
+    EXPECT_NE(ctx, nullptr);
+    EXPECT_NE(spamsum, nullptr);
+
+    aaruf_spamsum_update_mt(ctx, buffer, 1048576, 4);
+    aaruf_spamsum_final(ctx, (uint8_t*)spamsum);
+    aaruf_spamsum_free(ctx);
+
+    EXPECT_STREQ(spamsum, EXPECTED_SPAMSUM);
+
+    free((void*)spamsum);
+}
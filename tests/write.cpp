@@ -0,0 +1,1209 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <set>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <aaruformat.h>
+
+#include "gtest/gtest.h"
+
+static const uint8_t* buffer;
+
+class writeFixture : public ::testing::Test
+{
+  public:
+    writeFixture()
+    {
+        // initialization;
+        // can also be done in SetUp()
+    }
+
+  protected:
+    void SetUp()
+    {
+        char path[PATH_MAX];
+        char filename[PATH_MAX];
+
+        getcwd(path, PATH_MAX);
+        snprintf(filename, PATH_MAX, "%s/data/data.bin", path);
+
+        FILE* file = fopen(filename, "rb");
+        buffer     = (const uint8_t*)malloc(8388608);
+        fread((void*)buffer, 1, 8388608, file);
+        fclose(file);
+    }
+
+    void TearDown() { free((void*)buffer); }
+
+    ~writeFixture()
+    {
+        // resources cleanup, no exceptions allowed
+    }
+
+    // shared user data
+};
+
+static void write_and_read(uint16_t compression, uint32_t threads, bool sequential)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint32_t       length;
+    uint64_t       i;
+    uint64_t       lba;
+    int32_t        err;
+
+    void* ctx = aaruf_create("write.aif", 0, 512, sectors, 8, compression, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++)
+    {
+        lba = sequential ? i : (i * 7919) % sectors;
+        err = aaruf_write_sector(ctx, lba, buffer + lba * 512, 512);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("write.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_EQ(readCtx->imageInfo.Sectors, sectors);
+    EXPECT_EQ(readCtx->checksums.hasSpamSum, sequential);
+
+    for(i = 0; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        err    = aaruf_read_sector(readCtx, i, sector, &length);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(length, 512);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_STATUS_OK);
+
+    aaruf_close(readCtx);
+    remove("write.aif");
+}
+
+TEST_F(writeFixture, write_lzma_threads) { write_and_read(Lzma, 4, true); }
+
+TEST_F(writeFixture, write_lz4_unordered) { write_and_read(Lz4, 2, false); }
+
+TEST_F(writeFixture, write_uncompressed_no_threads) { write_and_read(None, 0, true); }
+
+// An uncompressed DDT is mapped from the image, with a new index that points to it appended after the old index
+TEST_F(writeFixture, write_mapped_ddt)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint32_t       length;
+    uint64_t       i;
+    uint64_t*      ddt;
+    uint64_t       ddtEntry;
+    AaruHeader     header;
+    IndexHeader    indexHeader;
+    IndexEntry*    indexEntries;
+    DdtHeader      ddtHeader;
+    long           ddtOffset;
+
+    void* ctx = aaruf_create("mapped.aif", 0, 512, sectors, 8, Lz4, 0);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    ctx = aaruf_open("mapped.aif");
+    ASSERT_NE(nullptr, ctx);
+
+    ddt = (uint64_t*)malloc(sizeof(uint64_t) * sectors);
+    ASSERT_NE(nullptr, ddt);
+
+    for(i = 0; i < sectors; i++) ASSERT_EQ(aaruf_get_ddt_entry(ctx, i, &ddt[i]), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_get_ddt_entry(ctx, sectors, &ddtEntry), AARUF_ERROR_SECTOR_OUT_OF_BOUNDS);
+    aaruf_close(ctx);
+
+    FILE* file = fopen("mapped.aif", "r+b");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(fread(&header, sizeof(AaruHeader), 1, file), 1);
+    fseek(file, (long)header.indexOffset, SEEK_SET);
+    ASSERT_EQ(fread(&indexHeader, sizeof(IndexHeader), 1, file), 1);
+    indexEntries = (IndexEntry*)malloc(sizeof(IndexEntry) * indexHeader.entries);
+    ASSERT_NE(nullptr, indexEntries);
+    ASSERT_EQ(fread(indexEntries, sizeof(IndexEntry), indexHeader.entries, file), indexHeader.entries);
+
+    fseek(file, 0, SEEK_END);
+    header.indexOffset = ftell(file);
+    ddtOffset          = (long)(header.indexOffset + sizeof(IndexHeader) + sizeof(IndexEntry) * indexHeader.entries);
+
+    for(i = 0; i < indexHeader.entries; i++)
+        if(indexEntries[i].blockType == DeDuplicationTable && indexEntries[i].dataType == UserData)
+            indexEntries[i].offset = ddtOffset;
+
+    memset(&ddtHeader, 0, sizeof(DdtHeader));
+    ddtHeader.identifier  = DeDuplicationTable;
+    ddtHeader.type        = UserData;
+    ddtHeader.compression = None;
+    ddtHeader.shift       = 8;
+    ddtHeader.entries     = sectors;
+    ddtHeader.length      = sizeof(uint64_t) * sectors;
+    ddtHeader.cmpLength   = ddtHeader.length;
+
+    fwrite(&indexHeader, sizeof(IndexHeader), 1, file);
+    fwrite(indexEntries, sizeof(IndexEntry), indexHeader.entries, file);
+    fwrite(&ddtHeader, sizeof(DdtHeader), 1, file);
+    fwrite(ddt, sizeof(uint64_t), sectors, file);
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(AaruHeader), 1, file);
+    fclose(file);
+    free(indexEntries);
+    free(ddt);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("mapped.aif");
+    ASSERT_NE(nullptr, readCtx);
+    EXPECT_FALSE(readCtx->inMemoryDdt);
+
+    for(i = 0; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        EXPECT_EQ(aaruf_read_sector(readCtx, i, sector, &length), AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    aaruf_close(readCtx);
+
+    // Cut in the middle of the DDT, it cannot be mapped
+    file = fopen("mapped.aif", "rb");
+    ASSERT_NE(nullptr, file);
+    const size_t cut   = ddtOffset + sizeof(DdtHeader) + sectors * 4;
+    uint8_t*     image = (uint8_t*)malloc(cut);
+    ASSERT_NE(nullptr, image);
+    ASSERT_EQ(fread(image, 1, cut, file), cut);
+    fclose(file);
+
+    file = fopen("mapped.aif", "wb");
+    ASSERT_NE(nullptr, file);
+    fwrite(image, 1, cut, file);
+    fclose(file);
+    free(image);
+
+    EXPECT_EQ(nullptr, aaruf_open("mapped.aif"));
+
+    remove("mapped.aif");
+}
+
+// Only 97 different sectors, in blocks small enough that most matches are found in blocks already written
+static void write_repeated(uint32_t threads)
+{
+    const uint64_t sectors = 65536;
+    uint8_t        sector[512];
+    uint32_t       length;
+    uint64_t       i;
+    int32_t        err;
+
+    void* ctx = aaruf_create("dedup.aif", 0, 512, sectors, 4, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++)
+    {
+        err = aaruf_write_sector(ctx, i, buffer + (i % 97) * 512, 512);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    FILE* file = fopen("dedup.aif", "rb");
+    ASSERT_NE(nullptr, file);
+    fseek(file, 0, SEEK_END);
+    EXPECT_LT(ftell(file), 65536 * 8 + 97 * 512 * 2);
+    fclose(file);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("dedup.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_TRUE(readCtx->checksums.hasSpamSum);
+
+    for(i = 0; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        err    = aaruf_read_sector(readCtx, i, sector, &length);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + (i % 97) * 512, 512), 0);
+    }
+
+    EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_STATUS_OK);
+
+    aaruf_close(readCtx);
+    remove("dedup.aif");
+}
+
+TEST_F(writeFixture, write_deduplicated_threads) { write_repeated(2); }
+
+TEST_F(writeFixture, write_deduplicated_no_threads) { write_repeated(0); }
+
+// Sector written in write_tables, NULL if never written. The second half repeats the 97 sectors that start it.
+static const uint8_t* tables_expected(uint64_t i)
+{
+    if(i >= 1000 && i < 1100) return NULL;
+
+    return i >= 8192 ? buffer + (8192 + (i - 8192) % 97) * 512 : buffer + i * 512;
+}
+
+// The lookup, deduplication statistics, reverse DDT and extraction all agree with what was written
+TEST_F(writeFixture, write_tables)
+{
+    const uint64_t     sectors = 8388608 / 512;
+    uint8_t            sector[512];
+    uint32_t           length;
+    uint64_t           i;
+    uint64_t           j;
+    uint64_t           s;
+    uint64_t*          ddt;
+    uint64_t           ddtEntry;
+    uint64_t           references;
+    uint64_t           total = 0;
+    uint64_t           rangeCount;
+    const LbaRange*    ranges;
+    DedupStats         stats;
+    std::set<uint64_t> entries;
+    std::set<uint64_t> blocks;
+    const uint8_t*     expected;
+
+    void* ctx = aaruf_create("tables.aif", 0, 512, sectors, 4, Lz4, 0);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++)
+    {
+        expected = tables_expected(i);
+
+        if(expected != NULL) EXPECT_EQ(aaruf_write_sector(ctx, i, expected, 512), AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("tables.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    // Mostly runs of consecutive sectors, so it is turned into extents
+    EXPECT_NE(nullptr, readCtx->extentDdt);
+
+    ddt = (uint64_t*)malloc(sizeof(uint64_t) * sectors);
+    ASSERT_NE(nullptr, ddt);
+
+    for(i = 0; i < sectors; i++)
+    {
+        ASSERT_EQ(aaruf_get_ddt_entry(readCtx, i, &ddt[i]), AARUF_STATUS_OK);
+
+        expected = tables_expected(i);
+        EXPECT_EQ(ddt[i] == 0, expected == NULL);
+
+        // Written again, points to where it was first stored
+        if(i >= 8192 + 97) EXPECT_EQ(ddt[i], ddt[8192 + (i - 8192) % 97]);
+
+        if(ddt[i] != 0)
+        {
+            entries.insert(ddt[i]);
+            blocks.insert(ddt[i] >> readCtx->shift);
+        }
+
+        length = sizeof(sector);
+
+        if(expected == NULL)
+            EXPECT_EQ(aaruf_read_sector(readCtx, i, sector, &length), AARUF_STATUS_SECTOR_NOT_DUMPED);
+        else
+        {
+            EXPECT_EQ(aaruf_read_sector(readCtx, i, sector, &length), AARUF_STATUS_OK);
+            EXPECT_EQ(memcmp(sector, expected, 512), 0);
+        }
+    }
+
+    // Out of order, so the extents are searched instead of followed
+    for(i = 0; i < sectors; i++)
+    {
+        s = (i * 7919) % sectors;
+        EXPECT_EQ(aaruf_get_ddt_entry(readCtx, s, &ddtEntry), AARUF_STATUS_OK);
+        EXPECT_EQ(ddtEntry, ddt[s]);
+    }
+
+    EXPECT_EQ(aaruf_get_ddt_entry(readCtx, sectors, &ddtEntry), AARUF_ERROR_SECTOR_OUT_OF_BOUNDS);
+
+    ASSERT_EQ(aaruf_get_dedup_stats(readCtx, &stats, 8, 2), AARUF_STATUS_OK);
+    EXPECT_EQ(stats.sectors, sectors);
+    EXPECT_EQ(stats.notDumped, 100);
+    EXPECT_EQ(stats.referenced, sectors - 100);
+    EXPECT_EQ(stats.unique, entries.size());
+    EXPECT_EQ(stats.blocks, blocks.size());
+    EXPECT_EQ(stats.topCount, 8);
+
+    for(i = 1; i < stats.topCount; i++) EXPECT_GE(stats.top[i - 1].references, stats.top[i].references);
+
+    // Every sector referencing a block is in its ranges, and nothing else is
+    ASSERT_EQ(aaruf_build_reverse_ddt(readCtx, 2), AARUF_STATUS_OK);
+
+    for(i = 0; i < stats.blocks; i++)
+    {
+        ASSERT_EQ(aaruf_get_block_sectors(readCtx, stats.blockReferences[i].blockOffset, &ranges, &rangeCount),
+                  AARUF_STATUS_OK);
+        ASSERT_NE(nullptr, ranges);
+
+        references = 0;
+
+        for(j = 0; j < rangeCount; j++)
+        {
+            ASSERT_LE(ranges[j].start + ranges[j].length, sectors);
+
+            // Sorted and merged when consecutive
+            if(j > 0) EXPECT_GT(ranges[j].start, ranges[j - 1].start + ranges[j - 1].length);
+
+            for(s = ranges[j].start; s < ranges[j].start + ranges[j].length; s++)
+                EXPECT_EQ(ddt[s] >> readCtx->shift, stats.blockReferences[i].blockOffset);
+
+            references += ranges[j].length;
+        }
+
+        EXPECT_EQ(references, stats.blockReferences[i].references);
+        total += references;
+    }
+
+    EXPECT_EQ(total, stats.referenced);
+
+    aaruf_free_dedup_stats(&stats);
+    free(ddt);
+
+    FILE* file = fopen("tables.bin", "w+b");
+    ASSERT_NE(nullptr, file);
+    EXPECT_EQ(aaruf_extract_user_data(readCtx, file), AARUF_STATUS_OK);
+
+    fseek(file, 0, SEEK_END);
+    EXPECT_EQ(ftell(file), (long)(sectors * 512));
+    fseek(file, 0, SEEK_SET);
+
+    for(i = 0; i < sectors; i++)
+    {
+        ASSERT_EQ(fread(sector, 1, 512, file), 512);
+
+        expected = tables_expected(i);
+
+        if(expected != NULL) EXPECT_EQ(memcmp(sector, expected, 512), 0);
+        else
+            for(j = 0; j < 512; j++) EXPECT_EQ(sector[j], 0);
+    }
+
+    fclose(file);
+    aaruf_close(readCtx);
+    remove("tables.bin");
+    remove("tables.aif");
+}
+
+// Mode 1 sectors in two tracks, some with a prefix or suffix that cannot be rebuilt
+static void write_long(uint32_t threads)
+{
+    const uint64_t sectors = 1000;
+    uint8_t        sector[2352];
+    uint8_t        expected[2352];
+    uint8_t*       longSectors;
+    uint8_t*       tags;
+    uint32_t       length;
+    uint64_t       i;
+    uint32_t       t;
+    int32_t        err;
+    TrackEntry     tracks[2];
+    void*          ecc = aaruf_ecc_cd_init();
+
+    // Where each tag is in a mode 1 sector
+    const int32_t  tagTypes[]   = {CdSectorSync, CdSectorHeader, CdSectorEdc, CdSectorEcc};
+    const uint32_t tagOffsets[] = {0, 12, 2064, 2076};
+    const uint32_t tagLengths[] = {12, 4, 4, 276};
+
+    memset(tracks, 0, sizeof(tracks));
+    tracks[0].sequence = 1;
+    tracks[0].type     = CdMode1;
+    tracks[0].end      = sectors / 2 - 1;
+    tracks[0].session  = 1;
+    tracks[1].sequence = 2;
+    tracks[1].type     = CdMode1;
+    tracks[1].start    = sectors / 2;
+    tracks[1].end      = sectors - 1;
+    tracks[1].session  = 1;
+
+    void* ctx = aaruf_create("long.aif", CDROM, 2048, sectors, 6, Lzma, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_tracks(ctx, tracks, 2), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(sector + 16, buffer + i * 2048, 2048);
+        aaruf_ecc_cd_reconstruct_prefix(sector, CdMode1, (int64_t)i);
+        aaruf_ecc_cd_reconstruct(ecc, sector, CdMode1);
+
+        if(i % 100 == 7) sector[14] ^= 0x01;
+
+        if(i % 100 == 42) sector[2100] ^= 0xFF;
+
+        err = aaruf_write_sector_long(ctx, i, sector, sizeof(sector));
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("long.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    longSectors = (uint8_t*)malloc(sectors * 2352);
+    ASSERT_NE(nullptr, longSectors);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(expected + 16, buffer + i * 2048, 2048);
+        aaruf_ecc_cd_reconstruct_prefix(expected, CdMode1, (int64_t)i);
+        aaruf_ecc_cd_reconstruct(ecc, expected, CdMode1);
+
+        if(i % 100 == 7) expected[14] ^= 0x01;
+
+        if(i % 100 == 42) expected[2100] ^= 0xFF;
+
+        length = sizeof(sector);
+        err    = aaruf_read_sector_long(readCtx, i, sector, &length);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, expected, sizeof(sector)), 0);
+        memcpy(longSectors + i * 2352, expected, 2352);
+    }
+
+    // All sectors at once, across both tracks
+    for(t = 0; t < 4; t++)
+    {
+        length = 0;
+        EXPECT_EQ(aaruf_read_sector_tags(readCtx, 0, sectors, tagTypes[t], NULL, &length),
+                  AARUF_ERROR_BUFFER_TOO_SMALL);
+        ASSERT_EQ(length, sectors * tagLengths[t]);
+
+        tags = (uint8_t*)malloc(length);
+        ASSERT_NE(nullptr, tags);
+        EXPECT_EQ(aaruf_read_sector_tags(readCtx, 0, sectors, tagTypes[t], tags, &length), AARUF_STATUS_OK);
+
+        for(i = 0; i < sectors; i++)
+            EXPECT_EQ(memcmp(tags + i * tagLengths[t], longSectors + i * 2352 + tagOffsets[t], tagLengths[t]), 0);
+
+        free(tags);
+    }
+
+    length = sizeof(sector);
+    EXPECT_EQ(aaruf_read_sector_tags(readCtx, 1, sectors, CdSectorSync, sector, &length),
+              AARUF_ERROR_SECTOR_OUT_OF_BOUNDS);
+
+    free(longSectors);
+    aaruf_close(readCtx);
+    remove("long.aif");
+    free(ecc);
+}
+
+TEST_F(writeFixture, write_long_threads) { write_long(2); }
+
+TEST_F(writeFixture, write_long_no_threads) { write_long(0); }
+
+// More blocks than fit in the index, only user data blocks can be left out of it
+TEST_F(writeFixture, write_long_index_full)
+{
+    const uint64_t sectors = 132000;
+    uint8_t        sector[2352];
+    uint8_t        expected[2352];
+    uint32_t       length;
+    uint64_t       i;
+    TrackEntry     track;
+    void*          ecc = aaruf_ecc_cd_init();
+
+    memset(&track, 0, sizeof(TrackEntry));
+    track.sequence = 1;
+    track.type     = CdMode1;
+    track.end      = sectors - 1;
+    track.session  = 1;
+
+    void* ctx = aaruf_create("index.aif", CDROM, 2048, sectors, 1, Lz4, 2);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_deduplication(ctx, false), AARUF_STATUS_OK);
+    EXPECT_EQ(aaruf_set_tracks(ctx, &track, 1), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(sector + 16, buffer + (i % 4096) * 2048, 2048);
+        aaruf_ecc_cd_reconstruct_prefix(sector, CdMode1, (int64_t)i);
+        aaruf_ecc_cd_reconstruct(ecc, sector, CdMode1);
+
+        if(i % 1000 == 7) sector[14] ^= 0x01;
+
+        EXPECT_EQ(aaruf_write_sector_long(ctx, i, sector, sizeof(sector)), AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("index.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    for(i = 7; i < sectors; i += 1000)
+    {
+        memcpy(expected + 16, buffer + (i % 4096) * 2048, 2048);
+        aaruf_ecc_cd_reconstruct_prefix(expected, CdMode1, (int64_t)i);
+        aaruf_ecc_cd_reconstruct(ecc, expected, CdMode1);
+        expected[14] ^= 0x01;
+
+        length = sizeof(sector);
+        EXPECT_EQ(aaruf_read_sector_long(readCtx, i, sector, &length), AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, expected, sizeof(sector)), 0);
+    }
+
+    aaruf_close(readCtx);
+    remove("index.aif");
+    free(ecc);
+}
+
+// Every 50th sector changed in the child, every 50th starting at 25 in the grandchild
+static void write_child(uint32_t threads)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint8_t        expected[512];
+    uint32_t       length;
+    uint64_t       i;
+    int32_t        err;
+
+    void* ctx = aaruf_create("parent.aif", 0, 512, sectors, 8, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    ctx = aaruf_create("child.aif", 0, 512, sectors, 8, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_parent(ctx, "parent.aif"), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(sector, buffer + i * 512, 512);
+
+        if(i % 50 == 0) sector[0] ^= 0xFF;
+
+        EXPECT_EQ(aaruf_write_sector(ctx, i, sector, 512), AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    ctx = aaruf_create("grandchild.aif", 0, 512, sectors, 8, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_parent(ctx, "child.aif"), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(sector, buffer + i * 512, 512);
+
+        if(i % 50 == 0) sector[0] ^= 0xFF;
+
+        if(i % 50 == 25) sector[1] ^= 0xFF;
+
+        EXPECT_EQ(aaruf_write_sector(ctx, i, sector, 512), AARUF_STATUS_OK);
+    }
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    FILE* file = fopen("grandchild.aif", "rb");
+    ASSERT_NE(nullptr, file);
+    fseek(file, 0, SEEK_END);
+    EXPECT_LT(ftell(file), sectors * 8 + sectors / 50 * 512 * 2);
+    fclose(file);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("grandchild.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(expected, buffer + i * 512, 512);
+
+        if(i % 50 == 0) expected[0] ^= 0xFF;
+
+        if(i % 50 == 25) expected[1] ^= 0xFF;
+
+        length = sizeof(sector);
+        err    = aaruf_read_sector(readCtx, i, sector, &length);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, expected, 512), 0);
+    }
+
+    EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_STATUS_OK);
+
+    // Sectors only the parents have are extracted from them
+    FILE* output = fopen("grandchild.bin", "w+b");
+    ASSERT_NE(nullptr, output);
+    EXPECT_EQ(aaruf_extract_user_data(readCtx, output), AARUF_STATUS_OK);
+    fseek(output, 0, SEEK_SET);
+
+    for(i = 0; i < sectors; i++)
+    {
+        memcpy(expected, buffer + i * 512, 512);
+
+        if(i % 50 == 0) expected[0] ^= 0xFF;
+
+        if(i % 50 == 25) expected[1] ^= 0xFF;
+
+        ASSERT_EQ(fread(sector, 1, 512, output), 512);
+        EXPECT_EQ(memcmp(sector, expected, 512), 0);
+    }
+
+    fclose(output);
+    remove("grandchild.bin");
+
+    aaruf_close(readCtx);
+    remove("grandchild.aif");
+    remove("child.aif");
+    remove("parent.aif");
+}
+
+TEST_F(writeFixture, write_child_threads) { write_child(2); }
+
+TEST_F(writeFixture, write_child_no_threads) { write_child(0); }
+
+// A child with every sector in its parent, renamed over its parent so it is its own parent
+TEST_F(writeFixture, write_child_loop)
+{
+    const uint64_t sectors = 1048576 / 512;
+    uint8_t        sector[512];
+    uint32_t       length;
+    uint64_t       i;
+
+    void* ctx = aaruf_create("parent.aif", 0, 512, sectors, 8, Lz4, 0);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    ctx = aaruf_create("child.aif", 0, 512, sectors, 8, Lz4, 0);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_parent(ctx, "parent.aif"), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    ASSERT_EQ(rename("child.aif", "parent.aif"), 0);
+
+    ctx = aaruf_open("parent.aif");
+    ASSERT_NE(nullptr, ctx);
+
+    length = sizeof(sector);
+    EXPECT_NE(aaruf_read_sector(ctx, 0, sector, &length), AARUF_STATUS_OK);
+
+    aaruf_close(ctx);
+    remove("parent.aif");
+}
+
+static void snapshot_expected(uint8_t* sector, uint64_t i, uint32_t snapshot)
+{
+    memcpy(sector, buffer + i * 512, 512);
+
+    if(snapshot >= 1 && i % 100 == 0) sector[0] ^= 0xFF;
+
+    if(snapshot >= 2 && i % 1000 == 500) sector[1] ^= 0xFF;
+}
+
+// The first snapshot writes every sector again, the second only the ones that changed
+static void write_snapshots(uint32_t threads)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint8_t        expected[512];
+    uint32_t       length;
+    uint64_t       i;
+    uint32_t       snapshot;
+    long           sizes[3];
+    int32_t        err;
+
+    void* ctx = aaruf_create("snapshot.aif", 0, 512, sectors, 8, Lzma, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    for(snapshot = 1; snapshot <= 2; snapshot++)
+    {
+        FILE* file = fopen("snapshot.aif", "rb");
+        ASSERT_NE(nullptr, file);
+        fseek(file, 0, SEEK_END);
+        sizes[snapshot - 1] = ftell(file);
+        fclose(file);
+
+        ctx = aaruf_create_snapshot("snapshot.aif", Lzma, threads);
+        ASSERT_NE(nullptr, ctx);
+
+        for(i = 0; i < sectors; i++)
+        {
+            if(snapshot == 2 && i % 1000 != 500) continue;
+
+            snapshot_expected(sector, i, snapshot);
+            EXPECT_EQ(aaruf_write_sector(ctx, i, sector, 512), AARUF_STATUS_OK);
+        }
+
+        EXPECT_EQ(aaruf_close(ctx), 0);
+    }
+
+    FILE* file = fopen("snapshot.aif", "rb");
+    ASSERT_NE(nullptr, file);
+    fseek(file, 0, SEEK_END);
+    sizes[2] = ftell(file);
+    fclose(file);
+
+    EXPECT_LT(sizes[1] - sizes[0], sectors / 100 * 512 * 2);
+    EXPECT_LT(sizes[2] - sizes[1], sectors / 1000 * 512 * 2);
+
+    for(snapshot = 0; snapshot <= 2; snapshot++)
+    {
+        aaruformatContext* readCtx = (aaruformatContext*)aaruf_open_snapshot("snapshot.aif", snapshot);
+        ASSERT_NE(nullptr, readCtx);
+
+        EXPECT_EQ(readCtx->snapshot, snapshot);
+        EXPECT_EQ(readCtx->snapshots, 2);
+
+        for(i = 0; i < sectors; i++)
+        {
+            snapshot_expected(expected, i, snapshot);
+
+            length = sizeof(sector);
+            err    = aaruf_read_sector(readCtx, i, sector, &length);
+            EXPECT_EQ(err, AARUF_STATUS_OK);
+            EXPECT_EQ(memcmp(sector, expected, 512), 0);
+        }
+
+        EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_STATUS_OK);
+
+        aaruf_close(readCtx);
+    }
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("snapshot.aif");
+    ASSERT_NE(nullptr, readCtx);
+    EXPECT_EQ(readCtx->snapshot, 2);
+    aaruf_close(readCtx);
+
+    EXPECT_EQ(nullptr, aaruf_open_snapshot("snapshot.aif", 3));
+
+    remove("snapshot.aif");
+}
+
+TEST_F(writeFixture, write_snapshots_threads) { write_snapshots(2); }
+
+TEST_F(writeFixture, write_snapshots_no_threads) { write_snapshots(0); }
+
+// Damages the index and the first data block, the rest is found scanning the image
+static void write_recover(uint32_t threads)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint8_t        garbage[64];
+    uint32_t       length;
+    uint64_t       i;
+    int32_t        err;
+
+    void* ctx = aaruf_create("recover.aif", 0, 512, sectors, 8, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+    EXPECT_EQ(aaruf_set_deduplication(ctx, false), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("recover.aif");
+    ASSERT_NE(nullptr, readCtx);
+    const uint64_t indexOffset = readCtx->header.indexOffset;
+    aaruf_close(readCtx);
+
+    memset(garbage, 0xA5, sizeof(garbage));
+
+    FILE* file = fopen("recover.aif", "r+b");
+    ASSERT_NE(nullptr, file);
+    fseek(file, (long)indexOffset, SEEK_SET);
+    fwrite(garbage, 1, sizeof(garbage), file);
+    fseek(file, sizeof(AaruHeader) + sizeof(BlockHeader) + 100, SEEK_SET);
+    fwrite(garbage, 1, sizeof(garbage), file);
+    fclose(file);
+
+    EXPECT_EQ(nullptr, aaruf_open("recover.aif"));
+
+    readCtx = (aaruformatContext*)aaruf_open_recover("recover.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_EQ(readCtx->damagedBlocks, 1);
+    EXPECT_GT(readCtx->skippedBytes, 0);
+    EXPECT_EQ(readCtx->imageInfo.Sectors, sectors);
+    EXPECT_EQ(readCtx->imageInfo.SectorSize, 512);
+
+    // The first block is the damaged one
+    for(i = 256; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        err    = aaruf_read_sector(readCtx, i, sector, &length);
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    aaruf_close(readCtx);
+    remove("recover.aif");
+}
+
+TEST_F(writeFixture, write_recover_threads) { write_recover(2); }
+
+TEST_F(writeFixture, write_recover_no_threads) { write_recover(0); }
+
+// The prefetcher keeps running after the reads, the other readers of the image must not race with it
+TEST_F(writeFixture, write_verify_prefetching)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint8_t        sector[512];
+    uint8_t        garbage[64];
+    uint32_t       length;
+    uint64_t       i;
+    DedupStats     stats;
+
+    void* ctx = aaruf_create("prefetch.aif", 0, 512, sectors, 8, Lz4, 2);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    memset(garbage, 0xA5, sizeof(garbage));
+
+    FILE* file = fopen("prefetch.aif", "r+b");
+    ASSERT_NE(nullptr, file);
+    fseek(file, sizeof(AaruHeader) + sizeof(BlockHeader) + 100, SEEK_SET);
+    fwrite(garbage, 1, sizeof(garbage), file);
+    fclose(file);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("prefetch.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_EQ(aaruf_set_prefetch_depth(readCtx, 8), AARUF_STATUS_OK);
+
+    // The first block is the damaged one
+    for(i = 256; i < 1024; i++)
+    {
+        length = sizeof(sector);
+        EXPECT_EQ(aaruf_read_sector(readCtx, i, sector, &length), AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_ERROR_INVALID_BLOCK_CRC);
+    EXPECT_EQ(aaruf_get_dedup_stats(readCtx, &stats, 4, 2), AARUF_STATUS_OK);
+    EXPECT_EQ(stats.sectors, sectors);
+    aaruf_free_dedup_stats(&stats);
+
+    for(i = 1024; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        EXPECT_EQ(aaruf_read_sector(readCtx, i, sector, &length), AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    aaruf_close(readCtx);
+    remove("prefetch.aif");
+}
+
+static void write_tape(uint32_t threads)
+{
+    const uint64_t            sectors      = 8388608 / 512;
+    const TapeFileEntry       files[]      = {{1, 0, 5000, 9999}, {0, 1, 10000, sectors - 1}, {0, 0, 0, 4999}};
+    const TapePartitionEntry  partitions[] = {{0, 0, 9999}, {1, 10000, sectors - 1}};
+    const TapeFileEntry*      readFiles;
+    const TapePartitionEntry* readPartitions;
+    uint8_t*                  data;
+    uint32_t                  fileCount;
+    uint8_t                   partitionCount;
+    uint32_t                  length;
+    uint64_t                  offset;
+    uint64_t                  i;
+
+    void* ctx = aaruf_create("tape.aif", LTO, 512, sectors, 8, Lz4, threads);
+    ASSERT_NE(nullptr, ctx);
+
+    EXPECT_EQ(aaruf_set_tape_partitions(ctx, partitions, 2), AARUF_STATUS_OK);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_set_tape_files(ctx, files, 3), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("tape.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_EQ(aaruf_get_tape_partitions(readCtx, &readPartitions, &partitionCount), AARUF_STATUS_OK);
+    EXPECT_EQ(partitionCount, 2);
+    EXPECT_EQ(readPartitions[1].firstBlock, 10000);
+
+    // Sorted by partition and file
+    EXPECT_EQ(aaruf_get_tape_files(readCtx, &readFiles, &fileCount), AARUF_STATUS_OK);
+    ASSERT_EQ(fileCount, 3);
+    EXPECT_EQ(readFiles[0].firstBlock, 0);
+    EXPECT_EQ(readFiles[1].firstBlock, 5000);
+    EXPECT_EQ(readFiles[2].firstBlock, 10000);
+
+    data = (uint8_t*)malloc(8388608);
+    ASSERT_NE(nullptr, data);
+
+    // Chunks that do not match the blocks
+    for(offset = 0;; offset += length)
+    {
+        length = 1000;
+        EXPECT_EQ(aaruf_read_tape_file(readCtx, 0, 1, offset, data + offset, &length), AARUF_STATUS_OK);
+
+        if(length == 0) break;
+    }
+
+    EXPECT_EQ(offset, 5000 * 512);
+    EXPECT_EQ(memcmp(data, buffer + 5000 * 512, offset), 0);
+
+    length = 8388608;
+    EXPECT_EQ(aaruf_read_tape_file(readCtx, 1, 0, 777, data, &length), AARUF_STATUS_OK);
+    EXPECT_EQ(length, (sectors - 10000) * 512 - 777);
+    EXPECT_EQ(memcmp(data, buffer + 10000 * 512 + 777, length), 0);
+
+    length = 512;
+    EXPECT_EQ(aaruf_read_tape_file(readCtx, 0, 0, 5000 * 512, data, &length), AARUF_STATUS_OK);
+    EXPECT_EQ(length, 0);
+
+    length = 512;
+    EXPECT_EQ(aaruf_read_tape_file(readCtx, 1, 1, 0, data, &length), AARUF_ERROR_TAPE_FILE_NOT_FOUND);
+
+    const uint64_t indexOffset = readCtx->header.indexOffset;
+    aaruf_close(readCtx);
+
+    // A file ending past the last block, with a matching CRC, makes the tape file block be ignored
+    IndexHeader    indexHeader;
+    IndexEntry     indexEntry;
+    TapeFileHeader fileHeader;
+    TapeFileEntry  entries[3];
+
+    FILE* file = fopen("tape.aif", "r+b");
+    ASSERT_NE(nullptr, file);
+    fseek(file, (long)indexOffset, SEEK_SET);
+    ASSERT_EQ(fread(&indexHeader, sizeof(IndexHeader), 1, file), 1);
+
+    for(i = 0; i < indexHeader.entries; i++)
+    {
+        ASSERT_EQ(fread(&indexEntry, sizeof(IndexEntry), 1, file), 1);
+
+        if(indexEntry.blockType == TapeFileBlock) break;
+    }
+
+    ASSERT_LT(i, indexHeader.entries);
+    fseek(file, (long)indexEntry.offset, SEEK_SET);
+    ASSERT_EQ(fread(&fileHeader, sizeof(TapeFileHeader), 1, file), 1);
+    ASSERT_EQ(fread(entries, sizeof(TapeFileEntry), 3, file), 3);
+
+    entries[2].lastBlock = sectors;
+    fileHeader.crc64     = bswap_64(aaruf_crc64_data((const uint8_t*)entries, sizeof(entries)));
+
+    fseek(file, (long)indexEntry.offset, SEEK_SET);
+    fwrite(&fileHeader, sizeof(TapeFileHeader), 1, file);
+    fwrite(entries, sizeof(TapeFileEntry), 3, file);
+    fclose(file);
+
+    readCtx = (aaruformatContext*)aaruf_open("tape.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    EXPECT_EQ(aaruf_get_tape_files(readCtx, &readFiles, &fileCount), AARUF_STATUS_OK);
+    EXPECT_EQ(fileCount, 0);
+
+    length = 512;
+    EXPECT_EQ(aaruf_read_tape_file(readCtx, 0, 0, 0, data, &length), AARUF_ERROR_TAPE_FILE_NOT_FOUND);
+
+    free(data);
+    aaruf_close(readCtx);
+    remove("tape.aif");
+}
+
+TEST_F(writeFixture, write_tape_threads) { write_tape(2); }
+
+TEST_F(writeFixture, write_dpm)
+{
+    const uint64_t                      sectors = 8388608 / 512;
+    DataPositionMeasurementEntry        measurements[1000];
+    DataPositionMeasurementEntry        copied[1000];
+    const DataPositionMeasurementEntry* found;
+    uint32_t                            count;
+    uint64_t                            i;
+
+    // Out of order, two measurements every 32 sectors
+    for(i = 0; i < 1000; i++)
+    {
+        measurements[i].sectorAddress = ((i * 7) % 500) * 32;
+        measurements[i].position      = (int64_t)i;
+    }
+
+    void* ctx = aaruf_create("dpm.aif", 0, 512, sectors, 8, Lz4, 0);
+    ASSERT_NE(nullptr, ctx);
+
+    for(i = 0; i < sectors; i++) EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+    EXPECT_EQ(aaruf_set_dpm(ctx, measurements, 1000), AARUF_STATUS_OK);
+    EXPECT_EQ(aaruf_close(ctx), 0);
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open("dpm.aif");
+    ASSERT_NE(nullptr, readCtx);
+
+    // Not read until queried
+    EXPECT_EQ(nullptr, readCtx->dpmEntries);
+
+    EXPECT_EQ(aaruf_get_dpm(readCtx, 0, UINT64_MAX, &found, &count), AARUF_STATUS_OK);
+    ASSERT_EQ(count, 1000);
+
+    for(i = 1; i < count; i++) EXPECT_LE(found[i - 1].sectorAddress, found[i].sectorAddress);
+
+    EXPECT_EQ(aaruf_get_dpm(readCtx, 64, 128, &found, &count), AARUF_STATUS_OK);
+    ASSERT_EQ(count, 6);
+    EXPECT_EQ(found[0].sectorAddress, 64);
+    EXPECT_EQ(found[5].sectorAddress, 128);
+
+    EXPECT_EQ(aaruf_get_dpm(readCtx, 65, 95, &found, &count), AARUF_STATUS_OK);
+    EXPECT_EQ(count, 0);
+
+    count = 0;
+    EXPECT_EQ(aaruf_read_dpm(readCtx, 1000, 2000, nullptr, &count), AARUF_ERROR_BUFFER_TOO_SMALL);
+    EXPECT_EQ(count, 62);
+    EXPECT_EQ(aaruf_read_dpm(readCtx, 1000, 2000, copied, &count), AARUF_STATUS_OK);
+    EXPECT_EQ(count, 62);
+    EXPECT_EQ(copied[0].sectorAddress, 1024);
+
+    aaruf_close(readCtx);
+    remove("dpm.aif");
+}
+
+#ifndef _WIN32
+static void resume_check(const char* filename, uint64_t sectors, uint64_t written)
+{
+    uint8_t  sector[512];
+    uint32_t length;
+    uint64_t i;
+    int32_t  err;
+
+    aaruformatContext* readCtx = (aaruformatContext*)aaruf_open(filename);
+    ASSERT_NE(nullptr, readCtx);
+
+    for(i = 0; i < sectors; i++)
+    {
+        length = sizeof(sector);
+        err    = aaruf_read_sector(readCtx, i, sector, &length);
+
+        if(i >= written)
+        {
+            EXPECT_EQ(err, AARUF_STATUS_SECTOR_NOT_DUMPED);
+            continue;
+        }
+
+        EXPECT_EQ(err, AARUF_STATUS_OK);
+        EXPECT_EQ(memcmp(sector, buffer + i * 512, 512), 0);
+    }
+
+    EXPECT_EQ(aaruf_verify_image(readCtx), AARUF_STATUS_OK);
+
+    aaruf_close(readCtx);
+}
+
+// Kills the writing process at random sectors, then either finishes the image or salvages what was written
+static void write_resume(uint32_t threads, bool salvage)
+{
+    const uint64_t sectors = 8388608 / 512;
+    uint64_t       killAt;
+    uint64_t       i;
+    uint32_t       run;
+    int            status;
+    pid_t          pid;
+
+    srand(threads * 2 + salvage);
+
+    for(run = 0; run < 8; run++)
+    {
+        killAt = (uint64_t)rand() % sectors;
+        pid    = fork();
+        ASSERT_NE(pid, -1);
+
+        if(pid == 0)
+        {
+            void* ctx = aaruf_create("resume.aif", 0, 512, sectors, 8, Lz4, threads);
+
+            if(ctx == NULL || aaruf_set_checkpoint_interval(ctx, 4) != AARUF_STATUS_OK) _exit(1);
+
+            for(i = 0; i < killAt; i++)
+                if(aaruf_write_sector(ctx, i, buffer + i * 512, 512) != AARUF_STATUS_OK) _exit(1);
+
+            raise(SIGKILL);
+        }
+
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_TRUE(WIFSIGNALED(status));
+
+        aaruformatContext* ctx = (aaruformatContext*)aaruf_resume("resume.aif", threads);
+
+        // Killed before the first checkpoint
+        if(ctx == NULL)
+        {
+            EXPECT_LT(killAt, 4 * 256 + 256 * threads * WRITE_QUEUE_DEPTH + 256);
+            remove("resume.aif");
+            continue;
+        }
+
+        EXPECT_LE(ctx->resumeSector, killAt);
+        EXPECT_EQ(ctx->resumeSector % 256, 0);
+
+        const uint64_t resumeSector = ctx->resumeSector;
+
+        if(!salvage)
+            for(i = resumeSector; i < sectors; i++)
+                EXPECT_EQ(aaruf_write_sector(ctx, i, buffer + i * 512, 512), AARUF_STATUS_OK);
+
+        EXPECT_EQ(aaruf_close(ctx), 0);
+
+        resume_check("resume.aif", sectors, salvage ? resumeSector : sectors);
+
+        // Finished images are not resumed
+        EXPECT_EQ(nullptr, aaruf_resume("resume.aif", threads));
+
+        remove("resume.aif");
+    }
+}
+
+TEST_F(writeFixture, write_resume_threads) { write_resume(2, false); }
+
+TEST_F(writeFixture, write_resume_no_threads) { write_resume(0, false); }
+
+TEST_F(writeFixture, write_salvage_threads) { write_resume(2, true); }
+#endif
@@ -23,22 +23,36 @@
 
 #include <aaruformat.h>
 
-int   identify(char* path);
-int   info(char* path);
-char* byte_array_to_hex_string(const unsigned char* array, int array_size);
-int   read(unsigned long long sector_no, char* path);
-int   printhex(unsigned char* array, unsigned int length, int width, bool color);
-int   read_long(unsigned long long sector_no, char* path);
-int   verify(char* path);
-int   verify_sectors(char* path);
-bool  check_cd_sector_channel(CdEccContext* context,
-                              uint8_t*      sector,
-                              bool*         unknown,
-                              bool*         has_edc,
-                              bool*         edc_correct,
-                              bool*         has_ecc_p,
-                              bool*         ecc_p_correct,
-                              bool*         has_ecc_q,
-                              bool*         ecc_q_correct);
+int      identify(char* path);
+int      info(char* path);
+char*    byte_array_to_hex_string(const unsigned char* array, int array_size);
+int      read(unsigned long long sector_no, char* path);
+int      printhex(unsigned char* array, unsigned int length, int width, bool color);
+int      read_long(unsigned long long sector_no, char* path);
+int      verify(char* path);
+int      verify_sectors(char* path);
+int      stats(char* path);
+int      extract(char* input, char* output);
+int      repack(char* input, char* output, uint8_t shift, uint16_t compression, uint32_t level, uint32_t threads);
+int      import(char*    input,
+                char*    output,
+                uint32_t sectorSize,
+                uint8_t  shift,
+                uint16_t compression,
+                uint32_t level,
+                uint32_t threads);
+int      scan(char* path);
+int      dpm(char* path, uint64_t firstSector, uint64_t lastSector);
+double   now_seconds();
+uint64_t file_size(const char* path);
+bool     check_cd_sector_channel(CdEccContext* context,
+                                 uint8_t*      sector,
+                                 bool*         unknown,
+                                 bool*         has_edc,
+                                 bool*         edc_correct,
+                                 bool*         has_ecc_p,
+                                 bool*         ecc_p_correct,
+                                 bool*         has_ecc_q,
+                                 bool*         ecc_q_correct);
 
 #endif // LIBAARUFORMAT_TOOL_AARUFORMATTOOL_H_
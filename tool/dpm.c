@@ -0,0 +1,81 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+int dpm(char* path, uint64_t firstSector, uint64_t lastSector)
+{
+    aaruformatContext*            ctx;
+    DataPositionMeasurementEntry* entries = NULL;
+    uint32_t                      count   = 0;
+    uint32_t                      i;
+    int32_t                       res;
+
+    ctx = aaruf_open(path);
+
+    if(ctx == NULL)
+    {
+        printf("Error %d when opening AaruFormat image.\n", errno);
+        return errno;
+    }
+
+    // Asked for the size first
+    res = aaruf_read_dpm(ctx, firstSector, lastSector, NULL, &count);
+
+    if(res == AARUF_ERROR_BUFFER_TOO_SMALL)
+    {
+        entries = malloc(sizeof(DataPositionMeasurementEntry) * count);
+
+        if(entries == NULL)
+        {
+            printf("Could not allocate memory for %u measurements.\n", count);
+            aaruf_close(ctx);
+            return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        res = aaruf_read_dpm(ctx, firstSector, lastSector, entries, &count);
+    }
+
+    if(res != AARUF_STATUS_OK)
+    {
+        printf("Error %d reading data position measurements.\n", res);
+        free(entries);
+        aaruf_close(ctx);
+        return res;
+    }
+
+    if(count == 0) fprintf(stderr, "No data position measurements found.\n");
+
+    // As comma separated values, to be gathered from many images
+    printf("sector,position\n");
+
+    for(i = 0; i < count; i++) printf("%" PRIu64 ",%" PRId64 "\n", entries[i].sectorAddress, entries[i].position);
+
+    free(entries);
+    aaruf_close(ctx);
+
+    return AARUF_STATUS_OK;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+int extract(char* input, char* output)
+{
+    aaruformatContext* ctx;
+    FILE*              outputFile;
+    int32_t            res;
+
+    ctx = aaruf_open(input);
+
+    if(ctx == NULL)
+    {
+        printf("Error %d when opening AaruFormat image.\n", errno);
+        return errno;
+    }
+
+    outputFile = fopen(output, "wb");
+
+    if(outputFile == NULL)
+    {
+        printf("Error %d when creating output file.\n", errno);
+        aaruf_close(ctx);
+        return errno;
+    }
+
+    res = aaruf_extract_user_data(ctx, outputFile);
+
+    fclose(outputFile);
+
+    if(res != AARUF_STATUS_OK) printf("Error %d extracting image.\n", res);
+    else
+        printf("Extracted %" PRIu64 " sectors of %u bytes.\n", ctx->imageInfo.Sectors, ctx->imageInfo.SectorSize);
+
+    aaruf_close(ctx);
+
+    return res;
+}
@@ -17,8 +17,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "aaruformattool.h"
 
@@ -50,3 +52,36 @@ char* byte_array_to_hex_string(const unsigned char* array, int array_size)
 
     return hex_string;
 }
+
+// Monotonic seconds, to measure throughput
+double now_seconds()
+{
+    struct timespec ts;
+
+#if defined(_WIN32)
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// Size of a file, 0 if it cannot be opened
+uint64_t file_size(const char* path)
+{
+    FILE*    file = fopen(path, "rb");
+    uint64_t size = 0;
+
+    if(file == NULL) return 0;
+
+#if defined(_WIN32)
+    if(_fseeki64(file, 0, SEEK_END) == 0) size = (uint64_t)_ftelli64(file);
+#else
+    if(fseeko(file, 0, SEEK_END) == 0) size = (uint64_t)ftello(file);
+#endif
+
+    fclose(file);
+
+    return size;
+}
@@ -0,0 +1,280 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+// Sectors read from the dump at once, the prefix and suffix checks and compression run in the library threads
+#define IMPORT_CHUNK_SECTORS 512
+
+static const uint8_t cd_sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+static const char* track_type_name(uint8_t type)
+{
+    switch(type)
+    {
+        case Audio: return "audio";
+        case CdMode1: return "mode 1";
+        case CdMode2Formless: return "mode 2";
+        default: return "data";
+    }
+}
+
+// The whole dump is taken as a single track of the kind of its first sector
+static uint8_t detect_track_type(FILE* file)
+{
+    uint8_t sector[2352];
+
+    if(fread(sector, 1, sizeof(sector), file) != sizeof(sector)) return Audio;
+
+    fseek(file, 0, SEEK_SET);
+
+    if(memcmp(sector, cd_sync, sizeof(cd_sync)) != 0) return Audio;
+
+    switch(sector[15])
+    {
+        case 1: return CdMode1;
+        case 2: return CdMode2Formless;
+        default: return Audio;
+    }
+}
+
+// Compares every sector of the image with the dump
+static int import_verify(aaruformatContext* ctx, FILE* file, uint32_t sectorSize, uint8_t* buffer)
+{
+    uint8_t  sector[2352];
+    uint32_t length;
+    uint64_t i;
+    int32_t  res;
+
+    fseek(file, 0, SEEK_SET);
+
+    for(i = 0; i < ctx->imageInfo.Sectors; i++)
+    {
+        if(fread(buffer, 1, sectorSize, file) != sectorSize) return AARUF_ERROR_CANNOT_READ_BLOCK;
+
+        length = sizeof(sector);
+        res    = sectorSize == 2352 ? aaruf_read_sector_long(ctx, i, sector, &length)
+                                    : aaruf_read_sector(ctx, i, sector, &length);
+
+        if(res != AARUF_STATUS_OK || length != sectorSize || memcmp(sector, buffer, sectorSize) != 0)
+        {
+            printf("Sector %" PRIu64 " differs.\n", i);
+            return AARUF_ERROR_INVALID_BLOCK_CRC;
+        }
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+// Counts the prefixes or suffixes that had to be stored
+static uint64_t count_stored(const uint32_t* ddt, uint64_t sectors)
+{
+    uint64_t stored = 0;
+    uint64_t i;
+
+    if(ddt == NULL) return 0;
+
+    for(i = 0; i < sectors; i++)
+        if((ddt[i] & CD_XFIX_MASK) != Correct && (ddt[i] & CD_XFIX_MASK) != NotDumped) stored++;
+
+    return stored;
+}
+
+int import(char*    input,
+           char*    output,
+           uint32_t sectorSize,
+           uint8_t  shift,
+           uint16_t compression,
+           uint32_t level,
+           uint32_t threads)
+{
+    FILE*              file;
+    void*              writeCtx;
+    aaruformatContext* ctx;
+    TrackEntry         track;
+    uint8_t*           buffer;
+    uint64_t           inputSize;
+    uint64_t           outputSize;
+    uint64_t           sectors;
+    uint64_t           sector;
+    uint32_t           chunk;
+    uint32_t           userSize;
+    uint32_t           mediaType;
+    uint32_t           i;
+    double             start;
+    double             elapsed;
+    int32_t            res = AARUF_STATUS_OK;
+
+    inputSize = file_size(input);
+    sectors   = inputSize / sectorSize;
+
+    if(sectors == 0 || inputSize % sectorSize != 0)
+    {
+        printf("%s is not made of %u bytes sectors.\n", input, sectorSize);
+        return AARUF_ERROR_INCORRECT_DATA_SIZE;
+    }
+
+    file = fopen(input, "rb");
+
+    if(file == NULL)
+    {
+        printf("Cannot open %s.\n", input);
+        return errno;
+    }
+
+    memset(&track, 0, sizeof(TrackEntry));
+    track.sequence = 1;
+    track.session  = 1;
+    track.end      = (int64_t)sectors - 1;
+
+    switch(sectorSize)
+    {
+        case 2352:
+            track.type = detect_track_type(file);
+            mediaType  = track.type == Audio ? CDDA : CDROM;
+            userSize   = track.type == CdMode1 ? 2048 : track.type == CdMode2Formless ? 2336 : 2352;
+            break;
+        case 2048:
+            track.type = CdMode1;
+            mediaType  = CDROM;
+            userSize   = 2048;
+            break;
+        default:
+            mediaType = GENERIC_HDD;
+            userSize  = sectorSize;
+            break;
+    }
+
+    buffer = malloc((size_t)sectorSize * IMPORT_CHUNK_SECTORS);
+
+    if(buffer == NULL)
+    {
+        printf("Not enough memory.\n");
+        fclose(file);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    start = now_seconds();
+
+    writeCtx = aaruf_create(output, mediaType, userSize, sectors, shift, compression, threads);
+
+    if(writeCtx == NULL)
+    {
+        printf("Error %d when creating AaruFormat image.\n", errno);
+        free(buffer);
+        fclose(file);
+        return errno;
+    }
+
+    res = aaruf_set_compression_level(writeCtx, level);
+
+    if(res == AARUF_STATUS_OK && sectorSize != 512) res = aaruf_set_tracks(writeCtx, &track, 1);
+
+    for(sector = 0; sector < sectors && res == AARUF_STATUS_OK; sector += chunk)
+    {
+        chunk = sectors - sector < IMPORT_CHUNK_SECTORS ? (uint32_t)(sectors - sector) : IMPORT_CHUNK_SECTORS;
+
+        if(fread(buffer, sectorSize, chunk, file) != chunk)
+        {
+            printf("Error reading sector %" PRIu64 ".\n", sector);
+            res = AARUF_ERROR_CANNOT_READ_BLOCK;
+            break;
+        }
+
+        for(i = 0; i < chunk && res == AARUF_STATUS_OK; i++)
+        {
+            if(sectorSize == 2352)
+                res = aaruf_write_sector_long(writeCtx, sector + i, buffer + (size_t)i * sectorSize, sectorSize);
+            else
+                res = aaruf_write_sector(writeCtx, sector + i, buffer + (size_t)i * sectorSize, sectorSize);
+
+            if(res != AARUF_STATUS_OK) printf("Error %d writing sector %" PRIu64 ".\n", res, sector + i);
+        }
+    }
+
+    if(aaruf_close(writeCtx) != 0 && res == AARUF_STATUS_OK)
+    {
+        printf("Error %d when finishing AaruFormat image.\n", errno);
+        res = errno;
+    }
+
+    elapsed = now_seconds() - start;
+
+    if(res != AARUF_STATUS_OK)
+    {
+        free(buffer);
+        fclose(file);
+        return res;
+    }
+
+    ctx = aaruf_open(output);
+
+    if(ctx == NULL)
+    {
+        printf("Error %d when opening imported AaruFormat image.\n", errno);
+        free(buffer);
+        fclose(file);
+        return errno;
+    }
+
+    res = import_verify(ctx, file, sectorSize, buffer);
+
+    free(buffer);
+    fclose(file);
+
+    if(res != AARUF_STATUS_OK)
+    {
+        printf("Imported image does not match.\n");
+        aaruf_close(ctx);
+        return res;
+    }
+
+    outputSize = file_size(output);
+
+    printf("Imported %" PRIu64 " sectors of %u bytes.\n", sectors, sectorSize);
+    printf("All sectors verified.\n");
+
+    if(sectorSize != 512) printf("\tTrack type: %s\n", track_type_name(track.type));
+
+    if(sectorSize == 2352 && track.type != Audio)
+    {
+        printf("\tPrefixes stored: %" PRIu64 "\n", count_stored(ctx->sectorPrefixDdt, sectors));
+
+        if(track.type == CdMode1)
+            printf("\tSuffixes stored: %" PRIu64 "\n", count_stored(ctx->sectorSuffixDdt, sectors));
+    }
+
+    printf("\tRaw size: %" PRIu64 " bytes\n", inputSize);
+    printf("\tImage size: %" PRIu64 " bytes\n", outputSize);
+    printf("\tSpace saved: %.2f%%\n", 100.0 - (double)outputSize * 100.0 / (double)inputSize);
+
+    if(elapsed > 0) printf("\tThroughput: %.2f MiB/s\n", (double)inputSize / elapsed / 1048576.0);
+
+    aaruf_close(ctx);
+
+    return AARUF_STATUS_OK;
+}
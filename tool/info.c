@@ -18,6 +18,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <unicode/ucnv.h>
 
@@ -27,12 +28,16 @@
 
 int info(char* path)
 {
-    aaruformatContext* ctx;
-    char*              strBuffer;
-    UErrorCode         u_error_code;
-    uint               i, j;
-    mediaTagEntry*     mediaTag;
-    mediaTagEntry*     tmpMediaTag;
+    aaruformatContext*                  ctx;
+    char*                               strBuffer;
+    UErrorCode                          u_error_code;
+    uint                                i, j;
+    const int32_t*                      mediaTagTypes;
+    uint32_t                            mediaTagCount;
+    const uint8_t*                      mediaTagData;
+    uint32_t                            mediaTagLength;
+    const DataPositionMeasurementEntry* dpmEntries;
+    uint32_t                            dpmCount;
 
     ctx = aaruf_open(path);
 
@@ -81,12 +86,27 @@ int info(char* path)
 
     if(ctx->userDataDdt != NULL) printf("User-data DDT has been read to memory.\n");
 
+    if(ctx->pagedDdt != NULL)
+        printf("User-data DDT is paged from a temporary file, %d pages of %d entries are kept in memory.\n",
+               DDT_PAGE_CACHE_SLOTS,
+               DDT_PAGE_ENTRIES);
+
+    if(ctx->extentDdt != NULL)
+        printf("User-data DDT is stored as %" PRIu64 " extents.\n", ctx->extentDdt->count);
+
     if(ctx->mappedMemoryDdtSize > 0) printf("Mapped memory DDT has %zu bytes", ctx->mappedMemoryDdtSize);
 
     if(ctx->sectorPrefixDdt != NULL) printf("Sector prefix DDT has been read to memory.\n");
 
     if(ctx->sectorPrefixDdt != NULL) printf("Sector suffix DDT has been read to memory.\n");
 
+    if(ctx->parentPath != NULL) printf("Image is a child of %s.\n", ctx->parentPath);
+
+    if(ctx->snapshots > 0) printf("Opened snapshot %u of %u.\n", ctx->snapshot, ctx->snapshots);
+
+    if(ctx->dpmOffset != 0 && aaruf_get_dpm(ctx, 0, UINT64_MAX, &dpmEntries, &dpmCount) == AARUF_STATUS_OK)
+        printf("Image has %u data position measurements.\n", dpmCount);
+
     if(ctx->geometryBlock.identifier == GeometryBlock)
         printf("Media has %d cylinders, %d heads and %d sectors per track.\n",
                ctx->geometryBlock.cylinders,
@@ -300,6 +320,27 @@ int info(char* path)
         }
     }
 
+    if(ctx->tapePartitions != NULL)
+    {
+        printf("Tape partitions block:\n");
+        for(i = 0; i < ctx->tapePartitionCount; i++)
+            printf("\tPartition %d: blocks %lu to %lu\n",
+                   ctx->tapePartitions[i].number,
+                   ctx->tapePartitions[i].firstBlock,
+                   ctx->tapePartitions[i].lastBlock);
+    }
+
+    if(ctx->tapeFiles != NULL)
+    {
+        printf("Tape files block:\n");
+        for(i = 0; i < ctx->tapeFileCount; i++)
+            printf("\tFile %u in partition %d: blocks %lu to %lu\n",
+                   ctx->tapeFiles[i].file,
+                   ctx->tapeFiles[i].partition,
+                   ctx->tapeFiles[i].firstBlock,
+                   ctx->tapeFiles[i].lastBlock);
+    }
+
     if(ctx->cicmBlockHeader.identifier == CicmBlock)
     {
         printf("CICM block:\n");
@@ -534,12 +575,15 @@ int info(char* path)
 
     if(ctx->checksums.hasSpamSum) printf("SpamSum: %s\n", ctx->checksums.spamsum);
 
-    if(ctx->mediaTags != NULL)
+    if(aaruf_get_media_tag_types(ctx, &mediaTagTypes, &mediaTagCount) == AARUF_STATUS_OK && mediaTagCount > 0)
     {
         printf("Media tags:\n");
-        HASH_ITER(hh, ctx->mediaTags, mediaTag, tmpMediaTag)
+        for(i = 0; i < mediaTagCount; i++)
         {
-            printf("\tType %d is %d bytes long.\n", mediaTag->type, mediaTag->length);
+            if(aaruf_get_media_tag(ctx, mediaTagTypes[i], &mediaTagData, &mediaTagLength) != AARUF_STATUS_OK)
+                continue;
+
+            printf("\tType %d is %u bytes long.\n", mediaTagTypes[i], mediaTagLength);
         }
     }
 
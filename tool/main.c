@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <aaruformat.h>
 
@@ -39,6 +40,12 @@ void usage()
     printf("\tread_long\tReads a sector with all its prefixes and suffixes and prints it out on screen.\n");
     printf("\tverify\tVerifies the integrity of all blocks in a AaruFormat image.\n");
     printf("\tverify_sectors\tVerifies the integrity of all sectors in a AaruFormat image.\n");
+    printf("\tstats\tPrints deduplication statistics of a AaruFormat image.\n");
+    printf("\textract\tWrites the user data of all sectors of a AaruFormat image to a file.\n");
+    printf("\trepack\tWrites a copy of a AaruFormat image with new block size and compression.\n");
+    printf("\timport\tConverts a raw sector dump to a AaruFormat image.\n");
+    printf("\tscan\tFinds the blocks of a AaruFormat image with a damaged index.\n");
+    printf("\tdpm\tPrints the data position measurements of a AaruFormat image.\n");
     printf("\n");
     printf("For help on the verb invoke the tool with the verb and no arguments.\n");
 }
@@ -111,6 +118,145 @@ void usage_verify_sectors()
     printf("\t<filename>\tPath to AaruFormat image to verify.\n");
 }
 
+void usage_stats()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool stats <filename>\n");
+    printf("Prints deduplication statistics of a AaruFormat image.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to AaruFormat image to print statistics from.\n");
+}
+
+void usage_extract()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool extract <filename> <output>\n");
+    printf("Writes the user data of all sectors of a AaruFormat image to a file.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to AaruFormat image to extract.\n");
+    printf("\t<output>\tPath to the file to write.\n");
+}
+
+void usage_repack()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool repack <filename> <output> [shift] [compression] [level] [threads]\n");
+    printf("Writes a copy of a AaruFormat image with new block size and compression, and verifies it.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to AaruFormat image to repack.\n");
+    printf("\t<output>\tPath to the AaruFormat image to write.\n");
+    printf("\t[shift]\tEach block holds 2^shift sectors, 12 by default.\n");
+    printf("\t[compression]\tnone, lzma or lz4, lzma by default.\n");
+    printf("\t[level]\tLZMA compression level from 0 to 9, 9 by default.\n");
+    printf("\t[threads]\tThreads compressing blocks, 4 by default.\n");
+}
+
+void usage_import()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool import <filename> <output> <sector_size> [shift] [compression] [level] [threads]\n");
+    printf("Converts a raw sector dump to a AaruFormat image, and verifies it.\n");
+    printf("Prefixes and suffixes of raw CD sectors are only stored when they cannot be rebuilt.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to the raw dump.\n");
+    printf("\t<output>\tPath to the AaruFormat image to write.\n");
+    printf("\t<sector_size>\t512 for disks, 2048 for CD user data, 2352 for raw CD sectors.\n");
+    printf("\t[shift]\tEach block holds 2^shift sectors, 12 by default.\n");
+    printf("\t[compression]\tnone, lzma or lz4, lzma by default.\n");
+    printf("\t[level]\tLZMA compression level from 0 to 9, 9 by default.\n");
+    printf("\t[threads]\tThreads checking and compressing blocks, 4 by default.\n");
+}
+
+void usage_scan()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool scan <filename>\n");
+    printf("Finds the blocks of a AaruFormat image with a damaged index, checking the CRC64 of each.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to AaruFormat image to scan.\n");
+}
+
+void usage_dpm()
+{
+    printf("\n");
+    printf("Usage:\n");
+    printf("aaruformattool dpm <filename> [first_sector] [last_sector]\n");
+    printf("Prints the data position measurements of a AaruFormat image as comma separated values.\n");
+    printf("\n");
+    printf("Arguments:\n");
+    printf("\t<filename>\tPath to AaruFormat image.\n");
+    printf("\t[first_sector]\tFirst sector to print measurements of, 0 by default.\n");
+    printf("\t[last_sector]\tLast sector to print measurements of, the last of the image by default.\n");
+}
+
+// Parses the optional arguments of verbs writing an image, starting at first, returns false if any is not valid
+static bool parse_write_options(int       argc,
+                                char*     argv[],
+                                int       first,
+                                uint8_t*  shift,
+                                uint16_t* compression,
+                                uint32_t* level,
+                                uint32_t* threads)
+{
+    char* end;
+    long  value;
+
+    *shift       = 12;
+    *compression = Lzma;
+    *level       = 9;
+    *threads     = 4;
+
+    if(argc > first)
+    {
+        value = strtol(argv[first], &end, 10);
+
+        if(*end != 0 || value < 1 || value > 24) return false;
+
+        *shift = (uint8_t)value;
+    }
+
+    if(argc > first + 1)
+    {
+        if(strcmp(argv[first + 1], "none") == 0) *compression = None;
+        else if(strcmp(argv[first + 1], "lzma") == 0)
+            *compression = Lzma;
+        else if(strcmp(argv[first + 1], "lz4") == 0)
+            *compression = Lz4;
+        else
+            return false;
+    }
+
+    if(argc > first + 2)
+    {
+        value = strtol(argv[first + 2], &end, 10);
+
+        if(*end != 0 || value < 0 || value > 9) return false;
+
+        *level = (uint32_t)value;
+    }
+
+    if(argc > first + 3)
+    {
+        value = strtol(argv[first + 3], &end, 10);
+
+        if(*end != 0 || value < 0 || value > 256) return false;
+
+        *threads = (uint32_t)value;
+    }
+
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     uint64_t sector_no = 0;
@@ -254,5 +400,158 @@ int main(int argc, char* argv[])
         return verify(argv[2]);
     }
 
+    if(strncmp(argv[1], "stats", strlen("stats")) == 0)
+    {
+        if(argc == 2)
+        {
+            usage_stats();
+            return -1;
+        }
+
+        if(argc > 3)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_stats();
+            return -1;
+        }
+
+        return stats(argv[2]);
+    }
+
+    if(strncmp(argv[1], "extract", strlen("extract")) == 0)
+    {
+        if(argc < 4)
+        {
+            usage_extract();
+            return -1;
+        }
+
+        if(argc > 4)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_extract();
+            return -1;
+        }
+
+        return extract(argv[2], argv[3]);
+    }
+
+    if(strncmp(argv[1], "repack", strlen("repack")) == 0)
+    {
+        uint8_t  shift;
+        uint16_t compression;
+        uint32_t level;
+        uint32_t threads;
+
+        if(argc < 4)
+        {
+            usage_repack();
+            return -1;
+        }
+
+        if(argc > 8)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_repack();
+            return -1;
+        }
+
+        if(!parse_write_options(argc, argv, 4, &shift, &compression, &level, &threads))
+        {
+            fprintf(stderr, "Invalid arguments\n");
+            usage_repack();
+            return -1;
+        }
+
+        return repack(argv[2], argv[3], shift, compression, level, threads);
+    }
+
+    if(strncmp(argv[1], "import", strlen("import")) == 0)
+    {
+        uint8_t  shift;
+        uint16_t compression;
+        uint32_t level;
+        uint32_t threads;
+        char*    end;
+        long     sectorSize;
+
+        if(argc < 5)
+        {
+            usage_import();
+            return -1;
+        }
+
+        if(argc > 9)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_import();
+            return -1;
+        }
+
+        sectorSize = strtol(argv[4], &end, 10);
+
+        if(*end != 0 || (sectorSize != 512 && sectorSize != 2048 && sectorSize != 2352) ||
+           !parse_write_options(argc, argv, 5, &shift, &compression, &level, &threads))
+        {
+            fprintf(stderr, "Invalid arguments\n");
+            usage_import();
+            return -1;
+        }
+
+        return import(argv[2], argv[3], (uint32_t)sectorSize, shift, compression, level, threads);
+    }
+
+    if(strncmp(argv[1], "scan", strlen("scan")) == 0)
+    {
+        if(argc == 2)
+        {
+            usage_scan();
+            return -1;
+        }
+
+        if(argc > 3)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_scan();
+            return -1;
+        }
+
+        return scan(argv[2]);
+    }
+
+    if(strncmp(argv[1], "dpm", strlen("dpm")) == 0)
+    {
+        unsigned long long firstSector = 0;
+        unsigned long long lastSector  = UINT64_MAX;
+
+        if(argc == 2)
+        {
+            usage_dpm();
+            return -1;
+        }
+
+        if(argc > 5)
+        {
+            fprintf(stderr, "Invalid number of arguments\n");
+            usage_dpm();
+            return -1;
+        }
+
+        errno = 0;
+
+        if(argc > 3) firstSector = strtoull(argv[3], NULL, 10);
+
+        if(argc > 4) lastSector = strtoull(argv[4], NULL, 10);
+
+        if(errno != 0 || firstSector > lastSector)
+        {
+            fprintf(stderr, "Invalid sector number\n");
+            usage_dpm();
+            return -1;
+        }
+
+        return dpm(argv[2], firstSector, lastSector);
+    }
+
     return 0;
 }
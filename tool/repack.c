@@ -0,0 +1,248 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+#define REPACK_PREFETCH_DEPTH 4
+
+// Compares every sector and media tag of both images
+static int repack_verify(aaruformatContext* input, aaruformatContext* output)
+{
+    uint8_t*       inputSector;
+    uint8_t*       outputSector;
+    uint32_t       inputLength;
+    uint32_t       outputLength;
+    int32_t        inputStatus;
+    int32_t        outputStatus;
+    const int32_t* tags;
+    uint32_t       tagCount;
+    const uint8_t* inputTag;
+    const uint8_t* outputTag;
+    uint32_t       i;
+    uint64_t       sector;
+    int            res = AARUF_STATUS_OK;
+
+    inputSector  = malloc(input->imageInfo.SectorSize);
+    outputSector = malloc(output->imageInfo.SectorSize);
+
+    if(inputSector == NULL || outputSector == NULL)
+    {
+        free(inputSector);
+        free(outputSector);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for(sector = 0; sector < input->imageInfo.Sectors; sector++)
+    {
+        inputLength  = input->imageInfo.SectorSize;
+        outputLength = output->imageInfo.SectorSize;
+        inputStatus  = aaruf_read_sector(input, sector, inputSector, &inputLength);
+        outputStatus = aaruf_read_sector(output, sector, outputSector, &outputLength);
+
+        if(inputStatus != outputStatus || inputLength != outputLength ||
+           (inputStatus == AARUF_STATUS_OK &&
+            aaruf_crc64_data(inputSector, inputLength) != aaruf_crc64_data(outputSector, outputLength)))
+        {
+            printf("Sector %" PRIu64 " differs.\n", sector);
+            res = AARUF_ERROR_INVALID_BLOCK_CRC;
+            break;
+        }
+    }
+
+    free(inputSector);
+    free(outputSector);
+
+    if(res != AARUF_STATUS_OK) return res;
+
+    if(aaruf_get_media_tag_types(input, &tags, &tagCount) != AARUF_STATUS_OK) return AARUF_STATUS_OK;
+
+    for(i = 0; i < tagCount; i++)
+    {
+        if(aaruf_get_media_tag(input, tags[i], &inputTag, &inputLength) != AARUF_STATUS_OK) continue;
+
+        if(aaruf_get_media_tag(output, tags[i], &outputTag, &outputLength) != AARUF_STATUS_OK ||
+           inputLength != outputLength || memcmp(inputTag, outputTag, inputLength) != 0)
+        {
+            printf("Media tag %d differs.\n", tags[i]);
+            return AARUF_ERROR_INVALID_BLOCK_CRC;
+        }
+    }
+
+    return AARUF_STATUS_OK;
+}
+
+int repack(char* input, char* output, uint8_t shift, uint16_t compression, uint32_t level, uint32_t threads)
+{
+    aaruformatContext* inputCtx;
+    aaruformatContext* outputCtx;
+    void*              writeCtx;
+    uint8_t*           buffer;
+    uint32_t           length;
+    uint64_t           sector;
+    uint64_t           notDumped = 0;
+    uint64_t           inputSize;
+    uint64_t           outputSize;
+    double             start;
+    double             elapsed;
+    int32_t            res = AARUF_STATUS_OK;
+
+    inputCtx = aaruf_open(input);
+
+    if(inputCtx == NULL)
+    {
+        printf("Error %d when opening AaruFormat image.\n", errno);
+        return errno;
+    }
+
+    buffer = malloc(inputCtx->imageInfo.SectorSize);
+
+    if(buffer == NULL)
+    {
+        printf("Not enough memory.\n");
+        aaruf_close(inputCtx);
+        return AARUF_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    start = now_seconds();
+
+    writeCtx = aaruf_create(output,
+                            inputCtx->imageInfo.MediaType,
+                            inputCtx->imageInfo.SectorSize,
+                            inputCtx->imageInfo.Sectors,
+                            shift,
+                            compression,
+                            threads);
+
+    if(writeCtx == NULL)
+    {
+        printf("Error %d when creating AaruFormat image.\n", errno);
+        free(buffer);
+        aaruf_close(inputCtx);
+        return errno;
+    }
+
+    res = aaruf_set_compression_level(writeCtx, level);
+
+    if(res == AARUF_STATUS_OK) res = aaruf_copy_metadata(writeCtx, inputCtx);
+
+    if(res != AARUF_STATUS_OK) printf("Error %d copying metadata.\n", res);
+
+    aaruf_set_prefetch_depth(inputCtx, REPACK_PREFETCH_DEPTH);
+
+    for(sector = 0; sector < inputCtx->imageInfo.Sectors && res == AARUF_STATUS_OK; sector++)
+    {
+        length = inputCtx->imageInfo.SectorSize;
+        res    = aaruf_read_sector(inputCtx, sector, buffer, &length);
+
+        // Left out of the new image too
+        if(res == AARUF_STATUS_SECTOR_NOT_DUMPED)
+        {
+            notDumped++;
+            res = AARUF_STATUS_OK;
+            continue;
+        }
+
+        if(res != AARUF_STATUS_OK)
+        {
+            printf("Error %d reading sector %" PRIu64 ".\n", res, sector);
+            break;
+        }
+
+        if(length != inputCtx->imageInfo.SectorSize)
+        {
+            printf("Sector %" PRIu64 " is %u bytes, images with sectors of different sizes cannot be repacked.\n",
+                   sector,
+                   length);
+            res = AARUF_ERROR_INCORRECT_DATA_SIZE;
+            break;
+        }
+
+        res = aaruf_write_sector(writeCtx, sector, buffer, length);
+
+        if(res != AARUF_STATUS_OK) printf("Error %d writing sector %" PRIu64 ".\n", res, sector);
+    }
+
+    free(buffer);
+
+    if(aaruf_close(writeCtx) != 0 && res == AARUF_STATUS_OK)
+    {
+        printf("Error %d when finishing AaruFormat image.\n", errno);
+        res = errno;
+    }
+
+    elapsed = now_seconds() - start;
+
+    if(res != AARUF_STATUS_OK)
+    {
+        aaruf_close(inputCtx);
+        return res;
+    }
+
+    outputCtx = aaruf_open(output);
+
+    if(outputCtx == NULL)
+    {
+        printf("Error %d when opening repacked AaruFormat image.\n", errno);
+        aaruf_close(inputCtx);
+        return errno;
+    }
+
+    aaruf_set_prefetch_depth(outputCtx, REPACK_PREFETCH_DEPTH);
+
+    res = repack_verify(inputCtx, outputCtx);
+
+    aaruf_close(outputCtx);
+
+    if(res != AARUF_STATUS_OK)
+    {
+        printf("Repacked image does not match.\n");
+        aaruf_close(inputCtx);
+        return res;
+    }
+
+    inputSize  = file_size(input);
+    outputSize = file_size(output);
+
+    printf("Repacked %" PRIu64 " sectors of %u bytes, %" PRIu64 " not dumped.\n",
+           inputCtx->imageInfo.Sectors,
+           inputCtx->imageInfo.SectorSize,
+           notDumped);
+    printf("All sectors and media tags verified.\n");
+    printf("\tOriginal size: %" PRIu64 " bytes\n", inputSize);
+    printf("\tRepacked size: %" PRIu64 " bytes\n", outputSize);
+
+    if(inputSize > 0)
+        printf("\tSpace saved: %.2f%%\n", 100.0 - (double)outputSize * 100.0 / (double)inputSize);
+
+    if(elapsed > 0)
+        printf("\tThroughput: %.2f MiB/s\n",
+               (double)inputCtx->imageInfo.Sectors * inputCtx->imageInfo.SectorSize / elapsed / 1048576.0);
+
+    aaruf_close(inputCtx);
+
+    return AARUF_STATUS_OK;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+int scan(char* path)
+{
+    aaruformatContext* ctx;
+    uint64_t           size = file_size(path);
+    double             start;
+    double             elapsed;
+
+    start = now_seconds();
+
+    ctx = aaruf_open_recover(path);
+
+    elapsed = now_seconds() - start;
+
+    if(ctx == NULL)
+    {
+        printf("Error %d when scanning AaruFormat image.\n", errno);
+        return errno;
+    }
+
+    printf("Scanned %" PRIu64 " bytes.\n", size);
+    printf("\tValid blocks: %" PRIu64 "\n", ctx->recoveredBlocks);
+    printf("\tDamaged blocks: %" PRIu64 "\n", ctx->damagedBlocks);
+    printf("\tBytes outside valid blocks: %" PRIu64 "\n", ctx->skippedBytes);
+    printf("\tSectors: %" PRIu64 " of %u bytes\n", ctx->imageInfo.Sectors, ctx->imageInfo.SectorSize);
+
+    if(elapsed > 0) printf("\tThroughput: %.2f MiB/s\n", (double)size / elapsed / 1048576.0);
+
+    if(ctx->damagedBlocks == 0 && ctx->skippedBytes == 0) printf("No damage found.\n");
+    else
+        printf("Image can be read without its index, damaged sectors will fail to read.\n");
+
+    aaruf_close(ctx);
+
+    return AARUF_STATUS_OK;
+}
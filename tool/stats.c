@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Aaru Data Preservation Suite.
+ * Copyright (c) 2019-2022 Natalia Portillo.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+
+#include <aaruformat.h>
+
+#include "aaruformattool.h"
+
+#define STATS_TOP_BLOCKS 10
+#define STATS_THREADS 8
+
+int stats(char* path)
+{
+    aaruformatContext* ctx;
+    DedupStats         dedup_stats;
+    int32_t            res;
+    uint32_t           i;
+
+    ctx = aaruf_open(path);
+
+    if(ctx == NULL)
+    {
+        printf("Error %d when opening AaruFormat image.\n", errno);
+        return errno;
+    }
+
+    res = aaruf_get_dedup_stats(ctx, &dedup_stats, STATS_TOP_BLOCKS, STATS_THREADS);
+
+    if(res != AARUF_STATUS_OK)
+    {
+        printf("Error %d getting deduplication statistics.\n", res);
+        aaruf_close(ctx);
+        return res;
+    }
+
+    printf("Deduplication statistics:\n");
+    printf("\tSectors: %" PRIu64 "\n", dedup_stats.sectors);
+    printf("\tNot dumped sectors: %" PRIu64 "\n", dedup_stats.notDumped);
+    printf("\tReferenced sectors: %" PRIu64 "\n", dedup_stats.referenced);
+    printf("\tUnique stored sectors: %" PRIu64 "\n", dedup_stats.unique);
+    printf("\tReferenced blocks: %" PRIu64 "\n", dedup_stats.blocks);
+
+    if(dedup_stats.unique > 0)
+        printf("\tDeduplication ratio: %.2f:1\n", (double)dedup_stats.referenced / (double)dedup_stats.unique);
+
+    if(dedup_stats.topCount > 0) printf("Most referenced blocks:\n");
+
+    for(i = 0; i < dedup_stats.topCount; i++)
+        printf("\tBlock at %" PRIu64 ": %" PRIu64 " references to %" PRIu64 " unique sectors\n",
+               dedup_stats.top[i].blockOffset,
+               dedup_stats.top[i].references,
+               dedup_stats.top[i].uniqueSectors);
+
+    aaruf_free_dedup_stats(&dedup_stats);
+    aaruf_close(ctx);
+
+    return 0;
+}